@@ -0,0 +1,59 @@
+/*
+*	Arduino.h, Copyright Jonathan Mackey 2020
+*	The few Arduino timing functions used by MSPeriod, USPeriod and
+*	SDHexSession, for host builds that define SUPPORT_HOST_SERIAL.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <inttypes.h>
+#include <time.h>
+
+inline uint32_t micros(void)
+{
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint32_t)((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000));
+}
+
+inline uint32_t millis(void)
+{
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint32_t)((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000));
+}
+
+inline void delayMicroseconds(
+	uint32_t	inMicroseconds)
+{
+	struct timespec	period;
+	period.tv_sec = inMicroseconds / 1000000;
+	period.tv_nsec = (inMicroseconds % 1000000) * 1000;
+	nanosleep(&period, nullptr);
+}
+
+inline void delay(
+	uint32_t	inMilliseconds)
+{
+	delayMicroseconds(inMilliseconds * 1000);
+}
+
+#endif // Arduino_h
@@ -0,0 +1,302 @@
+/*
+*	HexDecodeBench.cpp, Copyright Jonathan Mackey 2020
+*	Checks that HexDecoder returns the same records as IntelHexFile for each
+*	of its kernels, then reports the decoding rate of each.  Also checks that
+*	HexImage produces the same image when reading in parallel as sequentially,
+*	and reports its rate for 1 through threads threads.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		HexDecodeBench [-r repeats] [-j threads] path.hex...
+*			Compares and times the decoding of each file.  Each file is
+*			decoded repeats times per decoder (default 20) for the timing.
+*			threads defaults to the number of cores.
+*
+*		HexDecodeBench -g size_kb path.hex
+*			Writes a hex file of random data for benchmarking, with a mix of
+*			record lengths and line endings, and extended segment records.
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -O2 -std=gnu++11 -D__MACH__ -I. -o HexDecodeBench \
+*			-pthread ../HostTools/HexDecodeBench.cpp \
+*			../HostTools/HexDecoder.cpp ../HostTools/HexImage.cpp \
+*			IntelHexFile.cpp ImageSource.cpp BufferArena.cpp
+*
+*	The exit status is 0 when the records matched.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include "HexDecoder.h"
+#include "HexImage.h"
+#include "IntelHexFile.h"
+#include "BufferArena.h"
+
+const uint32_t	kMaxImageSize = 0x100000;	// 20 bit address
+
+static uint32_t	sMismatches;
+
+/*********************************** Seconds **********************************/
+static double Seconds(void)
+{
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return(now.tv_sec + now.tv_nsec / 1e9);
+}
+
+/******************************* CompareDecoders ******************************/
+/*
+*	Both decoders are read until either fails or the end of file record.
+*/
+static void CompareDecoders(
+	const char*	inPath,
+	uint8_t		inKernel)
+{
+	IntelHexFile	hexFile;
+	HexDecoder		hexDecoder;
+	hexDecoder.SetKernel(inKernel);
+	if (!hexFile.begin(inPath) ||
+		!hexDecoder.begin(inPath))
+	{
+		fprintf(stderr, "%s: unable to open\n", inPath);
+		sMismatches++;
+		return;
+	}
+	for (uint32_t record = 1; true; record++)
+	{
+		bool	valid = hexFile.NextRecord();
+		bool	decoderValid = hexDecoder.NextRecord();
+		if (valid != decoderValid ||
+			(valid &&
+				(hexFile.RecordType() != hexDecoder.RecordType() ||
+				hexFile.Address32() != hexDecoder.Address32() ||
+				hexFile.ByteCount() != hexDecoder.ByteCount() ||
+				hexFile.RecordPosition() != hexDecoder.RecordPosition() ||
+				memcmp(hexFile.Data(), hexDecoder.Data(), hexFile.ByteCount()) != 0)))
+		{
+			fprintf(stderr, "%s: record %u differs using %s\n", inPath, record,
+				HexDecoder::KernelName(inKernel));
+			sMismatches++;
+			break;
+		}
+		if (!valid ||
+			hexFile.RecordType() == IntelHexFile::eEndOfFileRecord)
+		{
+			break;
+		}
+	}
+	hexFile.end();
+	hexDecoder.end();
+}
+
+/******************************** CompareImages *******************************/
+static void CompareImages(
+	const char*	inPath,
+	uint32_t	inThreads)
+{
+	HexImage	sequential;
+	HexImage	parallel;
+	sequential.Read(inPath, kMaxImageSize);
+	parallel.Read(inPath, kMaxImageSize, inThreads);
+	if (sequential.Error() != parallel.Error() ||
+		sequential.ErrorRecord() != parallel.ErrorRecord() ||
+		sequential.ErrorAddress() != parallel.ErrorAddress() ||
+		sequential.ByteCount() != parallel.ByteCount() ||
+		sequential.FirstAddress() != parallel.FirstAddress() ||
+		sequential.EndAddress() != parallel.EndAddress() ||
+		sequential.Memory() != parallel.Memory())
+	{
+		fprintf(stderr, "%s: image differs using %u chunks\n", inPath, parallel.Chunks());
+		sMismatches++;
+	}
+}
+
+/********************************* DecodeFile *********************************/
+/*
+*	Returns a sum of the last data byte of each record so that the work isn't
+*	optimized away.
+*/
+static uint32_t DecodeFile(
+	const char*	inPath,
+	int			inKernel)	// -1 for IntelHexFile
+{
+	uint32_t	dataBytes = 0;
+	if (inKernel < 0)
+	{
+		IntelHexFile	hexFile;
+		hexFile.begin(inPath);
+		while (hexFile.NextRecord() &&
+			hexFile.RecordType() != IntelHexFile::eEndOfFileRecord)
+		{
+			dataBytes += hexFile.ByteCount() ? hexFile.Data()[hexFile.ByteCount()-1] : 0;
+		}
+		hexFile.end();
+	} else
+	{
+		HexDecoder	hexDecoder;
+		hexDecoder.SetKernel(inKernel);
+		hexDecoder.begin(inPath);
+		while (hexDecoder.NextRecord() &&
+			hexDecoder.RecordType() != IntelHexFile::eEndOfFileRecord)
+		{
+			dataBytes += hexDecoder.ByteCount() ? hexDecoder.Data()[hexDecoder.ByteCount()-1] : 0;
+		}
+		hexDecoder.end();
+	}
+	return(dataBytes);
+}
+
+/******************************** GenerateFile ********************************/
+static bool GenerateFile(
+	const char*	inPath,
+	uint32_t	inSizeKB)
+{
+	FILE*	file = fopen(inPath, "w");
+	if (!file)
+	{
+		perror(inPath);
+		return(false);
+	}
+	uint32_t	address = 0;
+	uint8_t		addressH = 0;
+	srand(1);
+	while (ftell(file) < (long)inSizeKB * 1024)
+	{
+		uint8_t	byteCount = (rand() % 4) ? 16 : (rand() % 16) + 1;
+		if ((address + byteCount) > 0x10000)
+		{
+			// Extended segment address record for the next 64KB
+			addressH = (addressH + 1) & 0xF;
+			uint8_t	checksum = -(2 + 2 + (addressH << 4));
+			fprintf(file, ":02000002%02X00%02X\n", addressH << 4, checksum);
+			address = 0;
+		}
+		uint8_t	checksum = byteCount + (address >> 8) + address;
+		fprintf(file, ":%02X%04X00", byteCount, address);
+		for (uint8_t i = 0; i < byteCount; i++)
+		{
+			uint8_t	thisByte = rand();
+			checksum += thisByte;
+			fprintf(file, "%02X", thisByte);
+		}
+		fprintf(file, "%02X%s", (uint8_t)-checksum, (rand() % 8) ? "\n" : "\r\n");
+		address += byteCount;
+	}
+	fprintf(file, ":00000001FF\n");
+	return(fclose(file) == 0);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	uint32_t	repeats = 20;
+	uint32_t	generateKB = 0;
+	uint32_t	threads = std::thread::hardware_concurrency();
+	int			opt;
+	while ((opt = getopt(argc, argv, "r:g:j:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'j':
+				threads = strtoul(optarg, nullptr, 0);
+				break;
+			case 'r':
+				repeats = strtoul(optarg, nullptr, 0);
+				break;
+			case 'g':
+				generateKB = strtoul(optarg, nullptr, 0);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind >= argc)
+	{
+		fprintf(stderr, "Usage:\n"
+			"  HexDecodeBench [-r repeats] [-j threads] path.hex...\n"
+			"  HexDecodeBench -g size_kb path.hex\n");
+		return(2);
+	}
+	if (generateKB)
+	{
+		return(GenerateFile(argv[optind], generateKB) ? 0 : 1);
+	}
+	uint8_t	bestKernel = HexDecoder::BestKernel();
+	for (int i = optind; i < argc; i++)
+	{
+		for (uint8_t kernel = 0; kernel <= bestKernel; kernel++)
+		{
+			CompareDecoders(argv[i], kernel);
+		}
+		CompareImages(argv[i], threads);
+	}
+	printf("%u mismatched decodes of %d files\n", sMismatches, argc - optind);
+
+	uint64_t	fileBytes = 0;
+	for (int i = optind; i < argc; i++)
+	{
+		struct stat	status;
+		if (stat(argv[i], &status) == 0)
+		{
+			fileBytes += status.st_size;
+		}
+	}
+	for (int kernel = -1; kernel <= (int)bestKernel; kernel++)
+	{
+		uint32_t	dataBytes = 0;
+		double		start = Seconds();
+		for (uint32_t repeat = 0; repeat < repeats; repeat++)
+		{
+			for (int i = optind; i < argc; i++)
+			{
+				dataBytes += DecodeFile(argv[i], kernel);
+			}
+		}
+		double	seconds = Seconds() - start;
+		printf("%-22s %8.1f MB/s (%u)\n",
+			kernel < 0 ? "IntelHexFile" : HexDecoder::KernelName(kernel),
+			(fileBytes * repeats) / (seconds * 1e6), dataBytes);
+	}
+	for (uint32_t imageThreads = 1; imageThreads <= threads; imageThreads *= 2)
+	{
+		uint32_t	chunks = 0;
+		double		start = Seconds();
+		for (uint32_t repeat = 0; repeat < repeats; repeat++)
+		{
+			for (int i = optind; i < argc; i++)
+			{
+				HexImage	hexImage;
+				hexImage.Read(argv[i], kMaxImageSize, imageThreads);
+				chunks += hexImage.Chunks();
+			}
+		}
+		double	seconds = Seconds() - start;
+		printf("HexImage %2u threads    %8.1f MB/s (%.1f chunks)\n", imageThreads,
+			(fileBytes * repeats) / (seconds * 1e6), (double)chunks / (repeats * (argc - optind)));
+	}
+	return(sMismatches ? 1 : 0);
+}
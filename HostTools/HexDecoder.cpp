@@ -0,0 +1,411 @@
+/*
+*	HexDecoder.cpp, Copyright Jonathan Mackey 2020
+*	Host only Intel hex decoder for tools that process many files.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "HexDecoder.h"
+#include "IntelHexFile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __x86_64__
+#define SUPPORT_X86_KERNELS	1
+#include <immintrin.h>
+#endif
+
+/*
+*	A kernel converts inLength hex digits (always even) to bytes.  inReadable
+*	is the number of bytes that can be read starting at inHex, which may be
+*	less than a vector block at the end of the file.  The sum of the bytes,
+*	modulo 256, is returned, or -1 if a digit isn't valid.
+*/
+typedef int (*DecodeKernel)(const char*, uint8_t, size_t, uint8_t*);
+
+/*********************************** Nibble ***********************************/
+static inline uint8_t Nibble(
+	uint8_t	inChar)
+{
+	uint8_t	nibble = inChar - '0';
+	if (nibble > 9)
+	{
+		nibble = inChar - 'A';
+		nibble = nibble <= 5 ? nibble + 10 : 0xFF;
+	}
+	return(nibble);
+}
+
+/******************************** DecodeScalar ********************************/
+static int DecodeScalar(
+	const char*	inHex,
+	uint8_t		inLength,
+	size_t		inReadable,
+	uint8_t*	outBytes)
+{
+	uint8_t	sum = 0;
+	for (uint8_t i = 0; i < inLength; i += 2)
+	{
+		uint8_t	highNibble = Nibble(inHex[i]);
+		uint8_t	lowNibble = Nibble(inHex[i+1]);
+		if ((highNibble | lowNibble) & 0xF0)
+		{
+			return(-1);
+		}
+		uint8_t	thisByte = (highNibble << 4) | lowNibble;
+		*(outBytes++) = thisByte;
+		sum += thisByte;
+	}
+	return(sum);
+}
+
+#ifdef SUPPORT_X86_KERNELS
+/*
+*	The vector kernels convert a block of digits at a time.  For each char:
+*	digit = char - '0', letter = char - 'A'.  The char is valid when digit is
+*	at most 9 or letter is at most 5 (unsigned).  Pairs of nibbles are then
+*	combined within each 16 bit lane, the first char of the pair being the
+*	high nibble, and the lanes are packed to bytes.  Only the bytes within the
+*	record are included in the sum, a sum of absolute differences with zero.
+*/
+/********************************* NibblesSSE2 ********************************/
+static inline __m128i NibblesSSE2(
+	__m128i		inChars,
+	__m128i&	outValid)
+{
+	__m128i	digit = _mm_sub_epi8(inChars, _mm_set1_epi8('0'));
+	__m128i	letter = _mm_sub_epi8(inChars, _mm_set1_epi8('A'));
+	__m128i	isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	__m128i	isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+	outValid = _mm_or_si128(isDigit, isLetter);
+	return(_mm_or_si128(_mm_and_si128(isDigit, digit),
+			_mm_andnot_si128(isDigit, _mm_add_epi8(letter, _mm_set1_epi8(10)))));
+}
+
+/****************************** PairsToBytesSSE2 ******************************/
+static inline __m128i PairsToBytesSSE2(
+	__m128i	inNibbles)
+{
+	return(_mm_or_si128(_mm_and_si128(_mm_slli_epi16(inNibbles, 4), _mm_set1_epi16(0xF0)),
+			_mm_srli_epi16(inNibbles, 8)));
+}
+
+/********************************* DecodeSSE2 *********************************/
+static int DecodeSSE2(
+	const char*	inHex,
+	uint8_t		inLength,
+	size_t		inReadable,
+	uint8_t*	outBytes)
+{
+	const __m128i	kIndex = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	uint32_t	sum = 0;
+	uint8_t		offset = 0;
+	for (; offset < inLength && (inReadable - offset) >= 32; offset += 32)
+	{
+		__m128i		valid0, valid1;
+		__m128i		nibbles0 = NibblesSSE2(_mm_loadu_si128((const __m128i*)&inHex[offset]), valid0);
+		__m128i		nibbles1 = NibblesSSE2(_mm_loadu_si128((const __m128i*)&inHex[offset+16]), valid1);
+		uint8_t		chars = (inLength - offset) < 32 ? (inLength - offset) : 32;
+		uint32_t	validMask = (uint32_t)_mm_movemask_epi8(valid0) |
+								((uint32_t)_mm_movemask_epi8(valid1) << 16);
+		uint32_t	required = chars == 32 ? 0xFFFFFFFF : ((1UL << chars) - 1);
+		if ((validMask & required) != required)
+		{
+			return(-1);
+		}
+		__m128i	bytes = _mm_packus_epi16(PairsToBytesSSE2(nibbles0), PairsToBytesSSE2(nibbles1));
+		__m128i	inRecord = _mm_cmplt_epi8(kIndex, _mm_set1_epi8(chars/2));
+		__m128i	sums = _mm_sad_epu8(_mm_and_si128(bytes, inRecord), _mm_setzero_si128());
+		sum += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+		_mm_storeu_si128((__m128i*)&outBytes[offset/2], bytes);
+	}
+	if (offset < inLength)
+	{
+		int	tailSum = DecodeScalar(&inHex[offset], inLength - offset, 0, &outBytes[offset/2]);
+		if (tailSum < 0)
+		{
+			return(-1);
+		}
+		sum += tailSum;
+	}
+	return((uint8_t)sum);
+}
+
+/********************************* NibblesAVX2 ********************************/
+__attribute__((target("avx2")))
+static inline __m256i NibblesAVX2(
+	__m256i		inChars,
+	__m256i&	outValid)
+{
+	__m256i	digit = _mm256_sub_epi8(inChars, _mm256_set1_epi8('0'));
+	__m256i	letter = _mm256_sub_epi8(inChars, _mm256_set1_epi8('A'));
+	__m256i	isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+	__m256i	isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+	outValid = _mm256_or_si256(isDigit, isLetter);
+	return(_mm256_or_si256(_mm256_and_si256(isDigit, digit),
+			_mm256_andnot_si256(isDigit, _mm256_add_epi8(letter, _mm256_set1_epi8(10)))));
+}
+
+/****************************** PairsToBytesAVX2 ******************************/
+__attribute__((target("avx2")))
+static inline __m256i PairsToBytesAVX2(
+	__m256i	inNibbles)
+{
+	return(_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(inNibbles, 4), _mm256_set1_epi16(0xF0)),
+			_mm256_srli_epi16(inNibbles, 8)));
+}
+
+/********************************* DecodeAVX2 *********************************/
+/*
+*	A 64 digit block covers the largest record, 42 digits, so the SSE2 kernel
+*	is only used near the end of the file.
+*/
+__attribute__((target("avx2")))
+static int DecodeAVX2(
+	const char*	inHex,
+	uint8_t		inLength,
+	size_t		inReadable,
+	uint8_t*	outBytes)
+{
+	const __m256i	kIndex = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+								16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+	uint32_t	sum = 0;
+	uint8_t		offset = 0;
+	for (; offset < inLength && (inReadable - offset) >= 64; offset += 64)
+	{
+		__m256i		valid0, valid1;
+		__m256i		nibbles0 = NibblesAVX2(_mm256_loadu_si256((const __m256i*)&inHex[offset]), valid0);
+		__m256i		nibbles1 = NibblesAVX2(_mm256_loadu_si256((const __m256i*)&inHex[offset+32]), valid1);
+		uint8_t		chars = (inLength - offset) < 64 ? (inLength - offset) : 64;
+		uint64_t	validMask = (uint32_t)_mm256_movemask_epi8(valid0) |
+								((uint64_t)(uint32_t)_mm256_movemask_epi8(valid1) << 32);
+		uint64_t	required = chars == 64 ? ~(uint64_t)0 : (((uint64_t)1 << chars) - 1);
+		if ((validMask & required) != required)
+		{
+			return(-1);
+		}
+		// packus works within each 128 bit lane, the permute restores the order.
+		__m256i	bytes = _mm256_permute4x64_epi64(
+							_mm256_packus_epi16(PairsToBytesAVX2(nibbles0),
+								PairsToBytesAVX2(nibbles1)), 0xD8);
+		__m256i	inRecord = _mm256_cmpgt_epi8(_mm256_set1_epi8(chars/2), kIndex);
+		__m256i	sums = _mm256_sad_epu8(_mm256_and_si256(bytes, inRecord), _mm256_setzero_si256());
+		__m128i	sums128 = _mm_add_epi64(_mm256_castsi256_si128(sums),
+								_mm256_extracti128_si256(sums, 1));
+		sum += _mm_cvtsi128_si32(sums128) + _mm_extract_epi16(sums128, 4);
+		_mm256_storeu_si256((__m256i*)&outBytes[offset/2], bytes);
+	}
+	if (offset < inLength)
+	{
+		int	tailSum = DecodeSSE2(&inHex[offset], inLength - offset,
+							inReadable - offset, &outBytes[offset/2]);
+		if (tailSum < 0)
+		{
+			return(-1);
+		}
+		sum += tailSum;
+	}
+	return((uint8_t)sum);
+}
+#endif
+
+static const DecodeKernel	kKernels[] =
+{
+	DecodeScalar,
+#ifdef SUPPORT_X86_KERNELS
+	DecodeSSE2,
+	DecodeAVX2
+#endif
+};
+
+/********************************* HexDecoder *********************************/
+HexDecoder::HexDecoder(void)
+: mMap(nullptr), mMapSize(0), mStart(0), mEnd(0), mKernel(BestKernel()),
+  mOwnsMap(false)
+{
+	Rewind();
+}
+
+/******************************** ~HexDecoder *********************************/
+HexDecoder::~HexDecoder(void)
+{
+	end();
+}
+
+/********************************* BestKernel *********************************/
+uint8_t HexDecoder::BestKernel(void)
+{
+#ifdef SUPPORT_X86_KERNELS
+	return(__builtin_cpu_supports("avx2") ? eAVX2Kernel : eSSE2Kernel);
+#else
+	return(eScalarKernel);
+#endif
+}
+
+/********************************* KernelName *********************************/
+const char* HexDecoder::KernelName(
+	uint8_t	inKernel)
+{
+	static const char* const	kNames[] = {"scalar", "SSE2", "AVX2"};
+	return(inKernel <= eAVX2Kernel ? kNames[inKernel] : "?");
+}
+
+/*********************************** begin ************************************/
+bool HexDecoder::begin(
+	const char*	inPath)
+{
+	end();
+	int		fd = open(inPath, O_RDONLY);
+	bool	success = fd >= 0;
+	if (success)
+	{
+		struct stat	status;
+		success = fstat(fd, &status) == 0;
+		if (success &&
+			status.st_size)
+		{
+			void*	map = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			success = map != MAP_FAILED;
+			if (success)
+			{
+				mMap = (const char*)map;
+				mMapSize = status.st_size;
+				mEnd = mMapSize;
+				mOwnsMap = true;
+			}
+		}
+		close(fd);
+	}
+	Rewind();
+	return(success);
+}
+
+/*********************************** begin ************************************/
+bool HexDecoder::begin(
+	const HexDecoder&	inFile,
+	size_t				inStart,
+	size_t				inEnd)
+{
+	end();
+	mMap = inFile.mMap;
+	mMapSize = inFile.mMapSize;
+	mStart = inStart < mMapSize ? inStart : mMapSize;
+	mEnd = inEnd < mMapSize ? inEnd : mMapSize;
+	Rewind();
+	return(mMap != nullptr);
+}
+
+/************************************ end *************************************/
+void HexDecoder::end(void)
+{
+	if (mMap &&
+		mOwnsMap)
+	{
+		munmap((void*)mMap, mMapSize);
+	}
+	mMap = nullptr;
+	mMapSize = 0;
+	mStart = 0;
+	mEnd = 0;
+	mOwnsMap = false;
+}
+
+/*********************************** Rewind ***********************************/
+bool HexDecoder::Rewind(void)
+{
+	mPosition = mStart;
+	mRecordPosition = mStart;
+	mRecordType = IntelHexFile::eInvalidRecordType;
+	mByteCount = 0;
+	mAddress = 0;
+	mAddressH = 0;
+	return(true);
+}
+
+/********************************* NextRecord *********************************/
+/*
+*	The record's byte count determines its length.  The record is then
+*	converted and its checksum validated by the kernel.  A record may extend
+*	past the end of a range, but not past the end of the file.
+*/
+bool HexDecoder::NextRecord(void)
+{
+	mRecordType = IntelHexFile::eInvalidRecordType;
+	mRecordPosition = mPosition;
+	if (mPosition >= mEnd ||
+		mMap[mPosition] != ':')
+	{
+		return(false);
+	}
+	const char*	hex = &mMap[mPosition + 1];
+	size_t		readable = mMapSize - mPosition - 1;
+	if (readable < 2)
+	{
+		return(false);
+	}
+	uint8_t	byteCount = (Nibble(hex[0]) << 4) | Nibble(hex[1]);
+	if (((Nibble(hex[0]) | Nibble(hex[1])) & 0xF0) ||
+		byteCount > 16)
+	{
+		return(false);
+	}
+	uint8_t	length = (byteCount + 5) * 2;	// count, address, type, checksum
+	if (readable < length ||
+		kKernels[mKernel](hex, length, readable, mRecord) != 0)
+	{
+		return(false);
+	}
+	mAddress = ((uint16_t)mRecord[1] << 8) | mRecord[2];
+	mRecordType = mRecord[3];
+	mByteCount = byteCount;
+	bool	valid;
+	switch (mRecordType)
+	{
+		case IntelHexFile::eDataRecord:
+			valid = byteCount != 0;
+			break;
+		case IntelHexFile::eEndOfFileRecord:
+			valid = byteCount == 0;
+			break;
+		case IntelHexFile::eExtendedSegmentAddress:
+			// See IntelHexFile::NextRecord, only address bits 19:16 are kept.
+			valid = byteCount == 2;
+			mAddressH = mRecord[4] >> 4;
+			mByteCount = 0;
+			break;
+		case IntelHexFile::eStartSegmentAddress:
+			valid = byteCount == 4;
+			mByteCount = 0;
+			break;
+		default:
+			valid = false;
+			break;
+	}
+	/*
+	*	Skip the line ending (CRLF or LF), as IntelHexFile does.
+	*/
+	mPosition += length + 1;
+	if (mPosition < mMapSize &&
+		mMap[mPosition++] == '\r' &&
+		mPosition < mMapSize)
+	{
+		mPosition++;
+	}
+	return(valid);
+}
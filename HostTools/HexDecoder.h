@@ -0,0 +1,112 @@
+/*
+*	HexDecoder.h, Copyright Jonathan Mackey 2020
+*	Host only Intel hex decoder for tools that process many files.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	The interface and the records returned are the same as IntelHexFile.  The
+*	file is memory mapped.  Each record is located using its byte count, then
+*	its hex digits are converted and the checksum validated in one pass using
+*	SSE2 or AVX2 when available, otherwise a table based scalar routine.
+*
+*	As with IntelHexFile, only uppercase hex digits are accepted, records are
+*	limited to 16 data bytes, and zero length data records are rejected.
+*	HostTools/HexDecodeBench checks that both decoders return the same records.
+*
+*	A decoder can also decode a range of another decoder's file, as used by
+*	HexImage to decode chunks of a file in parallel.  The range shares the
+*	other decoder's mapping, so that decoder must stay open.  Like a decoder
+*	starting at the beginning of a file, the extended address starts at 0.
+*/
+#ifndef HexDecoder_h
+#define HexDecoder_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+class HexDecoder
+{
+public:
+							HexDecoder(void);
+							~HexDecoder(void);
+	bool					begin(
+								const char*				inPath);
+	bool					begin(	// Records starting within a range of inFile
+								const HexDecoder&		inFile,
+								size_t					inStart,
+								size_t					inEnd);
+	void					end(void);
+	bool					NextRecord(void);
+	uint8_t					RecordType(void) const
+								{return(mRecordType);}
+	uint16_t				Address(void) const
+								{return(mAddress);}
+	uint8_t					AddressH(void) const
+								{return(mAddressH);}
+	uint32_t				Address32(void) const
+								{return(((uint32_t)mAddressH << 16) | mAddress);}
+	const uint8_t*			Data(void) const
+								{return(&mRecord[4]);}
+	uint8_t					ByteCount(void) const
+								{return(mByteCount);}
+	bool					Rewind(void);
+	uint32_t				RecordPosition(void) const	// File offset of the current record
+								{return(mRecordPosition);}
+	size_t					Position(void) const	// File offset of the next record
+								{return(mPosition);}
+	const char*				Map(void) const
+								{return(mMap);}
+	size_t					MapSize(void) const
+								{return(mMapSize);}
+	enum EKernel
+	{
+		eScalarKernel,
+		eSSE2Kernel,
+		eAVX2Kernel
+	};
+	static uint8_t			BestKernel(void);
+	uint8_t					Kernel(void) const
+								{return(mKernel);}
+	void					SetKernel(	// Defaults to BestKernel()
+								uint8_t					inKernel)
+								{mKernel = inKernel < BestKernel() ? inKernel : BestKernel();}
+	static const char*		KernelName(
+								uint8_t					inKernel);
+protected:
+	const char*	mMap;
+	size_t		mMapSize;
+	size_t		mStart;		// Of the range, 0 for the whole file
+	size_t		mEnd;		// Of the range, no record starts at or after
+	size_t		mPosition;	// Of the next record
+	uint32_t	mRecordPosition;
+	uint16_t	mAddress;
+	uint8_t		mAddressH;
+	uint8_t		mByteCount;
+	uint8_t		mRecordType;
+	uint8_t		mKernel;
+	bool		mOwnsMap;	// false when decoding a range of another decoder
+	/*
+	*	The decoded record: byte count, address, type, data, checksum.  The
+	*	vector kernels store whole blocks so it's larger than the 21 bytes of
+	*	the largest record.
+	*/
+	uint8_t		mRecord[32];
+};
+
+#endif // HexDecoder_h
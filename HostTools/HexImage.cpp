@@ -0,0 +1,297 @@
+/*
+*	HexImage.cpp, Copyright Jonathan Mackey 2020
+*	Host only memory image of an Intel hex file.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "HexImage.h"
+#include "HexDecoder.h"
+#include "IntelHexFile.h"
+#include <string.h>
+#include <thread>
+
+const uint8_t	kUnknownAddressH = 0xFF;	// Set by a previous chunk
+
+struct SChunkRecord
+{
+	uint32_t	dataOffset;	// In SChunk::data
+	uint16_t	address;
+	uint8_t		addressH;	// kUnknownAddressH before the first type 2 record
+	uint8_t		byteCount;
+};
+
+struct SChunk
+{
+	size_t						start;
+	size_t						end;
+	std::vector<SChunkRecord>	records;
+	std::vector<uint8_t>		data;
+	uint8_t						lastAddressH;	// kUnknownAddressH if unchanged
+	uint8_t						state;
+};
+
+enum EChunkState
+{
+	eChunkComplete,		// Ended exactly at the start of the next chunk
+	eChunkEndOfFile,	// Contains the end of file record
+	eChunkFailed		// Invalid record, or didn't end at the next chunk
+};
+
+/********************************* DecodeChunk ********************************/
+/*
+*	Runs on its own thread.  inFile is shared read only.
+*/
+static void DecodeChunk(
+	const HexDecoder*	inFile,
+	SChunk*				ioChunk)
+{
+	HexDecoder	hexDecoder;
+	hexDecoder.begin(*inFile, ioChunk->start, ioChunk->end);
+	// A full line of 16 bytes is 44 chars with CRLF
+	ioChunk->records.reserve((ioChunk->end - ioChunk->start) / 44 + 1);
+	ioChunk->data.reserve(((ioChunk->end - ioChunk->start) / 44 + 1) * 16);
+	ioChunk->lastAddressH = kUnknownAddressH;
+	ioChunk->state = eChunkFailed;
+	while (hexDecoder.Position() < ioChunk->end)
+	{
+		if (!hexDecoder.NextRecord())
+		{
+			return;
+		}
+		switch (hexDecoder.RecordType())
+		{
+			case IntelHexFile::eDataRecord:
+			{
+				SChunkRecord	record;
+				record.dataOffset = ioChunk->data.size();
+				record.address = hexDecoder.Address();
+				record.addressH = ioChunk->lastAddressH;
+				record.byteCount = hexDecoder.ByteCount();
+				ioChunk->records.push_back(record);
+				ioChunk->data.insert(ioChunk->data.end(), hexDecoder.Data(),
+					hexDecoder.Data() + hexDecoder.ByteCount());
+				break;
+			}
+			case IntelHexFile::eExtendedSegmentAddress:
+				ioChunk->lastAddressH = hexDecoder.AddressH();
+				break;
+			case IntelHexFile::eEndOfFileRecord:
+				ioChunk->state = eChunkEndOfFile;
+				return;
+		}
+	}
+	if (hexDecoder.Position() == ioChunk->end)
+	{
+		ioChunk->state = eChunkComplete;
+	}
+}
+
+/********************************** HexImage **********************************/
+HexImage::HexImage(void)
+{
+	Clear();
+}
+
+/************************************ Clear ***********************************/
+void HexImage::Clear(void)
+{
+	mMemory.clear();
+	mByteCount = 0;
+	mFirstAddress = 0;
+	mEndAddress = 0;
+	mChunks = 0;
+	mErrorRecord = 0;
+	mErrorAddress = 0;
+	mError = eNoErr;
+}
+
+/************************************ Read ************************************/
+bool HexImage::Read(
+	const char*	inPath,
+	uint32_t	inMemorySize,
+	uint32_t	inThreads)
+{
+	Clear();
+	if (inThreads <= 1 ||
+		!ReadParallel(inPath, inMemorySize, inThreads))
+	{
+		Clear();
+		ReadSequential(inPath, inMemorySize);
+	}
+	return(mError == eNoErr);
+}
+
+/********************************* CopyRecord *********************************/
+bool HexImage::CopyRecord(
+	uint32_t		inAddress,
+	const uint8_t*	inData,
+	uint8_t			inByteCount,
+	uint32_t		inMemorySize)
+{
+	uint32_t	recordEnd = inAddress + inByteCount;
+	if (recordEnd > inMemorySize)
+	{
+		mError = eExceedsMemoryErr;
+		mErrorAddress = inAddress;
+		return(false);
+	}
+	if (recordEnd > mMemory.size())
+	{
+		mMemory.resize(recordEnd, 0xFF);
+	}
+	memcpy(&mMemory[inAddress], inData, inByteCount);
+	mByteCount += inByteCount;
+	if (mEndAddress == 0 ||
+		inAddress < mFirstAddress)
+	{
+		mFirstAddress = inAddress;
+	}
+	if (recordEnd > mEndAddress)
+	{
+		mEndAddress = recordEnd;
+	}
+	return(true);
+}
+
+/******************************* ReadSequential *******************************/
+bool HexImage::ReadSequential(
+	const char*	inPath,
+	uint32_t	inMemorySize)
+{
+	HexDecoder	hexDecoder;
+	mChunks = 1;
+	if (!hexDecoder.begin(inPath))
+	{
+		mError = eOpenErr;
+		return(false);
+	}
+	uint32_t	recordCount = 0;
+	while (hexDecoder.NextRecord())
+	{
+		recordCount++;
+		if (hexDecoder.RecordType() == IntelHexFile::eEndOfFileRecord)
+		{
+			return(true);
+		}
+		if (hexDecoder.RecordType() == IntelHexFile::eDataRecord &&
+			!CopyRecord(hexDecoder.Address32(), hexDecoder.Data(),
+				hexDecoder.ByteCount(), inMemorySize))
+		{
+			return(false);
+		}
+	}
+	mError = eInvalidRecordErr;
+	mErrorRecord = recordCount + 1;
+	return(false);
+}
+
+/******************************** ReadParallel ********************************/
+/*
+*	Returns false when the file needs to be read sequentially, either because
+*	it's too small to split or a chunk failed.
+*/
+bool HexImage::ReadParallel(
+	const char*	inPath,
+	uint32_t	inMemorySize,
+	uint32_t	inThreads)
+{
+	HexDecoder	hexFile;
+	if (!hexFile.begin(inPath))
+	{
+		return(false);
+	}
+	size_t		fileSize = hexFile.MapSize();
+	uint32_t	chunkCount = fileSize / kMinChunkSize;
+	if (chunkCount > inThreads)
+	{
+		chunkCount = inThreads;
+	}
+	if (chunkCount <= 1)
+	{
+		return(false);
+	}
+	/*
+	*	Each chunk after the first starts following a line feed.
+	*/
+	std::vector<SChunk>	chunks(1);
+	chunks[0].start = 0;
+	const char*	map = hexFile.Map();
+	for (uint32_t i = 1; i < chunkCount; i++)
+	{
+		const char*	lineFeed = (const char*)memchr(&map[fileSize / chunkCount * i], '\n',
+									fileSize - fileSize / chunkCount * i);
+		if (!lineFeed)
+		{
+			break;
+		}
+		size_t	start = lineFeed - map + 1;
+		if (start > chunks.back().start &&
+			start < fileSize)
+		{
+			chunks.back().end = start;
+			chunks.push_back(SChunk());
+			chunks.back().start = start;
+		}
+	}
+	chunks.back().end = fileSize;
+	mChunks = chunks.size();
+
+	std::vector<std::thread>	threads;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		threads.push_back(std::thread(DecodeChunk, &hexFile, &chunks[i]));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+
+	/*
+	*	The fix-up pass, in file order.
+	*/
+	uint8_t	addressH = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		const SChunk&	chunk = chunks[i];
+		if (chunk.state == eChunkFailed)
+		{
+			return(false);
+		}
+		for (size_t j = 0; j < chunk.records.size(); j++)
+		{
+			const SChunkRecord&	record = chunk.records[j];
+			uint8_t	recordAddressH = record.addressH == kUnknownAddressH ?
+										addressH : record.addressH;
+			if (!CopyRecord(((uint32_t)recordAddressH << 16) | record.address,
+					&chunk.data[record.dataOffset], record.byteCount, inMemorySize))
+			{
+				return(true);	// eExceedsMemoryErr, all preceding records were valid
+			}
+		}
+		if (chunk.state == eChunkEndOfFile)
+		{
+			return(true);
+		}
+		if (chunk.lastAddressH != kUnknownAddressH)
+		{
+			addressH = chunk.lastAddressH;
+		}
+	}
+	return(false);	// No end of file record
+}
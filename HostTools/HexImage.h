@@ -0,0 +1,105 @@
+/*
+*	HexImage.h, Copyright Jonathan Mackey 2020
+*	Host only memory image of an Intel hex file.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Read decodes every record up to the end of file record into a memory
+*	image.  Unused bytes are 0xFF.  When a record overlaps an earlier one, the
+*	later record's data is kept, the same as loading the file sequentially.
+*
+*	Large files are split into chunks at line boundaries and the chunks are
+*	decoded in parallel by HexDecoder.  Each chunk starts with an unknown
+*	extended address.  Once all of the chunks are decoded, a fix-up pass walks
+*	the chunks in file order, giving the records preceding each chunk's first
+*	extended segment address record the address in effect at the end of the
+*	previous chunk, and copies the data into the image.
+*
+*	Any error detected while decoding in parallel, or a chunk that doesn't end
+*	exactly where the next one starts, causes the file to be read again
+*	sequentially, so the error reported is always the one the sequential
+*	read finds first.
+*/
+#ifndef HexImage_h
+#define HexImage_h
+
+#include <inttypes.h>
+#include <vector>
+
+class HexImage
+{
+public:
+							HexImage(void);
+	bool					Read(
+								const char*				inPath,
+								uint32_t				inMemorySize,
+								uint32_t				inThreads = 1);
+	const std::vector<uint8_t>&	Memory(void) const	// From address 0 to EndAddress
+									{return(mMemory);}
+	uint32_t				ByteCount(void) const	// Of data, overlaps counted again
+								{return(mByteCount);}
+	uint32_t				FirstAddress(void) const
+								{return(mFirstAddress);}
+	uint32_t				EndAddress(void) const	// 0 when there's no data
+								{return(mEndAddress);}
+	uint32_t				Chunks(void) const	// Used by the last Read
+								{return(mChunks);}
+	uint8_t					Error(void) const
+								{return(mError);}
+	uint32_t				ErrorRecord(void) const	// 1 based, eInvalidRecordErr
+								{return(mErrorRecord);}
+	uint32_t				ErrorAddress(void) const	// eExceedsMemoryErr
+								{return(mErrorAddress);}
+	enum EErrors
+	{
+		eNoErr,
+		eOpenErr,
+		eInvalidRecordErr,	// Including a missing end of file record
+		eExceedsMemoryErr
+	};
+	/*
+	*	Files smaller than this per thread are read with fewer threads.
+	*/
+	static const uint32_t	kMinChunkSize = 256 * 1024;
+protected:
+	std::vector<uint8_t>	mMemory;
+	uint32_t	mByteCount;
+	uint32_t	mFirstAddress;
+	uint32_t	mEndAddress;
+	uint32_t	mChunks;
+	uint32_t	mErrorRecord;
+	uint32_t	mErrorAddress;
+	uint8_t		mError;
+
+	void					Clear(void);
+	bool					CopyRecord(
+								uint32_t				inAddress,
+								const uint8_t*			inData,
+								uint8_t					inByteCount,
+								uint32_t				inMemorySize);
+	bool					ReadSequential(
+								const char*				inPath,
+								uint32_t				inMemorySize);
+	bool					ReadParallel(
+								const char*				inPath,
+								uint32_t				inMemorySize,
+								uint32_t				inThreads);
+};
+
+#endif // HexImage_h
@@ -0,0 +1,264 @@
+/*
+*	ISPSelfTest.cpp, Copyright Jonathan Mackey 2020
+*	Checks the flash paths of the __MACH__ (host) build of AVRStreamISP by
+*	feeding it STK500 commands and checking the responses.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		ISPSelfTest
+*			A pattern is written with STK_PROG_PAGE, several pages per
+*			command, then read back with STK_READ_PAGE using lengths on both
+*			sides of ISP_BUFFER_SIZE.  Each read is compared byte for byte
+*			with the pattern.  The single page (bootloader) mode is then
+*			checked to fail anything other than one aligned page.
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -std=gnu++11 -D__MACH__ -I. -o ISPSelfTest \
+*			../HostTools/ISPSelfTest.cpp AVRStreamISP.cpp AVRConfig.cpp \
+*			ContextualStream.cpp CRC32.cpp BufferArena.cpp
+*
+*	The exit status is 0 when every check passed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "AVRStreamISP.h"
+#include "stk500.h"
+#include "BufferArena.h"
+
+const uint16_t	kPageSize = 128;
+const uint16_t	kPatternSize = 4096;
+// Read lengths, the interesting ones straddle ISP_BUFFER_SIZE (275 or 256)
+const uint16_t	kReadLengths[] = {2, 128, 254, 256, 258, 274, 276, 512, 550, 1024, 2048};
+
+static uint32_t	sFailures;
+
+/********************************* TestStream *********************************/
+/*
+*	In-memory stream.  The command is the input, the response is collected as
+*	the output.
+*/
+class TestStream : public ContextualStream
+{
+public:
+							TestStream(void)
+								: mInputIndex(0){}
+	void					SetInput(
+								const std::vector<uint8_t>&	inInput)
+								{mInput = inInput; mInputIndex = 0; mOutput.clear();}
+	const std::vector<uint8_t>&	Output(void) const
+								{return(mOutput);}
+	virtual int				available(void)
+								{return((int)(mInput.size() - mInputIndex));}
+	virtual int				read(void)
+								{return(mInputIndex < mInput.size() ? mInput[mInputIndex++] : -1);}
+	virtual int				peek(void)
+								{return(mInputIndex < mInput.size() ? mInput[mInputIndex] : -1);}
+	virtual size_t			write(
+								uint8_t					inByte)
+								{mOutput.push_back(inByte); return(1);}
+	virtual size_t			write(
+								const uint8_t*			inBuffer,
+								size_t					inLength)
+								{mOutput.insert(mOutput.end(), inBuffer, inBuffer + inLength); return(inLength);}
+	virtual void			flush(void){}
+protected:
+	std::vector<uint8_t>	mInput;
+	size_t					mInputIndex;
+	std::vector<uint8_t>	mOutput;
+};
+
+/********************************* SendCommand ********************************/
+/*
+*	Returns the response to inCommand, CRC_EOP is appended.
+*/
+static const std::vector<uint8_t>& SendCommand(
+	AVRStreamISP&			inISP,
+	TestStream&				inStream,
+	std::vector<uint8_t>	inCommand)
+{
+	inCommand.push_back(CRC_EOP);
+	inStream.SetInput(inCommand);
+	while (inStream.available())
+	{
+		inISP.Update();
+	}
+	return(inStream.Output());
+}
+
+/********************************* CheckStatus ********************************/
+/*
+*	Checks a response without data, STK_INSYNC followed by inStatus.
+*/
+static void CheckStatus(
+	const char*					inWhat,
+	const std::vector<uint8_t>&	inResponse,
+	uint8_t						inStatus)
+{
+	if (inResponse.size() != 2 ||
+		inResponse[0] != STK_INSYNC ||
+		inResponse[1] != inStatus)
+	{
+		printf("%s: expected status %02X, got", inWhat, inStatus);
+		for (size_t i = 0; i < inResponse.size(); i++)
+		{
+			printf(" %02X", inResponse[i]);
+		}
+		printf("\n");
+		sFailures++;
+	}
+}
+
+/********************************* LoadAddress ********************************/
+static void LoadAddress(
+	AVRStreamISP&	inISP,
+	TestStream&		inStream,
+	uint16_t		inByteAddress)
+{
+	uint16_t	wordAddress = inByteAddress >> 1;
+	CheckStatus("STK_LOAD_ADDRESS",
+		SendCommand(inISP, inStream,
+			{STK_LOAD_ADDRESS, (uint8_t)wordAddress, (uint8_t)(wordAddress >> 8)}),
+		STK_OK);
+}
+
+/********************************* ProgramPage ********************************/
+static const std::vector<uint8_t>& ProgramPage(
+	AVRStreamISP&			inISP,
+	TestStream&				inStream,
+	const uint8_t*			inData,
+	uint16_t				inLength)
+{
+	std::vector<uint8_t>	command = {STK_PROG_PAGE,
+								(uint8_t)(inLength >> 8), (uint8_t)inLength, 'F'};
+	command.insert(command.end(), inData, inData + inLength);
+	return(SendCommand(inISP, inStream, command));
+}
+
+/********************************** ReadBack **********************************/
+/*
+*	Reads inLength bytes from inByteAddress and compares them to the pattern.
+*/
+static void ReadBack(
+	AVRStreamISP&				inISP,
+	TestStream&					inStream,
+	const std::vector<uint8_t>&	inPattern,
+	uint16_t					inByteAddress,
+	uint16_t					inLength)
+{
+	LoadAddress(inISP, inStream, inByteAddress);
+	const std::vector<uint8_t>&	response = SendCommand(inISP, inStream,
+		{STK_READ_PAGE, (uint8_t)(inLength >> 8), (uint8_t)inLength, 'F'});
+	if (response.size() != (size_t)inLength + 2 ||
+		response.front() != STK_INSYNC ||
+		response.back() != STK_OK)
+	{
+		printf("Read %hu bytes at %04hX: bad response, %zu bytes\n",
+			inLength, inByteAddress, response.size());
+		sFailures++;
+		return;
+	}
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		if (response[i + 1] != inPattern[inByteAddress + i])
+		{
+			printf("Read %hu bytes at %04hX: byte %hu is %02X, expected %02X\n",
+				inLength, inByteAddress, i, response[i + 1],
+				inPattern[inByteAddress + i]);
+			sFailures++;
+			return;
+		}
+	}
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	TestStream		stream;
+	AVRStreamISP*	avrStreamISP = new AVRStreamISP;	// Large simulated flash
+	AVRStreamISP&	isp = *avrStreamISP;
+	BufferArena::Begin(BufferArena::eUSBPhase);
+	isp.begin();
+	isp.SetStream(&stream);
+
+	/*
+	*	STK_SET_DEVICE, only the page size (big endian at [12]) matters to the
+	*	host AVRStreamISP.
+	*/
+	std::vector<uint8_t>	setDevice(21, 0);
+	setDevice[0] = STK_SET_DEVICE;
+	setDevice[1 + 12] = kPageSize >> 8;
+	setDevice[1 + 13] = (uint8_t)kPageSize;
+	CheckStatus("STK_SET_DEVICE", SendCommand(isp, stream, setDevice), STK_OK);
+	CheckStatus("STK_ENTER_PROGMODE",
+		SendCommand(isp, stream, {STK_ENTER_PROGMODE}), STK_OK);
+
+	std::vector<uint8_t>	pattern(kPatternSize);
+	srand(1);
+	for (uint16_t i = 0; i < kPatternSize; i++)
+	{
+		pattern[i] = (uint8_t)rand();
+	}
+	// Two pages per command, as SDHexSession batches them with the ISP.
+	for (uint16_t address = 0; address < kPatternSize; address += kPageSize * 2)
+	{
+		LoadAddress(isp, stream, address);
+		CheckStatus("STK_PROG_PAGE",
+			ProgramPage(isp, stream, &pattern[address], kPageSize * 2), STK_OK);
+	}
+	uint32_t	reads = 0;
+	for (uint16_t length : kReadLengths)
+	{
+		for (uint16_t address = 0; address + length <= kPatternSize;
+			address += length + kPageSize)
+		{
+			ReadBack(isp, stream, pattern, address, length);
+			reads++;
+		}
+	}
+
+	/*
+	*	Single page mode, one aligned page passes, anything else fails and
+	*	flash is left unchanged.
+	*/
+	isp.SetSinglePageWrites(true);
+	std::vector<uint8_t>	erased(kPageSize * 2, 0xFF);
+	LoadAddress(isp, stream, 0);
+	CheckStatus("Single page, two pages",
+		ProgramPage(isp, stream, erased.data(), kPageSize * 2), STK_FAILED);
+	LoadAddress(isp, stream, kPageSize / 2);
+	CheckStatus("Single page, unaligned",
+		ProgramPage(isp, stream, erased.data(), kPageSize), STK_FAILED);
+	ReadBack(isp, stream, pattern, 0, kPageSize * 2);
+	LoadAddress(isp, stream, 0);
+	CheckStatus("Single page, one page",
+		ProgramPage(isp, stream, erased.data(), kPageSize), STK_OK);
+	memset(pattern.data(), 0xFF, kPageSize);
+	ReadBack(isp, stream, pattern, 0, kPageSize * 2);
+
+	isp.Halt();
+	isp.SetStream(nullptr);
+	delete avrStreamISP;
+	printf("%u reads checked, %u failed\n", reads + 2, sFailures);
+	return(sFailures ? 1 : 0);
+}
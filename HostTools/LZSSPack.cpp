@@ -0,0 +1,366 @@
+/*
+*	LZSSPack.cpp, Copyright Jonathan Mackey 2020
+*	Compresses a hex or bin file into the LZSS image format read by
+*	SDHexLoaderISP/LZSSFile, then checks the result by decoding it with
+*	LZSSFile.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		LZSSPack [-w window_bits] [-l length_bits] [-a address] in [out.lzs]
+*			in is a .hex, .eep or .bin file.  out defaults to in with the
+*			extension replaced by lzs.  The window bits default to
+*			LZSS_WINDOW_BITS, the length bits to 4.  address is the load
+*			address of a .bin file (the config's bin.address), default 0.
+*
+*	A hex file is read by IntelHexFile, the same as the loader reads it.  Each
+*	contiguous range of memory it loads becomes a block.  Gaps of less than
+*	kMinGap bytes are filled with 0xFF rather than starting a new block.  When
+*	records overlap, the later record's data is kept.  A bin file is a single
+*	block.
+*
+*	Matches are found by searching the entire window, it's small enough that
+*	this takes well under a second for the largest AVR image.
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -O2 -std=gnu++11 -D__MACH__ -I. -o LZSSPack \
+*			../HostTools/LZSSPack.cpp LZSSFile.cpp IntelHexFile.cpp \
+*			ImageSource.cpp BufferArena.cpp
+*
+*	The exit status is 0 when the file was written and decoded correctly.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "IntelHexFile.h"
+#include "LZSSFile.h"
+
+const uint32_t	kMaxImageSize = 0x1000000;	// 24 bit address
+const uint32_t	kMinGap = 64;
+
+struct SBlock
+{
+	uint32_t				address;
+	std::vector<uint8_t>	data;
+};
+
+/******************************** LZSSBitWriter *******************************/
+/*
+*	Appends bits to a byte vector, most significant bit first.
+*/
+class LZSSBitWriter
+{
+public:
+							LZSSBitWriter(
+								std::vector<uint8_t>&	ioOutput)
+								: mOutput(ioOutput), mBitsUsed(8){}
+	void					WriteBytes(	// Starting on a byte boundary
+								const void*				inData,
+								uint32_t				inLength)
+	{
+		mOutput.insert(mOutput.end(), (const uint8_t*)inData,
+										(const uint8_t*)inData + inLength);
+		mBitsUsed = 8;
+	}
+	void					Write(
+								uint32_t				inValue,
+								uint8_t					inCount)
+	{
+		while (inCount)
+		{
+			inCount--;
+			if (mBitsUsed == 8)
+			{
+				mOutput.push_back(0);
+				mBitsUsed = 0;
+			}
+			mOutput.back() |= ((inValue >> inCount) & 1) << (7 - mBitsUsed);
+			mBitsUsed++;
+		}
+	}
+protected:
+	std::vector<uint8_t>&	mOutput;
+	uint8_t					mBitsUsed;	// Of the last byte
+};
+
+/********************************** Compress **********************************/
+/*
+*	Greedy, the longest match in the window is always taken.  Matches shorter
+*	than LZSS_MIN_MATCH cost more than the literals they replace.  The window
+*	spans blocks, a match doesn't.
+*/
+static void Compress(
+	const std::vector<SBlock>&	inBlocks,
+	uint8_t						inWindowBits,
+	uint8_t						inLengthBits,
+	std::vector<uint8_t>&		ioOutput)
+{
+	LZSSBitWriter	writer(ioOutput);
+	std::vector<uint8_t>	decoded;
+	uint32_t	windowSize = 1 << inWindowBits;
+	uint32_t	maxMatch = (1 << inLengthBits) - 1 + LZSS_MIN_MATCH;
+	for (const SBlock& block : inBlocks)
+	{
+		SLZSSBlock	blockHeader;
+		blockHeader.address = block.address;
+		blockHeader.length = block.data.size();
+		writer.WriteBytes(&blockHeader, sizeof(SLZSSBlock));
+		uint32_t	position = decoded.size();
+		decoded.insert(decoded.end(), block.data.begin(), block.data.end());
+		const uint8_t*	data = decoded.data();
+		uint32_t	end = decoded.size();
+		while (position < end)
+		{
+			uint32_t	bestLength = 0;
+			uint32_t	bestOffset = 0;
+			uint32_t	limit = end - position;
+			if (limit > maxMatch)
+			{
+				limit = maxMatch;
+			}
+			for (uint32_t offset = 1; offset <= windowSize && offset <= position; offset++)
+			{
+				const uint8_t*	match = &data[position - offset];
+				uint32_t	length = 0;
+				while (length < limit && match[length] == data[position + length])
+				{
+					length++;
+				}
+				if (length > bestLength)
+				{
+					bestLength = length;
+					bestOffset = offset;
+					if (length == limit)
+					{
+						break;
+					}
+				}
+			}
+			if (bestLength >= LZSS_MIN_MATCH)
+			{
+				writer.Write(0, 1);
+				writer.Write(bestOffset - 1, inWindowBits);
+				writer.Write(bestLength - LZSS_MIN_MATCH, inLengthBits);
+				position += bestLength;
+			} else
+			{
+				writer.Write(1, 1);
+				writer.Write(data[position], 8);
+				position++;
+			}
+		}
+	}
+}
+
+/*********************************** Verify ***********************************/
+/*
+*	Decodes inPath with LZSSFile and compares it to the blocks.
+*/
+static bool Verify(
+	const char*					inPath,
+	const std::vector<SBlock>&	inBlocks,
+	uint32_t					inLength)
+{
+	LZSSFile	lzssFile;
+	bool		success = lzssFile.begin(inPath) &&
+					lzssFile.EstimateLength() == inLength;
+	uint32_t	blockIndex = 0;
+	uint32_t	offset = 0;		// Within the block
+	while (success &&
+		lzssFile.NextRecord() &&
+		lzssFile.RecordType() == ImageSource::eDataRecord)
+	{
+		if (blockIndex < inBlocks.size() &&
+			offset == inBlocks[blockIndex].data.size())
+		{
+			blockIndex++;
+			offset = 0;
+		}
+		success = blockIndex < inBlocks.size() &&
+			lzssFile.Address32() == (inBlocks[blockIndex].address + offset) &&
+			(offset + lzssFile.ByteCount()) <= inBlocks[blockIndex].data.size() &&
+			memcmp(lzssFile.Data(), &inBlocks[blockIndex].data[offset],
+										lzssFile.ByteCount()) == 0;
+		offset += lzssFile.ByteCount();
+	}
+	success = success &&
+		lzssFile.RecordType() == ImageSource::eEndOfFileRecord &&
+		(blockIndex + 1) == inBlocks.size() &&
+		offset == inBlocks[blockIndex].data.size();
+	lzssFile.end();
+	return(success);
+}
+
+/********************************** ReadBlocks ********************************/
+static bool ReadBlocks(
+	const char*				inPath,
+	uint32_t				inBinAddress,
+	std::vector<SBlock>&	outBlocks)
+{
+	size_t	pathLen = strlen(inPath);
+	bool	success = false;
+	if (pathLen > 4 && strcmp(&inPath[pathLen-4], ".bin") == 0)
+	{
+		FILE*	file = fopen(inPath, "rb");
+		if (file)
+		{
+			SBlock	block;
+			uint8_t	buffer[4096];
+			size_t	bytesRead;
+			block.address = inBinAddress;
+			while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			{
+				block.data.insert(block.data.end(), buffer, &buffer[bytesRead]);
+			}
+			fclose(file);
+			success = block.data.size() != 0 &&
+				(inBinAddress + block.data.size()) <= kMaxImageSize;
+			outBlocks.push_back(block);
+		}
+	} else
+	{
+		IntelHexFile	hexFile;
+		std::vector<uint8_t>	memory(kMaxImageSize, 0xFF);
+		std::vector<bool>		loaded(kMaxImageSize, false);
+		success = hexFile.begin(inPath);
+		while (success &&
+			(success = hexFile.NextRecord()) == true &&
+			hexFile.RecordType() != ImageSource::eEndOfFileRecord)
+		{
+			if (hexFile.RecordType() == ImageSource::eDataRecord)
+			{
+				uint32_t	address = hexFile.Address32();
+				for (uint8_t i = 0; i < hexFile.ByteCount(); i++)
+				{
+					memory[address + i] = hexFile.Data()[i];
+					loaded[address + i] = true;
+				}
+			}
+		}
+		hexFile.end();
+		for (uint32_t address = 0; success && address < kMaxImageSize; address++)
+		{
+			if (!loaded[address])
+			{
+				continue;
+			}
+			if (outBlocks.empty() ||
+				(address - (outBlocks.back().address + outBlocks.back().data.size())) >= kMinGap)
+			{
+				outBlocks.push_back(SBlock());
+				outBlocks.back().address = address;
+			}
+			SBlock&	block = outBlocks.back();
+			block.data.resize(address - block.address, 0xFF);
+			block.data.push_back(memory[address]);
+		}
+		success = success && !outBlocks.empty() && outBlocks.size() <= 0xFFFF;
+	}
+	if (!success)
+	{
+		fprintf(stderr, "%s: can't be read\n", inPath);
+	}
+	return(success);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	uint32_t	windowBits = LZSS_WINDOW_BITS;
+	uint32_t	lengthBits = 4;
+	uint32_t	baseAddress = 0;
+	int			opt;
+	while ((opt = getopt(argc, argv, "w:l:a:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'w':
+				windowBits = strtoul(optarg, nullptr, 0);
+				break;
+			case 'l':
+				lengthBits = strtoul(optarg, nullptr, 0);
+				break;
+			case 'a':
+				baseAddress = strtoul(optarg, nullptr, 0);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind >= argc ||
+		windowBits == 0 || windowBits > LZSS_WINDOW_BITS ||
+		lengthBits == 0 || lengthBits > 8)
+	{
+		fprintf(stderr, "Usage:\n"
+			"  LZSSPack [-w window_bits] [-l length_bits] [-a address] in [out.lzs]\n"
+			"  window_bits 1 to %d, length_bits 1 to 8\n", LZSS_WINDOW_BITS);
+		return(2);
+	}
+	const char*	inPath = argv[optind];
+	std::string	outPath;
+	if ((optind + 1) < argc)
+	{
+		outPath = argv[optind + 1];
+	} else
+	{
+		outPath = inPath;
+		size_t	dot = outPath.rfind('.');
+		outPath = outPath.substr(0, dot == std::string::npos ? outPath.size() : dot) + ".lzs";
+	}
+	std::vector<SBlock>	blocks;
+	if (!ReadBlocks(inPath, baseAddress, blocks))
+	{
+		return(1);
+	}
+	uint32_t	length = 0;
+	for (const SBlock& block : blocks)
+	{
+		length += block.data.size();
+	}
+	SLZSSHeader	header;
+	memcpy(header.ident, "LZS\x01", 4);
+	header.windowBits = windowBits;
+	header.lengthBits = lengthBits;
+	header.blockCount = blocks.size();
+	header.length = length;
+	std::vector<uint8_t>	output((uint8_t*)&header, (uint8_t*)&header + sizeof(header));
+	Compress(blocks, windowBits, lengthBits, output);
+
+	FILE*	file = fopen(outPath.c_str(), "wb");
+	bool	success = file &&
+		fwrite(output.data(), 1, output.size(), file) == output.size();
+	success = file && fclose(file) == 0 && success;
+	if (!success)
+	{
+		fprintf(stderr, "%s: can't be written\n", outPath.c_str());
+		return(1);
+	}
+	success = Verify(outPath.c_str(), blocks, length);
+	printf("%s: %u bytes in %zu blocks, %zu compressed (%.1f%%), %s\n",
+		outPath.c_str(), length, blocks.size(), output.size(),
+		100.0 * output.size() / length,
+		success ? "verified" : "FAILED verification");
+	return(success ? 0 : 1);
+}
@@ -0,0 +1,335 @@
+/*
+*	ProfileReport.cpp, Copyright Jonathan Mackey 2020
+*	Maps the histogram dumped by SDHexLoaderISP/SampleProfiler to the
+*	functions of the sketch using the symbol table of its .elf file.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		ProfileReport [-n count] sketch.elf profile.txt
+*			profile.txt is what was received on Serial, e.g. captured with
+*			"cat /dev/cu.usbserial-XXXX > profile.txt".  Lines outside of a
+*			profile are ignored.  When the file contains more than one
+*			profile (one per session), they are added together.  count limits
+*			the report to the count functions with the most samples.
+*
+*	The .elf file is the one the Arduino IDE leaves in the build folder
+*	(Sketch > Export Compiled Binary also leaves a copy in the sketch folder.)
+*	Only function symbols are used.  When a bucket covers more than one
+*	function, its samples are shared between them in proportion to the bytes
+*	of the bucket each occupies.  Bytes not in any function (e.g. PROGMEM
+*	data, the vector table) are reported as "(other)".  Use a small
+*	SAMPLE_PROFILER_SHIFT for exact figures.
+*
+*	Build:
+*		g++ -O2 -std=gnu++11 -o ProfileReport ProfileReport.cpp
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cxxabi.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+const uint32_t	kFlashLimit = 0x800000;	// avr-gcc places SRAM at 0x800000
+
+struct SFunction
+{
+	uint32_t	address;
+	uint32_t	size;
+	std::string	name;
+	double		samples;
+};
+
+struct SBucket
+{
+	uint32_t	address;
+	uint32_t	size;
+	uint32_t	count;
+};
+
+/********************************** ReadFile **********************************/
+static bool ReadFile(
+	const char*				inPath,
+	std::vector<uint8_t>&	outData)
+{
+	FILE*	file = fopen(inPath, "rb");
+	bool	success = file != nullptr;
+	if (success)
+	{
+		uint8_t	buffer[4096];
+		size_t	bytesRead;
+		while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		{
+			outData.insert(outData.end(), buffer, buffer + bytesRead);
+		}
+		fclose(file);
+	} else
+	{
+		fprintf(stderr, "%s: can't be read\n", inPath);
+	}
+	return(success);
+}
+
+/********************************** Get16/32 **********************************/
+// ELF32 little endian, as built by avr-gcc
+static uint16_t Get16(
+	const std::vector<uint8_t>&	inData,
+	uint32_t					inOffset)
+{
+	return(inData[inOffset] | (inData[inOffset+1] << 8));
+}
+
+static uint32_t Get32(
+	const std::vector<uint8_t>&	inData,
+	uint32_t					inOffset)
+{
+	return(Get16(inData, inOffset) | ((uint32_t)Get16(inData, inOffset+2) << 16));
+}
+
+/******************************** ReadFunctions *******************************/
+/*
+*	Reads the function symbols of the symbol table, sorted by address.
+*/
+static bool ReadFunctions(
+	const char*				inPath,
+	std::vector<SFunction>&	outFunctions)
+{
+	std::vector<uint8_t>	elf;
+	if (!ReadFile(inPath, elf))
+	{
+		return(false);
+	}
+	if (elf.size() < 52 ||
+		memcmp(elf.data(), "\x7F" "ELF", 4) != 0 ||
+		elf[4] != 1 ||	// ELFCLASS32
+		elf[5] != 1)	// ELFDATA2LSB
+	{
+		fprintf(stderr, "%s: not a little endian ELF32 file\n", inPath);
+		return(false);
+	}
+	uint32_t	shOffset = Get32(elf, 0x20);
+	uint16_t	shEntSize = Get16(elf, 0x2E);
+	uint16_t	shCount = Get16(elf, 0x30);
+	if (shEntSize < 40 ||
+		shOffset + (uint64_t)shCount * shEntSize > elf.size())
+	{
+		fprintf(stderr, "%s: bad section header table\n", inPath);
+		return(false);
+	}
+	for (uint16_t i = 0; i < shCount; i++)
+	{
+		uint32_t	sh = shOffset + i * shEntSize;
+		if (Get32(elf, sh + 4) != 2)	// SHT_SYMTAB
+		{
+			continue;
+		}
+		uint32_t	symOffset = Get32(elf, sh + 16);
+		uint32_t	symSize = Get32(elf, sh + 20);
+		uint32_t	link = Get32(elf, sh + 24);
+		if (link >= shCount ||
+			symOffset + (uint64_t)symSize > elf.size())
+		{
+			break;
+		}
+		uint32_t	strSh = shOffset + link * shEntSize;
+		uint32_t	strOffset = Get32(elf, strSh + 16);
+		uint32_t	strSize = Get32(elf, strSh + 20);
+		if (strOffset + (uint64_t)strSize > elf.size())
+		{
+			break;
+		}
+		for (uint32_t sym = symOffset; sym + 16 <= symOffset + symSize; sym += 16)
+		{
+			uint32_t	nameIndex = Get32(elf, sym);
+			SFunction	function;
+			function.address = Get32(elf, sym + 4);
+			function.size = Get32(elf, sym + 8);
+			function.samples = 0;
+			if ((elf[sym + 12] & 0xF) != 2 ||	// STT_FUNC
+				function.size == 0 ||
+				function.address >= kFlashLimit ||
+				nameIndex >= strSize)
+			{
+				continue;
+			}
+			const char*	name = (const char*)&elf[strOffset + nameIndex];
+			function.name.assign(name, strnlen(name, strSize - nameIndex));
+			int		status;
+			char*	demangled = abi::__cxa_demangle(function.name.c_str(),
+										nullptr, nullptr, &status);
+			if (demangled)
+			{
+				function.name = demangled;
+				free(demangled);
+			}
+			outFunctions.push_back(function);
+		}
+	}
+	if (outFunctions.empty())
+	{
+		fprintf(stderr, "%s: no function symbols\n", inPath);
+		return(false);
+	}
+	std::sort(outFunctions.begin(), outFunctions.end(),
+		[](const SFunction& inA, const SFunction& inB)
+			{return(inA.address < inB.address);});
+	return(true);
+}
+
+/********************************* ReadProfile ********************************/
+/*
+*	See SampleProfiler.h for the format.
+*/
+static bool ReadProfile(
+	const char*				inPath,
+	std::vector<SBucket>&	outBuckets,
+	uint32_t&				outSamples,
+	uint32_t&				outOutside)
+{
+	FILE*	file = fopen(inPath, "r");
+	if (!file)
+	{
+		fprintf(stderr, "%s: can't be read\n", inPath);
+		return(false);
+	}
+	char		line[256];
+	uint32_t	profiles = 0;
+	uint32_t	bucketSize = 0;	// 0 when not in a profile
+	outSamples = 0;
+	outOutside = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		unsigned	base, shift, samples, outside;
+		SBucket		bucket;
+		if (sscanf(line, "profile base=%x shift=%u samples=%u outside=%u",
+				&base, &shift, &samples, &outside) == 4 &&
+			shift < 16)
+		{
+			bucketSize = 1 << shift;
+			outSamples += samples;
+			outOutside += outside;
+			profiles++;
+		} else if (bucketSize &&
+			strncmp(line, "end", 3) == 0)
+		{
+			bucketSize = 0;
+		} else if (bucketSize &&
+			sscanf(line, "%x %u", &bucket.address, &bucket.count) == 2)
+		{
+			bucket.size = bucketSize;
+			outBuckets.push_back(bucket);
+		}
+	}
+	fclose(file);
+	if (profiles == 0)
+	{
+		fprintf(stderr, "%s: no profile found\n", inPath);
+		return(false);
+	}
+	printf("%u profile%s, %u samples, %u outside of the histogram\n",
+		profiles, profiles == 1 ? "" : "s", outSamples, outOutside);
+	return(true);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	uint32_t	maxFunctions = 0xFFFFFFFF;
+	int			opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				maxFunctions = strtoul(optarg, nullptr, 0);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if ((optind + 2) != argc)
+	{
+		fprintf(stderr, "Usage:\n"
+			"  ProfileReport [-n count] sketch.elf profile.txt\n");
+		return(2);
+	}
+	std::vector<SFunction>	functions;
+	std::vector<SBucket>	buckets;
+	uint32_t	samples, outside;
+	if (!ReadFunctions(argv[optind], functions) ||
+		!ReadProfile(argv[optind + 1], buckets, samples, outside))
+	{
+		return(1);
+	}
+	/*
+	*	Share each bucket's count between the functions it overlaps.  The
+	*	functions are sorted by address and don't overlap each other.
+	*/
+	double	other = 0;
+	for (const SBucket& bucket : buckets)
+	{
+		uint32_t	bucketEnd = bucket.address + bucket.size;
+		uint32_t	covered = 0;
+		for (SFunction& function : functions)
+		{
+			uint32_t	start = std::max(function.address, bucket.address);
+			uint32_t	end = std::min(function.address + function.size, bucketEnd);
+			if (start < end)
+			{
+				function.samples += (double)bucket.count * (end - start) / bucket.size;
+				covered += end - start;
+			}
+		}
+		other += (double)bucket.count * (bucket.size - std::min(covered, bucket.size)) / bucket.size;
+	}
+	if (other > 0)
+	{
+		SFunction	otherFunction = {0, 0, "(other)", other};
+		functions.push_back(otherFunction);
+	}
+	std::stable_sort(functions.begin(), functions.end(),
+		[](const SFunction& inA, const SFunction& inB)
+			{return(inA.samples > inB.samples);});
+	uint32_t	inHistogram = samples - outside;
+	printf("      %%   samples  address  function\n");
+	for (const SFunction& function : functions)
+	{
+		if (maxFunctions == 0 ||
+			function.samples < 0.5)
+		{
+			break;
+		}
+		maxFunctions--;
+		char	addressStr[16] = "";
+		if (function.size)
+		{
+			snprintf(addressStr, sizeof(addressStr), "%05X", function.address);
+		}
+		printf("%7.2f %9.0f  %7s  %s\n",
+			inHistogram ? 100.0 * function.samples / inHistogram : 0.0,
+			function.samples, addressStr, function.name.c_str());
+	}
+	return(0);
+}
@@ -0,0 +1,529 @@
+/*
+*	SDHexMultiLoad.cpp, Copyright Jonathan Mackey 2020
+*	Loads a hex file into any number of serial (bootloader) targets at once
+*	using the same SDHexSession state machine and config files as the
+*	SDHexLoader.  Each port gets its own session, run on a pool of threads.
+*	Linux only.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		SDHexMultiLoad [-j threads] [-b baud] [-t timestamp] path.hex port...
+*			Loads and verifies path.hex on each port, e.g. /dev/ttyUSB0.
+*			path.hex is paired with its config, path.txt, as on the SD card.
+*			The baud rate defaults to the config's upload.speed.  The target
+*			is reset by pulsing DTR/RTS.  -t is the timestamp passed to
+*			SDHexSession::begin.
+*
+*		SDHexMultiLoad [-j threads] -l count path.hex
+*			Loopback test.  Each port is a pseudo terminal with a simulated
+*			target (the host AVRStreamISP) on the other end.  Like Optiboot,
+*			the simulated target fails any STK_PROG_PAGE that isn't exactly
+*			one aligned flash page.
+*
+*		-j is the number of sessions run at the same time, by default one per
+*		port.
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -std=gnu++11 -D__MACH__ -DSUPPORT_HOST_SERIAL -pthread \
+*			-I../HostTools -I. -I../libraries/UnixTime -I../libraries/MSPeriod \
+*			-o SDHexMultiLoad ../HostTools/SDHexMultiLoad.cpp SDHexSession.cpp \
+*			AVRStreamISP.cpp AVRConfig.cpp IntelHexFile.cpp IntelHexWriter.cpp \
+*			ContextualStream.cpp CRC32.cpp BufferArena.cpp HexRunIndex.cpp \
+*			ImageSource.cpp ElfFile.cpp SRecordFile.cpp BinaryFile.cpp \
+*			LZSSFile.cpp ImagePreflight.cpp ../libraries/UnixTime/UnixTime.cpp
+*
+*	The result of each port is listed.  The byte addresses of the pages
+*	rewritten after a verify mismatch (see verify_retries) are included.
+*
+*	The exit status is 0 when every port passed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "SDHexSession.h"
+#include "AVRStreamISP.h"
+#include "AVRConfig.h"
+#include "BufferArena.h"
+
+const int		kPollTimeout = 1;	// ms, available() waits this long for input
+const uint16_t	kInputBufferSize = 256;
+
+/********************************* SerialPort *********************************/
+/*
+*	A POSIX serial port (or either side of a pseudo terminal) as a Stream.
+*	When there's no input, available() waits up to kPollTimeout for some so
+*	that the session loops don't spin.  Writes block until all of the data
+*	has been queued.
+*/
+class SerialPort : public ContextualStream
+{
+public:
+							SerialPort(void)
+								: mFD(-1), mInputHead(0), mInputTail(0){}
+							~SerialPort(void)
+								{Close();}
+	bool					Open(
+								const char*				inPath,
+								uint32_t				inBaud);
+	void					Attach(
+								int						inFD)
+								{mFD = inFD;}
+	void					Close(void);
+	virtual int				available(void);
+	virtual int				read(void)
+								{return(available() ? mInput[mInputHead++] : -1);}
+	virtual int				peek(void)
+								{return(available() ? mInput[mInputHead] : -1);}
+	virtual size_t			write(
+								uint8_t					inByte)
+								{return(write(&inByte, 1));}
+	virtual size_t			write(
+								const uint8_t*			inBuffer,
+								size_t					inLength);
+	virtual void			flush(void)
+								{tcdrain(mFD);}
+	virtual void			SetReset(
+								bool					inAssert);
+protected:
+	int			mFD;
+	uint16_t	mInputHead;
+	uint16_t	mInputTail;
+	uint8_t		mInput[kInputBufferSize];
+
+	static speed_t			BaudToSpeed(
+								uint32_t				inBaud);
+};
+
+/********************************* BaudToSpeed ********************************/
+speed_t SerialPort::BaudToSpeed(
+	uint32_t	inBaud)
+{
+	switch (inBaud)
+	{
+		case 9600:		return(B9600);
+		case 19200:		return(B19200);
+		case 38400:		return(B38400);
+		case 57600:		return(B57600);
+		case 115200:	return(B115200);
+		case 230400:	return(B230400);
+		case 460800:	return(B460800);
+		case 500000:	return(B500000);
+		case 921600:	return(B921600);
+		case 1000000:	return(B1000000);
+	}
+	return(B0);
+}
+
+/************************************ Open ************************************/
+bool SerialPort::Open(
+	const char*	inPath,
+	uint32_t	inBaud)
+{
+	speed_t	speed = BaudToSpeed(inBaud);
+	if (speed == B0)
+	{
+		fprintf(stderr, "%s: unsupported baud rate %u\n", inPath, inBaud);
+		return(false);
+	}
+	mFD = open(inPath, O_RDWR | O_NOCTTY);
+	if (mFD < 0)
+	{
+		perror(inPath);
+		return(false);
+	}
+	struct termios	tio;
+	if (tcgetattr(mFD, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tio.c_cflag |= (CLOCAL | CREAD);
+		tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		if (tcsetattr(mFD, TCSANOW, &tio) == 0)
+		{
+			tcflush(mFD, TCIOFLUSH);
+			return(true);
+		}
+	}
+	perror(inPath);
+	Close();
+	return(false);
+}
+
+/************************************ Close ***********************************/
+void SerialPort::Close(void)
+{
+	if (mFD >= 0)
+	{
+		close(mFD);
+		mFD = -1;
+	}
+}
+
+/********************************** available *********************************/
+/*
+*	Anything that has arrived is appended to the input.  The wait is only when
+*	the input is empty.
+*/
+int SerialPort::available(void)
+{
+	if (mInputHead == mInputTail)
+	{
+		mInputHead = mInputTail = 0;
+	} else if (mInputTail == sizeof(mInput))
+	{
+		memmove(mInput, &mInput[mInputHead], mInputTail - mInputHead);
+		mInputTail -= mInputHead;
+		mInputHead = 0;
+	}
+	if (mInputTail < sizeof(mInput))
+	{
+		struct pollfd	pfd;
+		pfd.fd = mFD;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, mInputHead == mInputTail ? kPollTimeout : 0) > 0 &&
+			(pfd.revents & POLLIN))
+		{
+			ssize_t	bytesRead = ::read(mFD, &mInput[mInputTail],
+										sizeof(mInput) - mInputTail);
+			if (bytesRead > 0)
+			{
+				mInputTail += bytesRead;
+			}
+		}
+	}
+	return(mInputTail - mInputHead);
+}
+
+/************************************ write ***********************************/
+size_t SerialPort::write(
+	const uint8_t*	inBuffer,
+	size_t			inLength)
+{
+	size_t	bytesWritten = 0;
+	while (bytesWritten < inLength)
+	{
+		ssize_t	result = ::write(mFD, &inBuffer[bytesWritten], inLength - bytesWritten);
+		if (result <= 0)
+		{
+			break;
+		}
+		bytesWritten += result;
+	}
+	return(bytesWritten);
+}
+
+/********************************** SetReset **********************************/
+/*
+*	Asserting DTR (and RTS, used by some adapters) pulls the target's reset
+*	low via the capacitor on the target board.  Pseudo terminals don't have
+*	modem lines so the failure is ignored.
+*/
+void SerialPort::SetReset(
+	bool	inAssert)
+{
+	int	lines = TIOCM_DTR | TIOCM_RTS;
+	ioctl(mFD, inAssert ? TIOCMBIS : TIOCMBIC, &lines);
+}
+
+struct SPortJob
+{
+	const char*		path;
+	uint8_t			error;
+	bool			opened;
+	uint8_t			retryCount;
+#ifdef SUPPORT_VERIFY_RETRY
+	uint32_t		retriedPages[RETRIED_PAGES_SIZE];	// byte addresses
+#endif
+	uint32_t		bytesProcessed;
+	uint32_t		milliseconds;
+};
+
+static const char*	sHexPath;
+static uint32_t		sBaud;
+static uint32_t		sTimestamp;
+static std::vector<SPortJob>	sJobs;
+static std::atomic<size_t>		sNextJob;
+static std::atomic<bool>		sStopTargets;
+
+/********************************* ProgramPort ********************************/
+/*
+*	Runs a complete session on one port, as SDHexLoader::Update does for the
+*	serial source.
+*/
+static void ProgramPort(
+	SPortJob&	ioJob)
+{
+	SerialPort		port;
+	SDHexSession	session;
+	uint32_t		start = millis();
+
+	BufferArena::Begin(BufferArena::eSerialLoadPhase);
+	ioJob.opened = port.Open(ioJob.path, sBaud);
+	if (ioJob.opened)
+	{
+		if (session.begin(sHexPath, &port, nullptr, false, sTimestamp))
+		{
+			while (session.Update()){}
+		}
+		session.Halt();
+		ioJob.error = session.Error();
+		ioJob.bytesProcessed = session.BytesProcessed();
+	#ifdef SUPPORT_VERIFY_RETRY
+		ioJob.retryCount = session.RetryCount();
+		for (uint8_t i = 0; i < ioJob.retryCount && i < RETRIED_PAGES_SIZE; i++)
+		{
+			ioJob.retriedPages[i] = session.RetriedPage(i);
+		}
+	#endif
+	}
+	ioJob.milliseconds = millis() - start;
+}
+
+/*********************************** Worker ***********************************/
+static void Worker(void)
+{
+	size_t	jobIndex;
+	while ((jobIndex = sNextJob++) < sJobs.size())
+	{
+		ProgramPort(sJobs[jobIndex]);
+	}
+}
+
+/****************************** SimulatedTarget *******************************/
+/*
+*	The other end of a loopback port.  The host AVRStreamISP answers the
+*	STK500 commands a bootloader would, writing to simulated flash.  As
+*	with a bootloader, only one flash page is accepted per STK_PROG_PAGE.
+*/
+static void SimulatedTarget(
+	int					inFD,
+	const SAVRConfig*	inConfig)
+{
+	SerialPort		port;
+	AVRStreamISP*	avrStreamISP = new AVRStreamISP;	// Large simulated flash
+
+	BufferArena::Begin(BufferArena::eUSBPhase);
+	port.Attach(inFD);
+	avrStreamISP->begin();
+	avrStreamISP->SetStream(&port);
+	avrStreamISP->SetAVRConfig(*inConfig);
+	avrStreamISP->SetSinglePageWrites(true);
+	while (!sStopTargets)
+	{
+		avrStreamISP->Update();
+	}
+	avrStreamISP->SetStream(nullptr);
+	delete avrStreamISP;
+}
+
+/****************************** OpenLoopbackPort ******************************/
+/*
+*	Creates a pseudo terminal.  The target side is returned in outFD, the
+*	path of the side opened by the session is returned in outPath.
+*/
+static bool OpenLoopbackPort(
+	int&	outFD,
+	char*	outPath,
+	size_t	inPathSize)
+{
+	outFD = posix_openpt(O_RDWR | O_NOCTTY);
+	if (outFD >= 0)
+	{
+		const char*	path;
+		if (grantpt(outFD) == 0 &&
+			unlockpt(outFD) == 0 &&
+			(path = ptsname(outFD)) != nullptr &&
+			strlen(path) < inPathSize)
+		{
+			strcpy(outPath, path);
+			/*
+			*	The line settings are shared by both sides, raw mode is set
+			*	here so that nothing is echoed before the session opens the
+			*	port.
+			*/
+			struct termios	tio;
+			if (tcgetattr(outFD, &tio) == 0)
+			{
+				cfmakeraw(&tio);
+				tcsetattr(outFD, TCSANOW, &tio);
+			}
+			return(true);
+		}
+		close(outFD);
+	}
+	perror("posix_openpt");
+	return(false);
+}
+
+/*********************************** Usage ************************************/
+static int Usage(void)
+{
+	fprintf(stderr, "Usage:\n"
+		"  SDHexMultiLoad [-j threads] [-b baud] [-t timestamp] path.hex port...\n"
+		"  SDHexMultiLoad [-j threads] -l count path.hex\n");
+	return(2);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	uint32_t	threads = 0;
+	uint32_t	loopbackPorts = 0;
+	int			opt;
+	while ((opt = getopt(argc, argv, "j:b:t:l:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'j':
+				threads = strtoul(optarg, nullptr, 0);
+				break;
+			case 'b':
+				sBaud = strtoul(optarg, nullptr, 0);
+				break;
+			case 't':
+				sTimestamp = strtoul(optarg, nullptr, 0);
+				break;
+			case 'l':
+				loopbackPorts = strtoul(optarg, nullptr, 0);
+				break;
+			default:
+				return(Usage());
+		}
+	}
+	if (optind >= argc ||
+		(loopbackPorts == 0 && (optind + 1) >= argc))
+	{
+		return(Usage());
+	}
+	sHexPath = argv[optind++];
+	/*
+	*	The config is read here for the baud rate and the simulated target's
+	*	signature.  SDHexSession::begin reads it again for each session.
+	*/
+	size_t	pathLen = strlen(sHexPath);
+	if (pathLen < 4)
+	{
+		return(Usage());
+	}
+	std::vector<char>	configPath(sHexPath, sHexPath + pathLen + 1);
+	strcpy(&configPath[pathLen-3], "txt");
+	AVRConfig	avrConfig;
+	if (!avrConfig.ReadFile(configPath.data()))
+	{
+		fprintf(stderr, "Unable to read the config %s\n", configPath.data());
+		return(1);
+	}
+	if (sBaud == 0)
+	{
+		sBaud = avrConfig.Config().uploadSpeed;
+	}
+
+	std::vector<std::thread>	targets;
+	std::vector<std::vector<char> >	loopbackPaths(loopbackPorts, std::vector<char>(64));
+	for (uint32_t i = 0; i < loopbackPorts; i++)
+	{
+		int	fd;
+		if (!OpenLoopbackPort(fd, loopbackPaths[i].data(), loopbackPaths[i].size()))
+		{
+			return(1);
+		}
+		targets.push_back(std::thread(SimulatedTarget, fd, &avrConfig.Config()));
+		SPortJob	job = {loopbackPaths[i].data()};
+		sJobs.push_back(job);
+	}
+	for (; optind < argc; optind++)
+	{
+		SPortJob	job = {argv[optind]};
+		sJobs.push_back(job);
+	}
+
+	if (threads == 0 || threads > sJobs.size())
+	{
+		threads = sJobs.size();
+	}
+	std::vector<std::thread>	workers;
+	for (uint32_t i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread(Worker));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	/*
+	*	A simulated target that was cut off mid command blocks in
+	*	AVRStreamISP::read(), so the targets are detached rather than joined.
+	*/
+	sStopTargets = true;
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		targets[i].detach();
+	}
+
+	uint32_t	passed = 0;
+	for (size_t i = 0; i < sJobs.size(); i++)
+	{
+		const SPortJob&	job = sJobs[i];
+		if (!job.opened)
+		{
+			printf("%s: not opened\n", job.path);
+		} else if (job.error)
+		{
+			printf("%s: FAILED, error %hhu after %u bytes, %u ms\n", job.path,
+				job.error, job.bytesProcessed, job.milliseconds);
+		} else
+		{
+			passed++;
+			printf("%s: passed, %u bytes, %u ms", job.path, job.bytesProcessed,
+				job.milliseconds);
+			if (job.retryCount)
+			{
+				printf(", %hhu pages rewritten", job.retryCount);
+			#ifdef SUPPORT_VERIFY_RETRY
+				printf(" at");
+				for (uint8_t i = 0; i < job.retryCount && i < RETRIED_PAGES_SIZE; i++)
+				{
+					printf(" 0x%X", job.retriedPages[i]);
+				}
+				if (job.retryCount > RETRIED_PAGES_SIZE)
+				{
+					printf(" ...");
+				}
+			#endif
+			}
+			printf("\n");
+		}
+	}
+	printf("%u of %zu passed\n", passed, sJobs.size());
+	return(passed == sJobs.size() ? 0 : 1);
+}
@@ -0,0 +1,650 @@
+/*
+*	SDMaster.cpp, Copyright Jonathan Mackey 2020
+*	Masters a production SD card from a project tree.  Every flash image (hex,
+*	elf, s19/s28/s37, bin or lzs), eep and rcp file with a sibling config
+*	(.txt) is validated using the same record rules and AVRConfig code as the
+*	loader.  The files are processed in parallel.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		SDMaster [-j threads] project_dir sd_dir
+*
+*	The hex files are decoded by HexImage, checked against IntelHexFile by
+*	HostTools/HexDecodeBench.  Files of at least 512KB are also split into
+*	chunks decoded in parallel.  The other flash images are read by the
+*	loader's own ImageSource readers and checked by ImagePreflight, so they
+*	have to fit in the application section of the config, and an elf file's
+*	EEPROM in the EEPROM.
+*
+*	The project tree is searched recursively.  In sd_dir (normally the root of
+*	the card):
+*	- The valid files are copied to the root, as the loader only browses the
+*	  root.  A filename used in more than one folder is an error.
+*	- Each config is copied with byte_count set to the exact number of data
+*	  bytes in its flash image, so the loader never has to estimate the
+*	  length.
+*	- Files in a folder named bootloaders are validated and copied to
+*	  bootloaders.
+*	- catalog.bin lists the valid files, see SDCatalog.h.
+*
+*	Invalid files are reported and left out.  The exit status is 0 when every
+*	file was valid.
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -std=gnu++11 -D__MACH__ -pthread -I. -I../libraries/UnixTime \
+*			-I../libraries/MSPeriod -o SDMaster ../HostTools/SDMaster.cpp \
+*			../HostTools/HexDecoder.cpp ../HostTools/HexImage.cpp \
+*			AVRConfig.cpp BufferArena.cpp ImageSource.cpp IntelHexFile.cpp \
+*			ElfFile.cpp SRecordFile.cpp BinaryFile.cpp LZSSFile.cpp \
+*			ImagePreflight.cpp ../libraries/UnixTime/UnixTime.cpp
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AVRConfig.h"
+#include "BinaryFile.h"
+#include "ElfFile.h"
+#include "HexImage.h"
+#include "ImagePreflight.h"
+#include "LZSSFile.h"
+#include "SDCatalog.h"
+#include "SRecordFile.h"
+
+const uint32_t	kMaxImageSize = 0x100000;	// 20 bit address
+const size_t	kMaxFilenameLen = 49;		// See SDHexLoader::LoadNextHexFilename
+
+struct SSourceFile
+{
+	std::string				path;		// In the project tree
+	std::string				filename;
+	std::string				configPath;	// Empty for bootloaders
+	uint8_t					type;		// ECatalogType
+	bool					isBootloader;
+	bool					valid;
+	std::string				error;
+	SCatalogEntry			entry;
+};
+
+static std::vector<SSourceFile>	sFiles;
+static std::atomic<size_t>		sNextFile;
+static std::string				sSDDir;
+static uint32_t					sThreads;	// Also used to split large files
+
+/********************************** HasSuffix *********************************/
+static bool HasSuffix(
+	const std::string&	inString,
+	const char*			inSuffix)
+{
+	size_t	suffixLen = strlen(inSuffix);
+	return(inString.size() > suffixLen &&
+		inString.compare(inString.size() - suffixLen, suffixLen, inSuffix) == 0);
+}
+
+/*********************************** CopyFile *********************************/
+static bool CopyFile(
+	const std::string&	inSrcPath,
+	const std::string&	inDstPath)
+{
+	bool	success = false;
+	FILE*	srcFile = fopen(inSrcPath.c_str(), "rb");
+	if (srcFile)
+	{
+		FILE*	dstFile = fopen(inDstPath.c_str(), "wb");
+		if (dstFile)
+		{
+			char	buffer[4096];
+			size_t	bytesRead;
+			success = true;
+			while (success &&
+				(bytesRead = fread(buffer, 1, sizeof(buffer), srcFile)) > 0)
+			{
+				success = fwrite(buffer, 1, bytesRead, dstFile) == bytesRead;
+			}
+			success = fclose(dstFile) == 0 && success;
+		}
+		fclose(srcFile);
+	}
+	return(success);
+}
+
+/******************************** IsFlashImage ********************************/
+static bool IsFlashImage(
+	uint8_t	inType)
+{
+	return(inType != eCatalogEEP && inType != eCatalogRecipe);
+}
+
+/******************************* CollectFiles *********************************/
+/*
+*	Recursively finds the flash image, eep and rcp files with a sibling
+*	config, and the bootloaders.  The extensions are those of
+*	SDHexLoader::LoadNextHexFilename.
+*/
+static void CollectFiles(
+	const std::string&	inDir)
+{
+	DIR*	dir = opendir(inDir.c_str());
+	if (!dir)
+	{
+		perror(inDir.c_str());
+		return;
+	}
+	bool	isBootloaderDir = HasSuffix(inDir, "/bootloaders");
+	std::vector<std::string>	subdirs;
+	struct dirent*	dirEntry;
+	while ((dirEntry = readdir(dir)) != nullptr)
+	{
+		std::string	filename(dirEntry->d_name);
+		if (filename[0] == '.')
+		{
+			continue;
+		}
+		std::string	path = inDir + "/" + filename;
+		struct stat	status;
+		if (stat(path.c_str(), &status) != 0)
+		{
+			continue;
+		}
+		if (S_ISDIR(status.st_mode))
+		{
+			subdirs.push_back(path);
+			continue;
+		}
+		SSourceFile	file;
+		file.path = path;
+		file.filename = filename;
+		file.isBootloader = isBootloaderDir;
+		file.valid = false;
+		memset(&file.entry, 0, sizeof(file.entry));
+		if (isBootloaderDir)
+		{
+			if (filename[0] != 'B' ||
+				!HasSuffix(filename, ".hex"))
+			{
+				continue;
+			}
+			file.type = eCatalogHex;
+		} else
+		{
+			if (HasSuffix(filename, ".hex"))
+			{
+				file.type = eCatalogHex;
+			} else if (HasSuffix(filename, ".eep"))
+			{
+				file.type = eCatalogEEP;
+			} else if (HasSuffix(filename, ".rcp"))
+			{
+				file.type = eCatalogRecipe;
+			} else if (HasSuffix(filename, ".elf"))
+			{
+				file.type = eCatalogElf;
+			} else if (HasSuffix(filename, ".s19") ||
+				HasSuffix(filename, ".s28") ||
+				HasSuffix(filename, ".s37"))
+			{
+				file.type = eCatalogSRecord;
+			} else if (HasSuffix(filename, ".bin"))
+			{
+				file.type = eCatalogBinary;
+			} else if (HasSuffix(filename, ".lzs"))
+			{
+				file.type = eCatalogLZSS;
+			} else
+			{
+				continue;
+			}
+			file.configPath = path.substr(0, path.size() - 3) + "txt";
+			if (access(file.configPath.c_str(), R_OK) != 0)
+			{
+				continue;	// Not a loader file
+			}
+		}
+		sFiles.push_back(file);
+	}
+	closedir(dir);
+	for (size_t i = 0; i < subdirs.size(); i++)
+	{
+		CollectFiles(subdirs[i]);
+	}
+}
+
+/********************************* DecodeHex **********************************/
+/*
+*	Reads every record of the hex file.  Returns the exact number of data
+*	bytes.
+*/
+static bool DecodeHex(
+	SSourceFile&	ioFile,
+	uint32_t		inMemorySize,
+	uint32_t&		outByteCount)
+{
+	HexImage	hexImage;
+	if (!hexImage.Read(ioFile.path.c_str(), inMemorySize, sThreads))
+	{
+		char	error[64];
+		switch (hexImage.Error())
+		{
+			case HexImage::eOpenErr:
+				snprintf(error, sizeof(error), "unable to open");
+				break;
+			case HexImage::eExceedsMemoryErr:
+				snprintf(error, sizeof(error), "data at 0x%X exceeds the memory size",
+					hexImage.ErrorAddress());
+				break;
+			default:
+				snprintf(error, sizeof(error), "invalid record %u", hexImage.ErrorRecord());
+				break;
+		}
+		ioFile.error = error;
+		return(false);
+	}
+	outByteCount = hexImage.ByteCount();
+	return(true);
+}
+
+/******************************* PreflightImage *******************************/
+/*
+*	Checks the selected memory of an open image the way SDHexSession does
+*	before a session, see ImagePreflight.h.  inImage is an
+*	ImagePreflight::EImage.
+*/
+static bool PreflightImage(
+	SSourceFile&		ioFile,
+	const SAVRConfig&	inConfig,
+	ImageSource&		inSource,
+	uint8_t				inImage,
+	uint32_t&			outByteCount)
+{
+	ImagePreflight	preflight;
+	const char*		memory = inImage == ImagePreflight::eEEPROM ? "EEPROM" : "flash";
+	char			error[64];
+	if (!preflight.begin(inSource))
+	{
+		snprintf(error, sizeof(error), "invalid %s records", memory);
+	} else if (!preflight.FitsIn(inConfig, inImage))
+	{
+		snprintf(error, sizeof(error), "%s data to 0x%X exceeds the memory size",
+			memory, preflight.EndAddress());
+	} else
+	{
+		outByteCount = preflight.ByteCount();
+		return(true);
+	}
+	ioFile.error = error;
+	return(false);
+}
+
+/********************************* ReadImage **********************************/
+/*
+*	Reads an elf, S-record, bin or lzs file with the loader's reader for its
+*	format.  Returns the exact number of flash data bytes.  Each thread has
+*	its own BufferArena, so the readers can run in parallel.
+*/
+static bool ReadImage(
+	SSourceFile&		ioFile,
+	const SAVRConfig&	inConfig,
+	uint32_t&			outByteCount)
+{
+	ElfFile			elfFile;
+	SRecordFile		sRecordFile;
+	BinaryFile		binaryFile;
+	LZSSFile		lzssFile;
+	ImageSource*	image;
+	switch (ioFile.type)
+	{
+		case eCatalogElf:
+			image = &elfFile;
+			break;
+		case eCatalogSRecord:
+			image = &sRecordFile;
+			break;
+		case eCatalogBinary:
+			binaryFile.SetBaseAddress(inConfig.binAddress);
+			image = &binaryFile;
+			break;
+		default:
+			image = &lzssFile;
+			break;
+	}
+	bool	success = image->begin(ioFile.path.c_str());
+	if (success)
+	{
+		success = PreflightImage(ioFile, inConfig, *image,
+							ImagePreflight::eApplication, outByteCount);
+		if (success &&
+			ioFile.type == eCatalogElf)
+		{
+			uint32_t	eepromByteCount;
+			elfFile.SelectMemory(ElfFile::eEEPROMMemory);
+			success = PreflightImage(ioFile, inConfig, *image,
+							ImagePreflight::eEEPROM, eepromByteCount);
+		}
+	} else
+	{
+		ioFile.error = ioFile.type == eCatalogElf ? "not an ELF32 file" :
+			(ioFile.type == eCatalogLZSS ? "not an LZSS file" : "unable to open");
+	}
+	image->end();
+	return(success);
+}
+
+/********************************* ProcessFile ********************************/
+static void ProcessFile(
+	SSourceFile&	ioFile)
+{
+	SCatalogEntry&	entry = ioFile.entry;
+	uint32_t		memorySize = kMaxImageSize;
+	if (!ioFile.isBootloader)
+	{
+		if (ioFile.filename.size() > kMaxFilenameLen)
+		{
+			ioFile.error = "filename is too long";
+			return;
+		}
+		for (size_t i = 0; i < ioFile.filename.size(); i++)
+		{
+			if ((uint8_t)ioFile.filename[i] >= 0x80)
+			{
+				ioFile.error = "filename isn't ASCII";
+				return;
+			}
+		}
+		AVRConfig	avrConfig;
+		if (!avrConfig.ReadFile(ioFile.configPath.c_str()))
+		{
+			ioFile.error = "invalid config";
+			return;
+		}
+		const SAVRConfig&	config = avrConfig.Config();
+		entry.uploadSpeed = config.uploadSpeed;
+		memcpy(entry.signature, config.signature, 3);
+		snprintf(entry.desc, sizeof(entry.desc), "%.*s", (int)sizeof(config.desc), config.desc);
+		strcpy(entry.filename, ioFile.filename.c_str());
+		entry.type = ioFile.type;
+		/*
+		*	The displayed name, as in SDHexLoader::LoadNextHexFilename
+		*/
+		size_t	nameLen = ioFile.filename.size() - 4;
+		if (nameLen > 4 &&
+			ioFile.filename.compare(nameLen - 4, 4, ".ino") == 0)
+		{
+			nameLen -= 4;
+		}
+		nameLen = std::min(nameLen, sizeof(entry.name) - 1);
+		memcpy(entry.name, ioFile.filename.c_str(), nameLen);
+		if (ioFile.type == eCatalogHex)
+		{
+			memorySize = config.flashSize ? config.flashSize : kMaxImageSize;
+		} else if (ioFile.type == eCatalogEEP)
+		{
+			memorySize = config.eepromSize ? config.eepromSize : kMaxImageSize;
+		}
+		if (ioFile.type != eCatalogHex &&
+			IsFlashImage(ioFile.type))
+		{
+			ioFile.valid = ReadImage(ioFile, config, entry.byteCount);
+			return;
+		}
+	}
+	if (ioFile.type != eCatalogRecipe &&
+		!DecodeHex(ioFile, memorySize, entry.byteCount))
+	{
+		return;
+	}
+	ioFile.valid = true;
+}
+
+/*********************************** Worker ***********************************/
+static void Worker(void)
+{
+	size_t	fileIndex;
+	while ((fileIndex = sNextFile++) < sFiles.size())
+	{
+		ProcessFile(sFiles[fileIndex]);
+	}
+}
+
+/********************************* WriteConfig ********************************/
+/*
+*	Copies the config, replacing any byte_count with inByteCount when it's
+*	non-zero.
+*/
+static bool WriteConfig(
+	const std::string&	inSrcPath,
+	const std::string&	inDstPath,
+	uint32_t			inByteCount)
+{
+	bool	success = false;
+	FILE*	srcFile = fopen(inSrcPath.c_str(), "r");
+	if (srcFile)
+	{
+		FILE*	dstFile = fopen(inDstPath.c_str(), "w");
+		if (dstFile)
+		{
+			char	line[256];
+			bool	endsWithNewline = true;
+			success = true;
+			while (fgets(line, sizeof(line), srcFile))
+			{
+				if (inByteCount &&
+					strncmp(line, "byte_count", 10) == 0)
+				{
+					continue;
+				}
+				size_t	lineLen = strlen(line);
+				endsWithNewline = lineLen && line[lineLen-1] == '\n';
+				success = success && fputs(line, dstFile) >= 0;
+			}
+			if (inByteCount)
+			{
+				success = success && fprintf(dstFile, "%sbyte_count=%u\n",
+								endsWithNewline ? "" : "\n", inByteCount) > 0;
+			}
+			success = fclose(dstFile) == 0 && success;
+		}
+		fclose(srcFile);
+	}
+	return(success);
+}
+
+/******************************** WriteOutput *********************************/
+/*
+*	Copies the valid files, writes the configs and catalog.
+*/
+static bool WriteOutput(
+	std::vector<SSourceFile*>&	inEntries)
+{
+	bool	success = true;
+	mkdir(sSDDir.c_str(), 0777);
+	mkdir((sSDDir + "/bootloaders").c_str(), 0777);
+	std::vector<std::string>	configsWritten;
+	for (size_t i = 0; i < sFiles.size(); i++)
+	{
+		SSourceFile&	file = sFiles[i];
+		if (!file.valid)
+		{
+			continue;
+		}
+		std::string	dstPath = sSDDir + (file.isBootloader ? "/bootloaders/" : "/") +
+								file.filename;
+		if (!CopyFile(file.path, dstPath))
+		{
+			fprintf(stderr, "%s: write failed\n", dstPath.c_str());
+			success = false;
+			continue;
+		}
+		if (file.isBootloader)
+		{
+			continue;
+		}
+		inEntries.push_back(&file);
+		/*
+		*	A flash image, its eep file and recipe share the config.  The
+		*	byte_count is that of the flash image.
+		*/
+		if (std::find(configsWritten.begin(), configsWritten.end(),
+				file.configPath) == configsWritten.end())
+		{
+			configsWritten.push_back(file.configPath);
+			uint32_t	byteCount = 0;
+			for (size_t j = 0; j < sFiles.size(); j++)
+			{
+				if (sFiles[j].valid &&
+					IsFlashImage(sFiles[j].type) &&
+					sFiles[j].configPath == file.configPath)
+				{
+					byteCount = sFiles[j].entry.byteCount;
+				}
+			}
+			std::string	configFilename = file.filename.substr(0, file.filename.size() - 3) + "txt";
+			if (!WriteConfig(file.configPath, sSDDir + "/" + configFilename, byteCount))
+			{
+				fprintf(stderr, "%s: write failed\n", configFilename.c_str());
+				success = false;
+			}
+		}
+	}
+	return(success);
+}
+
+/******************************** WriteCatalog ********************************/
+static bool CompareEntries(
+	const SSourceFile*	inFile1,
+	const SSourceFile*	inFile2)
+{
+	return(inFile1->filename < inFile2->filename);
+}
+
+static bool WriteCatalog(
+	std::vector<SSourceFile*>&	inEntries)
+{
+	std::sort(inEntries.begin(), inEntries.end(), CompareEntries);
+	std::string	path = sSDDir + "/" SD_CATALOG_PATH;
+	FILE*	catalogFile = fopen(path.c_str(), "wb");
+	bool	success = catalogFile != nullptr;
+	if (success)
+	{
+		SCatalogHeader	header;
+		memcpy(header.magic, SD_CATALOG_MAGIC, 4);
+		header.version = SD_CATALOG_VERSION;
+		header.count = inEntries.size();
+		success = fwrite(&header, sizeof(header), 1, catalogFile) == 1;
+		for (size_t i = 0; success && i < inEntries.size(); i++)
+		{
+			success = fwrite(&inEntries[i]->entry, sizeof(SCatalogEntry), 1, catalogFile) == 1;
+		}
+		success = fclose(catalogFile) == 0 && success;
+	}
+	if (!success)
+	{
+		fprintf(stderr, "%s: write failed\n", path.c_str());
+	}
+	return(success);
+}
+
+/*********************************** Usage ************************************/
+static int Usage(void)
+{
+	fprintf(stderr, "Usage: SDMaster [-j threads] project_dir sd_dir\n");
+	return(2);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	uint32_t	threads = std::thread::hardware_concurrency();
+	int			opt;
+	while ((opt = getopt(argc, argv, "j:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'j':
+				threads = strtoul(optarg, nullptr, 0);
+				break;
+			default:
+				return(Usage());
+		}
+	}
+	if ((optind + 2) != argc)
+	{
+		return(Usage());
+	}
+	std::string	projectDir(argv[optind]);
+	sSDDir = argv[optind + 1];
+	CollectFiles(projectDir);
+
+	/*
+	*	All of the files end up in the same folder on the card.
+	*/
+	uint32_t	invalidCount = 0;
+	for (size_t i = 0; i < sFiles.size(); i++)
+	{
+		for (size_t j = i + 1; j < sFiles.size(); j++)
+		{
+			if (sFiles[i].isBootloader == sFiles[j].isBootloader &&
+				sFiles[i].filename == sFiles[j].filename)
+			{
+				fprintf(stderr, "%s: also in %s\n", sFiles[j].path.c_str(),
+					sFiles[i].path.c_str());
+				sFiles[j].error = "duplicate filename";
+			}
+		}
+	}
+
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+	sThreads = threads;
+	std::vector<std::thread>	workers;
+	for (uint32_t i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread(Worker));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	for (size_t i = 0; i < sFiles.size(); i++)
+	{
+		SSourceFile&	file = sFiles[i];
+		if (file.error.size())
+		{
+			file.valid = false;
+			invalidCount++;
+			fprintf(stderr, "%s: %s\n", file.path.c_str(), file.error.c_str());
+		}
+	}
+
+	std::vector<SSourceFile*>	entries;
+	bool	success = WriteOutput(entries) && WriteCatalog(entries);
+	printf("%zu cataloged, %u invalid\n", entries.size(), invalidCount);
+	return(success && invalidCount == 0 ? 0 : 1);
+}
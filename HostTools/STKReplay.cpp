@@ -0,0 +1,495 @@
+/*
+*	STKReplay.cpp, Copyright Jonathan Mackey 2020
+*	Replays an STK500 trace recorded by STKTrace (SUPPORT_STK_TRACE) against
+*	the __MACH__ (host) build of SDHexSession or AVRStreamISP.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		STKReplay -i [-l ms] trace.stk
+*			The recorded commands are fed to AVRStreamISP and its responses
+*			are compared to the recorded responses.  Use this for traces of
+*			USB pass-through sessions.  Note that the host AVRStreamISP only
+*			simulates flash, so signature, fuse and EEPROM reads will differ.
+*
+*		STKReplay -s [-f] [-t timestamp] [-l ms] trace.stk path.hex
+*			The recorded responses are fed to SDHexSession and the commands it
+*			generates are compared to the recorded commands.  Use this for
+*			traces of SD sessions.  path.hex and its config must be the same
+*			files used when the trace was recorded.  -f sets the fuses and
+*			bootloader, -t is the timestamp passed to SDHexSession::begin.
+*
+*		In both modes -l reports every response that took longer than ms to
+*		arrive when recorded (default 500).
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -std=gnu++11 -D__MACH__ -I. -I../libraries/UnixTime \
+*			-I../libraries/MSPeriod -o STKReplay ../HostTools/STKReplay.cpp \
+*			SDHexSession.cpp AVRStreamISP.cpp AVRConfig.cpp IntelHexFile.cpp \
+*			IntelHexWriter.cpp ContextualStream.cpp CRC32.cpp BufferArena.cpp \
+*			HexRunIndex.cpp ImageSource.cpp ElfFile.cpp SRecordFile.cpp \
+*			BinaryFile.cpp LZSSFile.cpp ImagePreflight.cpp \
+*			../libraries/UnixTime/UnixTime.cpp
+*
+*	The exit status is 0 when the replay matched the trace.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "SDHexSession.h"
+#include "AVRStreamISP.h"
+#include "STKTrace.h"
+#include "BufferArena.h"
+
+const uint32_t	kMaxIdleUpdates = 1000000;	// Session Updates without traffic
+const uint8_t	kMaxReportedMismatches = 20;
+
+struct SFrame
+{
+	uint8_t					type;		// STKTrace::EChunkType
+	bool					truncated;	// Chunks were dropped (eOverflow)
+	uint32_t				micros;		// Of the first chunk
+	std::vector<uint8_t>	data;
+};
+
+/******************************** ReplayStream ********************************/
+/*
+*	Stands in for the serial port.  AVRStreamISP::read() spins until a byte is
+*	available, so reading past the end of the input while an Update is in
+*	progress means the recorded command was shorter than AVRStreamISP expected.
+*/
+class ReplayStream : public ContextualStream
+{
+public:
+							ReplayStream(void)
+								: mInputIndex(0), mInUpdate(false){}
+	void					SetInput(
+								const std::vector<uint8_t>&	inInput)
+								{mInput = inInput; mInputIndex = 0; mOutput.clear();}
+	void					SetInUpdate(
+								bool					inInUpdate)
+								{mInUpdate = inInUpdate;}
+	const std::vector<uint8_t>&	Output(void) const
+								{return(mOutput);}
+	virtual int				available(void)
+							{
+								int	available = (int)(mInput.size() - mInputIndex);
+								if (!available && mInUpdate)
+								{
+									fprintf(stderr, "AVRStreamISP read past the end of the command\n");
+									exit(2);
+								}
+								return(available);
+							}
+	virtual int				read(void)
+								{return(mInputIndex < mInput.size() ? mInput[mInputIndex++] : -1);}
+	virtual int				peek(void)
+								{return(mInputIndex < mInput.size() ? mInput[mInputIndex] : -1);}
+	virtual size_t			write(
+								uint8_t					inByte)
+								{mOutput.push_back(inByte); return(1);}
+	virtual size_t			write(
+								const uint8_t*			inBuffer,
+								size_t					inLength)
+								{mOutput.insert(mOutput.end(), inBuffer, inBuffer + inLength); return(inLength);}
+	virtual void			flush(void){}
+protected:
+	std::vector<uint8_t>	mInput;
+	size_t					mInputIndex;
+	std::vector<uint8_t>	mOutput;
+	bool					mInUpdate;
+};
+
+/******************************** ReplaySession *******************************/
+/*
+*	Exposes the session's ContextualStream so that the replay can play the
+*	role of AVRStreamISP.
+*/
+class ReplaySession : public SDHexSession
+{
+public:
+	ContextualStream&		GetContextualStream(void)
+								{return(mContextualStream);}
+	const SAVRConfig&		GetConfig(void) const
+								{return(mConfig);}
+};
+
+static uint32_t	sMismatches;
+static uint32_t	sSlowResponses;
+static uint32_t	sSlowThreshold = 500000;	// microseconds
+
+/********************************* ReadTrace **********************************/
+/*
+*	Reassembles the chunks of the trace into frames.
+*/
+static bool ReadTrace(
+	const char*				inPath,
+	std::vector<SFrame>&	outFrames)
+{
+	FILE*	file = fopen(inPath, "rb");
+	if (!file)
+	{
+		fprintf(stderr, "Unable to open %s\n", inPath);
+		return(false);
+	}
+	uint8_t	header[STK_TRACE_HEADER_SIZE];
+	while (fread(header, 1, sizeof(header), file) == sizeof(header))
+	{
+		uint8_t		type = header[0] & ~STKTrace::eContinued;
+		uint32_t	micros = header[1] | (header[2] << 8) |
+							(header[3] << 16) | ((uint32_t)header[4] << 24);
+		uint8_t		length = header[5];
+		if (type == STKTrace::eOverflow)
+		{
+			if (outFrames.size())
+			{
+				outFrames.back().truncated = true;
+			}
+			continue;
+		}
+		if (type != STKTrace::eCommandFrame &&
+			type != STKTrace::eResponseFrame)
+		{
+			fprintf(stderr, "Invalid chunk type 0x%02X\n", header[0]);
+			break;
+		}
+		if ((header[0] & STKTrace::eContinued) == 0 ||
+			outFrames.size() == 0 ||
+			outFrames.back().type != type)
+		{
+			SFrame	frame;
+			frame.type = type;
+			frame.truncated = false;
+			frame.micros = micros;
+			outFrames.push_back(frame);
+		}
+		std::vector<uint8_t>&	data = outFrames.back().data;
+		size_t	offset = data.size();
+		data.resize(offset + length);
+		if (fread(&data[offset], 1, length, file) != length)
+		{
+			fprintf(stderr, "Trace ends mid chunk\n");
+			outFrames.back().truncated = true;
+			break;
+		}
+	}
+	fclose(file);
+	return(true);
+}
+
+/******************************* CompareFrame *********************************/
+static bool CompareFrame(
+	size_t						inFrameIndex,
+	const char*					inWhat,
+	const std::vector<uint8_t>&	inExpected,
+	const uint8_t*				inActual,
+	size_t						inActualLength)
+{
+	bool	matched = inExpected.size() == inActualLength &&
+				memcmp(inExpected.data(), inActual, inActualLength) == 0;
+	if (!matched)
+	{
+		sMismatches++;
+		if (sMismatches <= kMaxReportedMismatches)
+		{
+			fprintf(stderr, "Frame %zu: %s mismatch\n  recorded:", inFrameIndex, inWhat);
+			for (size_t i = 0; i < inExpected.size(); i++)
+			{
+				fprintf(stderr, " %02X", inExpected[i]);
+			}
+			fprintf(stderr, "\n  replayed:");
+			for (size_t i = 0; i < inActualLength; i++)
+			{
+				fprintf(stderr, " %02X", inActual[i]);
+			}
+			fprintf(stderr, "\n");
+		}
+	}
+	return(matched);
+}
+
+/******************************** CheckTiming *********************************/
+/*
+*	Reports the recorded latency of the response frame at inFrameIndex.
+*/
+static void CheckTiming(
+	const std::vector<SFrame>&	inFrames,
+	size_t						inFrameIndex)
+{
+	if (inFrameIndex > 0)
+	{
+		uint32_t	latency = inFrames[inFrameIndex].micros -
+								inFrames[inFrameIndex-1].micros;
+		if (latency > sSlowThreshold)
+		{
+			sSlowResponses++;
+			fprintf(stderr, "Frame %zu: response took %u ms\n", inFrameIndex,
+					latency/1000);
+		}
+	}
+}
+
+/********************************* ReplayISP **********************************/
+/*
+*	Each recorded command is fed to AVRStreamISP and the response it generates
+*	is compared to the recorded response.
+*/
+static size_t ReplayISP(
+	const std::vector<SFrame>&	inFrames)
+{
+	ReplayStream	stream;
+	AVRStreamISP	avrStreamISP;
+	BufferArena::Begin(BufferArena::eUSBPhase);
+	avrStreamISP.begin();
+	avrStreamISP.SetStream(&stream);
+	size_t	frameIndex = 0;
+	for (; frameIndex < inFrames.size(); frameIndex++)
+	{
+		const SFrame&	frame = inFrames[frameIndex];
+		if (frame.truncated)
+		{
+			fprintf(stderr, "Frame %zu: truncated, replay stopped\n", frameIndex);
+			break;
+		}
+		if (frame.type == STKTrace::eCommandFrame)
+		{
+			stream.SetInput(frame.data);
+			while (stream.available())
+			{
+				stream.SetInUpdate(true);
+				avrStreamISP.Update();
+				stream.SetInUpdate(false);
+			}
+			/*
+			*	If the response wasn't recorded (the trace ended) THEN
+			*	there's nothing to compare it to.
+			*/
+			if ((frameIndex + 1) < inFrames.size() &&
+				inFrames[frameIndex + 1].type == STKTrace::eResponseFrame)
+			{
+				frameIndex++;
+				CompareFrame(frameIndex, "response", inFrames[frameIndex].data,
+					stream.Output().data(), stream.Output().size());
+				CheckTiming(inFrames, frameIndex);
+			} else if (stream.Output().size())
+			{
+				CompareFrame(frameIndex, "response", std::vector<uint8_t>(),
+					stream.Output().data(), stream.Output().size());
+			}
+		} else
+		{
+			fprintf(stderr, "Frame %zu: unexpected response\n", frameIndex);
+			sMismatches++;
+		}
+	}
+	avrStreamISP.Halt();
+	return(frameIndex);
+}
+
+/******************************* ReplaySession ********************************/
+/*
+*	Plays the role of AVRStreamISP.  The commands generated by SDHexSession
+*	are compared to the recorded commands, and the recorded responses are
+*	returned to SDHexSession.  The commands are also passed to a simulated
+*	AVRStreamISP so that CRC verification has flash to read.
+*/
+static size_t ReplaySDSession(
+	const std::vector<SFrame>&	inFrames,
+	const char*					inHexPath,
+	bool						inSetFusesAndBootloader,
+	uint32_t					inTimestamp,
+	uint8_t&					outError)
+{
+	ReplaySession	session;
+	AVRStreamISP	avrStreamISP;
+	ReplayStream	shadowStream;
+	std::vector<uint8_t>	command;
+	size_t		frameIndex = 0;
+	uint32_t	idleUpdates = 0;
+
+	BufferArena::Begin(BufferArena::eISPLoadPhase);
+	avrStreamISP.begin();
+	if (!session.begin(inHexPath, nullptr, &avrStreamISP,
+			inSetFusesAndBootloader, inTimestamp))
+	{
+		fprintf(stderr, "SDHexSession::begin failed, error %hhu\n", session.Error());
+		outError = session.Error();
+		return(0);
+	}
+	avrStreamISP.SetStream(&shadowStream);
+	avrStreamISP.SetAVRConfig(session.GetConfig());
+	ContextualStream&	stream = session.GetContextualStream();
+	/*
+	*	begin() leaves the first command in the stream, so AVRStreamISP's role
+	*	is played before each session Update, as in SDHexLoader::Update.
+	*/
+	while (true)
+	{
+		bool	traffic = false;
+		while (stream.available())
+		{
+			command.push_back(stream.read());
+			traffic = true;
+		}
+		while (frameIndex < inFrames.size() &&
+			inFrames[frameIndex].type == STKTrace::eCommandFrame &&
+			!inFrames[frameIndex].truncated &&
+			command.size() >= inFrames[frameIndex].data.size())
+		{
+			const SFrame&	frame = inFrames[frameIndex];
+			CompareFrame(frameIndex, "command", frame.data, command.data(),
+				frame.data.size());
+			command.erase(command.begin(), command.begin() + frame.data.size());
+			shadowStream.SetInput(frame.data);
+			while (shadowStream.available())
+			{
+				shadowStream.SetInUpdate(true);
+				avrStreamISP.Update();
+				shadowStream.SetInUpdate(false);
+			}
+			frameIndex++;
+			if (frameIndex < inFrames.size() &&
+				inFrames[frameIndex].type == STKTrace::eResponseFrame &&
+				!inFrames[frameIndex].truncated)
+			{
+				const SFrame&	response = inFrames[frameIndex];
+				stream.write(response.data.data(), response.data.size());
+				CheckTiming(inFrames, frameIndex);
+				frameIndex++;
+			}
+		}
+		/*
+		*	If the session sent a command that can't be matched THEN
+		*	the replay can't continue.
+		*/
+		if (command.size() &&
+			(frameIndex >= inFrames.size() ||
+			 inFrames[frameIndex].truncated ||
+			 inFrames[frameIndex].type != STKTrace::eCommandFrame))
+		{
+			if (frameIndex < inFrames.size())
+			{
+				fprintf(stderr, "Frame %zu: %s, replay stopped\n", frameIndex,
+					inFrames[frameIndex].truncated ? "truncated" : "unexpected response");
+			} else
+			{
+				fprintf(stderr, "Trace ended before the session completed\n");
+			}
+			break;
+		}
+		if (!session.Update())
+		{
+			break;
+		}
+		/*
+		*	CRC verification and command delays generate no traffic for
+		*	several Updates, but a session shouldn't wait forever.
+		*/
+		idleUpdates = traffic ? 0 : (idleUpdates + 1);
+		if (idleUpdates > kMaxIdleUpdates)
+		{
+			fprintf(stderr, "Frame %zu: session stalled\n", frameIndex);
+			sMismatches++;
+			break;
+		}
+	}
+	if (command.size())
+	{
+		CompareFrame(frameIndex, "command", std::vector<uint8_t>(),
+			command.data(), command.size());
+	} else if (frameIndex < inFrames.size())
+	{
+		fprintf(stderr, "%zu recorded frames weren't replayed\n",
+			inFrames.size() - frameIndex);
+		sMismatches++;
+	}
+	outError = session.Error();
+	session.Halt();
+	return(frameIndex);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	bool		replayISP = false;
+	bool		replaySession = false;
+	bool		setFusesAndBootloader = false;
+	uint32_t	timestamp = 0;
+	int			opt;
+	while ((opt = getopt(argc, argv, "isft:l:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'i':
+				replayISP = true;
+				break;
+			case 's':
+				replaySession = true;
+				break;
+			case 'f':
+				setFusesAndBootloader = true;
+				break;
+			case 't':
+				timestamp = (uint32_t)strtoul(optarg, nullptr, 0);
+				break;
+			case 'l':
+				sSlowThreshold = (uint32_t)strtoul(optarg, nullptr, 0) * 1000;
+				break;
+			default:
+				replayISP = replaySession;	// Force usage
+				break;
+		}
+	}
+	if (replayISP == replaySession ||
+		(argc - optind) != (replaySession ? 2 : 1))
+	{
+		fprintf(stderr, "usage: STKReplay -i [-l ms] trace.stk\n"
+						"       STKReplay -s [-f] [-t timestamp] [-l ms] trace.stk path.hex\n");
+		return(2);
+	}
+	std::vector<SFrame>	frames;
+	if (!ReadTrace(argv[optind], frames))
+	{
+		return(2);
+	}
+	size_t	framesReplayed;
+	uint8_t	sessionError = 0;
+	if (replayISP)
+	{
+		framesReplayed = ReplayISP(frames);
+	} else
+	{
+		framesReplayed = ReplaySDSession(frames, argv[optind + 1],
+							setFusesAndBootloader, timestamp, sessionError);
+	}
+	uint32_t	duration = frames.size() ?
+							(frames.back().micros - frames.front().micros) : 0;
+	printf("%zu of %zu frames replayed, %u mismatched, %u slow, recorded %u ms",
+		framesReplayed, frames.size(), sMismatches, sSlowResponses, duration/1000);
+	if (replaySession)
+	{
+		printf(", session error %hhu", sessionError);
+	}
+	printf("\n");
+	return(sMismatches || sessionError ? 1 : 0);
+}
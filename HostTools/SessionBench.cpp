@@ -0,0 +1,145 @@
+/*
+*	SessionBench.cpp, Copyright Jonathan Mackey 2020
+*	Times SD sessions run against the host (__MACH__) build of AVRStreamISP,
+*	i.e. the internal ISP path of SDHexSession with the target simulated.  The
+*	time is that of the session's own code (hex decoding, page assembly and
+*	the page transfers through ContextualStream), nothing is timed on the
+*	target.  The host timing is only a relative measure of changes to that
+*	code, it says nothing about the flash size or speed on the ATmega644.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	Usage:
+*		SessionBench [-r repeats] [-b] path.hex
+*			Loads and verifies path.hex repeats times (default 200) and
+*			reports the fastest session.  path.hex is paired with its config,
+*			path.txt, as on the SD card.  -b verifies by reading back each
+*			page rather than by CRC.
+*
+*	Build from the SDHexLoaderISP folder:
+*		g++ -O2 -std=gnu++11 -D__MACH__ -I. -I../libraries/UnixTime \
+*			-I../libraries/MSPeriod -o SessionBench \
+*			../HostTools/SessionBench.cpp SDHexSession.cpp AVRStreamISP.cpp \
+*			AVRConfig.cpp IntelHexFile.cpp IntelHexWriter.cpp \
+*			ContextualStream.cpp CRC32.cpp BufferArena.cpp HexRunIndex.cpp \
+*			ImageSource.cpp ElfFile.cpp SRecordFile.cpp BinaryFile.cpp \
+*			LZSSFile.cpp ImagePreflight.cpp ../libraries/UnixTime/UnixTime.cpp
+*
+*	The exit status is 0 when every session passed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "SDHexSession.h"
+#include "AVRStreamISP.h"
+#include "BufferArena.h"
+
+/******************************** BenchSession ********************************/
+class BenchSession : public SDHexSession
+{
+public:
+	void					UseByteVerify(void)
+								{mCRCVerify = false;}
+};
+
+/*********************************** Seconds **********************************/
+static double Seconds(void)
+{
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return(now.tv_sec + now.tv_nsec * 1e-9);
+}
+
+/************************************ main ************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	uint32_t	repeats = 200;
+	bool		byteVerify = false;
+	int			opt;
+	while ((opt = getopt(argc, argv, "r:b")) != -1)
+	{
+		switch (opt)
+		{
+			case 'r':
+				repeats = strtoul(optarg, nullptr, 0);
+				break;
+			case 'b':
+				byteVerify = true;
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if ((optind + 1) != argc ||
+		repeats == 0)
+	{
+		fprintf(stderr, "Usage:\n"
+			"  SessionBench [-r repeats] [-b] path.hex\n");
+		return(2);
+	}
+	BufferArena::Begin(BufferArena::eISPLoadPhase);
+	AVRStreamISP*	avrStreamISP = new AVRStreamISP;	// Large simulated flash
+	avrStreamISP->begin();
+	double		fastest = 0;
+	uint32_t	byteCount = 0;
+	for (uint32_t i = 0; i < repeats; i++)
+	{
+		BenchSession*	session = new BenchSession;
+		double			start = Seconds();
+		if (!session->begin(argv[optind], nullptr, avrStreamISP))
+		{
+			fprintf(stderr, "%s: session failed to begin, error %d\n",
+				argv[optind], session->Error());
+			return(1);
+		}
+		if (byteVerify)
+		{
+			session->UseByteVerify();
+		}
+		do
+		{
+			avrStreamISP->Update();
+		} while (session->Update());
+		double	seconds = Seconds() - start;
+		if (session->Error())
+		{
+			fprintf(stderr, "%s: session failed, error %d\n",
+				argv[optind], session->Error());
+			return(1);
+		}
+		byteCount = session->HexByteCount();
+		if (i == 0 ||
+			seconds < fastest)
+		{
+			fastest = seconds;
+		}
+		avrStreamISP->Halt();
+		session->Halt();
+		delete session;
+	}
+	delete avrStreamISP;
+	printf("%u bytes, %s verify, fastest of %u: %.3f ms, %.1f MB/s\n",
+		byteCount, byteVerify ? "read back" : "CRC", repeats,
+		fastest * 1000, byteCount / fastest / 1e6);
+	return(0);
+}
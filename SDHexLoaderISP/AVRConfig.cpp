@@ -36,6 +36,7 @@
 #include "sdios.h"
 #else
 #include <string>
+#include <string.h>
 #define PROGMEM
 #define pgm_read_ptr_near
 #define strcmp_P strcmp
@@ -44,10 +45,12 @@
 /*
 *	The list of desired keys
 */
+const char kBinAddressKeyStr[] PROGMEM = "bin.address";
 const char kBootloaderKeyStr[] PROGMEM = "bootloader";
 const char kByteCountKeyStr[] PROGMEM = "byte_count";
 const char kChipEraseDelayKeyStr[] PROGMEM = "chip_erase_delay";
 const char kDescKeyStr[] PROGMEM = "desc";
+const char kDiffProgramKeyStr[] PROGMEM = "diff_program";
 const char kEepromMinWriteDelayKeyStr[] PROGMEM = "eeprom.min_write_delay";
 const char kEepromPageSizeKeyStr[] PROGMEM = "eeprom.page_size";
 const char kEepromSizeKeyStr[] PROGMEM = "eeprom.size";
@@ -55,21 +58,32 @@ const char kFCPUKeyStr[] PROGMEM = "f_cpu";
 const char kFlashMinWriteDelayKeyStr[] PROGMEM = "flash.min_write_delay";
 const char kFlashPageSizeKeyStr[] PROGMEM = "flash.page_size";
 const char kFlashReadSizeKeyStr[] PROGMEM = "flash.readsize";
+const char kFlashSizeKeyStr[] PROGMEM = "flash.size";
 const char kFusesKeyStr[] PROGMEM = "fuses";
 const char kLockMinWriteDelayKeyStr[] PROGMEM = "lock.min_write_delay";
 const char kLockBitsKeyStr[] PROGMEM = "lock_bits";
+const char kRecipeBootloaderKeyStr[] PROGMEM = "recipe.bootloader";
+const char kRecipeEEPROMKeyStr[] PROGMEM = "recipe.eeprom";
+const char kRecipeFlashKeyStr[] PROGMEM = "recipe.flash";
+const char kRecipeFusesKeyStr[] PROGMEM = "recipe.fuses";
+const char kRecipeLockBitsKeyStr[] PROGMEM = "recipe.lock_bits";
 const char kSignatureKeyStr[] PROGMEM = "signature";
 const char kSTK500DevCodeKeyStr[] PROGMEM = "stk500_devcode";
+const char kSyncIntervalKeyStr[] PROGMEM = "sync.interval";
+const char kSyncWindowKeyStr[] PROGMEM = "sync.window";
 const char kTimestampKeyStr[] PROGMEM = "timestamp";
 const char kUploadMaximumSizeKeyStr[] PROGMEM = "upload.maximum_size";
 const char kUploadSpeedKeyStr[] PROGMEM = "upload.speed";
+const char kVerifyRetriesKeyStr[] PROGMEM = "verify_retries";
 
 const char* const kDesiredConfigKeys[] PROGMEM =
 {	// Sorted alphabetically
+	kBinAddressKeyStr,
 	kBootloaderKeyStr,
 	kByteCountKeyStr,
 	kChipEraseDelayKeyStr,
 	kDescKeyStr,
+	kDiffProgramKeyStr,
 	kEepromMinWriteDelayKeyStr,
 	kEepromPageSizeKeyStr,
 	kEepromSizeKeyStr,
@@ -77,24 +91,35 @@ const char* const kDesiredConfigKeys[] PROGMEM =
 	kFlashMinWriteDelayKeyStr,
 	kFlashPageSizeKeyStr,
 	kFlashReadSizeKeyStr,
+	kFlashSizeKeyStr,
 	kFusesKeyStr,
 	kLockMinWriteDelayKeyStr,
 	kLockBitsKeyStr,
+	kRecipeBootloaderKeyStr,
+	kRecipeEEPROMKeyStr,
+	kRecipeFlashKeyStr,
+	kRecipeFusesKeyStr,
+	kRecipeLockBitsKeyStr,
 	kSignatureKeyStr,
 	kSTK500DevCodeKeyStr,
+	kSyncIntervalKeyStr,
+	kSyncWindowKeyStr,
 	kTimestampKeyStr,
 	kUploadMaximumSizeKeyStr,
-	kUploadSpeedKeyStr
+	kUploadSpeedKeyStr,
+	kVerifyRetriesKeyStr
 };
 
 enum EDesiredKeyIndexes
 {
 	eInvalidKeyIndex,
 	// Must align with kDesiredConfigKeys
+	eBinAddress,
 	eBootloader,
 	eByteCount,
 	eChipEraseDelay,
 	eDesc,
+	eDiffProgram,
 	eEepromMinWriteDelay,
 	eEepromPageSize,
 	eEepromSize,
@@ -102,14 +127,23 @@ enum EDesiredKeyIndexes
 	eFlashMinWriteDelay,
 	eFlashPageSize,
 	eFlashReadSize,
+	eFlashSize,
 	eFuses,
 	eLockMinWriteDelay,
 	eLockBits,
+	eRecipeBootloader,
+	eRecipeEEPROM,
+	eRecipeFlash,
+	eRecipeFuses,
+	eRecipeLockBits,
 	eSignature,
 	eSTK500DevCode,
+	eSyncInterval,
+	eSyncWindow,
 	eTimestamp,
 	eUploadMaximumSize,
-	eUploadSpeed
+	eUploadSpeed,
+	eVerifyRetries
 };
 
 /********************************* AVRConfig **********************************/
@@ -163,6 +197,9 @@ bool AVRConfig::ReadFile(
 							thisChar = ReadUInt32Number(value);
 							switch (keyIndex)
 							{
+								case eBinAddress:
+									mConfig.binAddress = value;
+									break;
 								case eBootloader:
 									mConfig.bootloader = value;
 									break;
@@ -172,6 +209,9 @@ bool AVRConfig::ReadFile(
 								case eChipEraseDelay:
 									mConfig.chipEraseDelay = value;
 									break;
+								case eDiffProgram:
+									mConfig.diffProgram = value != 0;
+									break;
 								case eEepromMinWriteDelay:
 									mConfig.eepromMinWriteDelay = value;
 									break;
@@ -200,6 +240,9 @@ bool AVRConfig::ReadFile(
 								case eFlashReadSize:
 									mConfig.flashReadSize = value;
 									break;
+								case eFlashSize:
+									mConfig.flashSize = value;
+									break;
 								case eLockBits:
 									mConfig.lockBits[0] = value >> 16;
 									mConfig.lockBits[1] = value >> 8;
@@ -208,6 +251,21 @@ bool AVRConfig::ReadFile(
 								case eLockMinWriteDelay:
 									mConfig.lockMinWriteDelay = value;
 									break;
+								case eRecipeBootloader:
+									SetRecipeStep(SAVRConfig::eRecipeBootloader, value);
+									break;
+								case eRecipeEEPROM:
+									SetRecipeStep(SAVRConfig::eRecipeEEPROM, value);
+									break;
+								case eRecipeFlash:
+									SetRecipeStep(SAVRConfig::eRecipeFlash, value);
+									break;
+								case eRecipeFuses:
+									SetRecipeStep(SAVRConfig::eRecipeFuses, value);
+									break;
+								case eRecipeLockBits:
+									SetRecipeStep(SAVRConfig::eRecipeLockBits, value);
+									break;
 								case eSignature:
 									mConfig.signature[0] = value >> 16;
 									mConfig.signature[1] = value >> 8;
@@ -217,6 +275,12 @@ bool AVRConfig::ReadFile(
 								case eSTK500DevCode:
 									mConfig.devcode = value;
 									break;
+								case eSyncInterval:
+									mConfig.syncInterval = value;
+									break;
+								case eSyncWindow:
+									mConfig.syncWindow = value;
+									break;
 								case eTimestamp:
 									mConfig.timestamp = value;
 									break;
@@ -227,6 +291,9 @@ bool AVRConfig::ReadFile(
 									mConfig.uploadSpeed = value;
 									requiredKeyValues++;
 									break;
+								case eVerifyRetries:
+									mConfig.verifyRetries = value;
+									break;
 							}
 						} else
 						{
@@ -251,6 +318,20 @@ bool AVRConfig::ReadFile(
 	return(requiredKeyValues == 5);
 }
 
+/******************************* SetRecipeStep ********************************/
+void AVRConfig::SetRecipeStep(
+	uint8_t		inStep,
+	uint32_t	inValue)
+{
+	if (inValue)
+	{
+		mConfig.recipe |= inStep;
+	} else
+	{
+		mConfig.recipe &= ~inStep;
+	}
+}
+
 /********************************** NextChar **********************************/
 char AVRConfig::NextChar(void)
 {
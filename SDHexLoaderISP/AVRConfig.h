@@ -70,12 +70,37 @@ struct SAVRConfig
 	uint16_t	flashMinWriteDelay;
 	uint16_t	flashPageSize;
 	uint16_t	flashReadSize;
+	uint32_t	flashSize;	// 0 if not specified
 	uint16_t	lockMinWriteDelay;
 	uint16_t	timestamp;
 	uint16_t	bootloader;	// See above
 	uint32_t	uploadMaximumSize;
 	uint32_t	uploadSpeed;
 	uint32_t	byteCount;	// Of related hex file.
+	uint32_t	binAddress;	// Load address of a .bin file, see BinaryFile.h
+	uint8_t		diffProgram;	// Only program pages that differ from the target
+	/*
+	*	Serial bootloader entry, see SDHexSession::UpdateEarlySync().  The
+	*	interval is the time between STK_GET_SYNC attempts, the window is the
+	*	time allowed for the bootloader to respond, both in milliseconds.
+	*	0 = use the default.
+	*/
+	uint8_t		syncInterval;
+	uint16_t	syncWindow;
+	uint8_t		verifyRetries;	// Rewrites per page on a verify mismatch
+	/*
+	*	Steps of a recipe (.rcp) file, see SDHexSession::begin().  The recipe
+	*	keys are only expected in a recipe file.
+	*/
+	enum ERecipe
+	{
+		eRecipeFuses		= 0x01,
+		eRecipeBootloader	= 0x02,
+		eRecipeFlash		= 0x04,
+		eRecipeEEPROM		= 0x08,
+		eRecipeLockBits		= 0x10
+	};
+	uint8_t		recipe;
 };
 
 class AVRConfig
@@ -91,6 +116,9 @@ protected:
 	SAVRConfig	mConfig;
 	
 	char					NextChar(void);
+	void					SetRecipeStep(
+								uint8_t					inStep,
+								uint32_t				inValue);
 	uint8_t					FindKeyIndex(
 								const char*				inKey);
 	char					SkipWhitespace(
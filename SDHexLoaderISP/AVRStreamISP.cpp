@@ -22,6 +22,9 @@
 
 #include "AVRStreamISP.h"
 #include "stk500.h"
+#ifdef SUPPORT_STK500V2
+#include "stk500v2.h"
+#endif
 #ifdef __MACH__
 #include "ContextualStream.h"
 #include <stdio.h>
@@ -29,11 +32,20 @@
 #include <Arduino.h>
 #endif
 #include "AVRConfig.h"
+#include "CRC32.h"
+#include "BufferArena.h"
+
+#ifdef SUPPORT_STK_TRACE
+const char kTracePath[] = "trace.stk";
+#endif
 
 /******************************** AVRStreamISP ********************************/
 AVRStreamISP::AVRStreamISP(void)
-: mInProgMode(false)
+: mBuffer(nullptr), mInProgMode(false)
 {
+#ifndef __MACH__
+	mProbeState = eProbeIdle;
+#endif
 }
 
 /*********************************** begin ************************************/
@@ -64,15 +76,36 @@ void AVRStreamISP::begin(void)
 /*
 *	This should be called before SetAVRConfig.  In addition to setting the
 *	stream, this routine sets up defaults used if SetAVRConfig isn't called.
+*	mBuffer is taken from the BufferArena phase current when a stream is set.
 */
 void AVRStreamISP::SetStream(
 	Stream*		inStream)
 {
 	mStream = inStream;
+	if (inStream)
+	{
+		mBuffer = BufferArena::Region(BufferArena::eISPRegion);
+	}
 	mEEPromPageSize = 4;
-#ifndef __MACH__
+#ifdef SUPPORT_STK_TRACE
+	if (inStream)
+	{
+		mTrace.begin(kTracePath);
+	} else
+	{
+		mTrace.end();
+	}
+#endif
+#ifdef SUPPORT_STK500V2
+	mLoadExtAddress = false;
+	mExtAddressPending = false;
+#endif
+#ifdef __MACH__
+	mBaseAddress = 0;
+	mSinglePageWrites = false;
+#else
 //	mEEPromMinWriteDelay = 4500;	// default
-//	mFlashMinWriteDelay = 4500;		// default
+	mFlashMinWriteDelay = 4500;		// default
 #endif
 #ifdef DEBUG_AVR_STREAM
 	mReceiving = false;
@@ -124,7 +157,7 @@ void AVRStreamISP::SetAVRConfig(
 	memcpy(mSignature, inAVRConfig.signature, 3);
 #else
 //	mEEPromMinWriteDelay = inAVRConfig.eepromMinWriteDelay;
-//	mFlashMinWriteDelay = inAVRConfig.flashMinWriteDelay;
+	mFlashMinWriteDelay = inAVRConfig.flashMinWriteDelay;
 	SetSPIClock(inAVRConfig.fCPU);
 #endif
 }
@@ -194,6 +227,15 @@ void AVRStreamISP::ResetError(
 /************************************ Halt ************************************/
 void AVRStreamISP::Halt(void)
 {
+#ifndef __MACH__
+	// Release a target left in reset by an unfinished probe.
+	if (mProbeState != eProbeIdle)
+	{
+		BeginTransaction();	// LeaveProgMode ends it
+		LeaveProgMode();
+		mProbeState = eProbeIdle;
+	}
+#endif
 	if (mStream)
 	{
 		ResetError(true);
@@ -213,6 +255,9 @@ uint8_t AVRStreamISP::read(void)
 	*/
 	while (!mStream->available());
 	uint8_t	thisChar = mStream->read();
+#ifdef SUPPORT_STK_TRACE
+	mTrace.Append(STKTrace::eCommandFrame, thisChar);
+#endif
 #ifdef DEBUG_AVR_STREAM
 #ifdef __MACH__
 	if (!mReceiving)
@@ -252,6 +297,9 @@ void AVRStreamISP::write(
 	uint8_t	inChar)
 {
 	mStream->write(inChar);
+#ifdef SUPPORT_STK_TRACE
+	mTrace.Append(STKTrace::eResponseFrame, inChar);
+#endif
 #ifdef DEBUG_AVR_STREAM
 #ifdef __MACH__
 	if (mReceiving)
@@ -286,7 +334,7 @@ void AVRStreamISP::write(
 void AVRStreamISP::FillBuffer(
 	uint16_t inLength)
 {
-	if (inLength <= sizeof(mBuffer))
+	if (inLength <= ISP_BUFFER_SIZE)
 	{
 		for (uint16_t i = 0; i < inLength; i++)
 		{
@@ -493,17 +541,109 @@ void AVRStreamISP::EnterProgMode(void)
 	// Pulse the kResetPin after Config::kSCK is low:
 	digitalWrite(Config::kSCK, LOW);
 	delay(20); // discharge SCK, value arbitrarily chosen
+	PulseReset();
+
+	// Send the enable programming command:
+	delay(50); // datasheet: must be > 20 msec
+	ProgrammingEnable();
+	mInProgMode = true;
+	digitalWrite(Config::kProgModePin, HIGH);
+#endif
+}
+
+#ifndef __MACH__
+/********************************* PulseReset *********************************/
+void AVRStreamISP::PulseReset(void)
+{
 	digitalWrite(Config::kResetPin, !mReset);
 	// Pulse must be a minimum of 2 target CPU clock cycles, so 100 usec is ok
 	// for CPU speeds above 20 KHz
 	delayMicroseconds(100);
 	digitalWrite(Config::kResetPin, mReset);
+}
 
-	// Send the enable programming command:
-	delay(50); // datasheet: must be > 20 msec
-	TransferInstruction(0xAC, 0x53, 0x00, 0x00);
-	mInProgMode = true;
-	digitalWrite(Config::kProgModePin, HIGH);
+/****************************** ProgrammingEnable *****************************/
+/*
+*	Sends the Programming Enable instruction.  A target in sync echoes the
+*	second byte (0x53) while the third byte is sent.  Returns true if the
+*	echo was received.
+*/
+bool AVRStreamISP::ProgrammingEnable(void)
+{
+	SPI.transfer(0xAC);
+	SPI.transfer(0x53);
+	bool	echoed = SPI.transfer(0x00) == 0x53;
+	SPI.transfer(0x00);
+	return(echoed);
+}
+#endif
+
+/******************************** ProbeTarget *********************************/
+/*
+*	Checks whether a target with the 3 byte inSignature is connected to the
+*	ISP.  The sequence is the same as EnterProgMode, but the delays required
+*	by the datasheet (about 70ms) don't block.  Call repeatedly until the
+*	result isn't eProbing.  Between calls the ISP outputs are released, as
+*	they are between commands in Update(), so the SPI bus can be used by the
+*	display and SD card.
+*
+*	The target is only considered present if it echoes the Programming Enable
+*	instruction.  The signature is read only then.  Either way the target is
+*	released before the result is returned.  Halt() cancels a probe.
+*
+*	The slowest SPI clock is used because a new target may still be running
+*	from its internal RC oscillator.
+*/
+uint8_t AVRStreamISP::ProbeTarget(
+	const uint8_t*	inSignature)
+{
+#ifdef __MACH__
+	return(memcmp(mSignature, inSignature, 3) == 0 ? eTargetFound : eNoTarget);
+#else
+	uint8_t	result = eProbing;
+	if (mProbeState == eProbeIdle)
+	{
+		SetSPIClock(0);
+		mReset = false;	// AVR reset is active low
+	#if (HEX_LOADER_VER >= 12)
+		digitalWrite(Config::kReset3v3OEPin, LOW);
+	#endif
+		pinMode(Config::kResetPin, OUTPUT);
+		digitalWrite(Config::kResetPin, mReset);
+		mProbeDelay.Set(20);	// discharge SCK, see EnterProgMode
+		mProbeDelay.Start();
+		mProbeState = eProbeResetPulse;
+	} else if (mProbeDelay.Passed())
+	{
+		BeginTransaction();
+		if (mProbeState == eProbeResetPulse)
+		{
+			digitalWrite(Config::kSCK, LOW);
+			PulseReset();
+			EndTransaction();
+			mProbeDelay.Set(50);	// datasheet: must be > 20 msec
+			mProbeDelay.Start();
+			mProbeState = eProbeEnable;
+		} else
+		{
+			result = eNoTarget;
+			if (ProgrammingEnable())
+			{
+				result = eTargetFound;
+				for (uint8_t i = 0; i < 3; i++)
+				{
+					if (TransferInstruction(0x30, 0x00, i, 0x00) != inSignature[i])
+					{
+						result = eNoTarget;
+						break;
+					}
+				}
+			}
+			LeaveProgMode();
+			mProbeState = eProbeIdle;
+		}
+	}
+	return(result);
 #endif
 }
 
@@ -573,6 +713,20 @@ void AVRStreamISP::WriteProgram(
 	if (read() == CRC_EOP)
 	{
 		write(STK_INSYNC);
+	#ifdef __MACH__
+		/*
+		*	A bootloader such as Optiboot writes a single SPM page per command.
+		*	When simulating one, anything other than one aligned page fails
+		*	rather than being written.
+		*/
+		if (mSinglePageWrites &&
+			(inLength != mProgramPageSize ||
+				(mAddress & ((mProgramPageSize >> 1) -1)) != 0))
+		{
+			write(STK_FAILED);
+			return;
+		}
+	#endif
 		write(WriteProgramPages(inLength));
 	} else
 	{
@@ -602,15 +756,22 @@ uint8_t AVRStreamISP::WriteProgramPages(
 	for (uint16_t i = 0; i < inLength; )
 	{
 		/*
-		*	The test below may actually be detecting an error.  Only complete
-		*	pages should ever be written, and only one page should be passed at
-		*	a time.  If pageAddress != mAddress when entering this routine, the
-		*	result will be corrupted flash because the page buffer bits are
-		*	undefined.  This test was part of the original ArduinoISP code.
+		*	Only complete pages should ever be written.  If pageAddress !=
+		*	mAddress when entering this routine, the result will be corrupted
+		*	flash because the page buffer bits are undefined.  This test was
+		*	part of the original ArduinoISP code.
+		*
+		*	SDHexSession sends several pages per command for parts with small
+		*	pages.  The caller manages the write delay of the last page via the
+		*	stream.  The target can't accept the next page while a page write
+		*	is in progress, so the delay of the other pages is handled here.
 		*/
 		if (nextPageAddress == mAddress)
 		{
 			WriteMemoryPage(0x4C, pageAddress);
+		#ifndef __MACH__
+			delayMicroseconds(mFlashMinWriteDelay);
+		#endif
 			pageAddress = nextPageAddress;
 			nextPageAddress += wordsPerPage;
 		}
@@ -807,18 +968,109 @@ void AVRStreamISP::WritePageByte(
 }
 
 /****************************** ReadProgramPage *******************************/
+/*
+*	The flash is read into mBuffer then written to the stream as a block.
+*	This avoids the per byte write() overhead.  On the target the read
+*	instructions are issued back to back via SPI.transfer (inlined), rather
+*	than via TransferInstruction.
+*
+*	When DEBUG_AVR_STREAM is defined the original per byte path is used so that
+*	each byte is logged.
+*/
 uint8_t AVRStreamISP::ReadProgramPage(
 	uint16_t inLength)
 {
+#ifdef DEBUG_AVR_STREAM
 	for (uint16_t i = 0; i < inLength; i += 2)
 	{
 		write(ReadPageByte(0x20, mAddress));
 		write(ReadPageByte(0x28, mAddress));
 		mAddress++;
 	}
+#else
+	/*
+	*	Flash is read a word at a time, so a chunk is a whole number of words.
+	*	ISP_BUFFER_SIZE is odd when SUPPORT_STK500V2 is defined.
+	*/
+	const uint16_t	kMaxChunkLength = ISP_BUFFER_SIZE & ~1;
+	while (inLength)
+	{
+		uint16_t	chunkLength = inLength > kMaxChunkLength ? kMaxChunkLength : inLength;
+		uint16_t	chunkWords = (chunkLength + 1) >> 1;
+		uint8_t*	bufferPtr = mBuffer;
+		uint16_t	address = mAddress;
+		for (uint16_t i = 0; i < chunkWords; i++)
+		{
+		#ifdef __MACH__
+			*(bufferPtr++) = ReadPageByte(0x20, address);
+			*(bufferPtr++) = ReadPageByte(0x28, address);
+		#else
+			uint8_t	addressH = address >> 8;
+			uint8_t	addressL = address;
+			SPI.transfer(0x20);	// Read Program Memory, Low byte
+			SPI.transfer(addressH);
+			SPI.transfer(addressL);
+			*(bufferPtr++) = SPI.transfer(0);
+			SPI.transfer(0x28);	// Read Program Memory, High byte
+			SPI.transfer(addressH);
+			SPI.transfer(addressL);
+			*(bufferPtr++) = SPI.transfer(0);
+		#endif
+			address++;
+		}
+		mAddress += chunkWords;
+		mStream->write(mBuffer, chunkLength);
+	#ifdef SUPPORT_STK_TRACE
+		mTrace.Append(STKTrace::eResponseFrame, mBuffer, chunkLength);
+	#endif
+		inLength -= chunkLength;
+	}
+#endif
 	return(STK_OK);
 }
 
+/********************************** CRCFlash **********************************/
+/*
+*	Returns inCRC updated with inLength bytes of flash starting at
+*	inByteAddress.  The flash is read directly via SPI rather than through the
+*	stream, so there is no per page command/response overhead.  This is used
+*	by SDHexSession to verify flash.  The address and length are assumed to be
+*	even.  The target must be in programming mode.
+*
+*	inLoadExtAddress should be set for targets with more than 128KB of flash.
+*	The Load Extended Address byte is sent before the first read and whenever a
+*	64K word boundary is crossed.
+*/
+uint32_t AVRStreamISP::CRCFlash(
+	uint32_t	inByteAddress,
+	uint16_t	inLength,
+	uint32_t	inCRC,
+	bool		inLoadExtAddress)
+{
+#ifdef __MACH__
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		inCRC = CRC32::Update(inCRC, mFlashMem[inByteAddress + i]);
+	}
+#else
+	uint32_t	wordAddress = inByteAddress >> 1;
+	BeginTransaction();
+	for (uint16_t i = 0; i < inLength; i += 2)
+	{
+		if (inLoadExtAddress &&
+			(i == 0 || (uint16_t)wordAddress == 0))
+		{
+			TransferInstruction(0x4D, 0, wordAddress >> 16, 0);
+		}
+		inCRC = CRC32::Update(inCRC, ReadPageByte(0x20, wordAddress));
+		inCRC = CRC32::Update(inCRC, ReadPageByte(0x28, wordAddress));
+		wordAddress++;
+	}
+	EndTransaction();
+#endif
+	return(inCRC);
+}
+
 /******************************* ReadEepromPage *******************************/
 uint8_t AVRStreamISP::ReadEepromPage(
 	uint16_t inLength)
@@ -899,6 +1151,401 @@ void AVRStreamISP::ReadCalibration(void)
 	}
 }
 
+#ifdef SUPPORT_STK500V2
+/****************************** ProcessV2Message ******************************/
+/*
+*	Called from Update() after a MESSAGE_START byte is read.  An STK500v2
+*	message is framed as:
+*		MESSAGE_START, SEQUENCE_NUMBER, MESSAGE_SIZE (2 bytes, big endian),
+*		TOKEN, MESSAGE_BODY (up to 275 bytes), CHECKSUM
+*	The checksum is the XOR of all of the bytes of the message, including
+*	MESSAGE_START.  The body is read into mBuffer.  The response body is built
+*	in mBuffer then framed using the sequence number of the command.
+*	See the AVR068 doc.
+*/
+void AVRStreamISP::ProcessV2Message(void)
+{
+	uint8_t		sequence = read();
+	uint16_t	bodyLength = read() << 8;
+	bodyLength |= read();
+	if (read() != TOKEN)
+	{
+		LogError(eSyncErr);
+	} else if (bodyLength == 0 ||
+		bodyLength > ISP_BUFFER_SIZE)
+	{
+		LogError(eBufferOverflowErr);
+	} else
+	{
+		uint8_t	checksum = MESSAGE_START ^ sequence ^ (bodyLength >> 8) ^
+							(uint8_t)bodyLength ^ TOKEN;
+		FillBuffer(bodyLength);
+		for (uint16_t i = 0; i < bodyLength; i++)
+		{
+			checksum ^= mBuffer[i];
+		}
+		if (read() == checksum)
+		{
+			WriteV2Message(sequence, ProcessV2Command());
+		} else
+		{
+			LogError(eSyncErr);
+			mBuffer[0] = ANSWER_CKSUM_ERROR;
+			mBuffer[1] = STATUS_CKSUM_ERROR;
+			WriteV2Message(sequence, 2);
+		}
+	}
+}
+
+/****************************** ProcessV2Command ******************************/
+/*
+*	Performs the command in mBuffer and replaces it with the response body.
+*	The first byte of the response is the command, the second is the status.
+*	Returns the length of the response body.
+*/
+uint16_t AVRStreamISP::ProcessV2Command(void)
+{
+	uint16_t	responseLength = 2;
+	uint8_t		status = STATUS_CMD_OK;
+	switch (mBuffer[0])
+	{
+		case CMD_SIGN_ON:				// 0x01
+			ResetError();
+			mBuffer[2] = 8;
+			memcpy(&mBuffer[3], "STK500_2", 8);
+			responseLength = 11;
+			break;
+		case CMD_SET_PARAMETER:			// 0x02
+		case CMD_OSCCAL:				// 0x05
+			// Accepted but not used.  The SPI clock is set via the UI.
+			break;
+		case CMD_GET_PARAMETER:			// 0x03
+			responseLength = V2GetParameter();
+			break;
+		case CMD_LOAD_ADDRESS:			// 0x06
+			// 4 byte big endian.  Word address for flash, byte for EEPROM.
+			mLoadExtAddress = (mBuffer[1] & 0x80) != 0;
+			mExtAddress = mBuffer[2];
+			mExtAddressPending = mLoadExtAddress;
+			mAddress = (mBuffer[3] << 8) | mBuffer[4];
+			break;
+		case CMD_ENTER_PROGMODE_ISP:	// 0x10
+			/*
+			*	[1] timeout, [2] stabDelay, [3] cmdexeDelay, [4] synchLoops,
+			*	[5] byteDelay, [6] pollValue, [7] pollIndex, [8:11] cmd1:cmd4
+			*	EnterProgMode() follows the datasheet rather than these.
+			*/
+			mReset = false;	// AVR reset is active low
+			if (!mInProgMode)
+			{
+				EnterProgMode();
+			}
+			break;
+		case CMD_LEAVE_PROGMODE_ISP:	// 0x11
+			ResetError(true);	// Will call LeaveProgMode()
+			break;
+		case CMD_CHIP_ERASE_ISP:		// 0x12
+			// [1] eraseDelay, [2] pollMethod, [3:6] cmd1:cmd4
+			V2TransferInstruction(&mBuffer[3], 4);
+			V2WaitTillReady(mBuffer[2] == 1, mBuffer[1]);
+			break;
+		case CMD_PROGRAM_FLASH_ISP:		// 0x13
+		case CMD_PROGRAM_EEPROM_ISP:	// 0x15
+			responseLength = V2ProgramMemory(mBuffer[0] == CMD_PROGRAM_FLASH_ISP);
+			break;
+		case CMD_READ_FLASH_ISP:		// 0x14
+		case CMD_READ_EEPROM_ISP:		// 0x16
+			responseLength = V2ReadMemory(mBuffer[0] == CMD_READ_FLASH_ISP);
+			break;
+		case CMD_PROGRAM_FUSE_ISP:		// 0x17
+		case CMD_PROGRAM_LOCK_ISP:		// 0x19
+			// [1:4] cmd1:cmd4
+			V2TransferInstruction(&mBuffer[1], 4);
+			mBuffer[2] = STATUS_CMD_OK;
+			responseLength = 3;
+			break;
+		case CMD_READ_FUSE_ISP:			// 0x18
+		case CMD_READ_LOCK_ISP:			// 0x1A
+		case CMD_READ_SIGNATURE_ISP:	// 0x1B
+		case CMD_READ_OSCCAL_ISP:		// 0x1C
+			// [1] retAddr (1 to 4), [2:5] cmd1:cmd4
+			mBuffer[2] = V2TransferInstruction(&mBuffer[2], mBuffer[1]);
+			mBuffer[3] = STATUS_CMD_OK;
+			responseLength = 4;
+			break;
+		case CMD_SPI_MULTI:				// 0x1D
+			responseLength = V2SPIMulti();
+			break;
+		default:
+			status = STATUS_CMD_UNKNOWN;
+			break;
+	}
+	mBuffer[1] = status;
+	return(responseLength);
+}
+
+/******************************* WriteV2Message *******************************/
+void AVRStreamISP::WriteV2Message(
+	uint8_t		inSequence,
+	uint16_t	inLength)
+{
+	uint8_t	checksum = MESSAGE_START ^ inSequence ^ (inLength >> 8) ^
+						(uint8_t)inLength ^ TOKEN;
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		checksum ^= mBuffer[i];
+	}
+	write(MESSAGE_START);
+	write(inSequence);
+	write(inLength >> 8);
+	write(inLength);
+	write(TOKEN);
+#ifdef DEBUG_AVR_STREAM
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		write(mBuffer[i]);
+	}
+#else
+	mStream->write(mBuffer, inLength);
+#ifdef SUPPORT_STK_TRACE
+	mTrace.Append(STKTrace::eResponseFrame, mBuffer, inLength);
+#endif
+#endif
+	write(checksum);
+}
+
+/******************************* V2GetParameter *******************************/
+uint16_t AVRStreamISP::V2GetParameter(void)
+{
+	uint8_t	value = 0;
+	switch (mBuffer[1])
+	{
+		case PARAM_HW_VER:
+			value = 2;
+			break;
+		case PARAM_SW_MAJOR:
+			value = 2;
+			break;
+		case PARAM_SW_MINOR:
+			value = 10;
+			break;
+		case PARAM_VTARGET:
+			value = 50;	// 5.0V, there's no target voltage sense
+			break;
+		case PARAM_TOPCARD_DETECT:
+			value = 0xFF;	// No top card
+			break;
+	}
+	mBuffer[2] = value;
+	return(3);
+}
+
+/****************************** V2ProgramMemory *******************************/
+/*
+*	CMD_PROGRAM_FLASH_ISP and CMD_PROGRAM_EEPROM_ISP:
+*	[1:2] NumBytes, [3] mode, [4] delay, [5] cmd1 (load/write byte),
+*	[6] cmd2 (write page), [7] cmd3 (read byte), [8:9] poll1:poll2,
+*	[10...] data
+*
+*	In page mode the data is loaded into the target's page buffer, then the
+*	page is written if the mode's write page bit is set.  In word/byte mode
+*	each byte is written individually.  Value polling isn't supported, the
+*	delay is used instead.
+*/
+uint16_t AVRStreamISP::V2ProgramMemory(
+	bool	inIsFlash)
+{
+	uint16_t	length = (mBuffer[1] << 8) | mBuffer[2];
+	uint8_t		mode = mBuffer[3];
+	uint8_t		delayMS = mBuffer[4];
+	uint8_t		cmd1 = mBuffer[5];
+	uint8_t		cmd2 = mBuffer[6];
+	bool		poll = (mode & MODE_RDY_BSY_POLL) != 0;
+	uint16_t	startAddress = mAddress;
+	const uint8_t*	dataPtr = &mBuffer[10];
+
+	if (inIsFlash &&
+		mExtAddressPending)
+	{
+		V2LoadExtAddress();
+	}
+	for (uint16_t i = 0; i < length; i++)
+	{
+		// For flash, bit 3 of the instruction selects the high byte.
+		uint8_t	inst = (inIsFlash && (i & 1)) ? (cmd1 | 0x08) : cmd1;
+		WritePageByte(inst, mAddress, dataPtr[i]);
+		if ((mode & MODE_PAGE) == 0)
+		{
+			V2WaitTillReady(poll, delayMS);
+		}
+		if (!inIsFlash ||
+			(i & 1))
+		{
+			V2IncrementAddress();
+		}
+	}
+	if ((mode & (MODE_PAGE | MODE_WRITE_PAGE)) == (MODE_PAGE | MODE_WRITE_PAGE))
+	{
+		WriteMemoryPage(cmd2, startAddress);
+		V2WaitTillReady(poll, delayMS);
+	}
+	return(2);
+}
+
+/******************************** V2ReadMemory ********************************/
+/*
+*	CMD_READ_FLASH_ISP and CMD_READ_EEPROM_ISP:
+*	[1:2] NumBytes, [3] cmd1 (read byte)
+*	The response is the command, status, data, then a 2nd status.
+*/
+uint16_t AVRStreamISP::V2ReadMemory(
+	bool	inIsFlash)
+{
+	uint16_t	length = (mBuffer[1] << 8) | mBuffer[2];
+	uint8_t		cmd1 = mBuffer[3];
+	if (length > (ISP_BUFFER_SIZE - 3))
+	{
+		length = ISP_BUFFER_SIZE - 3;
+	}
+	if (inIsFlash &&
+		mExtAddressPending)
+	{
+		V2LoadExtAddress();
+	}
+	uint8_t*	bufferPtr = &mBuffer[2];
+	for (uint16_t i = 0; i < length; i++)
+	{
+		uint8_t	inst = (inIsFlash && (i & 1)) ? (cmd1 | 0x08) : cmd1;
+		*(bufferPtr++) = ReadPageByte(inst, mAddress);
+		if (!inIsFlash ||
+			(i & 1))
+		{
+			V2IncrementAddress();
+		}
+	}
+	*bufferPtr = STATUS_CMD_OK;
+	return(length + 3);
+}
+
+/********************************* V2SPIMulti *********************************/
+/*
+*	CMD_SPI_MULTI:
+*	[1] NumTx, [2] NumRx, [3] RxStartAddr, [4...] TxData
+*	Bytes are transferred until both all of the Tx data is sent and NumRx bytes
+*	starting at RxStartAddr have been received.  Zeros are sent once the Tx
+*	data is exhausted.  The Rx data is stored starting at mBuffer[2], which
+*	never overwrites Tx data not yet sent.
+*/
+uint16_t AVRStreamISP::V2SPIMulti(void)
+{
+	uint8_t		numTx = mBuffer[1];
+	uint8_t		numRx = mBuffer[2];
+	uint8_t		rxStart = mBuffer[3];
+	uint16_t	numTransfers = rxStart + numRx;
+	if (numTransfers < numTx)
+	{
+		numTransfers = numTx;
+	}
+	for (uint16_t i = 0; i < numTransfers; i++)
+	{
+		uint8_t	txByte = i < numTx ? mBuffer[4 + i] : 0;
+	#ifdef __MACH__
+		uint8_t	rxByte = 0;
+		(void)txByte;
+	#else
+		uint8_t	rxByte = SPI.transfer(txByte);
+	#endif
+		if (i >= rxStart &&
+			(i - rxStart) < numRx)
+		{
+			mBuffer[2 + i - rxStart] = rxByte;
+		}
+	}
+	mBuffer[2 + numRx] = STATUS_CMD_OK;
+	return(numRx + 3);
+}
+
+/*************************** V2TransferInstruction ****************************/
+/*
+*	Sends the 4 byte inInstruction.  Returns the byte received when the
+*	inRxIndex byte (1 to 4) was sent.
+*/
+uint8_t AVRStreamISP::V2TransferInstruction(
+	const uint8_t*	inInstruction,
+	uint8_t			inRxIndex)
+{
+#ifdef __MACH__
+	// 0x30 = Read Signature Byte
+	return((inInstruction[0] == 0x30 && inInstruction[2] < 3) ?
+				mSignature[inInstruction[2]] : 0);
+#else
+	uint8_t	rxByte = 0;
+	for (uint8_t i = 1; i <= 4; i++)
+	{
+		uint8_t	thisByte = SPI.transfer(*(inInstruction++));
+		if (i == inRxIndex)
+		{
+			rxByte = thisByte;
+		}
+	}
+	return(rxByte);
+#endif
+}
+
+/****************************** V2WaitTillReady *******************************/
+/*
+*	When inPoll is set the target's RDY/BSY bit is polled, otherwise inDelay
+*	milliseconds pass.  inDelay is also the maximum time spent polling.
+*/
+void AVRStreamISP::V2WaitTillReady(
+	bool	inPoll,
+	uint8_t	inDelay)
+{
+#ifndef __MACH__
+	if (inPoll)
+	{
+		uint32_t	startTime = millis();
+		// 0xF0 = Poll RDY/BSY, bit 0 is set while busy.
+		while ((TransferInstruction(0xF0, 0x00, 0x00, 0x00) & 1) &&
+			(millis() - startTime) <= inDelay){}
+	} else
+	{
+		delay(inDelay);
+	}
+#endif
+}
+
+/****************************** V2LoadExtAddress ******************************/
+void AVRStreamISP::V2LoadExtAddress(void)
+{
+	mExtAddressPending = false;
+#ifdef __MACH__
+	mBaseAddress = ((uint32_t)mExtAddress) << 17;
+#else
+	TransferInstruction(AVR_OP_LOAD_EXT_ADDR, 0x00, mExtAddress, 0x00);
+#endif
+}
+
+/***************************** V2IncrementAddress *****************************/
+/*
+*	When the word address crosses a 64K word boundary of a part with more than
+*	128KB of flash, the Load Extended Address byte is incremented and resent.
+*/
+void AVRStreamISP::V2IncrementAddress(void)
+{
+	mAddress++;
+#ifdef __MACH__
+	mAddress &= 0xFFFF;
+#endif
+	if (mAddress == 0 &&
+		mLoadExtAddress)
+	{
+		mExtAddress++;
+		V2LoadExtAddress();
+	}
+}
+#endif
+
 /*********************************** Update ***********************************/
 bool AVRStreamISP::Update(void)
 {
@@ -929,6 +1576,9 @@ bool AVRStreamISP::Update(void)
 				{
 					write(STK_INSYNC);
 					mStream->write((const uint8_t*)"AVR ISP", 7);
+				#ifdef SUPPORT_STK_TRACE
+					mTrace.Append(STKTrace::eResponseFrame, (const uint8_t*)"AVR ISP", 7);
+				#endif
 				#ifdef DEBUG_AVR_STREAM
 				#ifdef __MACH__
 					fprintf(stderr, "AVR ISP");
@@ -992,6 +1642,11 @@ bool AVRStreamISP::Update(void)
 			case STK_READ_OSCCAL:		// 0x76
 				ReadCalibration();
 				break;
+		#ifdef SUPPORT_STK500V2
+			case MESSAGE_START:			// 0x1B, STK500v2 message
+				ProcessV2Message();
+				break;
+		#endif
 			// anything else we will return STK_UNKNOWN
 			default:
 				LogError(eUnknownErr);
@@ -1004,6 +1659,10 @@ bool AVRStreamISP::Update(void)
 			EndTransaction();
 		}
 	#endif
+	#ifdef SUPPORT_STK_TRACE
+		// The SPI bus is free to access the SD card once the transaction ends.
+		mTrace.Flush();
+	#endif
 	} else
 	{
 		Heartbeat();
@@ -34,9 +34,23 @@
 #include <inttypes.h>
 #ifdef __MACH__
 #define Stream	ContextualStream
+/*
+*	The host tools always have STK500v2, see SDHexLoaderConfig.h.
+*/
+#define SUPPORT_STK500V2	1
 #else
 #include <SPI.h>
 #include "SDHexLoaderConfig.h"
+#include "MSPeriod.h"
+#endif
+#ifdef SUPPORT_STK_TRACE
+#include "STKTrace.h"
+#endif
+
+#ifdef SUPPORT_STK500V2
+#define ISP_BUFFER_SIZE		275	// STK500V2_MAX_BODY_SIZE
+#else
+#define ISP_BUFFER_SIZE		256
 #endif
 
 class Stream;
@@ -63,6 +77,24 @@ public:
 	void					Halt(void);
 	bool					InProgMode(void) const
 								{return(mInProgMode);}
+	uint8_t					ProbeTarget(
+								const uint8_t*			inSignature);
+	uint32_t				CRCFlash(
+								uint32_t				inByteAddress,
+								uint16_t				inLength,
+								uint32_t				inCRC,
+								bool					inLoadExtAddress);
+#ifdef __MACH__
+	void					SetSinglePageWrites(
+								bool					inSinglePageWrites)
+								{mSinglePageWrites = inSinglePageWrites;}
+#endif
+	enum EProbeResult
+	{
+		eProbing,
+		eNoTarget,
+		eTargetFound
+	};
 	enum EErrors
 	{
 		eNoErr,
@@ -81,23 +113,36 @@ protected:
 #endif
 //	uint16_t	mEEPromMinWriteDelay;
 	uint16_t	mEEPromSize;
-//	uint16_t	mFlashMinWriteDelay;
+#ifndef __MACH__
+	uint16_t	mFlashMinWriteDelay;	// microseconds
+#endif
 	uint16_t	mProgramPageSize;
-	uint8_t		mBuffer[256];
+	uint8_t*	mBuffer;	// ISP_BUFFER_SIZE bytes from BufferArena
 	uint8_t		mEEPromPageSize; 
 	uint8_t		mError;
 #ifdef __MACH__
 	uint8_t		mSignature[3];
 	uint8_t		mFlashMem[0x40000];
 	uint32_t	mBaseAddress;
+	bool		mSinglePageWrites;	// Behave like a bootloader, see WriteProgram
 #else
 	uint8_t		mISP_OE_BitMask;
 #endif
 	bool		mInProgMode;
 	bool		mReset;
+#ifdef SUPPORT_STK500V2
+	uint8_t		mExtAddress;		// Load Extended Address byte
+	bool		mLoadExtAddress;	// Set by CMD_LOAD_ADDRESS bit 31
+	bool		mExtAddressPending;	// mExtAddress hasn't been sent yet
+#endif
 #ifndef __MACH__
 	volatile uint8_t*	mISP_OE_PortReg;
 	SPISettings	mSPISettings;
+	MSPeriod	mProbeDelay;
+	uint8_t		mProbeState;
+#endif
+#ifdef SUPPORT_STK_TRACE
+	STKTrace	mTrace;
 #endif
 #ifdef DEBUG_AVR_STREAM
 	bool		mReceiving;
@@ -142,6 +187,16 @@ protected:
 	void					SetExtDeviceProgParams(void);
 	void					EnterProgMode(void);
 	void					LeaveProgMode(void);
+#ifndef __MACH__
+	void					PulseReset(void);
+	bool					ProgrammingEnable(void);
+	enum EProbeState
+	{
+		eProbeIdle,
+		eProbeResetPulse,
+		eProbeEnable
+	};
+#endif
 	void					Universal(void);
 	void					WriteMemoryPage(
 								uint8_t					inInst,
@@ -171,6 +226,27 @@ protected:
 	void					ReadPage(void);
 	void					ReadSignature(void);
 	void					ReadCalibration(void);
+#ifdef SUPPORT_STK500V2
+	void					ProcessV2Message(void);
+	uint16_t				ProcessV2Command(void);
+	void					WriteV2Message(
+								uint8_t					inSequence,
+								uint16_t				inLength);
+	uint16_t				V2GetParameter(void);
+	uint16_t				V2ProgramMemory(
+								bool					inIsFlash);
+	uint16_t				V2ReadMemory(
+								bool					inIsFlash);
+	uint16_t				V2SPIMulti(void);
+	uint8_t					V2TransferInstruction(
+								const uint8_t*			inInstruction,
+								uint8_t					inRxIndex);
+	void					V2WaitTillReady(
+								bool					inPoll,
+								uint8_t					inDelay);
+	void					V2LoadExtAddress(void);
+	void					V2IncrementAddress(void);
+#endif
 };
 
 #endif // AVRStreamISP_h
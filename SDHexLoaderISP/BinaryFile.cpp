@@ -0,0 +1,118 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	BinaryFile.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "BinaryFile.h"
+#ifndef __MACH__
+#include <Arduino.h>
+#endif
+
+/********************************* BinaryFile *********************************/
+BinaryFile::BinaryFile(void)
+	: mBaseAddress(0), mPosition(0), mFileSize(0)
+{
+}
+
+/*********************************** begin ************************************/
+bool BinaryFile::begin(
+	const char*	inPath)
+{
+	bool	success = ImageSource::begin(inPath);
+	mFileSize = success ? FileSize() : 0;
+	return(success);
+}
+
+/******************************* SetBaseAddress *******************************/
+void BinaryFile::SetBaseAddress(
+	uint32_t	inBaseAddress)
+{
+	mBaseAddress = inBaseAddress;
+	Rewind();
+}
+
+/*********************************** Rewind ***********************************/
+bool BinaryFile::Rewind(void)
+{
+	mPosition = 0;
+	return(ImageSource::Rewind());
+}
+
+/********************************* SeekRecord *********************************/
+/*
+*	The address is determined by inPosition, inAddressH isn't used.
+*/
+bool BinaryFile::SeekRecord(
+	uint32_t	inPosition,
+	uint8_t		inAddressH)
+{
+	mPosition = inPosition;
+	mEndOfFile = false;
+	return(Seek(inPosition) && NextRecord());
+}
+
+/********************************* NextRecord *********************************/
+/*
+*	Data records end on a 16 byte address boundary so a record never crosses a
+*	64KB boundary.
+*/
+bool BinaryFile::NextRecord(void)
+{
+	mRecordType = eInvalidRecordType;
+	mRecordPosition = mPosition;
+	bool	success = mFile != nullptr;
+	if (success)
+	{
+		if (mPosition >= mFileSize)
+		{
+			SetEndOfFileRecord();
+			mEndOfFile = true;
+		} else
+		{
+			uint32_t	address = mBaseAddress + mPosition;
+			uint8_t		byteCount = 16 - (address & 0xF);
+			if (byteCount > (mFileSize - mPosition))
+			{
+				byteCount = mFileSize - mPosition;
+			}
+			success = address <= 0xFFFFFF &&
+				ReadData(mData, byteCount);
+			if (success)
+			{
+				mRecordType = eDataRecord;
+				mByteCount = byteCount;
+				mAddressH = address >> 16;
+				mAddress = address;
+				mPosition += byteCount;
+			}
+		}
+	}
+	return(success);
+}
+
+/******************************* EstimateLength *******************************/
+uint32_t BinaryFile::EstimateLength(void)
+{
+	Rewind();
+	return(mFileSize);
+}
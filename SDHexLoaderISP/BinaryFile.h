@@ -0,0 +1,63 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	BinaryFile.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Reads a raw binary image (as written by avr-objcopy -O binary.)  The first
+*	byte of the file is loaded at the base address, 0 unless set by the
+*	config's bin.address key (e.g. for a bootloader.)  There's nothing to
+*	decode, the file is read in blocks of the read buffer's size and returned
+*	as 16 byte data records aligned the way a hex file's would be.  The end of
+*	the file is the end of file record.
+*
+*	The record position is the file offset of the record's first byte.
+*/
+
+#ifndef BinaryFile_h
+#define BinaryFile_h
+
+#include "ImageSource.h"
+
+class BinaryFile : public ImageSource
+{
+public:
+							BinaryFile(void);
+	virtual bool			begin(
+								const char*				inPath);
+	void					SetBaseAddress(	// Before or after begin, rewinds
+								uint32_t				inBaseAddress);
+	virtual bool			NextRecord(void);
+	virtual bool			Rewind(void);
+	virtual bool			SeekRecord(
+								uint32_t				inPosition,
+								uint8_t					inAddressH);
+	virtual uint32_t		EstimateLength(void);	// The file size
+	virtual bool			InAddressOrder(void) const
+								{return(true);}
+protected:
+	uint32_t	mBaseAddress;
+	uint32_t	mPosition;		// File offset of the next data byte
+	uint32_t	mFileSize;
+};
+
+#endif /* BinaryFile_h */
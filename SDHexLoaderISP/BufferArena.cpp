@@ -0,0 +1,105 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	BufferArena.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "BufferArena.h"
+#ifndef __MACH__
+#include "SDHexLoaderConfig.h"
+#endif
+
+#ifdef REPORT_SRAM_BUDGET
+#define ARENA_STR2(x)	#x
+#define ARENA_STR(x)	ARENA_STR2(x)
+#pragma message "Buffer arena (stream + ISP + trace + writer): " ARENA_STR(BUFFER_ARENA_SIZE)
+#pragma message "  ISP load read buffer: " ARENA_STR((ARENA_TRACE_SIZE + HEX_WRITER_BUFFER_SIZE))
+#pragma message "  Serial load read buffer: " ARENA_STR((ISP_BUFFER_SIZE + ARENA_TRACE_SIZE + HEX_WRITER_BUFFER_SIZE))
+#pragma message "Run avr-size on the elf for the static SRAM total."
+#endif
+static_assert(BUFFER_ARENA_SIZE <= BUFFER_ARENA_BUDGET, "Buffer arena exceeds its SRAM budget");
+
+// The default has all regions in use, none overlap.
+ARENA_STORAGE uint8_t	BufferArena::sPhase = BufferArena::eISPBackupPhase;
+ARENA_STORAGE uint8_t	BufferArena::sArena[BUFFER_ARENA_SIZE];
+
+/********************************* RegionSize *********************************/
+/*
+*	Returns the size of inRegion in the current phase, 0 if not in use.
+*/
+uint16_t BufferArena::RegionSize(
+	uint8_t	inRegion)
+{
+	uint16_t	size = 0;
+	switch (inRegion)
+	{
+		case eStreamRegion:
+			if (sPhase & eUsesStream)
+			{
+				size = ARENA_STREAM_SIZE;
+			}
+			break;
+		case eISPRegion:
+			if (sPhase & eUsesISP)
+			{
+				size = ISP_BUFFER_SIZE;
+			}
+			break;
+		case eTraceRegion:
+			if (sPhase & eUsesISP)
+			{
+				size = ARENA_TRACE_SIZE;
+			}
+			break;
+		case eWriterRegion:
+			if (sPhase & eUsesWriter)
+			{
+				size = HEX_WRITER_BUFFER_SIZE;
+			}
+			break;
+	}
+	return(size);
+}
+
+/*********************************** Region ***********************************/
+/*
+*	Returns the start of inRegion in the current phase, nullptr if the region
+*	isn't in use.
+*/
+uint8_t* BufferArena::Region(
+	uint8_t		inRegion,
+	uint16_t*	outSize)
+{
+	uint16_t	offset = 0;
+	uint16_t	size;
+	for (uint8_t region = eStreamRegion; region < inRegion; region++)
+	{
+		offset += RegionSize(region);
+	}
+	size = inRegion == eReadRegion ? (BUFFER_ARENA_SIZE - offset) :
+										RegionSize(inRegion);
+	if (outSize)
+	{
+		*outSize = size;
+	}
+	return(size ? &sArena[offset] : nullptr);
+}
@@ -0,0 +1,108 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	BufferArena.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	A single statically allocated block of SRAM shared by the large buffers of
+*	ContextualStream, AVRStreamISP, STKTrace, IntelHexWriter and ImageSource.
+*	These buffers are never all in use at the same time.  Which are in use
+*	depends on the session type, the phase.  SDHexLoader sets the phase when a
+*	session starts, before any of the buffer owners are started.  Each owner
+*	gets its buffer from the arena when it's started.
+*
+*	Within a phase, the regions in use are laid out in ERegion order.  The
+*	last region, the ImageSource read buffer, gets whatever remains.  The
+*	arena is sized for the worst case, a backup via the ISP.
+*
+*	The host tools may run a session per thread, so on the host each thread
+*	has its own arena.
+*/
+#ifndef BufferArena_h
+#define BufferArena_h
+
+#include <inttypes.h>
+#include "ContextualStream.h"
+#include "AVRStreamISP.h"
+#include "IntelHexWriter.h"
+#ifdef SUPPORT_STK_TRACE
+#include "STKTrace.h"
+#define ARENA_TRACE_SIZE	STK_TRACE_BUFFER_SIZE
+#else
+#define ARENA_TRACE_SIZE	0
+#endif
+
+/*
+*	The arena shouldn't take more than about a third of the 4KB of SRAM.
+*/
+#ifndef BUFFER_ARENA_BUDGET
+#define BUFFER_ARENA_BUDGET	1280
+#endif
+#define ARENA_STREAM_SIZE	(2*AVR_BUFFER_SIZE)
+#define BUFFER_ARENA_SIZE	(ARENA_STREAM_SIZE + ISP_BUFFER_SIZE + \
+								ARENA_TRACE_SIZE + HEX_WRITER_BUFFER_SIZE)
+#ifdef __MACH__
+#define ARENA_STORAGE		thread_local
+#else
+#define ARENA_STORAGE
+#endif
+
+class BufferArena
+{
+public:
+	enum ERegion
+	{
+		eStreamRegion,	// ContextualStream buffer1 followed by buffer2
+		eISPRegion,		// AVRStreamISP
+		eTraceRegion,	// STKTrace, only when SUPPORT_STK_TRACE is defined
+		eWriterRegion,	// IntelHexWriter, backups only
+		eReadRegion		// ImageSource, the remainder of the arena
+	};
+	enum EPhaseFlags
+	{
+		eUsesStream		= 1,
+		eUsesISP		= 2,
+		eUsesWriter		= 4
+	};
+	enum EPhase
+	{
+		eUSBPhase			= eUsesISP,	// USB pass-through
+		eISPLoadPhase		= eUsesStream + eUsesISP,
+		eISPBackupPhase		= eUsesStream + eUsesISP + eUsesWriter,
+		eSerialLoadPhase	= eUsesStream,
+		eSerialBackupPhase	= eUsesStream + eUsesWriter
+	};
+	static void				Begin(
+								uint8_t					inPhase)
+								{sPhase = inPhase;}
+	static uint8_t*			Region(
+								uint8_t					inRegion,
+								uint16_t*				outSize = nullptr);
+protected:
+	static ARENA_STORAGE uint8_t	sPhase;
+	static ARENA_STORAGE uint8_t	sArena[BUFFER_ARENA_SIZE];
+
+	static uint16_t			RegionSize(
+								uint8_t					inRegion);
+};
+
+#endif /* BufferArena_h */
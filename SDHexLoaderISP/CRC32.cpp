@@ -0,0 +1,63 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	CRC32.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "CRC32.h"
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define pgm_read_dword(x)	(*(x))
+#endif
+
+const uint32_t kCRC32NibbleTable[16] PROGMEM =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/*********************************** Update ***********************************/
+uint32_t CRC32::Update(
+	uint32_t	inCRC,
+	uint8_t		inByte)
+{
+	inCRC ^= inByte;
+	inCRC = (inCRC >> 4) ^ pgm_read_dword(&kCRC32NibbleTable[inCRC & 0x0F]);
+	return((inCRC >> 4) ^ pgm_read_dword(&kCRC32NibbleTable[inCRC & 0x0F]));
+}
+
+/*********************************** Update ***********************************/
+uint32_t CRC32::Update(
+	uint32_t		inCRC,
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		inCRC = Update(inCRC, inData[i]);
+	}
+	return(inCRC);
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	CRC32.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Standard (reflected 0xEDB88320) CRC-32 using a 16 entry nibble table to
+*	keep the flash and SRAM footprint small.
+*
+*	The value is kept unfinalized (i.e. not inverted) because it's only
+*	compared with other values calculated by this class.
+*/
+
+#ifndef CRC32_h
+#define CRC32_h
+
+#include <inttypes.h>
+
+class CRC32
+{
+public:
+	static const uint32_t	kInitial = 0xFFFFFFFF;
+
+	static uint32_t			Update(
+								uint32_t				inCRC,
+								uint8_t					inByte);
+	static uint32_t			Update(
+								uint32_t				inCRC,
+								const uint8_t*			inData,
+								uint16_t				inLength);
+};
+
+#endif // CRC32_h
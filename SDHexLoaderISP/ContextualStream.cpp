@@ -23,17 +23,25 @@
 *
 */
 #include "ContextualStream.h"
+#include "BufferArena.h"
 
 /********************************* ContextualStream **********************************/
 ContextualStream::ContextualStream(void)
  : mBuffer1Head(0), mBuffer1Tail(0), mBuffer2Head(0), mBuffer2Tail(0),
- 	mReadFrom1(false)
+ 	mBuffer1(nullptr), mBuffer2(nullptr), mReadFrom1(false)
 {
 }
 
 /*********************************** begin ************************************/
+/*
+*	The buffers are only valid for the BufferArena phase current at the time
+*	begin is called.
+*/
 void ContextualStream::begin(void)
 {
+	mBuffer1 = BufferArena::Region(BufferArena::eStreamRegion);
+	mBuffer2 = mBuffer1 ? &mBuffer1[AVR_BUFFER_SIZE] : nullptr;
+	flush();
 }
 
 /*********************************** flush ************************************/
@@ -165,6 +173,52 @@ size_t ContextualStream::write(
 	return(bytesWritten);
 }
 
+/************************************ Take ************************************/
+/*
+*	Returns a pointer to the next inLength bytes of the read buffer and
+*	consumes them.  Returns nullptr if fewer than inLength bytes are available.
+*/
+const uint8_t* ContextualStream::Take(
+	uint16_t	inLength)
+{
+	const uint8_t*	data = nullptr;
+	if (mReadFrom1)
+	{
+		if ((mBuffer1Tail - mBuffer1Head) >= inLength)
+		{
+			data = &mBuffer1[mBuffer1Head];
+			mBuffer1Head += inLength;
+		}
+	} else if ((mBuffer2Tail - mBuffer2Head) >= inLength)
+	{
+		data = &mBuffer2[mBuffer2Head];
+		mBuffer2Head += inLength;
+	}
+	return(data);
+}
+
+/************************************ Fill ************************************/
+/*
+*	Writes inCount copies of inByte.
+*/
+void ContextualStream::Fill(
+	uint8_t		inByte,
+	uint16_t	inCount)
+{
+	if (mReadFrom1)
+	{
+		if ((mBuffer2Tail + inCount) <= AVR_BUFFER_SIZE)
+		{
+			memset(&mBuffer2[mBuffer2Tail], inByte, inCount);
+			mBuffer2Tail += inCount;
+		}
+	} else if ((mBuffer1Tail + inCount) <= AVR_BUFFER_SIZE)
+	{
+		memset(&mBuffer1[mBuffer1Tail], inByte, inCount);
+		mBuffer1Tail += inCount;
+	}
+}
+
 /******************************** StReadFrom1 *********************************/
 StReadFrom1::StReadFrom1(
 	ContextualStream&	inContextualStream,
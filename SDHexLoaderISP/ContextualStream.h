@@ -57,7 +57,7 @@ class ContextualStream : public Stream
 {
 public:
 							ContextualStream(void);
-	void					begin(void);
+	void					begin(void);	// Gets the buffers from BufferArena
 	void					ReadFrom1(
 								bool					inReadFrom1);
 	virtual int				available(void);
@@ -70,6 +70,11 @@ public:
 								const uint8_t*			inBuffer,
 								size_t					inLength);
 	virtual void			flush(void);
+#ifdef __MACH__
+	// Host serial ports override this to drive DTR (see HostTools/SDHexMultiLoad)
+	virtual void			SetReset(
+								bool					inAssert){}
+#endif
 
 	// Low level access to buffers
 	bool					ReadingFrom1(void) const
@@ -80,13 +85,19 @@ public:
 	uint8_t*				Buffer2(void)
 								{return(mBuffer2);}
 	void					FlushBuffer2(void);
+	// Bulk access, not virtual
+	const uint8_t*			Take(
+								uint16_t				inLength);
+	void					Fill(
+								uint8_t					inByte,
+								uint16_t				inCount);
 protected:
 	uint16_t	mBuffer1Head;
 	uint16_t	mBuffer1Tail;
 	uint16_t	mBuffer2Head;
 	uint16_t	mBuffer2Tail;
-	uint8_t		mBuffer1[AVR_BUFFER_SIZE];
-	uint8_t		mBuffer2[AVR_BUFFER_SIZE];
+	uint8_t*	mBuffer1;	// AVR_BUFFER_SIZE bytes
+	uint8_t*	mBuffer2;	// AVR_BUFFER_SIZE bytes
 	bool		mReadFrom1;
 };
 
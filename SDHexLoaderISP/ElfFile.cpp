@@ -0,0 +1,329 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	ElfFile.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "ElfFile.h"
+#include <string.h>
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define memcmp_P memcmp
+#endif
+
+const uint8_t	kNoSegment = 0xFF;
+const uint32_t	kEndOfFilePosition = 0xFFFFFFFF;	// Of the end of file record
+const uint32_t	kPTLoad = 1;
+const uint32_t	kDataMemoryAddress = 0x800000;	// EEPROM, fuses, etc. follow
+const char kElfIdentStr[] PROGMEM = "\x7F" "ELF\x01\x01";	// 32 bit, little endian
+
+/*
+*	The fields of the ELF header used.  The header is 52 bytes.
+*/
+struct SElfHeader
+{
+	uint8_t		ident[16];
+	uint16_t	type;
+	uint16_t	machine;
+	uint32_t	version;
+	uint32_t	entry;
+	uint32_t	phoff;
+	uint32_t	shoff;
+	uint32_t	flags;
+	uint16_t	ehsize;
+	uint16_t	phentsize;
+	uint16_t	phnum;
+};
+
+/*********************************** ElfFile **********************************/
+ElfFile::ElfFile(void)
+	: mPhOffset(0), mPhCount(0), mMemory(eFlashMemory), mSegment(kNoSegment)
+{
+}
+
+/*********************************** begin ************************************/
+/*
+*	Opens inPath.  Only 32 bit little endian ELF files are accepted.
+*/
+bool ElfFile::begin(
+	const char*	inPath)
+{
+	SElfHeader	header;
+	mMemory = eFlashMemory;
+	mPhCount = 0;
+	bool	success = ImageSource::begin(inPath) &&
+		Seek(0) &&
+		ReadData(&header, sizeof(SElfHeader)) &&
+		memcmp_P(header.ident, kElfIdentStr, 6) == 0 &&
+		header.phentsize == sizeof(SElfProgramHeader) &&
+		header.phnum < kNoSegment;
+	if (success)
+	{
+		mPhOffset = header.phoff;
+		mPhCount = header.phnum;
+	}
+	Rewind();
+	return(success);
+}
+
+/******************************** SelectMemory ********************************/
+void ElfFile::SelectMemory(
+	uint8_t	inMemory)
+{
+	mMemory = inMemory;
+	Rewind();
+}
+
+/********************************** MemoryOf **********************************/
+/*
+*	Returns the memory of a segment's physical address.
+*/
+uint8_t ElfFile::MemoryOf(
+	uint32_t	inPAddr)
+{
+	if (inPAddr < kDataMemoryAddress)
+	{
+		return(eFlashMemory);
+	}
+	uint32_t	memory = (inPAddr - kDataMemoryAddress) >> 16;
+	return((memory >= eEEPROMMemory && memory <= eLockMemory) ?
+				(uint8_t)memory : eNoMemory);
+}
+
+/******************************** MemoryAddress *******************************/
+/*
+*	Returns the address of the selected memory in the ELF address space.
+*/
+uint32_t ElfFile::MemoryAddress(void) const
+{
+	return(mMemory == eFlashMemory ? 0 :
+				kDataMemoryAddress + ((uint32_t)mMemory << 16));
+}
+
+/*********************************** Rewind ***********************************/
+bool ElfFile::Rewind(void)
+{
+	mRecordType = eInvalidRecordType;
+	mByteCount = 0;
+	mAddressH = 0;
+	mEndOfFile = false;
+	mSegment = kNoSegment;
+	mSegmentPosition = 0;
+	mSegmentEnd = 0;
+	return(mFile != nullptr);
+}
+
+/********************************* NextSegment ********************************/
+/*
+*	Finds the segment of the selected memory that follows the current segment
+*	in address order.  Segments at the same address are taken in program
+*	header order.  When there are no more segments mSegment is kNoSegment.
+*	On return the file is positioned at the segment data.
+*/
+bool ElfFile::NextSegment(void)
+{
+	SElfProgramHeader	programHeader;
+	uint8_t		currSegment = mSegment;
+	uint32_t	currPAddr = mSegmentPAddr;
+	bool		success = Seek(mPhOffset);
+	mSegment = kNoSegment;
+	for (uint8_t i = 0; success && i < mPhCount; i++)
+	{
+		success = ReadData(&programHeader, sizeof(SElfProgramHeader));
+		if (!success ||
+			programHeader.type != kPTLoad ||
+			programHeader.filesz == 0 ||
+			MemoryOf(programHeader.paddr) != mMemory)
+		{
+			continue;
+		}
+		/*
+		*	If this segment follows the current segment and it precedes the
+		*	best found so far...
+		*/
+		if ((currSegment == kNoSegment ||
+				programHeader.paddr > currPAddr ||
+				(programHeader.paddr == currPAddr && i > currSegment)) &&
+			(mSegment == kNoSegment ||
+				programHeader.paddr < mSegmentPAddr))
+		{
+			mSegment = i;
+			mSegmentPAddr = programHeader.paddr;
+			mSegmentPosition = programHeader.offset;
+			mSegmentEnd = programHeader.offset + programHeader.filesz;
+		}
+	}
+	if (success &&
+		mSegment != kNoSegment)
+	{
+		mSegmentAddress = mSegmentPAddr - MemoryAddress();
+		success = Seek(mSegmentPosition);
+	}
+	return(success);
+}
+
+/********************************* NextRecord *********************************/
+/*
+*	Data records end on a 16 byte address boundary, the same as a hex file's
+*	records, so a record never crosses a 64KB boundary.
+*/
+bool ElfFile::NextRecord(void)
+{
+	mRecordType = eInvalidRecordType;
+	bool	success = mFile != nullptr;
+	if (success &&
+		!mEndOfFile &&
+		(mSegment == kNoSegment || mSegmentPosition >= mSegmentEnd))
+	{
+		success = NextSegment();
+		mEndOfFile = mSegment == kNoSegment;
+	}
+	if (success)
+	{
+		if (mEndOfFile)
+		{
+			mRecordPosition = kEndOfFilePosition;
+			mRecordType = eEndOfFileRecord;
+			mByteCount = 0;
+			mAddress = 0;
+		} else
+		{
+			uint8_t	byteCount = 16 - (mSegmentAddress & 0xF);
+			if (byteCount > (mSegmentEnd - mSegmentPosition))
+			{
+				byteCount = mSegmentEnd - mSegmentPosition;
+			}
+			mRecordPosition = mSegmentPosition;
+			success = ReadData(mData, byteCount);
+			if (success)
+			{
+				mRecordType = eDataRecord;
+				mByteCount = byteCount;
+				mAddressH = mSegmentAddress >> 16;
+				mAddress = (uint16_t)mSegmentAddress;
+				mSegmentAddress += byteCount;
+				mSegmentPosition += byteCount;
+			}
+		}
+	}
+	return(success);
+}
+
+/********************************* SeekRecord *********************************/
+/*
+*	Returns to a record previously read.  The segment containing inPosition is
+*	found from the program headers.  inAddressH is only used by hex files.
+*/
+bool ElfFile::SeekRecord(
+	uint32_t	inPosition,
+	uint8_t		inAddressH)
+{
+	Rewind();
+	if (inPosition == kEndOfFilePosition)
+	{
+		mEndOfFile = true;
+		return(NextRecord());
+	}
+	SElfProgramHeader	programHeader;
+	bool	success = Seek(mPhOffset);
+	for (uint8_t i = 0; success && i < mPhCount; i++)
+	{
+		success = ReadData(&programHeader, sizeof(SElfProgramHeader));
+		if (success &&
+			programHeader.type == kPTLoad &&
+			MemoryOf(programHeader.paddr) == mMemory &&
+			inPosition >= programHeader.offset &&
+			inPosition < (programHeader.offset + programHeader.filesz))
+		{
+			mSegment = i;
+			mSegmentPAddr = programHeader.paddr;
+			mSegmentPosition = inPosition;
+			mSegmentEnd = programHeader.offset + programHeader.filesz;
+			mSegmentAddress = mSegmentPAddr - MemoryAddress() +
+								(inPosition - programHeader.offset);
+			return(Seek(inPosition) && NextRecord());
+		}
+	}
+	return(false);
+}
+
+/******************************* EstimateLength *******************************/
+/*
+*	For an ELF file, the exact data length of the selected memory from the
+*	program headers.
+*/
+uint32_t ElfFile::EstimateLength(void)
+{
+	SElfProgramHeader	programHeader;
+	uint32_t	length = 0;
+	bool		success = Seek(mPhOffset);
+	for (uint8_t i = 0; success && i < mPhCount; i++)
+	{
+		success = ReadData(&programHeader, sizeof(SElfProgramHeader));
+		if (success &&
+			programHeader.type == kPTLoad &&
+			MemoryOf(programHeader.paddr) == mMemory)
+		{
+			length += programHeader.filesz;
+		}
+	}
+	Rewind();
+	return(length);
+}
+
+/********************************* ReadMemory *********************************/
+/*
+*	Reads the data of the first segment of inMemory, typically the fuse or
+*	lock bytes.  For fuses, the order is low, high, then extended.  Returns
+*	the number of bytes read, 0 if the file has no data for inMemory.
+*/
+uint8_t ElfFile::ReadMemory(
+	uint8_t		inMemory,
+	uint8_t*	outData,
+	uint8_t		inMaxLength)
+{
+	SElfProgramHeader	programHeader;
+	uint8_t	length = 0;
+	bool	success = Seek(mPhOffset);
+	for (uint8_t i = 0; success && i < mPhCount; i++)
+	{
+		success = ReadData(&programHeader, sizeof(SElfProgramHeader));
+		if (success &&
+			programHeader.type == kPTLoad &&
+			programHeader.filesz &&
+			MemoryOf(programHeader.paddr) == inMemory)
+		{
+			length = programHeader.filesz < inMaxLength ?
+						programHeader.filesz : inMaxLength;
+			if (!Seek(programHeader.offset) ||
+				!ReadData(outData, length))
+			{
+				length = 0;
+			}
+			break;
+		}
+	}
+	Rewind();
+	return(length);
+}
@@ -0,0 +1,105 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	ElfFile.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Reads the loadable segments of an ELF32 file (as built by avr-gcc) and
+*	returns them as the same records IntelHexFile returns, so a session can
+*	load a .elf file in place of its .hex and .eep files.
+*
+*	avr-gcc places each memory at its own offset in the ELF address space:
+*	flash at 0, EEPROM at 0x810000, fuses at 0x820000 and lock bits at
+*	0x830000.  The physical address of each PT_LOAD program header determines
+*	its memory (the .data segment is loaded from flash.)  Only the segments
+*	of the selected memory are returned, in address order, as data records of
+*	up to 16 bytes aligned the way a hex file's would be, followed by an end
+*	of file record.  Addresses are relative to the memory.
+*
+*	The program headers are read when a segment ends.  The segment data is
+*	read through the read buffer, in blocks of the buffer's size.
+*	The record position is the file offset of the record's data, so
+*	SeekRecord works the same as it does for a hex file.
+*/
+
+#ifndef ElfFile_h
+#define ElfFile_h
+
+#include "ImageSource.h"
+
+struct SElfProgramHeader
+{
+	uint32_t	type;		// 1 = PT_LOAD
+	uint32_t	offset;		// File offset of the segment data
+	uint32_t	vaddr;
+	uint32_t	paddr;		// Load address, determines the memory
+	uint32_t	filesz;		// Bytes of data in the file
+	uint32_t	memsz;
+	uint32_t	flags;
+	uint32_t	align;
+};
+
+class ElfFile : public ImageSource
+{
+public:
+							ElfFile(void);
+	virtual bool			begin(	// Fails if inPath isn't an ELF32 file
+								const char*				inPath);
+	enum EMemory
+	{
+		eFlashMemory,
+		eEEPROMMemory,
+		eFuseMemory,
+		eLockMemory,
+		eNoMemory
+	};
+	void					SelectMemory(	// Defaults to flash, rewinds
+								uint8_t					inMemory);
+	uint8_t					ReadMemory(	// Returns the bytes read, rewinds
+								uint8_t					inMemory,
+								uint8_t*				outData,
+								uint8_t					inMaxLength);
+	virtual bool			NextRecord(void);
+	virtual uint32_t		EstimateLength(void);
+	virtual bool			Rewind(void);
+	virtual bool			SeekRecord(
+								uint32_t				inPosition,
+								uint8_t					inAddressH);
+	virtual bool			InAddressOrder(void) const
+								{return(true);}
+protected:
+	uint32_t	mPhOffset;			// Of the program header table
+	uint16_t	mPhCount;
+	uint8_t		mMemory;			// EMemory selected
+	uint8_t		mSegment;			// Index of the current segment, kNoSegment
+	uint32_t	mSegmentPAddr;		// Of the current segment
+	uint32_t	mSegmentAddress;	// Of the next data byte, memory relative
+	uint32_t	mSegmentPosition;	// File offset of the next data byte
+	uint32_t	mSegmentEnd;		// File offset following the segment data
+
+	static uint8_t			MemoryOf(
+								uint32_t				inPAddr);
+	uint32_t				MemoryAddress(void) const;
+	bool					NextSegment(void);
+};
+
+#endif /* ElfFile_h */
@@ -0,0 +1,321 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	HexRunIndex.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "HexRunIndex.h"
+#include "ImageSource.h"
+#include <string.h>
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#endif
+
+const char kIndexMagicStr[] PROGMEM = "HRIX";
+const char kIndexExtensionStr[] PROGMEM = ".idx";
+
+/******************************** HexRunIndex *********************************/
+HexRunIndex::HexRunIndex(void)
+	: mFile(nullptr), mValid(false)
+{
+	mHeader.overlapAddress = 0xFFFFFFFF;
+}
+
+/*********************************** begin ************************************/
+/*
+*	Opens the index of inHexPath, building it if it's missing or out of date.
+*	inHexFile must be open on inHexPath.  When building, inHexFile is read and
+*	left rewound.
+*
+*	The index file is only kept open when the runs need to be followed.
+*/
+bool HexRunIndex::begin(
+	const char*		inHexPath,
+	ImageSource&	inHexFile)
+{
+	end();
+	SHexRunHeader	stamp;
+	char			path[64];
+	size_t			pathLen = strlen(inHexPath);
+	if (pathLen < (sizeof(path) - sizeof(kIndexExtensionStr)) &&
+		ImageSource::GetFileStamp(inHexPath, stamp.fileSize, stamp.modified))
+	{
+		memcpy(path, inHexPath, pathLen);
+		strcpy_P(&path[pathLen], kIndexExtensionStr);
+	#ifdef __MACH__
+		mFile = fopen(path, "r+b");
+	#else
+		mFile = mSdFile.open(path, O_RDWR) ? &mSdFile : nullptr;
+	#endif
+		mValid = mFile &&
+			ReadAt(0, &mHeader, sizeof(SHexRunHeader)) &&
+			memcmp_P(mHeader.magic, kIndexMagicStr, sizeof(mHeader.magic)) == 0 &&
+			mHeader.version == HEX_RUN_INDEX_VERSION &&
+			mHeader.fileSize == stamp.fileSize &&
+			mHeader.modified == stamp.modified;
+		if (!mValid)
+		{
+			/*
+			*	Missing or out of date, rebuild it.
+			*/
+			end();
+		#ifdef __MACH__
+			mFile = fopen(path, "w+b");
+		#else
+			mFile = mSdFile.open(path, O_RDWR | O_CREAT | O_TRUNC) ? &mSdFile : nullptr;
+		#endif
+			if (mFile)
+			{
+				mHeader = stamp;
+				mValid = Build(inHexFile);
+			}
+		}
+	}
+	if (!mValid)
+	{
+		mHeader.overlapAddress = 0xFFFFFFFF;
+	}
+	if (!Reordered())
+	{
+		bool	valid = mValid;
+		end();
+		mValid = valid;
+	}
+	return(mValid);
+}
+
+/************************************ end *************************************/
+void HexRunIndex::end(void)
+{
+	if (mFile)
+	{
+	#ifndef __MACH__
+		mFile->close();
+	#else
+		fclose(mFile);
+	#endif
+		mFile = nullptr;
+	}
+	mValid = false;
+}
+
+/************************************ Build ***********************************/
+/*
+*	Reads every record of inHexFile, writing each run as it ends.  A data
+*	record that doesn't follow on from the previous record starts a new run.
+*	The runs of a source that's always in address order aren't written.  The
+*	header is written last so an incomplete index is never used.
+*/
+bool HexRunIndex::Build(
+	ImageSource&	inHexFile)
+{
+	SHexRun	run;
+	bool	keepRuns = !inHexFile.InAddressOrder();
+	bool	inRun = false;
+	bool	endOfFile = false;
+	bool	success = true;
+	memcpy_P(mHeader.magic, kIndexMagicStr, sizeof(mHeader.magic));
+	mHeader.byteCount = 0;
+	mHeader.address = 0xFFFFFFFF;
+	mHeader.endAddress = 0;
+	mHeader.overlapAddress = 0xFFFFFFFF;
+	mHeader.runCount = 0;
+	mHeader.version = HEX_RUN_INDEX_VERSION;
+	mHeader.ordered = true;
+	inHexFile.Rewind();
+	while (success &&
+		inHexFile.NextRecord())
+	{
+		uint8_t	recordType = inHexFile.RecordType();
+		if (recordType == ImageSource::eEndOfFileRecord)
+		{
+			endOfFile = true;
+			break;
+		}
+		if (recordType != ImageSource::eDataRecord)
+		{
+			continue;
+		}
+		uint32_t	address = inHexFile.Address32();
+		if (address < mHeader.address)
+		{
+			mHeader.address = address;
+		}
+		if (keepRuns &&
+			(!inRun || address != run.endAddress))
+		{
+			if (inRun)
+			{
+				if (address < run.endAddress)
+				{
+					mHeader.ordered = false;
+				}
+				run.endPosition = inHexFile.RecordPosition();
+				success = WriteRun(mHeader.runCount, run);
+			}
+			inRun = true;
+			run.address = address;
+			run.position = inHexFile.RecordPosition();
+		}
+		run.endAddress = address + inHexFile.ByteCount();
+		if (run.endAddress > mHeader.endAddress)
+		{
+			mHeader.endAddress = run.endAddress;
+		}
+		mHeader.byteCount += inHexFile.ByteCount();
+	}
+	success = success && endOfFile;
+	if (mHeader.byteCount == 0)
+	{
+		mHeader.address = 0;
+	}
+	if (success &&
+		inRun)
+	{
+		run.endPosition = inHexFile.RecordPosition();	// Of the end of file record
+		success = WriteRun(mHeader.runCount, run);
+	}
+	if (success &&
+		!mHeader.ordered)
+	{
+		success = SortRuns();
+	}
+	success = success && WriteAt(0, &mHeader, sizeof(SHexRunHeader));
+	if (success)
+	{
+	#ifdef __MACH__
+		fflush(mFile);
+	#else
+		mFile->sync();
+	#endif
+	}
+	inHexFile.Rewind();
+	return(success);
+}
+
+/*********************************** WriteRun *********************************/
+/*
+*	Writes inRun at inIndex, appending if inIndex is the run count.
+*/
+bool HexRunIndex::WriteRun(
+	uint16_t		inIndex,
+	const SHexRun&	inRun)
+{
+	bool	success = inIndex < HEX_RUN_INDEX_MAX_RUNS &&
+		WriteAt(sizeof(SHexRunHeader) + (uint32_t)inIndex * sizeof(SHexRun),
+			&inRun, sizeof(SHexRun));
+	if (success &&
+		inIndex == mHeader.runCount)
+	{
+		mHeader.runCount++;
+	}
+	return(success);
+}
+
+/*********************************** ReadRun **********************************/
+bool HexRunIndex::ReadRun(
+	uint16_t	inIndex,
+	SHexRun&	outRun)
+{
+	return(inIndex < mHeader.runCount &&
+		ReadAt(sizeof(SHexRunHeader) + (uint32_t)inIndex * sizeof(SHexRun),
+			&outRun, sizeof(SHexRun)));
+}
+
+/*********************************** SortRuns *********************************/
+/*
+*	Insertion sort by address, in place in the index file.  The runs of a
+*	merged file are mostly in order, so few runs are moved.  Once sorted,
+*	each run is checked against the previous run for an overlap.
+*/
+bool HexRunIndex::SortRuns(void)
+{
+	SHexRun	run;
+	SHexRun	prevRun;
+	bool	success = true;
+	for (uint16_t i = 1; success && i < mHeader.runCount; i++)
+	{
+		success = ReadRun(i, run);
+		uint16_t	j = i;
+		for (; success && j; j--)
+		{
+			success = ReadRun(j-1, prevRun);
+			if (!success ||
+				prevRun.address <= run.address)
+			{
+				break;
+			}
+			success = WriteRun(j, prevRun);
+		}
+		if (success &&
+			j != i)
+		{
+			success = WriteRun(j, run);
+		}
+	}
+	for (uint16_t i = 1; success && i < mHeader.runCount; i++)
+	{
+		success = ReadRun(i-1, prevRun) && ReadRun(i, run);
+		if (success &&
+			prevRun.endAddress > run.address)
+		{
+			mHeader.overlapAddress = run.address;
+			break;
+		}
+	}
+	return(success);
+}
+
+/*********************************** ReadAt ***********************************/
+bool HexRunIndex::ReadAt(
+	uint32_t	inPosition,
+	void*		outData,
+	uint16_t	inLength)
+{
+#ifdef __MACH__
+	return(fseek(mFile, inPosition, SEEK_SET) == 0 &&
+		fread(outData, 1, inLength, mFile) == inLength);
+#else
+	return(mFile->seekSet(inPosition) &&
+		mFile->read(outData, inLength) == inLength);
+#endif
+}
+
+/*********************************** WriteAt **********************************/
+bool HexRunIndex::WriteAt(
+	uint32_t	inPosition,
+	const void*	inData,
+	uint16_t	inLength)
+{
+#ifdef __MACH__
+	return(fseek(mFile, inPosition, SEEK_SET) == 0 &&
+		fwrite(inData, 1, inLength, mFile) == inLength);
+#else
+	return(mFile->seekSet(inPosition) &&
+		mFile->write(inData, inLength) == inLength);
+#endif
+}
@@ -0,0 +1,143 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	HexRunIndex.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	An index of the runs of a hex file, kept on the SD card as <path>.idx
+*	(e.g. Blink.ino.hex.idx).  A run is a sequence of records in file order
+*	whose data is contiguous.  Each run maps an address range to the file
+*	offset of its first record.
+*
+*	SDHexSession loads pages assuming the records are in ascending address
+*	order.  When they aren't, for example a bootloader section placed before
+*	the application, the session follows the runs in address order instead of
+*	reading the file from the start, so each page is assembled from every
+*	record it contains and is programmed once.
+*
+*	The index is built by reading the hex file once.  The runs are written as
+*	they're found, then insertion sorted in place on the card by address, so
+*	only two runs are in SRAM at a time.  Runs that overlap are reported.  The
+*	index is rebuilt when the hex file's size or modification time changes.
+*	In-order files (the norm) are flagged as such and the session reads them
+*	as before.  S-record files are indexed the same way.
+*
+*	The same pass is the image's preflight check (see ImagePreflight.h), so
+*	the header also holds the range of addresses loaded.  An index is only
+*	written for a file whose records are all valid.  Sources that are always
+*	read in address order (elf, bin, lzs) get a header without runs.
+*/
+
+#ifndef HexRunIndex_h
+#define HexRunIndex_h
+
+#include <inttypes.h>
+#ifdef __MACH__
+#include <stdio.h>
+#define SdFile	FILE
+#else
+#include "SdFat.h"
+#endif
+
+class ImageSource;
+
+#define HEX_RUN_INDEX_VERSION	2
+/*
+*	Building an index of a file with more runs than this fails, and the file
+*	is read in file order.
+*/
+#define HEX_RUN_INDEX_MAX_RUNS	256
+
+struct SHexRun
+{
+	uint32_t	address;		// Of the first data byte, bits 19:0
+	uint32_t	endAddress;		// Following the last data byte
+	uint32_t	position;		// File offset of the first record
+	uint32_t	endPosition;	// File offset of the first record not in the run
+};
+
+struct SHexRunHeader
+{
+	char		magic[4];		// "HRIX"
+	uint32_t	fileSize;		// Of the hex file when indexed
+	uint32_t	modified;		// Of the hex file when indexed
+	uint32_t	byteCount;		// Exact data bytes of the hex file
+	uint32_t	address;		// Lowest address loaded, 0 if none
+	uint32_t	endAddress;		// Following the highest address loaded
+	uint32_t	overlapAddress;	// Of the first overlap, 0xFFFFFFFF if none
+	uint16_t	runCount;
+	uint8_t		version;		// HEX_RUN_INDEX_VERSION
+	uint8_t		ordered;		// Non-zero if the runs are in file order
+};
+
+class HexRunIndex
+{
+public:
+							HexRunIndex(void);
+	bool					begin(
+								const char*				inHexPath,
+								ImageSource&			inHexFile);
+	void					end(void);
+	bool					IsValid(void) const	// true if begin succeeded
+								{return(mValid);}
+	bool					Reordered(void) const	// true if the runs need to be followed
+								{return(mValid && !mHeader.ordered && !Overlaps());}
+	bool					Overlaps(void) const
+								{return(mValid && mHeader.overlapAddress != 0xFFFFFFFF);}
+	uint32_t				OverlapAddress(void) const
+								{return(mHeader.overlapAddress);}
+	uint32_t				ByteCount(void) const
+								{return(mHeader.byteCount);}
+	uint32_t				Address(void) const
+								{return(mHeader.address);}
+	uint32_t				EndAddress(void) const
+								{return(mHeader.endAddress);}
+	uint16_t				RunCount(void) const
+								{return(mHeader.runCount);}
+	bool					ReadRun(
+								uint16_t				inIndex,
+								SHexRun&				outRun);
+protected:
+#ifndef __MACH__
+	SdFile			mSdFile;
+#endif
+	SdFile*			mFile;
+	SHexRunHeader	mHeader;
+	bool			mValid;
+
+	bool					Build(
+								ImageSource&			inHexFile);
+	bool					SortRuns(void);
+	bool					WriteRun(
+								uint16_t				inIndex,
+								const SHexRun&			inRun);
+	bool					ReadAt(
+								uint32_t				inPosition,
+								void*					outData,
+								uint16_t				inLength);
+	bool					WriteAt(
+								uint32_t				inPosition,
+								const void*				inData,
+								uint16_t				inLength);
+};
+
+#endif /* HexRunIndex_h */
@@ -0,0 +1,134 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	ImagePreflight.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "ImagePreflight.h"
+#include "ImageSource.h"
+#include "HexRunIndex.h"
+#include <string.h>
+
+/******************************* ImagePreflight *******************************/
+ImagePreflight::ImagePreflight(void)
+{
+	memset(&mResult, 0, sizeof(SImagePreflight));
+}
+
+/*********************************** begin ************************************/
+/*
+*	Reads every record of inImage in file order.  The image is valid if every
+*	record up to and including the end of file record is valid.  inImage is
+*	left rewound.
+*/
+bool ImagePreflight::begin(
+	ImageSource&	inImage)
+{
+	mResult.valid = false;
+	mResult.byteCount = 0;
+	mResult.address = 0xFFFFFFFF;
+	mResult.endAddress = 0;
+	inImage.Rewind();
+	while (inImage.NextRecord())
+	{
+		uint8_t	recordType = inImage.RecordType();
+		if (recordType == ImageSource::eEndOfFileRecord)
+		{
+			mResult.valid = true;
+			break;
+		}
+		if (recordType == ImageSource::eDataRecord)
+		{
+			uint32_t	address = inImage.Address32();
+			if (address < mResult.address)
+			{
+				mResult.address = address;
+			}
+			address += inImage.ByteCount();
+			if (address > mResult.endAddress)
+			{
+				mResult.endAddress = address;
+			}
+			mResult.byteCount += inImage.ByteCount();
+		}
+	}
+	if (mResult.byteCount == 0)
+	{
+		mResult.address = 0;
+	}
+	inImage.Rewind();
+	return(IsValid());
+}
+
+/*********************************** begin ************************************/
+/*
+*	An index is only valid if every record of its image was, so nothing is
+*	read.
+*/
+bool ImagePreflight::begin(
+	const HexRunIndex&	inIndex)
+{
+	mResult.valid = inIndex.IsValid();
+	mResult.byteCount = inIndex.ByteCount();
+	mResult.address = inIndex.Address();
+	mResult.endAddress = inIndex.EndAddress();
+	return(IsValid());
+}
+
+/*********************************** FitsIn ***********************************/
+/*
+*	An application has to end before the bootloader section, which is what
+*	upload.maximum_size is for boards with a bootloader.  Any image has to fit
+*	in its memory.  Limits that aren't in the config aren't checked.
+*/
+bool ImagePreflight::FitsIn(
+	const SAVRConfig&	inConfig,
+	uint8_t				inImage) const
+{
+	uint32_t	endAddress = mResult.endAddress;
+	bool		fits;
+	if (inImage == eEEPROM)
+	{
+		fits = inConfig.eepromSize == 0 || endAddress <= inConfig.eepromSize;
+	} else
+	{
+		fits = (inConfig.flashSize == 0 || endAddress <= inConfig.flashSize) &&
+			(inImage != eApplication ||
+				inConfig.uploadMaximumSize == 0 ||
+				endAddress <= inConfig.uploadMaximumSize);
+	}
+	return(fits);
+}
+
+/********************************** Overlaps **********************************/
+/*
+*	Returns true if the address ranges of the two images overlap, e.g. an
+*	application that extends into the bootloader loaded with it.
+*/
+bool ImagePreflight::Overlaps(
+	const ImagePreflight&	inPreflight) const
+{
+	return(mResult.byteCount != 0 &&
+		inPreflight.mResult.byteCount != 0 &&
+		mResult.address < inPreflight.mResult.endAddress &&
+		inPreflight.mResult.address < mResult.endAddress);
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	ImagePreflight.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Checks an image before a session does anything to the target, so that a
+*	file that can't be loaded is never discovered after the chip has been
+*	erased.  Every record is read once to check that it's valid (checksums,
+*	supported record types, the end of file record), and to get the exact
+*	data byte count and the range of addresses loaded.
+*
+*	The check is the same pass that builds the image's run index, so when the
+*	image has a valid index the result is taken from its header (see
+*	HexRunIndex.h) and the image isn't read again.  Otherwise, e.g. the EEPROM
+*	of an .elf file or an image with too many runs, the image is read here.
+*	The range is then checked against the config (see FitsIn), which isn't
+*	part of the index because the config can change independently of the
+*	image.
+*/
+
+#ifndef ImagePreflight_h
+#define ImagePreflight_h
+
+#include <inttypes.h>
+#include "AVRConfig.h"
+
+class ImageSource;
+class HexRunIndex;
+
+struct SImagePreflight
+{
+	uint32_t	byteCount;		// Exact data bytes
+	uint32_t	address;		// Lowest address loaded, 0 if none
+	uint32_t	endAddress;		// Following the highest address loaded
+	uint8_t		valid;			// Non-zero if every record is valid
+};
+
+class ImagePreflight
+{
+public:
+							ImagePreflight(void);
+	/*
+	*	The image kinds are in the same order as SDHexSession::ERecipeFile.
+	*/
+	enum EImage
+	{
+		eApplication,
+		eBootloader,
+		eEEPROM
+	};
+	bool					begin(	// Returns true if the records are valid
+								ImageSource&			inImage);
+	bool					begin(	// From a valid index
+								const HexRunIndex&		inIndex);
+	bool					IsValid(void) const
+								{return(mResult.valid != 0);}
+	uint32_t				ByteCount(void) const
+								{return(mResult.byteCount);}
+	uint32_t				Address(void) const
+								{return(mResult.address);}
+	uint32_t				EndAddress(void) const
+								{return(mResult.endAddress);}
+	bool					FitsIn(
+								const SAVRConfig&		inConfig,
+								uint8_t					inImage) const;
+	bool					Overlaps(
+								const ImagePreflight&	inPreflight) const;
+protected:
+	SImagePreflight	mResult;
+
+};
+
+#endif /* ImagePreflight_h */
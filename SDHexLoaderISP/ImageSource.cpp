@@ -0,0 +1,296 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	ImageSource.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "ImageSource.h"
+#include "BufferArena.h"
+#include <string.h>
+#ifndef __MACH__
+#include <Arduino.h>
+#include "sdios.h"
+#else
+#include <sys/stat.h>
+#endif
+
+/******************************** ImageSource *********************************/
+ImageSource::ImageSource(void)
+	: mFile(nullptr), mReadBuffer(nullptr), mReadBufferSize(0), mReadIndex(0),
+	  mReadLength(0), mEndOfFile(false), mByteCount(0),
+	  mRecordType(eInvalidRecordType), mAddressH(0), mAddress(0),
+	  mRecordPosition(0)
+{
+}
+
+/*********************************** begin ************************************/
+/*
+*	The read buffer is whatever remains of the BufferArena in the current
+*	phase.  When there is none, the file is read a char at a time.
+*/
+bool ImageSource::begin(
+	const char*	inPath)
+{
+	mReadBuffer = BufferArena::Region(BufferArena::eReadRegion, &mReadBufferSize);
+#ifdef __MACH__
+	mFile = fopen(inPath, "r+");
+	bool success = mFile != nullptr;
+#else
+	bool success = mSdFile.open(inPath, O_RDONLY);
+	mFile = success ? &mSdFile : nullptr;
+#endif
+	Rewind();
+	return(success);
+}
+
+/************************************ end *************************************/
+void ImageSource::end(void)
+{
+	if (mFile)
+	{
+	#ifndef __MACH__
+		mFile->close();
+	#else
+		fclose(mFile);
+	#endif
+		mFile = nullptr;
+	}
+}
+
+/*********************************** Rewind ***********************************/
+bool ImageSource::Rewind(void)
+{
+	mRecordType = eInvalidRecordType;
+	mByteCount = 0;
+	mAddressH = 0;
+	mEndOfFile = false;
+	return(Seek(0));
+}
+
+/********************************* SeekRecord *********************************/
+/*
+*	Returns to a record previously read.  inPosition is the RecordPosition() of
+*	the record, inAddressH is the AddressH() at the time it was read.
+*/
+bool ImageSource::SeekRecord(
+	uint32_t	inPosition,
+	uint8_t		inAddressH)
+{
+	return(SeekLine(inPosition, inAddressH) && NextRecord());
+}
+
+/********************************** SeekLine **********************************/
+/*
+*	For line based formats, where the record position is that of the line.
+*	Positions the file so that the next NextRecord() reads the record at
+*	inPosition.
+*/
+bool ImageSource::SeekLine(
+	uint32_t	inPosition,
+	uint8_t		inAddressH)
+{
+	bool success = Seek(inPosition);
+	mAddressH = inAddressH;
+	mRecordType = eInvalidRecordType;
+	mByteCount = 0;
+	mEndOfFile = false;
+	return(success);
+}
+
+/***************************** SetEndOfFileRecord *****************************/
+/*
+*	Replaces the current record with an end of file record.
+*/
+void ImageSource::SetEndOfFileRecord(void)
+{
+	mRecordType = eEndOfFileRecord;
+	mByteCount = 0;
+	mAddress = 0;
+}
+
+/******************************** GetFileStamp ********************************/
+/*
+*	Gets the size and modification time of the file at inPath.  A cache of
+*	information read from a file (e.g. HexRunIndex) is valid while these don't
+*	change.
+*/
+bool ImageSource::GetFileStamp(
+	const char*	inPath,
+	uint32_t&	outFileSize,
+	uint32_t&	outModified)
+{
+#ifdef __MACH__
+	struct stat	status;
+	bool	success = stat(inPath, &status) == 0;
+	if (success)
+	{
+		outFileSize = status.st_size;
+		outModified = status.st_mtime;
+	}
+#else
+	SdFile	file;
+	bool	success = file.open(inPath, O_RDONLY);
+	if (success)
+	{
+		dir_t	dirEntry;
+		success = file.dirEntry(&dirEntry);
+		outFileSize = dirEntry.fileSize;
+		outModified = ((uint32_t)dirEntry.lastWriteDate << 16) |
+								dirEntry.lastWriteTime;
+		file.close();
+	}
+#endif
+	return(success);
+}
+
+/************************************ Seek ************************************/
+/*
+*	Sets the file position and discards anything in the read buffer.
+*/
+bool ImageSource::Seek(
+	uint32_t	inPosition)
+{
+	bool success = false;
+	mReadIndex = 0;
+	mReadLength = 0;
+	if (mFile)
+	{
+	#ifdef __MACH__
+		success = fseek(mFile, inPosition, SEEK_SET) == 0;
+	#else
+		success = mFile->seekSet(inPosition);
+	#endif
+	}
+	return(success);
+}
+
+/********************************** Position **********************************/
+/*
+*	Returns the file offset of the next char returned by NextChar.
+*/
+uint32_t ImageSource::Position(void) const
+{
+#ifdef __MACH__
+	uint32_t	position = ftell(mFile);
+#else
+	uint32_t	position = mFile->curPosition();
+#endif
+	return(position - (mReadLength - mReadIndex));
+}
+
+/********************************** FileSize **********************************/
+/*
+*	The file position isn't changed.
+*/
+uint32_t ImageSource::FileSize(void)
+{
+#ifdef __MACH__
+	struct stat	status;
+	return(fstat(fileno(mFile), &status) == 0 ? status.st_size : 0);
+#else
+	return(mFile->fileSize());
+#endif
+}
+
+/********************************** NextChar **********************************/
+uint8_t ImageSource::NextChar(void)
+{
+	char	thisChar;
+	if (mReadBuffer)
+	{
+		if (mReadIndex >= mReadLength)
+		{
+		#ifdef __MACH__
+			int	bytesRead = (int)fread(mReadBuffer, 1, mReadBufferSize, mFile);
+		#else
+			int	bytesRead = mFile->read(mReadBuffer, mReadBufferSize);
+		#endif
+			mReadIndex = 0;
+			mReadLength = bytesRead > 0 ? bytesRead : 0;
+			if (mReadLength == 0)
+			{
+				return(0);
+			}
+		}
+		return(mReadBuffer[mReadIndex++]);
+	}
+#ifdef __MACH__
+	thisChar = getc(mFile);
+	if (thisChar == -1)
+	{
+		thisChar = 0;
+	}
+#else
+	if (mFile->read(&thisChar,1) != 1)
+	{
+		thisChar = 0;
+	}
+#endif
+	return(thisChar);
+}
+
+/********************************** ReadData **********************************/
+/*
+*	Reads inLength bytes via the read buffer.  Unlike NextChar, a zero byte is
+*	data, so the length read is what determines the end of the file.
+*/
+bool ImageSource::ReadData(
+	void*		outData,
+	uint16_t	inLength)
+{
+	uint8_t*	data = (uint8_t*)outData;
+	if (!mReadBuffer)
+	{
+	#ifdef __MACH__
+		return(fread(data, 1, inLength, mFile) == inLength);
+	#else
+		return(mFile->read(data, inLength) == inLength);
+	#endif
+	}
+	while (inLength)
+	{
+		if (mReadIndex >= mReadLength)
+		{
+		#ifdef __MACH__
+			int	bytesRead = (int)fread(mReadBuffer, 1, mReadBufferSize, mFile);
+		#else
+			int	bytesRead = mFile->read(mReadBuffer, mReadBufferSize);
+		#endif
+			mReadIndex = 0;
+			mReadLength = bytesRead > 0 ? bytesRead : 0;
+			if (mReadLength == 0)
+			{
+				return(false);
+			}
+		}
+		uint16_t	length = mReadLength - mReadIndex;
+		if (length > inLength)
+		{
+			length = inLength;
+		}
+		memcpy(data, &mReadBuffer[mReadIndex], length);
+		mReadIndex += length;
+		data += length;
+		inLength -= length;
+	}
+	return(true);
+}
@@ -0,0 +1,147 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	ImageSource.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	The interface SDHexSession uses to read a memory image from the SD card.
+*	An image is read as a sequence of records.  A data record has an address
+*	and up to 16 bytes of data.  The last record is an end of file record.
+*	Records of other types carry no data and are skipped by the session.
+*
+*	The implementations are IntelHexFile (.hex, .eep), SRecordFile (.s19,
+*	.s28, .s37), BinaryFile (.bin), LZSSFile (.lzs) and ElfFile (.elf).  This
+*	class owns the file, the read buffer from the BufferArena, and the current
+*	record.
+*
+*	RecordPosition() identifies a record so that it can be returned to via
+*	SeekRecord().  What the position is depends on the implementation.
+*
+*	SDHexSession constructs the implementation for each file in a single
+*	block of storage, so the placement operator new is declared here rather
+*	than relying on the Arduino core providing one.
+*/
+
+#ifndef ImageSource_h
+#define ImageSource_h
+
+#include <inttypes.h>
+#include <stddef.h>
+#ifdef __MACH__
+#include <stdio.h>
+#define SdFile	FILE
+#else
+#include "SdFat.h"
+#endif
+
+class ImageSource
+{
+public:
+							ImageSource(void);
+	static void*			operator new(
+								size_t					inSize,
+								void*					inStorage)
+								{return(inStorage);}
+	virtual bool			begin(
+								const char*				inPath);
+	void					end(void);	// Close the file
+	virtual bool			NextRecord(void) = 0;
+	virtual bool			Rewind(void);
+	virtual bool			SeekRecord(
+								uint32_t				inPosition,
+								uint8_t					inAddressH);
+	bool					SeekLine(	// Line based formats, see SeekRecord
+								uint32_t				inPosition,
+								uint8_t					inAddressH);
+	/*
+	*	The number of data bytes.  Exact unless the implementation has to read
+	*	the entire file to determine it (IntelHexFile.)  Leaves the image
+	*	rewound.
+	*/
+	virtual uint32_t		EstimateLength(void) = 0;
+	/*
+	*	True if the records are always returned in ascending address order,
+	*	i.e. a run index isn't needed.
+	*/
+	virtual bool			InAddressOrder(void) const
+								{return(false);}
+	uint8_t					RecordType(void) const
+								{return(mRecordType);}
+	uint16_t				Address(void) const
+								{return(mAddress);}
+	uint8_t					AddressH(void) const
+								{return(mAddressH);}
+	uint32_t				Address32(void) const
+								{return(((uint32_t)mAddressH << 16) | mAddress);}
+	const uint8_t*			Data(void) const
+								{return(mData);}
+	uint8_t*				Data(void)	// For replacing data, see SDHexSession
+								{return(mData);}
+	uint8_t					ByteCount(void) const
+								{return(mByteCount);}
+	uint32_t				RecordPosition(void) const	// Of the current record
+								{return(mRecordPosition);}
+	void					SetEndOfFileRecord(void);
+	static bool				GetFileStamp(	// For caches of what's read
+								const char*				inPath,
+								uint32_t&				outFileSize,
+								uint32_t&				outModified);
+	enum ERecordType
+	{
+		eDataRecord,
+		eEndOfFileRecord,
+		eExtendedSegmentAddress,
+		eStartSegmentAddress,
+		/*eExtendedLinearAddress,
+		eStartLinearAddress,*/
+		eInformationRecord,		// Header and record counts, no data
+		eInvalidRecordType
+	};
+
+protected:
+#ifndef __MACH__
+	SdFile		mSdFile;
+#endif
+	SdFile*		mFile;
+	uint8_t*	mReadBuffer;	// From BufferArena, nullptr if none
+	uint16_t	mReadBufferSize;
+	uint16_t	mReadIndex;		// Of the next char in mReadBuffer
+	uint16_t	mReadLength;	// Chars in mReadBuffer
+	bool		mEndOfFile;	// Set when the end of file record is read.
+	uint8_t		mByteCount;
+	uint8_t		mRecordType;
+	uint8_t		mData[16];
+	uint8_t		mAddressH; // Represents bits 23:16 of the final address.
+	uint16_t	mAddress;
+	uint32_t	mRecordPosition;
+
+	uint8_t					NextChar(void);
+	bool					ReadData(
+								void*					outData,
+								uint16_t				inLength);
+	bool					Seek(
+								uint32_t				inPosition);
+	uint32_t				Position(void) const;
+	uint32_t				FileSize(void);
+};
+
+#endif /* ImageSource_h */
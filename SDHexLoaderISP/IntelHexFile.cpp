@@ -26,87 +26,14 @@
 #include "IntelHexFile.h"
 #ifndef __MACH__
 #include <Arduino.h>
-#include "sdios.h"
 #endif
 
-/******************************** IntelHexFile ********************************/
-IntelHexFile::IntelHexFile(void)
-	: mFile(nullptr)
-{
-}
-
-/*********************************** begin ************************************/
-bool IntelHexFile::begin(
-	const char*	inPath)
-{
-#ifdef __MACH__
-	mFile = fopen(inPath, "r+");
-	bool success = mFile != nullptr;
-#else
-	bool success = mSdFile.open(inPath, O_RDONLY);
-	mFile = success ? &mSdFile : nullptr;
-#endif
-	Rewind();
-	return(success);
-}
-
-/************************************ end *************************************/
-void IntelHexFile::end(void)
-{
-	if (mFile)
-	{
-	#ifndef __MACH__
-		mFile->close();
-	#else
-		fclose(mFile);
-	#endif
-		mFile = nullptr;
-	}
-}
-
-/*********************************** Rewind ***********************************/
-bool IntelHexFile::Rewind(void)
-{
-	mRecordType = eInvalidRecordType;
-	mByteCount = 0;
-	mAddressH = 0;
-	mEndOfFile = false;
-	bool success = false;
-	if (mFile)
-	{
-	#ifdef __MACH__
-		success = fseek(mFile, 0, SEEK_SET) == 0;
-	#else
-		success = mFile->seekSet(0);
-	#endif
-	}
-	return(success);
-}
-
-/********************************** NextChar **********************************/
-uint8_t IntelHexFile::NextChar(void)
-{
-	char	thisChar;
-#ifdef __MACH__
-	thisChar = getc(mFile);
-	if (thisChar == -1)
-	{
-		thisChar = 0;
-	}
-#else
-	if (mFile->read(&thisChar,1) != 1)
-	{
-		thisChar = 0;
-	}
-#endif
-	return(thisChar);
-}
-
 /********************************* NextRecord *********************************/
 bool IntelHexFile::NextRecord(void)
 {
 	uint8_t	checksum = 1;	// Error if NextChar doesn't return a startcode (:)
 	mRecordType = eInvalidRecordType;
+	mRecordPosition = Position();
 	/*
 	*	If startcode...
 	*/
@@ -242,25 +169,12 @@ uint32_t IntelHexFile::EstimateLength(void)
 	uint32_t	estimatedLength = 0;
 	if (mFile)
 	{
-		size_t	fileSize;
-	#ifdef __MACH__
-		fseek(mFile, 0, SEEK_END);
-		fileSize = ftell(mFile);
-		fseek(mFile, 0, SEEK_SET);
-	#else
-		fileSize = mFile->fileSize();
-	#endif
+		size_t	fileSize = FileSize();
 		if (fileSize > 256)
 		{
 			while (NextRecord() && RecordType() != eDataRecord){}
 			uint32_t	startingAddress = Address32();
-			if (
-		#ifdef __MACH__
-				fseek(mFile, fileSize-256, SEEK_SET) == 0
-		#else
-				mFile->seekSet(fileSize - 256)
-		#endif
-			)
+			if (Seek(fileSize - 256))
 			{
 				// Skip to the start of the next line.
 				uint8_t thisChar = NextChar();
@@ -0,0 +1,232 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	IntelHexWriter.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "IntelHexWriter.h"
+#include "BufferArena.h"
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#include <string.h>
+#endif
+
+/******************************* IntelHexWriter *******************************/
+IntelHexWriter::IntelHexWriter(void)
+	: mFile(nullptr), mBuffer(nullptr)
+{
+}
+
+/*********************************** begin ************************************/
+/*
+*	Creates the file, replacing any existing file of the same name.  Fails if
+*	the BufferArena phase doesn't include the writer region.
+*/
+bool IntelHexWriter::begin(
+	const char*	inPath)
+{
+	Close();
+	mBuffer = (char*)BufferArena::Region(BufferArena::eWriterRegion);
+	if (!mBuffer)
+	{
+		return(false);
+	}
+#ifdef __MACH__
+	mFile = fopen(inPath, "w");
+	if (mFile)
+	{
+		strncpy(mPath, inPath, sizeof(mPath)-1);
+		mPath[sizeof(mPath)-1] = 0;
+	}
+#else
+	if (mSdFile.open(inPath, O_WRONLY | O_CREAT | O_TRUNC))
+	{
+		mFile = &mSdFile;
+	}
+#endif
+	mAddress = 0;
+	mRecordAddress = 0;
+	mFFRunLength = 0;
+	mDataByteCount = 0;
+	mSegment = 0;
+	mRecordLength = 0;
+	mBufferLength = 0;
+	mError = false;
+	return(mFile != nullptr);
+}
+
+/************************************ end *************************************/
+/*
+*	Any held back 0xFF bytes are dropped.  Returns false if there was a write
+*	error at any point.
+*/
+bool IntelHexWriter::end(void)
+{
+	if (mFile)
+	{
+		WriteDataRecord();
+		WriteRecord(1, 0, nullptr, 0);	// End Of File
+		FlushBuffer();
+		Close();
+	}
+	return(!mError);
+}
+
+/*********************************** Close ************************************/
+void IntelHexWriter::Close(void)
+{
+	if (mFile)
+	{
+	#ifndef __MACH__
+		mFile->close();
+	#else
+		fclose(mFile);
+	#endif
+		mFile = nullptr;
+	}
+}
+
+/********************************** GetName ***********************************/
+void IntelHexWriter::GetName(
+	char*	outName,
+	uint8_t	inMaxLen)
+{
+#ifdef __MACH__
+	size_t	nameLen = strnlen(mPath, inMaxLen - 1);
+	memcpy(outName, mPath, nameLen);
+	outName[nameLen] = 0;
+#else
+	mSdFile.getName(outName, inMaxLen);
+#endif
+}
+
+/************************************ Put *************************************/
+void IntelHexWriter::Put(
+	uint8_t	inByte)
+{
+	if (inByte == 0xFF)
+	{
+		mFFRunLength++;
+	} else
+	{
+		for (; mFFRunLength; mFFRunLength--)
+		{
+			PutData(0xFF);
+		}
+		PutData(inByte);
+	}
+}
+
+/********************************** PutData ***********************************/
+void IntelHexWriter::PutData(
+	uint8_t	inByte)
+{
+	if (mRecordLength == 0)
+	{
+		mRecordAddress = mAddress;
+	}
+	mRecord[mRecordLength++] = inByte;
+	mAddress++;
+	/*
+	*	A record never crosses a 64KB boundary.
+	*/
+	if (mRecordLength == sizeof(mRecord) ||
+		(uint16_t)mAddress == 0)
+	{
+		WriteDataRecord();
+	}
+}
+
+/****************************** WriteDataRecord *******************************/
+void IntelHexWriter::WriteDataRecord(void)
+{
+	if (mRecordLength)
+	{
+		uint8_t	segment = mRecordAddress >> 16;
+		if (segment != mSegment)
+		{
+			mSegment = segment;
+			// Segment address bits 19:16 -> segment 0xN000
+			uint8_t	segmentAddress[2] = {(uint8_t)(segment << 4), 0};
+			WriteRecord(2, 0, segmentAddress, 2);
+		}
+		WriteRecord(0, mRecordAddress, mRecord, mRecordLength);
+		mDataByteCount += mRecordLength;
+		mRecordLength = 0;
+	}
+}
+
+/******************************** WriteRecord *********************************/
+void IntelHexWriter::WriteRecord(
+	uint8_t			inRecordType,
+	uint16_t		inAddress,
+	const uint8_t*	inData,
+	uint8_t			inLength)
+{
+	/*
+	*	Longest record: 1 + (5 + 16)*2 + 2 = 45 chars including CRLF
+	*/
+	if ((mBufferLength + 45) > HEX_WRITER_BUFFER_SIZE)
+	{
+		FlushBuffer();
+	}
+	uint8_t	checksum = inLength + (inAddress >> 8) + inAddress + inRecordType;
+	mBuffer[mBufferLength++] = ':';
+	AppendHexByte(inLength);
+	AppendHexByte(inAddress >> 8);
+	AppendHexByte(inAddress);
+	AppendHexByte(inRecordType);
+	for (uint8_t i = 0; i < inLength; i++)
+	{
+		checksum += inData[i];
+		AppendHexByte(inData[i]);
+	}
+	AppendHexByte(-checksum);
+	mBuffer[mBufferLength++] = '\r';
+	mBuffer[mBufferLength++] = '\n';
+}
+
+/******************************* AppendHexByte ********************************/
+void IntelHexWriter::AppendHexByte(
+	uint8_t	inByte)
+{
+	// IntelHexFile only supports uppercase hex ascii
+	uint8_t	nibble = inByte >> 4;
+	mBuffer[mBufferLength++] = nibble + (nibble < 10 ? '0' : ('A' - 10));
+	nibble = inByte & 0xF;
+	mBuffer[mBufferLength++] = nibble + (nibble < 10 ? '0' : ('A' - 10));
+}
+
+/******************************** FlushBuffer *********************************/
+void IntelHexWriter::FlushBuffer(void)
+{
+	if (mBufferLength)
+	{
+	#ifdef __MACH__
+		mError |= fwrite(mBuffer, 1, mBufferLength, mFile) != mBufferLength;
+	#else
+		mError |= mFile->write(mBuffer, mBufferLength) != mBufferLength;
+	#endif
+		mBufferLength = 0;
+	}
+}
@@ -0,0 +1,100 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	IntelHexWriter.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Writes sequential data as an Intel Hex file.  Records are 16 bytes.
+*	Extended segment address records (type 2) are used for addresses above
+*	64KB, the only extended address type IntelHexFile supports.
+*
+*	Runs of 0xFF are held back and only written when followed by other data,
+*	so erased memory at the end isn't written.
+*
+*	Lines are assembled in a buffer and written to the file when the buffer is
+*	full, rather than per record.
+*/
+
+#ifndef IntelHexWriter_h
+#define IntelHexWriter_h
+
+#include <inttypes.h>
+#ifdef __MACH__
+#include <stdio.h>
+#define SdFile	FILE
+#else
+#include "SdFat.h"
+#endif
+
+#define HEX_WRITER_BUFFER_SIZE	128
+
+class IntelHexWriter
+{
+public:
+							IntelHexWriter(void);
+	bool					begin(
+								const char*				inPath);
+	bool					end(void);	// Writes EOF record and closes
+	void					Close(void);	// Closes without an EOF record
+	bool					IsOpen(void) const
+								{return(mFile != nullptr);}
+	void					Put(
+								uint8_t					inByte);
+	void					GetName(
+								char*					outName,
+								uint8_t					inMaxLen);
+	uint32_t				DataByteCount(void) const
+								{return(mDataByteCount);}
+	bool					Error(void) const
+								{return(mError);}
+protected:
+#ifndef __MACH__
+	SdFile		mSdFile;
+#else
+	char		mPath[256];
+#endif
+	SdFile*		mFile;
+	char*		mBuffer;	// HEX_WRITER_BUFFER_SIZE bytes from BufferArena
+	uint32_t	mAddress;		// Of the next byte to be placed in mRecord
+	uint32_t	mRecordAddress;
+	uint32_t	mFFRunLength;	// Of 0xFF bytes held back
+	uint32_t	mDataByteCount;	// Bytes written as data records
+	uint8_t		mSegment;		// Current address bits 19:16
+	uint8_t		mRecordLength;
+	uint8_t		mBufferLength;
+	bool		mError;
+	uint8_t		mRecord[16];
+
+	void					PutData(
+								uint8_t					inByte);
+	void					WriteDataRecord(void);
+	void					WriteRecord(
+								uint8_t					inRecordType,
+								uint16_t				inAddress,
+								const uint8_t*			inData,
+								uint8_t					inLength);
+	void					AppendHexByte(
+								uint8_t					inByte);
+	void					FlushBuffer(void);
+};
+
+#endif /* IntelHexWriter_h */
@@ -0,0 +1,244 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	LZSSFile.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "LZSSFile.h"
+#include <string.h>
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define memcmp_P memcmp
+#endif
+
+const char kLZSSIdentStr[] PROGMEM = "LZS\x01";
+
+/********************************** LZSSFile **********************************/
+LZSSFile::LZSSFile(void)
+	: mLength(0), mPosition(0), mBlockAddress(0), mBlockLength(0),
+	  mBlockCount(0), mBlocksLeft(0), mWindowBits(0), mLengthBits(0), mBits(0),
+	  mBitsLeft(0), mWindowIndex(0), mCopyIndex(0), mCopyLength(0)
+{
+}
+
+/*********************************** begin ************************************/
+bool LZSSFile::begin(
+	const char*	inPath)
+{
+	SLZSSHeader	header;
+	mLength = 0;
+	mBlockCount = 0;
+	bool	success = ImageSource::begin(inPath) &&
+		Seek(0) &&
+		ReadData(&header, sizeof(SLZSSHeader)) &&
+		memcmp_P(header.ident, kLZSSIdentStr, 4) == 0 &&
+		header.windowBits <= LZSS_WINDOW_BITS &&
+		header.lengthBits != 0 && header.lengthBits <= 8;
+	if (success)
+	{
+		mLength = header.length;
+		mBlockCount = header.blockCount;
+		mWindowBits = header.windowBits;
+		mLengthBits = header.lengthBits;
+	}
+	Rewind();
+	return(success);
+}
+
+/*********************************** Rewind ***********************************/
+bool LZSSFile::Rewind(void)
+{
+	mPosition = 0;
+	mBlockLength = 0;
+	mBlocksLeft = mBlockCount;
+	mBitsLeft = 0;
+	mWindowIndex = 0;
+	mCopyLength = 0;
+	ImageSource::Rewind();
+	return(Seek(sizeof(SLZSSHeader)));
+}
+
+/********************************* SeekRecord *********************************/
+/*
+*	The address is determined by inPosition, inAddressH isn't used.  Seeking
+*	forward decodes the records in between, seeking backwards also decodes
+*	the records preceding inPosition.  This is only done when a session
+*	resumes from a checkpoint.
+*/
+bool LZSSFile::SeekRecord(
+	uint32_t	inPosition,
+	uint8_t		inAddressH)
+{
+	bool	success = inPosition >= mPosition || Rewind();
+	while (success && mPosition < inPosition)
+	{
+		success = NextRecord();
+	}
+	return(success && mPosition == inPosition && NextRecord());
+}
+
+/********************************** NextBits **********************************/
+bool LZSSFile::NextBits(
+	uint8_t		inCount,
+	uint16_t&	outValue)
+{
+	uint16_t	value = 0;
+	for (; inCount; inCount--)
+	{
+		if (mBitsLeft == 0)
+		{
+			if (!ReadData(&mBits, 1))
+			{
+				return(false);
+			}
+			mBitsLeft = 8;
+		}
+		value = (value << 1) | (mBits >> 7);
+		mBits <<= 1;
+		mBitsLeft--;
+	}
+	outValue = value;
+	return(true);
+}
+
+/********************************** NextByte **********************************/
+/*
+*	Returns the next byte of the decoded image.  Fails when the compressed
+*	data ends early or a copy refers to data preceding the image.
+*/
+bool LZSSFile::NextByte(
+	uint8_t&	outByte)
+{
+	uint16_t	value;
+	if (mCopyLength == 0)
+	{
+		if (!NextBits(1, value))
+		{
+			return(false);
+		}
+		if (value)
+		{
+			if (!NextBits(8, value))
+			{
+				return(false);
+			}
+			outByte = value;
+		} else
+		{
+			uint16_t	offset;
+			if (!NextBits(mWindowBits, offset) ||
+				!NextBits(mLengthBits, value) ||
+				offset >= mPosition)
+			{
+				return(false);
+			}
+			mCopyIndex = (mWindowIndex - offset - 1) & (LZSS_WINDOW_SIZE - 1);
+			mCopyLength = value + LZSS_MIN_MATCH;
+		}
+	}
+	if (mCopyLength)
+	{
+		outByte = mWindow[mCopyIndex];
+		mCopyIndex = (mCopyIndex + 1) & (LZSS_WINDOW_SIZE - 1);
+		mCopyLength--;
+	}
+	mWindow[mWindowIndex] = outByte;
+	mWindowIndex = (mWindowIndex + 1) & (LZSS_WINDOW_SIZE - 1);
+	mPosition++;
+	return(true);
+}
+
+/********************************* NextBlock **********************************/
+/*
+*	Reads the block header following the current block.  The block's data
+*	starts on a byte boundary.  A copy can't extend past the end of a block.
+*/
+bool LZSSFile::NextBlock(void)
+{
+	SLZSSBlock	block;
+	bool	success = mCopyLength == 0 &&
+		ReadData(&block, sizeof(SLZSSBlock)) &&
+		block.length != 0 &&
+		block.address < 0x1000000 &&
+		block.length <= (0x1000000 - block.address);
+	if (success)
+	{
+		mBlockAddress = block.address;
+		mBlockLength = block.length;
+		mBlocksLeft--;
+		mBitsLeft = 0;
+	}
+	return(success);
+}
+
+/********************************* NextRecord *********************************/
+/*
+*	Data records end on a 16 byte address boundary so a record never crosses a
+*	64KB boundary.  A copy can continue into the following record.
+*/
+bool LZSSFile::NextRecord(void)
+{
+	mRecordType = eInvalidRecordType;
+	mRecordPosition = mPosition;
+	bool	success = mFile != nullptr;
+	if (success)
+	{
+		if (mBlockLength == 0 &&
+			mBlocksLeft == 0)
+		{
+			SetEndOfFileRecord();
+			mEndOfFile = true;
+		} else
+		{
+			success = mBlockLength != 0 || NextBlock();
+			uint32_t	address = mBlockAddress;
+			uint8_t		byteCount = 16 - (address & 0xF);
+			if (byteCount > mBlockLength)
+			{
+				byteCount = mBlockLength;
+			}
+			for (uint8_t i = 0; success && i < byteCount; i++)
+			{
+				success = NextByte(mData[i]);
+			}
+			if (success)
+			{
+				mRecordType = eDataRecord;
+				mByteCount = byteCount;
+				mAddressH = address >> 16;
+				mAddress = address;
+				mBlockAddress += byteCount;
+				mBlockLength -= byteCount;
+			}
+		}
+	}
+	return(success);
+}
+
+/******************************* EstimateLength *******************************/
+uint32_t LZSSFile::EstimateLength(void)
+{
+	Rewind();
+	return(mLength);
+}
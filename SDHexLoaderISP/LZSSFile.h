@@ -0,0 +1,115 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	LZSSFile.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Reads an LZSS compressed image (.lzs) as written by HostTools/LZSSPack.
+*	Firmware images compress well, mostly because of runs of 0xFF and 0x00,
+*	so less of the card has to be read than for the equivalent .bin file, and
+*	far less than for a .hex file.
+*
+*	The file is a 12 byte header followed by one or more blocks.  A block is
+*	an 8 byte block header, the address and length of a contiguous block of
+*	memory, followed by its compressed data.  As with a hex file, memory not
+*	within a block isn't loaded.  The compressed data is a bit stream, most
+*	significant bit first, in the style of heatshrink:
+*		1 + 8 bits			A literal byte
+*		0 + W bits + L bits	A copy of (L bits + 2) bytes starting
+*							(W bits + 1) bytes back in the output
+*	W and L are in the header.  W can't exceed LZSS_WINDOW_BITS, the size of
+*	the window of recent output kept in SRAM.  A copy can refer to the output
+*	of a previous block but can't extend past the end of its block.  The bits
+*	following a block's last byte are unused.
+*
+*	The decoded blocks are returned as data records of up to 16 bytes aligned
+*	the way a hex file's would be.  The record position is the offset of the
+*	record's first byte in the decoded output.  The data can only be decoded
+*	in order, so SeekRecord decodes from the start of the file when seeking
+*	backwards.
+*/
+
+#ifndef LZSSFile_h
+#define LZSSFile_h
+
+#include "ImageSource.h"
+
+#ifndef LZSS_WINDOW_BITS
+#define LZSS_WINDOW_BITS	8
+#endif
+#define LZSS_WINDOW_SIZE	(1 << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH		2
+
+struct SLZSSHeader
+{
+	uint8_t		ident[4];		// "LZS" 0x01
+	uint8_t		windowBits;		// W
+	uint8_t		lengthBits;		// L
+	uint16_t	blockCount;
+	uint32_t	length;			// Of all of the blocks
+};
+
+struct SLZSSBlock
+{
+	uint32_t	address;
+	uint32_t	length;
+};
+
+class LZSSFile : public ImageSource
+{
+public:
+							LZSSFile(void);
+	virtual bool			begin(	// Fails if inPath isn't an LZSS file
+								const char*				inPath);
+	virtual bool			NextRecord(void);
+	virtual bool			Rewind(void);
+	virtual bool			SeekRecord(
+								uint32_t				inPosition,
+								uint8_t					inAddressH);
+	virtual uint32_t		EstimateLength(void);	// Exact, from the header
+	virtual bool			InAddressOrder(void) const
+								{return(true);}
+protected:
+	uint32_t	mLength;
+	uint32_t	mPosition;		// Of the next byte in the decoded output
+	uint32_t	mBlockAddress;	// Of the next byte of the current block
+	uint32_t	mBlockLength;	// Bytes of the current block remaining
+	uint16_t	mBlockCount;
+	uint16_t	mBlocksLeft;	// Following the current block
+	uint8_t		mWindowBits;
+	uint8_t		mLengthBits;
+	uint8_t		mBits;			// Undecoded bits of the last byte read
+	uint8_t		mBitsLeft;		// In mBits
+	uint16_t	mWindowIndex;	// Where the next byte decoded goes
+	uint16_t	mCopyIndex;		// Of the next byte of a copy
+	uint16_t	mCopyLength;	// Bytes of the copy remaining
+	uint8_t		mWindow[LZSS_WINDOW_SIZE];
+
+	bool					NextBits(
+								uint8_t					inCount,
+								uint16_t&				outValue);
+	bool					NextByte(
+								uint8_t&				outByte);
+	bool					NextBlock(void);
+};
+
+#endif /* LZSSFile_h */
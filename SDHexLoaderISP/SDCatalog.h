@@ -0,0 +1,79 @@
+/*
+*	SDCatalog.h, Copyright Jonathan Mackey 2020
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*
+*	The catalog is written to the root of the SD card by HostTools/SDMaster.
+*	It lists every valid flash image (hex, elf, s19/s28/s37, bin or lzs), eep
+*	and rcp file along with what the loader displays and needs from its
+*	config.  When the catalog is present the
+*	loader browses it rather than opening each file and config on the card.
+*
+*	The file is a SCatalogHeader followed by count SCatalogEntry records,
+*	sorted by filename.  A backup made on the device is added by SDHexSession
+*	after the sorted entries, or replaces the entry of an earlier backup with
+*	the same filename.  Multibyte values are little endian.  The layout has
+*	no padding on either the AVR or the host.
+*
+*	If files are added or removed by hand, delete the catalog (or run SDMaster
+*	again), otherwise the loader won't see the changes.
+*/
+#ifndef SDCatalog_h
+#define SDCatalog_h
+
+#include <inttypes.h>
+
+#define SD_CATALOG_VERSION	2
+#define SD_CATALOG_PATH		"catalog.bin"	// In the root
+#define SD_CATALOG_MAGIC	"SDHC"
+
+struct SCatalogHeader
+{
+	char		magic[4];	// SD_CATALOG_MAGIC
+	uint16_t	version;	// SD_CATALOG_VERSION
+	uint16_t	count;		// Of entries
+};
+
+struct SCatalogEntry
+{
+	uint32_t	uploadSpeed;	// From the config, 0 if ISP only
+	uint32_t	byteCount;		// Exact data bytes of the file, 0 for rcp
+	char		filename[50];	// Of the file on the card
+	char		name[20];		// Displayed, the filename without extensions
+	char		desc[20];		// From the config (ATtiny84A, etc)
+	uint8_t		signature[3];	// From the config
+	uint8_t		type;			// ECatalogType
+	uint8_t		reserved[2];
+};
+
+enum ECatalogType
+{
+	eCatalogHex,
+	eCatalogEEP,
+	eCatalogRecipe,
+	eCatalogElf,		// Flash byteCount, the EEPROM is also checked
+	eCatalogSRecord,	// s19, s28 or s37
+	eCatalogBinary,		// Loaded at the config's bin.address
+	eCatalogLZSS		// Skipped unless SUPPORT_LZSS_FILES is defined
+};
+
+static_assert(sizeof(SCatalogHeader) == 8, "Catalog header size changed");
+static_assert(sizeof(SCatalogEntry) == 104, "Catalog entry size changed");
+
+#endif // SDCatalog_h
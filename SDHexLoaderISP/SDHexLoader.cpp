@@ -29,6 +29,13 @@
 #include "SerialUtils.h"
 #include "ATmega644RTC.h"
 #include "AVRConfig.h"
+#include "BufferArena.h"
+#ifdef SUPPORT_SAMPLE_PROFILER
+#include "SampleProfiler.h"
+#endif
+#ifdef SUPPORT_SRAM_MONITOR
+#include "SRAMMonitor.h"
+#endif
 
 bool SDHexLoader::sButtonPressed;
 bool SDHexLoader::sSDInsertedOrRemoved;
@@ -44,12 +51,15 @@ const char kSourceStr[] PROGMEM = "Source: ";		// 119px
 const char kUSBStr[] PROGMEM = "USB";
 const char kSDStr[] PROGMEM = "SD";
 const char kSDBLStr[] PROGMEM = "SD BL";
+const char kSDBackupStr[] PROGMEM = "SD Backup";
+const char kSDAutoStr[] PROGMEM = "SD Auto";
 
 const char kInsertSDCardStr[] PROGMEM = "Insert SD Card";
 const char kNoHexFilesStr[] PROGMEM = "No hex files";
 
 const char kWritingStr[] PROGMEM = "Writing ";		// 118px
 const char kVerifyingStr[] PROGMEM = "Verifying ";	// 143px
+const char kReadingStr[] PROGMEM = "Reading ";
 const char kPassThroughStr[] PROGMEM = "Pass through...";
 
 const char kISPStr[] PROGMEM = "ISP: ";			// 82px
@@ -59,8 +69,41 @@ const char kAutoStr[] PROGMEM = "Auto";
 const char kClockStr[] PROGMEM = "Clock: ";
 const char kMHzStr[] PROGMEM = " MHz";
 
+#ifdef SUPPORT_SRAM_MONITOR
+const char kUnusedStr[] PROGMEM = "Unused: ";
+const char kStackStr[] PROGMEM = "Stack: ";
+const char kStaticStr[] PROGMEM = "Static: ";
+const char kHeapStr[] PROGMEM = "Heap: ";
+const char kLoaderObjStr[] PROGMEM = "Loader: ";
+const char kSessionObjStr[] PROGMEM = "Session: ";
+const char kISPObjStr[] PROGMEM = "ISP: ";
+const char kSdFatObjStr[] PROGMEM = "SdFat: ";
+const char kArenaObjStr[] PROGMEM = "Arena: ";
+
+struct SSRAMObject
+{
+	const char*	name;
+	uint16_t	size;
+};
+/*
+*	The SDHexSession, AVRStreamISP and SdFat objects are members of the
+*	SDHexLoader, so the Loader size includes them.  The BufferArena is
+*	static.
+*/
+const SSRAMObject kSRAMObjects[] PROGMEM =
+{
+	{kLoaderObjStr, sizeof(SDHexLoader)},
+	{kSessionObjStr, sizeof(SDHexSession)},
+	{kISPObjStr, sizeof(AVRStreamISP)},
+	{kSdFatObjStr, sizeof(SdFat)},
+	{kArenaObjStr, BUFFER_ARENA_SIZE}
+};
+const uint8_t	kSRAMObjectCount = sizeof(kSRAMObjects)/sizeof(SSRAMObject);
+#endif
+
 const char kSuccessStr[] PROGMEM = "Success!";
 const char kErrorNumStr[] PROGMEM = "Error: ";			// 89px
+const char kRetriesStr[] PROGMEM = "Retries: ";
 
 //const char kYesStr[] PROGMEM = "Yes";
 //const char kNoStr[] PROGMEM = "No";
@@ -68,6 +111,11 @@ const char kErrorNumStr[] PROGMEM = "Error: ";			// 89px
 const char kStartISPStr[] PROGMEM = "Start ISP";
 const char kStartSerialStr[] PROGMEM = "Start Serial";
 const char kStopStr[] PROGMEM = "Stop";
+const char kArmAutoStr[] PROGMEM = "Arm Auto";
+
+const char kReadyStr[] PROGMEM = "Ready ";
+const char kPassStr[] PROGMEM = "Pass ";
+const char kFailStr[] PROGMEM = "Fail ";
 
 const char kOKStr[] PROGMEM = "OK";
 
@@ -87,6 +135,13 @@ const char kLockErrorStr[] PROGMEM = "Lock error";
 const char kEFuseErrorStr[] PROGMEM = "EFuse error";
 const char kHFuseErrorStr[] PROGMEM = "HFuse error";
 const char kLFuseErrorStr[] PROGMEM = "LFuse error";
+const char kSDWriteErrorStr[] PROGMEM = "SD write error";
+const char kOverlapErrorStr[] PROGMEM = "Overlapping data";
+const char kImageSizeErrorStr[] PROGMEM = "Image too large";
+#ifdef SUPPORT_SD_CATALOG
+const char kCatalogPathStr[] PROGMEM = SD_CATALOG_PATH;
+const char kCatalogMagicStr[] PROGMEM = SD_CATALOG_MAGIC;
+#endif
 
 struct SStringDesc
 {
@@ -115,17 +170,28 @@ const SStringDesc kTextDesc[] PROGMEM =
 	{kEFuseErrorStr, XFont::eRed},
 	{kHFuseErrorStr, XFont::eRed},
 	{kLFuseErrorStr, XFont::eRed},
+	{kSDWriteErrorStr, XFont::eRed},
+	{kOverlapErrorStr, XFont::eRed},
+	{kImageSizeErrorStr, XFont::eRed},
 	
 	{kSuccessStr, XFont::eWhite},
 //	{kYesStr, XFont::eGreen},
 //	{kNoStr, XFont::eRed},
-	{kErrorNumStr, XFont::eWhite}
+	{kErrorNumStr, XFont::eWhite},
+	{kRetriesStr, XFont::eYellow}
 };
 
 #define DEBOUNCE_DELAY		20		// ms
+/*
+*	The probe doesn't block (see AVRStreamISP::ProbeTarget), so when armed
+*	the target is polled continuously.  A probe takes about 70ms, so with the
+*	pause between probes the removal or insertion of a target is seen within
+*	about 100ms.
+*/
+#define PROBE_PERIOD		30		// ms, between probes
 /********************************* SDHexLoader **********************************/
 SDHexLoader::SDHexLoader(void)
-:  mDebouncePeriod(DEBOUNCE_DELAY)
+:  mDebouncePeriod(DEBOUNCE_DELAY), mProbePeriod(PROBE_PERIOD)
 {
 
 }
@@ -195,7 +261,7 @@ void SDHexLoader::LeftRightButtonPressed(
 				{
 					if (inIncrement)
 					{
-						if (mSource < eSDBLSource)
+						if (mSource < eSDAutoSource)
 						{
 							mSource++;
 						} else
@@ -207,7 +273,7 @@ void SDHexLoader::LeftRightButtonPressed(
 						mSource--;
 					} else
 					{
-						mSource = eSDBLSource;
+						mSource = eSDAutoSource;
 					}
 					mMaxMainModeItem = mSource != eUSBSource ? eFilenameItem : eStartStopItem;
 					mPrevHexFileIndex = 0xFFFF;	// Force hex file line to redraw
@@ -280,6 +346,26 @@ void SDHexLoader::LeftRightButtonPressed(
 					break;
 			}
 			break;
+	#ifdef SUPPORT_SRAM_MONITOR
+		case eSRAMMode:
+			if (inIncrement)
+			{
+				if (mSRAMObject < (kSRAMObjectCount - 1))
+				{
+					mSRAMObject++;
+				} else
+				{
+					mSRAMObject = 0;
+				}
+			} else if (mSRAMObject > 0)
+			{
+				mSRAMObject--;
+			} else
+			{
+				mSRAMObject = kSRAMObjectCount - 1;
+			}
+			break;
+	#endif
 		case eSetTimeMode:
 			mUnixTimeEditor.LeftRightButtonPressed(inIncrement);
 			break;
@@ -331,6 +417,12 @@ void SDHexLoader::UpDownButtonPressed(
 				mCurrentFieldOrItem = eSourceItem;
 			}
 			break;
+	#ifdef SUPPORT_SRAM_MONITOR
+		case eSRAMMode:	// Only has one item, either direction returns
+			mMode = eSettingsMode;
+			mCurrentFieldOrItem = eClockItem;
+			break;
+	#endif
 		case eSetTimeMode:
 			mUnixTimeEditor.UpDownButtonPressed(!inIncrement);
 			break;
@@ -356,55 +448,36 @@ void SDHexLoader::EnterPressed(void)
 					mInSession = eIdle;
 					mPrevHexFileIndex = 0xFFFF;	// Force the filename to redraw (if SD source)
 					mPrevSource = eUSBSource;	// Force the source to redraw (if SD source)
+				/*
+				*	SD Auto doesn't start a session here.  It's armed and
+				*	UpdateArmed() starts a session each time a target with the
+				*	expected signature is connected.
+				*/
+				} else if (mSource == eSDAutoSource)
+				{
+					mPassCount = 0;
+					mFailCount = 0;
+					mAwaitingRemoval = false;
+					mLastPassed = true;
+					mInSession = eArmed;
+					mProbePeriod.Start();
+					mPrevHexFileIndex = 0xFFFF;	// Force the filename to redraw
+					mPrevSource = eUSBSource;	// Force the source to redraw
 				} else if (mSource != eUSBSource)
 				{
-					/*
-					*	The stored mFilename is truncated.  Filenames > 50 bytes
-					*	or contain multibyte UTF8 chars are skipped and won't be
-					*	listed (meaning it won't get here.)
-					*
-					*	Get the untruncated filename using the file index.
-					*/
-					FatFile		hexFile;
-					mInSession = hexFile.open(mSD.vwd(), mHexFileIndex, O_RDONLY);
-					if (mInSession)
-					{
-						char hexFilename[52];
-						hexFile.getName(hexFilename, 51);
-						hexFile.close();
-
-						if (mOnlyUseISP ||
-							mUploadSpeed == 0 ||
-							mSource == eSDBLSource)
-						{
-							// nullptr means "use contextual stream"
-							mInSession = mSDHexSession.begin(hexFilename, nullptr,
-												&mAVRStreamISP, mSource == eSDBLSource,
-													UnixTime::Time());
-						} else
-						{
-							Serial1.end();
-							Serial1.begin(mUploadSpeed);
-							// nullptr means "using HardwareSerial USB stream"
-							mInSession = mSDHexSession.begin(hexFilename, &Serial1,
-												nullptr, false, UnixTime::Time());
-							mTargetIsISP = false;
-						}
-					}
-					if (mInSession)
+					if (StartSDSession())
 					{
 						mPrevHexFileIndex = 0xFFFF;	// Force the filename to redraw
 						mPrevSource = eUSBSource;	// Force the source to redraw
 					} else
 					{
-						mAVRStreamISP.Halt();	// Does nothing if not target
-						mSDHexSession.Halt();
 						// File open error
 						QueueMessage(eFileOpenErrorDesc,
 							eNoMessage, eMainMode, eSourceItem);
 					}
 				} else
 				{
+					BufferArena::Begin(BufferArena::eUSBPhase);
 					mAVRStreamISP.SetStream(&Serial);
 					mAVRStreamISP.SetSPIClock(((uint32_t)mISPClockIndex)*4000000);
 					mInSession = ePassThrough;
@@ -417,8 +490,26 @@ void SDHexLoader::EnterPressed(void)
 			{
 				mMode = eSetTimeMode;
 				mUnixTimeEditor.SetTime(UnixTime::Time());
+		#ifdef SUPPORT_SRAM_MONITOR
+			} else if (mCurrentFieldOrItem == eClockItem)
+			{
+				mMode = eSRAMMode;
+				mCurrentFieldOrItem = eSRAMObjectItem;
+				mPrevSRAMObject = 0xFF;	// Force the object line to draw
+		#endif
 			}
 			break;
+	#ifdef SUPPORT_SRAM_MONITOR
+		case eSRAMMode:
+			/*
+			*	Serial is the ISP stream during a USB session.
+			*/
+			if (mInSession != ePassThrough)
+			{
+				ExportSRAMReport();
+			}
+			break;
+	#endif
 		case eSetTimeMode:
 			// If enter was pressed on SET or CANCEL
 			if (mUnixTimeEditor.EnterPressed())
@@ -463,6 +554,160 @@ void SDHexLoader::EnterPressed(void)
 	}
 }
 
+/******************************* StartSDSession *******************************/
+/*
+*	Starts a session using the selected hex file.  Returns true if the
+*	session started.  On failure the session and ISP are halted.
+*/
+bool SDHexLoader::StartSDSession(void)
+{
+	/*
+	*	The stored mFilename is truncated.  Filenames > 50 bytes
+	*	or contain multibyte UTF8 chars are skipped and won't be
+	*	listed (meaning it won't get here.)
+	*
+	*	Get the untruncated filename using the file index.
+	*/
+	FatFile		hexFile;
+	mTargetIsISP = true;
+	char hexFilename[52];
+#ifdef SUPPORT_SD_CATALOG
+	if (mUseCatalog)
+	{
+		SCatalogEntry	entry;
+		mInSession = ReadCatalogEntry(mHexFileIndex, entry);
+		if (mInSession)
+		{
+			strcpy(hexFilename, entry.filename);
+		}
+	} else
+#endif
+	{
+		mInSession = hexFile.open(mSD.vwd(), mHexFileIndex, O_RDONLY);
+		if (mInSession)
+		{
+			hexFile.getName(hexFilename, 51);
+			hexFile.close();
+		}
+	}
+	if (mInSession)
+	{
+
+		if (mOnlyUseISP ||
+			mUploadSpeed == 0 ||
+			mIsRecipe ||
+			mSource == eSDBLSource ||
+			mSource == eSDAutoSource)
+		{
+			// nullptr means "use contextual stream"
+			if (mSource == eSDBackupSource)
+			{
+				BufferArena::Begin(BufferArena::eISPBackupPhase);
+				mInSession = mSDHexSession.beginBackup(hexFilename,
+								nullptr, &mAVRStreamISP);
+			} else
+			{
+				BufferArena::Begin(BufferArena::eISPLoadPhase);
+				mInSession = mSDHexSession.begin(hexFilename, nullptr,
+								&mAVRStreamISP, mSource == eSDBLSource,
+									UnixTime::Time());
+			}
+		} else
+		{
+			Serial1.end();
+			Serial1.begin(mUploadSpeed);
+			// nullptr means "using HardwareSerial USB stream"
+			if (mSource == eSDBackupSource)
+			{
+				BufferArena::Begin(BufferArena::eSerialBackupPhase);
+				mInSession = mSDHexSession.beginBackup(hexFilename,
+								&Serial1, nullptr);
+			} else
+			{
+				BufferArena::Begin(BufferArena::eSerialLoadPhase);
+				mInSession = mSDHexSession.begin(hexFilename, &Serial1,
+								nullptr, false, UnixTime::Time());
+			}
+			mTargetIsISP = false;
+		}
+	}
+	if (!mInSession)
+	{
+		mAVRStreamISP.Halt();	// Does nothing if not target
+		mSDHexSession.Halt();
+	}
+#ifdef SUPPORT_SAMPLE_PROFILER
+	else
+	{
+		SampleProfiler::Start();
+	}
+#endif
+	return(mInSession != eIdle);
+}
+
+/******************************** UpdateArmed *********************************/
+/*
+*	Called from Update() while SD Auto is armed.  When a target with the
+*	signature of the selected config is detected, a session is started.  After
+*	a session ends the target must be removed before the next one is started.
+*/
+void SDHexLoader::UpdateArmed(void)
+{
+	/*
+	*	Once the period has passed the probe is continued on each call until
+	*	it has a result.  The period restarts when the probe ends.
+	*/
+	if (mProbePeriod.Passed())
+	{
+		uint8_t	probeResult = mAVRStreamISP.ProbeTarget(mSignature);
+		if (probeResult == AVRStreamISP::eProbing)
+		{
+			return;
+		}
+		bool	targetPresent = probeResult == AVRStreamISP::eTargetFound;
+		mProbePeriod.Start();
+		if (mAwaitingRemoval)
+		{
+			if (!targetPresent)
+			{
+				mAwaitingRemoval = false;
+				mPrevInSession = eIdle;	// Force the status line to redraw
+			}
+		} else if (targetPresent)
+		{
+			if (!StartSDSession())
+			{
+				QueueMessage(eFileOpenErrorDesc,
+					eNoMessage, eMainMode, eSourceItem);
+				mMaxMainModeItem = eFilenameItem;
+			}
+		}
+	}
+}
+
+/******************************* EndAutoSession *******************************/
+/*
+*	Counts the result of an SD Auto session and re-arms for the next target.
+*/
+void SDHexLoader::EndAutoSession(
+	bool	inPassed)
+{
+	mSDHexSession.Halt();
+	mAVRStreamISP.Halt();
+	if (inPassed)
+	{
+		mPassCount++;
+	} else
+	{
+		mFailCount++;
+	}
+	mLastPassed = inPassed;
+	mAwaitingRemoval = true;
+	mInSession = eArmed;
+	mProbePeriod.Start();
+	UnixTime::ResetSleepTime();
+}
+
 /******************************** QueueMessage ********************************/
 // Not a queue.  Only one message at a time is supported.
 void SDHexLoader::QueueMessage(
@@ -486,10 +731,13 @@ void SDHexLoader::Update(void)
 {
 	UpdateDisplay();
 	UpdateActions();
+	if (mInSession == eArmed)
+	{
+		UpdateArmed();
 	/*
-	*	If there is an active session...
+	*	Else if there is an active session...
 	*/
-	if (mInSession)
+	} else if (mInSession)
 	{
 		/*
 		*	If the target is ISP THEN
@@ -502,6 +750,11 @@ void SDHexLoader::Update(void)
 			*/
 			if (!mAVRStreamISP.Update())
 			{
+				if (mSource == eSDAutoSource)
+				{
+					EndAutoSession(false);
+					return;
+				}
 				mInSession = eIdle;
 				mError = mAVRStreamISP.Error();
 				QueueMessage(eInternalISPDesc, eErrorNumDesc, eMainMode, eSourceItem);
@@ -521,10 +774,16 @@ void SDHexLoader::Update(void)
 			*/
 			if (mSDHexSession.Update())
 			{
-				mInSession = (mSDHexSession.Stage() & SDHexSession::eVerifyingMemory) ? eVerifying : eWriting;
+				uint8_t	stage = mSDHexSession.Stage();
+				mInSession = (stage & SDHexSession::eDumpingMemory) ? eReading :
+								((stage & SDHexSession::eVerifyingMemory) ? eVerifying : eWriting);
 			/*
 			*	Else the session finished or there was an error...
 			*/
+			} else if (mSource == eSDAutoSource)
+			{
+				mError = mSDHexSession.Error();
+				EndAutoSession(mError == SDHexSession::eNoErr);
 			} else
 			{
 				mError = mSDHexSession.Error();
@@ -533,7 +792,31 @@ void SDHexLoader::Update(void)
 					QueueMessage(eSDSessionDesc, mError + eSDSessionDesc, eMainMode, eSourceItem);
 				} else
 				{
+				#ifdef SUPPORT_VERIFY_RETRY
+					/*
+					*	If pages had to be rewritten to pass verification THEN
+					*	show the number of pages under the success message.
+					*/
+					mRetryCount = mSDHexSession.RetryCount();
+					QueueMessage(eSuccessDesc, mRetryCount ? eRetriesDesc : eNoMessage,
+									eMainMode, eSourceItem);
+				#else
 					QueueMessage(eSuccessDesc, eNoMessage, eMainMode, eSourceItem);
+				#endif
+				}
+				/*
+				*	A backup adds files to the root and, on a mastered card,
+				*	entries to the catalog.
+				*/
+				if (mSource == eSDBackupSource)
+				{
+				#ifdef SUPPORT_SD_CATALOG
+					if (mUseCatalog)
+					{
+						mNumSDRootEntries = CountCatalogEntries();
+					} else
+				#endif
+					mNumSDRootEntries = CountRootDirEntries();
 				}
 				mInSession = eIdle;
 				mPrevHexFileIndex = 0xFFFF;	// Force the filename to redraw
@@ -545,6 +828,18 @@ void SDHexLoader::Update(void)
 			}
 		}
 	}
+#ifdef SUPPORT_SAMPLE_PROFILER
+	/*
+	*	When the SD session has ended, Serial (USB) isn't in use, so the
+	*	profile of the session is dumped to it.
+	*/
+	if (SampleProfiler::IsRunning() &&
+		(mInSession == eIdle || mInSession == eArmed))
+	{
+		SampleProfiler::Stop();
+		SampleProfiler::Dump(Serial);
+	}
+#endif
 }
 
 /******************************* UpdateActions ********************************/
@@ -682,8 +977,10 @@ void SDHexLoader::UpdateDisplay(void)
 					mPrevSource = mSource;
 					DrawItemP(0, kSourceStr, eWhite);
 					DrawItemValueP(mSource == eUSBSource ? kUSBStr :
-						(mSource == eSDSource ? kSDStr : kSDBLStr),
-							mInSession ? eGray : eMagenta);
+						(mSource == eSDSource ? kSDStr :
+							(mSource == eSDBLSource ? kSDBLStr :
+								(mSource == eSDBackupSource ? kSDBackupStr : kSDAutoStr))),
+								mInSession ? eGray : eMagenta);
 				}
 				if (updateAll ||
 					mPrevInSession != mInSession ||
@@ -696,11 +993,17 @@ void SDHexLoader::UpdateDisplay(void)
 						if (mInSession == ePassThrough)
 						{
 							DrawCenteredItemP(4, kPassThroughStr, eGray);
+						} else if (mInSession == eArmed)
+						{
+							DrawAutoStatus();
 						} else
 						{
 							if (mInSession == eWriting)
 							{
 								DrawItemP(4, kWritingStr, eYellow, Config::kTextInset, true);
+							} else if (mInSession == eReading)
+							{
+								DrawItemP(4, kReadingStr, eCyan, Config::kTextInset, true);
 							} else	// Verifying
 							{
 								DrawItemP(4, kVerifyingStr, eGreen, Config::kTextInset, true);
@@ -719,10 +1022,12 @@ void SDHexLoader::UpdateDisplay(void)
 						if (mSource == eUSBSource ||
 							mHexFileIndex != 0)
 						{
-							DrawItemP(1, (mOnlyUseISP || mSource == eUSBSource
+							DrawItemP(1, mSource == eSDAutoSource ? kArmAutoStr :
+											((mOnlyUseISP || mSource == eUSBSource
 											|| mSource == eSDBLSource
+											|| mIsRecipe
 											|| !mUploadSpeed) ?
-												kStartISPStr : kStartSerialStr, eGreen,
+												kStartISPStr : kStartSerialStr), eGreen,
 												Config::kTextInset, true);
 						/*
 						*	Else, SD is the source but there is no file selected.
@@ -745,7 +1050,8 @@ void SDHexLoader::UpdateDisplay(void)
 					ClearLines(2, 2);
 					if (mSource != eUSBSource && mHexFileIndex)
 					{
-						DrawItem(2, mFilename, mInSession ? eGray : eMagenta);
+						DrawItem(2, mFilename, mInSession ? eGray :
+											(mIsRecipe ? eYellow : eMagenta));
 						DrawItem(3, mMCUDesc, mInSession ? eGray : eCyan);
 					}
 				}
@@ -834,6 +1140,27 @@ void SDHexLoader::UpdateDisplay(void)
 				}
 				break;
 			}
+		#ifdef SUPPORT_SRAM_MONITOR
+			case eSRAMMode:
+				/*
+				*	The measured lines are only drawn when the page is
+				*	entered or the object changes.  Measuring walks the
+				*	unused SRAM, there's no need to do that continuously.
+				*/
+				if (updateAll ||
+					mPrevSRAMObject != mSRAMObject)
+				{
+					mPrevSRAMObject = mSRAMObject;
+					DrawSRAMItem(eSRAMUnusedItem, kUnusedStr, SRAMMonitor::Unused());
+					DrawSRAMItem(eSRAMStackItem, kStackStr, SRAMMonitor::StackHighWater());
+					DrawSRAMItem(eSRAMStaticItem, kStaticStr, SRAMMonitor::StaticSize());
+					DrawSRAMItem(eSRAMHeapItem, kHeapStr, SRAMMonitor::HeapSize());
+					DrawSRAMItem(eSRAMObjectItem,
+						(const char*)pgm_read_ptr_near(&kSRAMObjects[mSRAMObject].name),
+						pgm_read_word(&kSRAMObjects[mSRAMObject].size));
+				}
+				break;
+		#endif
 			case eSetTimeMode:
 				mUnixTimeEditor.Update();
 				break;
@@ -847,6 +1174,14 @@ void SDHexLoader::UpdateDisplay(void)
 						char errorNumStr[15];
 						UInt8ToDecStr(mError, errorNumStr);
 						DrawStr(errorNumStr, true);
+				#ifdef SUPPORT_VERIFY_RETRY
+					} else if (mMessageLine1 == eRetriesDesc)
+					{
+						DrawDescP(1, mMessageLine1);
+						char retriesStr[15];
+						UInt8ToDecStr(mRetryCount, retriesStr);
+						DrawStr(retriesStr, true);
+				#endif
 					} else
 					{
 						DrawCenteredDescP(1, mMessageLine1);
@@ -1062,10 +1397,89 @@ void SDHexLoader::DrawPercentComplete(void)
 		char* endOfStrPtr = UInt8ToDecStr(percentage, percentStr);
 		*(endOfStrPtr++) = '%';
 		*endOfStrPtr = 0;
-		DrawItem(4, percentStr, mInSession == eWriting ? eYellow : eGreen, 143 + Config::kTextInset, true);
+		DrawItem(4, percentStr, mInSession == eWriting ? eYellow :
+					(mInSession == eReading ? eCyan : eGreen), 143 + Config::kTextInset, true);
 	}
 }
 
+/******************************* DrawAutoStatus *******************************/
+/*
+*	Draws the SD Auto status line: the state followed by the pass and fail
+*	counts, e.g. "Pass P:12 F:1"
+*/
+void SDHexLoader::DrawAutoStatus(void)
+{
+	if (mAwaitingRemoval)
+	{
+		DrawItemP(4, mLastPassed ? kPassStr : kFailStr,
+					mLastPassed ? eGreen : eRed, Config::kTextInset, true);
+	} else
+	{
+		DrawItemP(4, kReadyStr, eWhite, Config::kTextInset, true);
+	}
+	char	countStr[16];
+	char*	endOfStrPtr = countStr;
+	*(endOfStrPtr++) = 'P';
+	*(endOfStrPtr++) = ':';
+	endOfStrPtr = UInt16ToDecStr(mPassCount, endOfStrPtr);
+	*(endOfStrPtr++) = ' ';
+	*(endOfStrPtr++) = 'F';
+	*(endOfStrPtr++) = ':';
+	UInt16ToDecStr(mFailCount, endOfStrPtr);
+	SetTextColor(eWhite);
+	DrawStr(countStr, true);
+}
+
+#ifdef SUPPORT_SRAM_MONITOR
+/******************************** DrawSRAMItem ********************************/
+void SDHexLoader::DrawSRAMItem(
+	uint8_t		inLine,
+	const char*	inLabelPStr,
+	uint16_t	inSize)
+{
+	DrawItemP(inLine, inLabelPStr, eWhite);
+	char	sizeStr[8];
+	UInt16ToDecStr(inSize, sizeStr);
+	SetTextColor(eMagenta);
+	DrawStr(sizeStr, true);
+}
+
+/****************************** ExportSRAMReport ******************************/
+/*
+*	Sends the figures shown on the SRAM page to Serial as text:
+*
+*		sram unused=812 stack=630 static=2514 heap=0
+*		Loader 1306
+*		Session 402
+*		...
+*		end
+*
+*	All of the sizes are in bytes.  See kSRAMObjects for what each object
+*	includes.
+*/
+void SDHexLoader::ExportSRAMReport(void)
+{
+	Serial.print(F("sram unused="));
+	Serial.print(SRAMMonitor::Unused());
+	Serial.print(F(" stack="));
+	Serial.print(SRAMMonitor::StackHighWater());
+	Serial.print(F(" static="));
+	Serial.print(SRAMMonitor::StaticSize());
+	Serial.print(F(" heap="));
+	Serial.println(SRAMMonitor::HeapSize());
+	for (uint8_t i = 0; i < kSRAMObjectCount; i++)
+	{
+		char	nameStr[12];
+		strcpy_P(nameStr, (const char*)pgm_read_ptr_near(&kSRAMObjects[i].name));
+		nameStr[strlen(nameStr) - 2] = 0;	// Remove the ": "
+		Serial.print(nameStr);
+		Serial.print(' ');
+		Serial.println(pgm_read_word(&kSRAMObjects[i].size));
+	}
+	Serial.println(F("end"));
+}
+#endif
+
 /******************************* UInt8ToDecStr ********************************/
 /*
 *	Returns the pointer to the char after the last char (the null terminator)
@@ -1094,6 +1508,31 @@ char* SDHexLoader::UInt8ToDecStr(
 	return(inBuffer);
 }
 
+/******************************* UInt16ToDecStr *******************************/
+/*
+*	Returns the pointer to the char after the last char (the null terminator)
+*/
+char* SDHexLoader::UInt16ToDecStr(
+	uint16_t	inNum,
+	char*		inBuffer)
+{
+	char*	bufPtr = inBuffer;
+	do
+	{
+		*(bufPtr++) = (inNum % 10) + '0';
+		inNum /= 10;
+	} while (inNum);
+	*bufPtr = 0;
+	// Digits were stored least significant first, reverse them.
+	for (char* endPtr = bufPtr-1; inBuffer < endPtr; inBuffer++, endPtr--)
+	{
+		char	thisChar = *inBuffer;
+		*inBuffer = *endPtr;
+		*endPtr = thisChar;
+	}
+	return(bufPtr);
+}
+
 /*********************************** WakeUp ***********************************/
 /*
 *	Wakup the display from sleep or keep it awake if not sleeping.
@@ -1154,6 +1593,11 @@ void SDHexLoader::SetSDCardPresent(
 			*	(This also opens the root.)
 			*/
 			mSD.chdir();
+		#ifdef SUPPORT_SD_CATALOG
+			mNumSDRootEntries = CountCatalogEntries();
+			mUseCatalog = mNumSDRootEntries != 0;
+			if (!mUseCatalog)
+		#endif
 			mNumSDRootEntries = CountRootDirEntries();
 			/*
 			*	Per the SdFat header, file directory indexes start at 1. If
@@ -1192,6 +1636,15 @@ void SDHexLoader::SetSDCardPresent(
 			{
 				mAVRStreamISP.Halt();	// If ISP session in progress.
 			}
+			/*
+			*	When SD Auto is armed there is no session for Update() to
+			*	report as failed, so disarm here.
+			*/
+			if (mInSession == eArmed)
+			{
+				mAVRStreamISP.Halt();	// Cancels a probe in progress
+				mInSession = eIdle;
+			}
 			QueueMessage(eSDCardErrorDesc,
 				eNoMessage, eMainMode, eSourceItem);
 		}
@@ -1238,6 +1691,12 @@ uint16_t SDHexLoader::CountRootDirEntries(void)
 bool SDHexLoader::LoadNextHexFilename(
 	bool	inIncrement)
 {
+#ifdef SUPPORT_SD_CATALOG
+	if (mUseCatalog)
+	{
+		return(LoadNextCatalogEntry(inIncrement));
+	}
+#endif
 	bool	success = false;
 	if (mHexFileIndex)
 	{
@@ -1264,7 +1723,7 @@ bool SDHexLoader::LoadNextHexFilename(
 		
 			/*
 			*	open will fail for all unused entry indexes.
-			*	For each valid entry see if it has the expected hex or eep extension AND
+			*	For each valid entry see if it has the expected hex, eep or rcp extension AND
 			*	that there is a sibling with a txt extension that points to a valid config file.
 			*/
 			if (thisFile.open(vwd, fileIndex, O_RDONLY))
@@ -1278,9 +1737,23 @@ bool SDHexLoader::LoadNextHexFilename(
 					size_t		pathLen = strlen(filename);
 					if (pathLen < 50)
 					{
-						// Case sensitive test for hex or eep file extension.
-						mIsHexFile = memcmp(&filename[pathLen-3], "hex", 3) == 0;
+						/*
+						*	Case sensitive test for a flash image (hex, elf,
+						*	s19/s28/s37, bin or lzs), eep or rcp (recipe) file
+						*	extension.  See SDHexSession::OpenHexFile().
+						*/
+						const char*	extension = &filename[pathLen-3];
+						mIsHexFile = memcmp(extension, "hex", 3) == 0 ||
+										memcmp(extension, "elf", 3) == 0 ||
+										memcmp(extension, "bin", 3) == 0 ||
+#ifdef SUPPORT_LZSS_FILES
+										memcmp(extension, "lzs", 3) == 0 ||
+#endif
+										(extension[0] == 's' &&
+											extension[1] >= '1' && extension[1] <= '3');
+						mIsRecipe = memcmp(&filename[pathLen-3], "rcp", 3) == 0;
 						if (mIsHexFile ||
+							mIsRecipe ||
 							memcmp(&filename[pathLen-3], "eep", 3) == 0)
 						{
 							strcpy(&filename[pathLen-3], "txt");
@@ -1311,6 +1784,7 @@ bool SDHexLoader::LoadNextHexFilename(
 								strcpy(mFilename, filename);
 								strcpy(mMCUDesc, configFile.Config().desc);
 								mUploadSpeed = configFile.Config().uploadSpeed;
+								memcpy(mSignature, configFile.Config().signature, 3);
 								success = true;
 								break;
 							}
@@ -1327,6 +1801,110 @@ bool SDHexLoader::LoadNextHexFilename(
 	return(success);
 }
 
+#ifdef SUPPORT_SD_CATALOG
+/**************************** CountCatalogEntries *****************************/
+/*
+*	Returns the number of entries in the SD root catalog, 0 if there isn't a
+*	valid catalog.
+*/
+uint16_t SDHexLoader::CountCatalogEntries(void)
+{
+	uint16_t	entryCount = 0;
+	SdFile		catalog;
+	char		path[sizeof(kCatalogPathStr)];
+	strcpy_P(path, kCatalogPathStr);
+	if (catalog.open(path, O_RDONLY))
+	{
+		SCatalogHeader	header;
+		if (catalog.read(&header, sizeof(header)) == sizeof(header) &&
+			memcmp_P(header.magic, kCatalogMagicStr, sizeof(header.magic)) == 0 &&
+			header.version == SD_CATALOG_VERSION &&
+			catalog.fileSize() == (sizeof(SCatalogHeader) +
+							(uint32_t)header.count * sizeof(SCatalogEntry)))
+		{
+			entryCount = header.count;
+		}
+		catalog.close();
+	}
+	return(entryCount);
+}
+
+/****************************** ReadCatalogEntry ******************************/
+/*
+*	Catalog entry indexes start at 1, the same as directory indexes.
+*/
+bool SDHexLoader::ReadCatalogEntry(
+	uint16_t		inIndex,
+	SCatalogEntry&	outEntry)
+{
+	bool	success = false;
+	SdFile	catalog;
+	char	path[sizeof(kCatalogPathStr)];
+	strcpy_P(path, kCatalogPathStr);
+	if (inIndex &&
+		catalog.open(path, O_RDONLY))
+	{
+		success = catalog.seekSet(sizeof(SCatalogHeader) +
+							(uint32_t)(inIndex - 1) * sizeof(SCatalogEntry)) &&
+					catalog.read(&outEntry, sizeof(SCatalogEntry)) == sizeof(SCatalogEntry);
+		catalog.close();
+	}
+	return(success);
+}
+
+/**************************** LoadNextCatalogEntry ****************************/
+/*
+*	The catalog equivalent of LoadNextHexFilename.  SDMaster only catalogs
+*	valid files with a config, so every entry is used other than those of a
+*	format that isn't supported by this build (lzs.)
+*/
+bool SDHexLoader::LoadNextCatalogEntry(
+	bool	inIncrement)
+{
+	bool	success = false;
+	if (mHexFileIndex)
+	{
+		uint16_t	startIndex = mHexFileIndex;
+		SCatalogEntry	entry;
+		do
+		{
+			if (inIncrement)
+			{
+				mHexFileIndex = mHexFileIndex < mNumSDRootEntries ? mHexFileIndex + 1 : 1;
+			} else
+			{
+				mHexFileIndex = mHexFileIndex > 1 ? mHexFileIndex - 1 : mNumSDRootEntries;
+			}
+			success = ReadCatalogEntry(mHexFileIndex, entry);
+			if (!success)
+			{
+				break;
+			}
+		#ifndef SUPPORT_LZSS_FILES
+			if (entry.type == eCatalogLZSS)
+			{
+				success = false;
+				continue;
+			}
+		#endif
+			mIsRecipe = entry.type == eCatalogRecipe;
+			mIsHexFile = !mIsRecipe && entry.type != eCatalogEEP;
+			// The name and desc are 0 terminated by SDMaster
+			strcpy(mFilename, entry.name);
+			strcpy(mMCUDesc, entry.desc);
+			mUploadSpeed = entry.uploadSpeed;
+			memcpy(mSignature, entry.signature, 3);
+			break;
+		} while (startIndex != mHexFileIndex);
+		if (!success)
+		{
+			mHexFileIndex = 0;
+		}
+	}
+	return(success);
+}
+#endif
+
 /************************* Pin change interrupt PCI0 **************************/
 /*
 *
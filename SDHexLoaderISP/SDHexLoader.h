@@ -32,6 +32,14 @@
 #include "SDHexSession.h"
 #include "AVRStreamISP.h"
 #include "SDHexLoaderConfig.h"
+/*
+*	When the SD card has a catalog written by HostTools/SDMaster, the files
+*	are browsed using the catalog.  See SDCatalog.h
+*/
+#define SUPPORT_SD_CATALOG	1
+#ifdef SUPPORT_SD_CATALOG
+#include "SDCatalog.h"
+#endif
 
 class SDHexLoader : public XFont
 {
@@ -59,6 +67,7 @@ protected:
 	Rect8_t					mSelectionRect;
 	MSPeriod				mDebouncePeriod;	// For buttons and SD card
 	MSPeriod				mSelectionPeriod;	// Selection frame flash rate
+	MSPeriod				mProbePeriod;		// SD Auto target probe rate
 	
 	uint8_t					mSleepState;
 	uint8_t					mMode;
@@ -68,6 +77,7 @@ protected:
 	uint8_t					mSelectionFieldOrItem;
 	uint8_t					mStartPinState;
 	uint8_t					mError;	// Used by eErrorDesc
+	uint8_t					mRetryCount;	// Used by eRetriesDesc
 	uint8_t					mPrevPercentage;
 	uint8_t					mISPClockIndex;
 	uint8_t					mPrevISPClockIndex;
@@ -83,6 +93,7 @@ protected:
 	bool					mPrevOnlyUseISP;
 	bool					mTargetIsISP;	// Only valid during a session.  Used by Update()
 	bool					mIsHexFile;
+	bool					mIsRecipe;		// Selected file is a .rcp, ISP only
 	uint8_t					mInSession;
 	uint8_t					mPrevInSession;
 	uint8_t					mSelectionIndex;
@@ -96,6 +107,18 @@ protected:
 	char					mFilename[20];	// Of hex file with extension removed
 	char					mMCUDesc[20];	// from current SD config (ATtiny84A, etc)
 	uint32_t				mUploadSpeed;	// from current SD config (0 if ISP only)
+	uint8_t					mSignature[3];	// from current SD config, used by SD Auto
+	uint16_t				mPassCount;		// SD Auto sessions that succeeded
+	uint16_t				mFailCount;		// SD Auto sessions that failed
+	bool					mAwaitingRemoval;	// SD Auto, waiting for the target to be removed
+	bool					mLastPassed;	// SD Auto, result of the last session
+#ifdef SUPPORT_SD_CATALOG
+	bool					mUseCatalog;	// mHexFileIndex is a catalog entry index
+#endif
+#ifdef SUPPORT_SRAM_MONITOR
+	uint8_t					mSRAMObject;	// Shown on the eSRAMObjectItem line
+	uint8_t					mPrevSRAMObject;
+#endif
 	static bool				sButtonPressed;
 	static bool				sSDInsertedOrRemoved;
 
@@ -109,6 +132,10 @@ protected:
 								{return(mCurrentFieldOrItem);}
 	void					GoToMainMode(void);
 	void					EnterPressed(void);
+	bool					StartSDSession(void);
+	void					UpdateArmed(void);
+	void					EndAutoSession(
+								bool					inPassed);
 	void					UpDownButtonPressed(
 								bool					inIncrement);
 	void					LeftRightButtonPressed(
@@ -154,6 +181,7 @@ protected:
 								uint8_t					inColumn = Config::kTextInset,
 								bool					inClearTillEOL = false);
 	void					DrawPercentComplete(void);
+	void					DrawAutoStatus(void);
 	void					UpdateSelectionFrame(void);
 	void					HideSelectionFrame(void);
 	void					ShowSelectionFrame(void);
@@ -166,14 +194,33 @@ protected:
 	bool					LoadNextHexFilename(
 								bool					inIncrement);
 	uint16_t				CountRootDirEntries(void);
+#ifdef SUPPORT_SD_CATALOG
+	uint16_t				CountCatalogEntries(void);
+	bool					ReadCatalogEntry(
+								uint16_t				inIndex,
+								SCatalogEntry&			outEntry);
+	bool					LoadNextCatalogEntry(
+								bool					inIncrement);
+#endif
+#ifdef SUPPORT_SRAM_MONITOR
+	void					DrawSRAMItem(
+								uint8_t					inLine,
+								const char*				inLabelPStr,
+								uint16_t				inSize);
+	void					ExportSRAMReport(void);
+#endif
 	static char*			UInt8ToDecStr(
 								uint8_t					inNum,
 								char*					inBuffer);
+	static char*			UInt16ToDecStr(
+								uint16_t				inNum,
+								char*					inBuffer);
 	
 	enum EMode
 	{
 		eMainMode,
 		eSettingsMode,
+		eSRAMMode,		// Hidden, entered from eClockItem
 		// All modes below are modal (waiting for input of some sort.)
 		// The display will not go to sleep when in a modal mode.
 		eSetTimeMode,
@@ -194,7 +241,9 @@ protected:
 		// eSDSource and eSDBLSource sources are non-zero.
 		eUSBSource,
 		eSDSource,
-		eSDBLSource
+		eSDBLSource,
+		eSDBackupSource,
+		eSDAutoSource		// Batch mode, ISP only
 	};
 	enum ESettingsItem
 	{
@@ -204,12 +253,22 @@ protected:
 		eISPItem,
 		eClockItem
 	};
+	enum ESRAMItem
+	{
+		eSRAMUnusedItem,
+		eSRAMStackItem,
+		eSRAMStaticItem,
+		eSRAMHeapItem,
+		eSRAMObjectItem		// Left/right selects the object shown
+	};
 	enum ESessionState
 	{
 		eIdle,				// Must be 0
 		eWriting,			// 0b001
 		eVerifying,			// 0b010
-		ePassThrough	= 4	// 0b100
+		eReading,			// 0b011
+		ePassThrough	= 4,	// 0b100
+		eArmed			= 8		// 0b1000, SD Auto waiting for a target
 	};
 	enum EMessageItem
 	{
@@ -239,11 +298,15 @@ protected:
 		eEFuseErrorDesc,
 		eHFuseErrorDesc,
 		eLFuseErrorDesc,
+		eSDWriteErrorDesc,
+		eOverlapErrorDesc,
+		eImageSizeErrorDesc,
 
 		eSuccessDesc,
 	//	eYesItemDesc,
 	//	eNoItemDesc,
-		eErrorNumDesc
+		eErrorNumDesc,
+		eRetriesDesc
 	};
 };
 
@@ -37,6 +37,40 @@
 *	source should not be used for anything that uses Serial1.
 */
 //#define DEBUG_AVR_STREAM	1
+/*
+*	Defining SUPPORT_STK_TRACE records the STK500 commands/responses seen by
+*	AVRStreamISP to /trace.stk on the SD card.  See STKTrace.h for the format
+*	and HostTools/STKReplay for replaying a trace.  Uses about 400 bytes of
+*	SRAM.
+*/
+//#define SUPPORT_STK_TRACE	1
+/*
+*	Defining SUPPORT_STK500V2 accepts STK500v2 messages in addition to the
+*	STK500v1 ArduinoISP dialect, so avrdude can be used with -c stk500v2 in
+*	USB pass-through mode.  The protocol is detected per message by the v2
+*	MESSAGE_START byte, which isn't a v1 command.  Raises ISP_BUFFER_SIZE
+*	from 256 to 275 bytes of SRAM.
+*/
+//#define SUPPORT_STK500V2	1
+/*
+*	Defining REPORT_SRAM_BUDGET lists the BufferArena sizes as compiler
+*	messages when BufferArena.cpp is compiled.
+*/
+//#define REPORT_SRAM_BUDGET	1
+/*
+*	Defining SUPPORT_SAMPLE_PROFILER samples where the CPU is during each SD
+*	session and dumps the histogram to Serial when the session ends.  See
+*	SampleProfiler.h and HostTools/ProfileReport.  Uses about 270 bytes of
+*	SRAM.
+*/
+//#define SUPPORT_SAMPLE_PROFILER	1
+/*
+*	SUPPORT_SRAM_MONITOR adds a hidden page to the settings showing the SRAM
+*	used by the stack, heap and the large objects.  Press Enter on the Clock
+*	item to show it, Enter on the page sends the report to Serial.  See
+*	SRAMMonitor.h.
+*/
+//#define SUPPORT_SRAM_MONITOR	1
 #endif
 
 namespace Config
@@ -29,18 +29,52 @@
 #include "stk500.h"
 #ifdef __MACH__
 #include "ContextualStream.h"
+#include <string.h>
+#define PROGMEM
+#define strcpy_P strcpy
+#define memcmp_P memcmp
 #else
 #include <Arduino.h>
 #include "SDHexLoaderConfig.h"
 #endif
 #include "AVRStreamISP.h"
 #include "UnixTime.h"
+#ifdef SUPPORT_CRC_VERIFY
+#include "CRC32.h"
+#endif
+#ifdef SUPPORT_TARGET_BACKUP
+#include "SDCatalog.h"
+#include <stddef.h>
+#endif
 
-#ifndef __MACH__
+#ifdef SESSION_TIMING
 const uint32_t	kSessionTimeout = 2000;	// milliseconds
+const uint8_t	kSyncInterval = 20;		// ms, default config sync.interval
+const uint16_t	kSyncWindow = 1000;		// ms, default config sync.window
+#endif
+#ifdef SUPPORT_RESUME
+const uint8_t	kMaxResumes = 3;	// Per session
 #endif
+#ifdef SUPPORT_CRC_VERIFY
+const uint16_t	kCRCRegionSize = 4096;	// Max bytes per region (when available)
+const uint16_t	kCRCChunkSize = 512;	// Bytes of flash read per Update()
+#endif
+const uint16_t	kMaxBatchSize = 256;	// AVRStreamISP mBuffer size
+const uint16_t	kSerialReadSize = 32;	// See SerialReadSize()
 const char kBootloaderPathPrefixStr[] PROGMEM = "bootloaders/B";
 const char kHexExtensionStr[] PROGMEM = ".hex";
+#ifdef SUPPORT_TARGET_BACKUP
+const char kBackupTxtSuffixStr[] PROGMEM = ".bak.txt";
+const char kBackupHexSuffixStr[] PROGMEM = ".bak.hex";
+/*
+*	Appended to the backup's config.  A backup includes the bootloader section
+*	so upload.maximum_size is cleared, see ImagePreflight::FitsIn().
+*/
+const char kBackupTimestampStr[] PROGMEM = "\ntimestamp=0\nupload.maximum_size=0\n";
+const char kBackupByteCountStr[] PROGMEM = "byte_count=";
+const char kCatalogPathStr[] PROGMEM = SD_CATALOG_PATH;
+const char kCatalogMagicStr[] PROGMEM = SD_CATALOG_MAGIC;
+#endif
 
 const SDHexSession::SFuseInst SDHexSession::kFuseInst[] =
 {
@@ -54,6 +88,7 @@ const SDHexSession::SFuseInst SDHexSession::kFuseInst[] =
 SDHexSession::SDHexSession(void)
 : mStage(eSessionCompleted)
 {
+	mImage = new (&mImageSource.hexFile) IntelHexFile;
 }
 
 /*********************************** begin ************************************/
@@ -65,6 +100,24 @@ SDHexSession::SDHexSession(void)
 *	For load + verify to ISP, inStream should be nil
 *	For load fuses (and bootloader if applicable), inStream should be nil
 *	because this takes place via the ISP.
+*
+*	A recipe (.rcp) file lists the steps of a complete provisioning session.
+*	Like all other files, its config is the .txt with the same base name.
+*	Steps not listed (or set to 0) are skipped.  The steps are always performed
+*	in the order shown below, within a single program mode session:
+*		# Blink.ino.rcp, config is Blink.ino.txt
+*		recipe.fuses=1
+*		recipe.bootloader=1
+*		recipe.flash=1
+*		recipe.eeprom=1
+*		recipe.lock_bits=1
+*	The bootloader is /bootloaders/B<n>.hex, where n is the config's bootloader
+*	value.  The flash and EEPROM files are Blink.ino.hex and Blink.ino.eep.
+*	Fuses and lock bits require the config's lock_bits mask.
+*	When there is a Blink.ino.elf file, it's used in place of the .hex and .eep
+*	files, and its .fuse and .lock sections (if any) replace the config's fuses
+*	and lock bits.
+*	A recipe is only performed via the ISP, inStream should be nil.
 */
 bool SDHexSession::begin(
 	const char*		inPath,
@@ -91,6 +144,9 @@ bool SDHexSession::begin(
 	mAVRStreamISP = inAVRStreamISP;
 	bool	loadingFlash = true;	// Is .hex file
 	bool success = mStream != nullptr;
+#ifdef SUPPORT_PREFLIGHT
+	mPreflightError = eNoErr;
+#endif
 	if (success)
 	{
 		AVRConfig	avrConfig;
@@ -105,6 +161,12 @@ bool SDHexSession::begin(
 		if (success)
 		{
 			memcpy(&mConfig, &avrConfig.Config(), sizeof(SAVRConfig));
+		#ifdef SUPPORT_RECIPES
+			if (memcmp(&inPath[pathLen-3], "rcp", 3) == 0)
+			{
+				success = BeginRecipe(inPath, inAVRStreamISP);
+			} else
+		#endif
 			if (inSetFusesAndBootloader)
 			{
 				/*
@@ -132,20 +194,20 @@ bool SDHexSession::begin(
 					if (mConfig.bootloader)
 					{
 						mOperation = eSetFusesAndBootloader;
-						strcpy_P(configPath, kBootloaderPathPrefixStr);
-						pathLen = strlen(configPath);
-						UnixTime::Uint16ToDecStr(mConfig.bootloader, &configPath[pathLen]);
-						pathLen = strlen(configPath);
-						strcpy_P(&configPath[pathLen], kHexExtensionStr);
+						BootloaderPath(configPath);
 						loadingFlash = true;
-						success = IntelHexFile::begin(configPath);
+						success = OpenHexFile(configPath);
 						/*
 						*	If the bootloader exists THEN
 						*	estimate its length.
 						*/ 
 						if (success)
 						{
-							mConfig.byteCount = EstimateLength();
+						#ifdef SUPPORT_PREFLIGHT
+							ImagePreflight	preflight;
+							PreflightImage(ImagePreflight::eBootloader, preflight);
+						#endif
+							mConfig.byteCount = HexDataLength();
 						}
 					} else
 					{
@@ -160,17 +222,25 @@ bool SDHexSession::begin(
 			} else
 			{
 				mOperation = loadingFlash ? eProgramFlash : eProgramEEPROM;
-				success = IntelHexFile::begin(inPath);
+				success = OpenHexFile(inPath);
 				if (success)
 				{
+				#ifdef SUPPORT_PREFLIGHT
+					ImagePreflight	preflight;
+					PreflightImage(loadingFlash ?
+						ImagePreflight::eApplication : ImagePreflight::eEEPROM, preflight);
+				#endif
 					/*
 					*	If the config doesn't contain the byte count THEN
 					*	estimate its size from the hex file. The estimation takes
 					*	time depending on the size of the hex file.
+					*	The config's byte count is that of the flash hex file, so
+					*	it isn't used for the eep file, which shares the config.
 					*/
-					if (mConfig.byteCount == 0)
+					if (mConfig.byteCount == 0 ||
+						!loadingFlash)
 					{
-						mConfig.byteCount = EstimateLength();
+						mConfig.byteCount = HexDataLength();
 					}
 				#ifdef __MACH__
 					fprintf(stderr, "%d\n", mConfig.byteCount);
@@ -186,929 +256,3011 @@ bool SDHexSession::begin(
 	}
 	if (success)
 	{
-		mSyncRetries = 0;
-		mError = 0;
-		mSerialISP = !inAVRStreamISP;
-		mCmdHandler = &SDHexSession::SetDevice;
+		StartSession(loadingFlash, inTimestamp);
+	#ifdef SUPPORT_RECORD_INDEX
 		/*
-		*	When using AVRStreamISP, AVRStreamISP manages the reset line.
-		*	
-		*	If AVRStreamISP isn't being used THEN
-		*	manage the reset line here (for Serial1 stream)
+		*	The session fails on its first update with the overlap error.
 		*/
-	#ifndef __MACH__
-		if (mSerialISP)
+		if (mRunIndex.Overlaps())
 		{
-			/*
-			*	In this case where Serial1 is used, resetting the target MCU is
-			*	done by holding DTR/reset low for the duration of the session.
-			*
-			*	At this point the reset pin/DTR is essentially floating. Change
-			*	the pin to output, enable the the buffered 3v3 DTR/reset signal
-			*	for possible 3v3 serial use.
-			*/
-			pinMode(Config::kResetPin, OUTPUT);
-			digitalWrite(Config::kResetPin, HIGH);
-		#if (HEX_LOADER_VER >= 12)
-			digitalWrite(Config::kReset3v3OEPin, LOW);	// The OE pin on the level shifter
-		#endif
-			delay(1);	// Allow the DTR/reset cap on the target board time to charge.
-						// If this isn't done the board may not notice reset going low.
-			digitalWrite(Config::kResetPin, LOW);
-			/*
-			*	avrdude appears to delay 300ms before sending the first bit of
-			*	data.  I didn't see anything in the acrdude.conf that implied
-			*	this was configurable.
-			*/
-			delay(300);
+			mError = eOverlapErr;
 		}
 	#endif
+	#ifdef SUPPORT_PREFLIGHT
 		/*
-		*	Setup the contextual stream even if the stream is serial.
+		*	As is an image that failed its preflight check.  The chip hasn't
+		*	been erased at this point.
 		*/
-		mContextualStream.flush();		
-		{
-			mContextualStream.ReadFrom1(true);
-			GetSync(false);	// Load the 1st command for either stream
-			mContextualStream.ReadFrom1(false);
-		}
-		mStage = eVerifySignature;
-		// Page variables:
-		mBytesPerPage = loadingFlash ? mConfig.flashPageSize : mConfig.eepromPageSize;
-		mWordsPerPage = mBytesPerPage >> 1;
-		mBytesProcessed = 0;
-		mPercentageProcessed = 0;
-		mPageAddressMask = (uint32_t)~(mWordsPerPage -1);
-		// When loading flash, if the target device capacity is greaterthan 128KB
-		// then initializing mCurrentAddressH to 0xFF will generate a Load Extended
-		// Address command for extended address 0.
-		mCurrentAddressH = (!loadingFlash || (mConfig.devcode < 0xB0)) ? 0 : 0xFF;
-		mDataIndex = 0;
-		// Initializing mCurrentPageAddress to 0xFFFF will generate the initial Load
-		// Address command for the first address.
-		mCurrentPageAddress = 0xFFFF;
-	#ifdef SUPPORT_REPLACEMENT_DATA
-		// See ReplaceData() for an explanation of what replacement data is.
-		mReplacementAddress = mConfig.timestamp;
-		mReplacementDataIndex = 0;
-		mReplacementData[3] = inTimestamp >> 24;
-		mReplacementData[2] = inTimestamp >> 16;
-		mReplacementData[1] = inTimestamp >> 8;
-		mReplacementData[0] = inTimestamp;
+		if (mPreflightError)
+		{
+			mError = mPreflightError;
+		}
 	#endif
 	}
 	return(success);
 }
 
-/************************************ Halt ************************************/
-bool SDHexSession::Halt(void)
+#ifdef SUPPORT_RECIPES
+/******************************** BeginRecipe *********************************/
+/*
+*	Called by begin() after mConfig has been loaded from the recipe's config.
+*	The steps are read from the .rcp file itself.  Nothing is opened here other
+*	than to check each file and get the length of the flash data.  Each file
+*	is opened again as its step is reached, see OpenRecipeFile().
+*/
+bool SDHexSession::BeginRecipe(
+	const char*		inPath,
+	AVRStreamISP*	inAVRStreamISP)
 {
-	bool haltedSession = mStream != nullptr;
-	if (haltedSession)
+	bool	success = false;
+	size_t	pathLen = strlen(inPath) - 3;	// Length without the extension
+	mOperation = eRecipe;
+	mError = eLoadHexDataErr;
+	if (inAVRStreamISP &&
+		pathLen < sizeof(mRecipePath) - 4)
 	{
-		mStage = eSessionCompleted;
-		mStream = nullptr;
-	#ifndef __MACH__
-		if (mSerialISP)
+		/*
+		*	The recipe doesn't contain the keys ReadFile requires so the
+		*	result is ignored.  An empty or missing recipe has no steps.
+		*/
+		AVRConfig	recipeConfig;
+		recipeConfig.ReadFile(inPath);
+		mConfig.recipe = recipeConfig.Config().recipe;
+		memcpy(mRecipePath, inPath, pathLen);
+		mRecipePath[pathLen] = 0;
+	#ifdef SUPPORT_ELF_FILES
+		mRecipeElf = ReadRecipeElf();
+	#endif
+		/*
+		*	Fuses and lock bits are only supported when the config contains
+		*	the lock bit mask, see begin().
+		*/
+		if ((mConfig.recipe & (SAVRConfig::eRecipeFuses + SAVRConfig::eRecipeLockBits)) &&
+			mConfig.lockBits[0] == 0)
+		{
+			mError = eLockErr;
+		} else if (mConfig.recipe)
 		{
+			if (mConfig.bootloader == 0)
+			{
+				mConfig.recipe &= ~SAVRConfig::eRecipeBootloader;
+			}
+			mError = eNoErr;
+			success = true;
+			uint32_t	byteCount = 0;
+		#ifdef SUPPORT_PREFLIGHT
 			/*
-			*	Restore DTR/reset to floating for 3v3 serial, and INPUT_PULLUP
-			*	for 5v. Both will allow the capacitor attached to DTR/reset on
-			*	the target board to rise to a HIGH state so the target MCU will
-			*	boot normally.
+			*	Each file is checked now rather than when its step is reached,
+			*	after the chip has been erased.  The application can't overlap
+			*	the bootloader.  The byte count is the exact count of the
+			*	application and bootloader.
 			*/
-			digitalWrite(Config::kResetPin, HIGH);
+			ImagePreflight	appPreflight;
+			ImagePreflight	preflight;
+			for (uint8_t recipeFile = eRecipeAppFile;
+				success && recipeFile < eNoRecipeFile; recipeFile++)
+			{
+				if (RecipeHasFile(recipeFile))
+				{
+					ImagePreflight&	filePreflight =
+						recipeFile == eRecipeAppFile ? appPreflight : preflight;
+					success = OpenRecipeFile(recipeFile, &filePreflight);
+					if (recipeFile != eRecipeEEPROMFile)
+					{
+						byteCount += filePreflight.ByteCount();
+					}
+					if (success &&
+						recipeFile == eRecipeBootloaderFile &&
+						appPreflight.Overlaps(preflight) &&
+						!mPreflightError)
+					{
+						mPreflightError = eImageSizeErr;
+					}
+				}
+			}
+		#else
 			/*
-			*	Something funky is happening and I don't understand why. If I
-			*	remove the delay before setting the pin mode, any SPI activity
-			*	following the call to pinMode will hang the MCU.  The reset pin
-			*	is on the same port as the SPI pins. I found this using code
-			*	elimination and have no idea why it happens or what the delay
-			*	does to keep it from hanging. I noticed that it stopped hanging
-			*	when I placed a few debugging print statements to isolate where
-			*	it was hanging.  I replaced the print statements with a delay.
+			*	The byte count in the config only applies to the
+			*	application.  The bootloader's length is added to it.
 			*/
-			delay(1);
-			pinMode(Config::kResetPin, INPUT_PULLUP);
-		#if (HEX_LOADER_VER >= 12)
-			digitalWrite(Config::kReset3v3OEPin, HIGH);
+			if (RecipeHasFile(eRecipeAppFile))
+			{
+				byteCount = mConfig.byteCount;
+				if (byteCount == 0 &&
+					(success = OpenRecipeFile(eRecipeAppFile)) != false)
+				{
+					byteCount = HexDataLength();
+				}
+			}
+			if (success &&
+				RecipeHasFile(eRecipeBootloaderFile) &&
+				(success = OpenRecipeFile(eRecipeBootloaderFile)) != false)
+			{
+				byteCount += HexDataLength();
+			}
 		#endif
+			mConfig.byteCount = byteCount ? byteCount : 1;
+			if (success)
+			{
+				mFusesWritten = false;
+				mProgModeReentered = false;
+				inAVRStreamISP->SetStream(&mContextualStream);
+				if (mConfig.recipe & SAVRConfig::eRecipeFuses)
+				{
+					inAVRStreamISP->SetSPIClock(0);	// Assume 1 MHz fCPU
+				} else
+				{
+					inAVRStreamISP->SetAVRConfig(mConfig);
+				}
+			}
 		}
-	#endif
-		end();	// Release/close SD file
-		mTimeout.Set(0);
 	}
-	return(haltedSession);
+	return(success);
 }
 
-/****************************** WaitForAvailable ******************************/
-bool SDHexSession::WaitForAvailable(
-	uint8_t	inBytesToWaitFor)
+#ifdef SUPPORT_ELF_FILES
+/******************************* ReadRecipeElf ********************************/
+/*
+*	Returns true if the recipe has a <base>.elf file.  The fuses and lock bits
+*	contained in the .elf file replace those of the config for the recipe's
+*	fuse and lock bit steps.
+*/
+bool SDHexSession::ReadRecipeElf(void)
 {
-	if (mSerialISP)
+	char	path[60];
+	strcpy(path, mRecipePath);
+	strcat(path, "elf");
+	bool	isElf = OpenHexFile(path);
+	if (isElf)
 	{
-		MSPeriod	timeout((uint32_t)inBytesToWaitFor * 10);
-		timeout.Start();
-		while (mStream->available() < inBytesToWaitFor)
+		ElfFile&	elfFile = mImageSource.elfFile;
+		uint8_t	elfBytes[3];	// low, high, extended
+		uint8_t	length;
+		if (mConfig.recipe & SAVRConfig::eRecipeFuses)
 		{
-			if (!timeout.Passed())
+			length = elfFile.ReadMemory(ElfFile::eFuseMemory, elfBytes, sizeof(elfBytes));
+			for (uint8_t i = 0; i < length; i++)
 			{
-				continue;
+				mConfig.fuses[SAVRConfig::eLow - i] = elfBytes[i];
 			}
-			return(false);
+		}
+		if ((mConfig.recipe & SAVRConfig::eRecipeLockBits) &&
+			elfFile.ReadMemory(ElfFile::eLockMemory, elfBytes, 1))
+		{
+			mConfig.lockBits[SAVRConfig::eLock] = elfBytes[0];
 		}
 	}
-	return(true);
-}
-
-/************************** WaitForAvailableForWrite **************************/
-void SDHexSession::WaitForAvailableForWrite(
-	uint8_t	inBytesToWaitFor)
-{
-	if (mSerialISP)
-	{
-		while (((HardwareSerial*)mStream)->availableForWrite() < inBytesToWaitFor){}
-	}
+	mImage->end();
+	return(isElf);
 }
+#endif
 
-/****************************** ResponseStatusOK ******************************/
-bool SDHexSession::ResponseStatusOK(void)
+/******************************* RecipeHasFile ********************************/
+bool SDHexSession::RecipeHasFile(
+	uint8_t	inRecipeFile) const
 {
-	
-	bool	statusOK = WaitForAvailable(1) &&
-						mStream->read() == STK_OK;
-	if (!statusOK)
-	{
-		GetSync(false);
-	}
-	return(statusOK);
+	static const uint8_t kRecipeStep[] = {SAVRConfig::eRecipeFlash,
+						SAVRConfig::eRecipeBootloader, SAVRConfig::eRecipeEEPROM};
+	return(inRecipeFile < eNoRecipeFile &&
+		(mConfig.recipe & kRecipeStep[inRecipeFile]) != 0);
 }
 
-/********************************** GetSync ***********************************/
+/******************************* OpenRecipeFile *******************************/
 /*
-*	Prior to calling GetSync(false), the mCmdHandler should point to the handler
-*	to be called after attaining sync.
+*	Closes the current file (if any) and opens the file for inRecipeFile.
+*	When outPreflight isn't nullptr the file is also checked, see
+*	PreflightImage().
 */
-void SDHexSession::GetSync(
-	bool	inIsResponse)
+bool SDHexSession::OpenRecipeFile(
+	uint8_t			inRecipeFile,
+	ImagePreflight*	outPreflight)
 {
-	if (!inIsResponse)
+	char	path[60];
+	mRecipeFile = inRecipeFile;
+	if (inRecipeFile == eRecipeBootloaderFile)
 	{
-		WaitForAvailableForWrite(2);
-		mStream->write(STK_GET_SYNC);
-		mStream->write(CRC_EOP);
-		/*
-		*	If not resync...
-		*/
-		if (mCmdHandler != &SDHexSession::GetSync)
+		BootloaderPath(path);
+	} else
+	{
+		strcpy(path, mRecipePath);
+	#ifdef SUPPORT_ELF_FILES
+		if (mRecipeElf)
 		{
-			mOnSyncCmdHandler = mCmdHandler;
-			mCmdHandler = &SDHexSession::GetSync;
-		}
-	} else if (ResponseStatusOK())
+			strcat(path, "elf");
+		} else
+	#endif
+		strcat(path, inRecipeFile == eRecipeAppFile ? "hex" : "eep");
+	}
+	mImage->end();
+	bool	success = OpenHexFile(path);
+#ifdef SUPPORT_ELF_FILES
+	if (success &&
+		mRecipeElf &&
+		inRecipeFile == eRecipeEEPROMFile)
 	{
-		mSyncRetries = 0;
-		mCmdHandler = mOnSyncCmdHandler;
-		(this->*(mCmdHandler))(false);
+		mImageSource.elfFile.SelectMemory(ElfFile::eEEPROMMemory);
+	#ifdef SUPPORT_RECORD_INDEX
+		mRunIndex.end();	// The index is of the flash memory
+	#endif
+	}
+#endif
+#ifdef SUPPORT_PREFLIGHT
+	if (success &&
+		outPreflight)
+	{
+		// ImagePreflight::EImage is in ERecipeFile order.
+		PreflightImage(inRecipeFile, *outPreflight);
+	}
+#endif
+	if (!success)
+	{
+		mError = eLoadHexDataErr;
 	}
+	return(success);
 }
 
-/********************************* SetDevice **********************************/
+/**************************** NextRecipeFlashFile *****************************/
 /*
-*	Most of the parameters of the STK_SET_DEVICE command aren't used by the
-*	internal AVRStreamISP.  AVRStreamISP only uses the pagesize and eepromsize.
-*	Bootloaders ignore all of these params.
-*
-*	
-*	See "Set Device Programming Parameters" in the AVR061 doc.
-*
-*	[0] devicecode - Device code as defined in “devices.h”
-*	[1] revision - Device revision. Currently not used. Should be 0.
-*	[2] progtype - Defines which Program modes is supported:
-*			“0” – Both Parallel/High-voltage and Serial mode
-*			“1” – Only Parallel/High-voltage mode
-*	[3] parmode - Defines if the device has a full parallel interface or a
-*			pseudo parallel programming interface:
-*			“0” – Pseudo parallel interface
-*			“1” – Full parallel interface
-*	[4] polling - Defines if polling may be used during SPI access:
-*			“0” – No polling may be used
-*			“1” – Polling may be used
-*	[5] selftimed - Defines if programming instructions are self timed:
-*			“0” – Not self timed
-*			“1” – Self timed
-*	[6] lockbytes - Number of Lock bytes. Currently not used. Should be set to
-*			actual number of Lock bytes for future compability.
-*	[7] fusebytes - Number of Fuse bytes. Currently not used. Should be set to
-*			actual number of Fuse bytes for future caompability.
-*
-*	Multi byte parameters values are big endian...
-*
-*	[8:9] flashpollval - FLASH polling value. See Data Sheet for the device.
-*	[10:11] eeprompollval - EEPROM polling value, See data sheet for the device.
-*	[12:13] pagesize - Page size in bytes for pagemode parts
-*	[14:15] eepromsize - EEPROM size in bytes
-*	[16:19] flashsize - FLASH size in bytes.
+*	Called at the end of a flash file.  Returns true if there is another flash
+*	file in the recipe (i.e. the bootloader after the application.)
 */
-/********************************* SetDevice **********************************/
-void SDHexSession::SetDevice(
-	bool	inIsResponse)
+bool SDHexSession::NextRecipeFlashFile(void)
 {
-	if (!inIsResponse)
-	{
-		WaitForAvailableForWrite(21);
-		mStream->write(STK_SET_DEVICE);	// 0x42
-		uint8_t	zeroParams[11] = {0};
-		mStream->write(mConfig.devcode);			// 0
-		mStream->write(zeroParams, 11);				// 1:11
-		// These are written out big endian.
-		mStream->write(mConfig.flashPageSize >> 8);	// 12
-		mStream->write(mConfig.flashPageSize);		// 13
-		mStream->write(mConfig.eepromSize >> 8);	// 14
-		mStream->write(mConfig.eepromSize);			// 15
-		mStream->write(zeroParams, 4);				// 16:19
-		mStream->write(CRC_EOP);
-		mCmdHandler = &SDHexSession::SetDevice;
-	} else if (ResponseStatusOK())
+	bool	hasNext = mRecipeFile == eRecipeAppFile &&
+				RecipeHasFile(eRecipeBootloaderFile);
+	if (hasNext)
 	{
-		SetDeviceExt(false);
+		mDataIndex = 0;
+		OpenRecipeFile(eRecipeBootloaderFile);
 	}
+	return(hasNext);
 }
 
-/******************************** SetDeviceExt ********************************/
+/***************************** BeginRecipeMemory ******************************/
 /*
-*	Most of the parameters of the STK_SET_DEVICE_EXT command aren't used by the
-*	internal AVRStreamISP.  AVRStreamISP only uses the eeprompagesize.
-*	Bootloaders ignore all of these params.
-*
-*	[0] commandsize - >> Differs from doc specification.  The doc says it's the
-*			number of bytes to follow.  Avrdude sends the total size including
-*			commandsize, so 5 instead of 4 as noted in the spec.
-*	[1]	eeprompagesize - EEPROM page size in bytes.
-*	[2] signalpagel - Defines to which port pin the PAGEL signal should be
-*			mapped. Example: signalpagel = 0xD7. In this case PAGEL should be
-*			mapped to PORTD7.
-*	[3] signalbs2 - Defines to which port pin the BS2 signal should be mapped.
-*			See signalpagel.
-*	[4] ResetDisable - Defines whether a part has RSTDSBL Fuse (value = 1) or
-*			not (value = 0).
+*	Called once the fuses (if any) are set.  The SPI clock can now be raised to
+*	whatever is reflected in the config.
 */
-void SDHexSession::SetDeviceExt(
-	bool	inIsResponse)
+void SDHexSession::BeginRecipeMemory(void)
 {
-	if (!inIsResponse)
+	mAVRStreamISP->SetAVRConfig(mConfig);
+	if (mConfig.recipe & (SAVRConfig::eRecipeFlash + SAVRConfig::eRecipeBootloader))
 	{
-		WaitForAvailableForWrite(7);
-		mStream->write(STK_SET_DEVICE_EXT);	// 0x45
-		uint8_t	zeroParams[3] = {0};
-		mStream->write(5);						// 0
-		mStream->write(mConfig.eepromPageSize);	// 1
-		mStream->write(zeroParams, 3);			// 2:4
-		mStream->write(CRC_EOP);
-		mCmdHandler = &SDHexSession::SetDeviceExt;
-	} else if (ResponseStatusOK())
+		mStage = eLoadingFlash;
+		SetBytesPerPage(FlashBatchSize());
+		RewindSession();
+		ProcessPage(false);
+	} else if (RecipeHasFile(eRecipeEEPROMFile))
 	{
-		EnterProgramMode(false);
+		BeginRecipeEEPROM();
+	} else
+	{
+		EndRecipe();
 	}
 }
 
-/****************************** EnterProgramMode ******************************/
-void SDHexSession::EnterProgramMode(
-	bool	inIsResponse)
+/***************************** BeginRecipeEEPROM ******************************/
+void SDHexSession::BeginRecipeEEPROM(void)
 {
-	if (!inIsResponse)
+#ifdef SUPPORT_DIFF_PROGRAMMING
+	mDiffState = eDiffOff;	// In case the CRC verify fell back to diff
+#endif
+	mStage = eLoadingEEPROM;
+	SetBytesPerPage(mConfig.eepromPageSize);
+	RewindSession();
+	mConfig.byteCount = HexDataLength();
+	if (mConfig.byteCount == 0)
 	{
-		WaitForAvailableForWrite(2);
+		mConfig.byteCount = 1;
+	}
+	ProcessPage(false);
+}
+
+/******************************* ContinueRecipe *******************************/
+/*
+*	Called when the verification of a flash file or the EEPROM has completed.
+*	When the flash is CRC verified, all of the flash files have already been
+*	verified.
+*/
+void SDHexSession::ContinueRecipe(void)
+{
+	if (mStage & eIsFlash)
+	{
+	#ifdef SUPPORT_CRC_VERIFY
+		if (!(mCRCVerify && mCRCRegionCount) &&
+			NextRecipeFlashFile())
+	#else
+		if (NextRecipeFlashFile())
+	#endif
+		{
+			ProcessPage(false);
+		} else if (RecipeHasFile(eRecipeEEPROMFile))
+		{
+			BeginRecipeEEPROM();
+		} else
+		{
+			EndRecipe();
+		}
+	} else
+	{
+		EndRecipe();
+	}
+}
+
+/********************************* EndRecipe **********************************/
+void SDHexSession::EndRecipe(void)
+{
+	if (mConfig.recipe & SAVRConfig::eRecipeLockBits)
+	{
+		mStage = eVerifyLockBits;
+		mStageModifier = 0;
+		VerifyLockBits(false);
+	} else
+	{
+		LeaveProgramMode(false);
+	}
+}
+#endif
+
+#ifdef SUPPORT_TARGET_BACKUP
+/******************************** beginBackup *********************************/
+/*
+*	Reads the target's flash and EEPROM to SD.  inPath is the path of an
+*	existing hex or eep file.  Its config (.txt) file describes the target.
+*	The backup is written to the same path with .bak inserted before the
+*	extension, e.g. Blink.ino.hex -> Blink.ino.bak.hex and Blink.ino.bak.eep.
+*	A copy of the config file, Blink.ino.bak.txt, is written so that the backup
+*	appears in the file list and can be loaded like any other hex file.  On a
+*	card mastered by SDMaster the backup files are also added to the catalog,
+*	see AddBackupToCatalog().
+*
+*	The inStream and inAVRStreamISP usage is the same as begin().
+*
+*	The flash size is taken from the flash.size key.  If the config doesn't
+*	have this key then upload.maximum_size is used, which doesn't include
+*	the bootloader section (if any.)
+*/
+bool SDHexSession::beginBackup(
+	const char*		inPath,
+	Stream*			inStream,
+	AVRStreamISP*	inAVRStreamISP)
+{
+	mStream = inStream == nullptr ? &mContextualStream : inStream;
+	mAVRStreamISP = inAVRStreamISP;
+	AVRConfig	avrConfig;
+	char		path[100];
+	size_t		pathLen = strlen(inPath);
+	memcpy(path, inPath, pathLen);
+	strcpy(&path[pathLen-3], "txt");
+	bool success = avrConfig.ReadFile(path);
+	if (success)
+	{
+		memcpy(&mConfig, &avrConfig.Config(), sizeof(SAVRConfig));
+		mOperation = eBackupMemory;
+		if (mConfig.flashSize == 0)
+		{
+			mConfig.flashSize = mConfig.uploadMaximumSize;
+		}
+		// byteCount is only used for the progress percentage.
+		mConfig.byteCount = mConfig.flashSize + mConfig.eepromSize;
+		success = mConfig.byteCount != 0 &&
+					CopyConfigForBackup(path, pathLen) &&
+						mHexWriter.begin(path);
+		if (success &&
+			inAVRStreamISP)
+		{
+			inAVRStreamISP->SetStream(&mContextualStream);
+			inAVRStreamISP->SetAVRConfig(avrConfig.Config());
+		}
+	}
+	if (success)
+	{
+		StartSession(true, 0);
+	} else
+	{
+		mHexWriter.Close();
+		mStream = nullptr;
+	}
+	return(success);
+}
+
+/**************************** CopyConfigForBackup *****************************/
+/*
+*	ioPath is the path of the config file of the hex file being backed up.
+*	inPathLen is the length of this path.  The config is copied to the backup
+*	config path with timestamp=0 appended so that data isn't replaced when the
+*	backup is loaded (see ReplaceData().)  upload.maximum_size=0 is also
+*	appended, see kBackupTimestampStr.  On return ioPath contains the path of
+*	the backup hex file.
+*/
+bool SDHexSession::CopyConfigForBackup(
+	char*	ioPath,
+	size_t	inPathLen)
+{
+	// mContextualStream isn't in use yet so its buffer is used for the copy.
+	mContextualStream.begin();
+	uint8_t*	buffer = mContextualStream.Buffer1();
+	char		backupPath[100];
+	bool		success = false;
+	memcpy(backupPath, ioPath, inPathLen-4);
+	strcpy_P(&backupPath[inPathLen-4], kBackupTxtSuffixStr);
+#ifdef __MACH__
+	FILE*	srcFile = fopen(ioPath, "r");
+	if (srcFile)
+	{
+		FILE*	dstFile = fopen(backupPath, "w");
+		if (dstFile)
+		{
+			size_t	bytesRead;
+			success = true;
+			while (success &&
+				(bytesRead = fread(buffer, 1, AVR_BUFFER_SIZE, srcFile)) != 0)
+			{
+				success = fwrite(buffer, 1, bytesRead, dstFile) == bytesRead;
+			}
+			success = success &&
+				fputs(kBackupTimestampStr, dstFile) >= 0;
+			fclose(dstFile);
+		}
+		fclose(srcFile);
+	}
+#else
+	SdFile	srcFile;
+	if (srcFile.open(ioPath, O_RDONLY))
+	{
+		SdFile	dstFile;
+		if (dstFile.open(backupPath, O_WRONLY | O_CREAT | O_TRUNC))
+		{
+			int	bytesRead;
+			success = true;
+			while (success &&
+				(bytesRead = srcFile.read(buffer, AVR_BUFFER_SIZE)) > 0)
+			{
+				success = dstFile.write(buffer, bytesRead) == bytesRead;
+			}
+			strcpy_P((char*)buffer, kBackupTimestampStr);
+			size_t	timestampLen = strlen((char*)buffer);
+			success = success &&
+				dstFile.write(buffer, timestampLen) == (int)timestampLen;
+			dstFile.close();
+		}
+		srcFile.close();
+	}
+#endif
+	strcpy_P(&ioPath[inPathLen-4], kBackupHexSuffixStr);
+	return(success);
+}
+
+/*************************** AppendBackupByteCount ****************************/
+/*
+*	ioPath is the name of the backup hex file.  The number of data bytes written
+*	to this file is appended to the backup config as the byte_count key.
+*	On return ioPath contains the path of the backup config.
+*/
+bool SDHexSession::AppendBackupByteCount(
+	char*	ioPath)
+{
+	char	line[24];
+	strcpy_P(line, kBackupByteCountStr);
+	{
+		char*		linePtr = &line[strlen(line)];
+		char*		startPtr = linePtr;
+		uint32_t	byteCount = mHexWriter.DataByteCount();
+		do
+		{
+			*(linePtr++) = (byteCount % 10) + '0';
+			byteCount /= 10;
+		} while (byteCount);
+		// The digits are in reverse order
+		for (char* endPtr = linePtr - 1; startPtr < endPtr; startPtr++, endPtr--)
+		{
+			char	thisChar = *startPtr;
+			*startPtr = *endPtr;
+			*endPtr = thisChar;
+		}
+		*(linePtr++) = '\n';
+		*linePtr = 0;
+	}
+	size_t	lineLen = strlen(line);
+	bool	success = false;
+	size_t	pathLen = strlen(ioPath);
+	strcpy(&ioPath[pathLen-3], "txt");
+#ifdef __MACH__
+	FILE*	configFile = fopen(ioPath, "a");
+	if (configFile)
+	{
+		success = fwrite(line, 1, lineLen, configFile) == lineLen;
+		fclose(configFile);
+	}
+#else
+	SdFile	configFile;
+	if (configFile.open(ioPath, O_WRONLY | O_AT_END))
+	{
+		success = configFile.write(line, lineLen) == (int)lineLen;
+		configFile.close();
+	}
+#endif
+	return(success);
+}
+
+/***************************** AddBackupToCatalog *****************************/
+/*
+*	inPath is the path of the backup hex or eep file just written.  When the
+*	card has a catalog, the loader only lists what's in the catalog, so the
+*	backup is added to it.  The entry of an earlier backup with the same
+*	filename is replaced, otherwise the entry is appended and the count in
+*	the header updated.  A card without a valid catalog isn't an error.
+*/
+bool SDHexSession::AddBackupToCatalog(
+	const char*	inPath)
+{
+	SCatalogHeader	header;
+	SCatalogEntry	entry;
+	char			path[sizeof(kCatalogPathStr)];
+	size_t			pathLen = strlen(inPath);
+	bool			success = true;
+	strcpy_P(path, kCatalogPathStr);
+#ifdef __MACH__
+	FILE*	catalog = fopen(path, "r+b");
+	bool	valid = catalog &&
+				fread(&header, sizeof(header), 1, catalog) == 1 &&
+				fseek(catalog, 0, SEEK_END) == 0 &&
+				(uint32_t)ftell(catalog) == (sizeof(SCatalogHeader) +
+							(uint32_t)header.count * sizeof(SCatalogEntry));
+#else
+	SdFile	catalogFile;
+	SdFile*	catalog = catalogFile.open(path, O_RDWR) ? &catalogFile : nullptr;
+	bool	valid = catalog &&
+				catalog->read(&header, sizeof(header)) == sizeof(header) &&
+				catalog->fileSize() == (sizeof(SCatalogHeader) +
+							(uint32_t)header.count * sizeof(SCatalogEntry));
+#endif
+	if (valid &&
+		memcmp_P(header.magic, kCatalogMagicStr, sizeof(header.magic)) == 0 &&
+		header.version == SD_CATALOG_VERSION &&
+		pathLen < sizeof(entry.filename))
+	{
+		/*
+		*	Look for an earlier backup, the filename field of each entry is
+		*	read into entry.filename.
+		*/
+		uint16_t	index = 0;
+		for (; index < header.count; index++)
+		{
+			uint32_t	position = sizeof(SCatalogHeader) +
+							(uint32_t)index * sizeof(SCatalogEntry) +
+								offsetof(SCatalogEntry, filename);
+		#ifdef __MACH__
+			success = fseek(catalog, position, SEEK_SET) == 0 &&
+				fread(entry.filename, sizeof(entry.filename), 1, catalog) == 1;
+		#else
+			success = catalog->seekSet(position) &&
+				catalog->read(entry.filename, sizeof(entry.filename)) ==
+												sizeof(entry.filename);
+		#endif
+			if (!success ||
+				strcmp(entry.filename, inPath) == 0)
+			{
+				break;
+			}
+		}
+		if (success)
+		{
+			memset(&entry, 0, sizeof(SCatalogEntry));
+			entry.uploadSpeed = mConfig.uploadSpeed;
+			entry.byteCount = mHexWriter.DataByteCount();
+			strcpy(entry.filename, inPath);
+			/*
+			*	The displayed name, as in SDHexLoader::LoadNextHexFilename
+			*/
+			pathLen -= 4;
+			if (pathLen > 4 &&
+				memcmp(&inPath[pathLen-4], ".ino", 4) == 0)
+			{
+				pathLen -= 4;
+			}
+			if (pathLen >= sizeof(entry.name))
+			{
+				pathLen = sizeof(entry.name) - 1;
+			}
+			memcpy(entry.name, inPath, pathLen);
+			memcpy(entry.desc, mConfig.desc, sizeof(entry.desc) - 1);
+			memcpy(entry.signature, mConfig.signature, 3);
+			entry.type = mStage == eDumpingFlash ? eCatalogHex : eCatalogEEP;
+			uint32_t	position = sizeof(SCatalogHeader) +
+							(uint32_t)index * sizeof(SCatalogEntry);
+		#ifdef __MACH__
+			success = fseek(catalog, position, SEEK_SET) == 0 &&
+				fwrite(&entry, sizeof(SCatalogEntry), 1, catalog) == 1;
+		#else
+			success = catalog->seekSet(position) &&
+				catalog->write(&entry, sizeof(SCatalogEntry)) ==
+												sizeof(SCatalogEntry);
+		#endif
+			/*
+			*	The header is only updated once the entry has been written.
+			*/
+			if (success &&
+				index == header.count)
+			{
+				header.count++;
+			#ifdef __MACH__
+				success = fseek(catalog, 0, SEEK_SET) == 0 &&
+					fwrite(&header, sizeof(header), 1, catalog) == 1;
+			#else
+				success = catalog->seekSet(0) &&
+					catalog->write(&header, sizeof(header)) == sizeof(header);
+			#endif
+			}
+		}
+	}
+	if (catalog)
+	{
+	#ifdef __MACH__
+		success = fclose(catalog) == 0 && success;
+	#else
+		success = catalog->close() && success;
+	#endif
+	}
+	return(success);
+}
+#endif
+
+/******************************* BootloaderPath *******************************/
+/*
+*	Bootloaders are stored in the root /bootloaders folder.  See begin().
+*/
+void SDHexSession::BootloaderPath(
+	char*	outPath)
+{
+	strcpy_P(outPath, kBootloaderPathPrefixStr);
+	size_t	pathLen = strlen(outPath);
+	UnixTime::Uint16ToDecStr(mConfig.bootloader, &outPath[pathLen]);
+	pathLen = strlen(outPath);
+	strcpy_P(&outPath[pathLen], kHexExtensionStr);
+}
+
+/******************************** StartSession ********************************/
+/*
+*	Common session setup once the config has been read and the hex file, if
+*	any, has been opened.
+*/
+void SDHexSession::StartSession(
+	bool		inLoadingFlash,
+	uint32_t	inTimestamp)
+{
+	mSyncRetries = 0;
+	mError = 0;
+	mSerialISP = !mAVRStreamISP;
+	mCmdHandler = &SDHexSession::SetDevice;
+	/*
+	*	When using AVRStreamISP, AVRStreamISP manages the reset line.
+	*	
+	*	If AVRStreamISP isn't being used THEN
+	*	manage the reset line here (for Serial1 stream)
+	*/
+#ifdef SESSION_TIMING
+	if (mSerialISP)
+	{
+	#ifndef __MACH__
+		/*
+		*	In this case where Serial1 is used, resetting the target MCU is
+		*	done by holding DTR/reset low for the duration of the session.
+		*
+		*	At this point the reset pin/DTR is essentially floating. Change
+		*	the pin to output, enable the the buffered 3v3 DTR/reset signal
+		*	for possible 3v3 serial use.
+		*/
+		pinMode(Config::kResetPin, OUTPUT);
+	#if (HEX_LOADER_VER >= 12)
+		digitalWrite(Config::kReset3v3OEPin, LOW);	// The OE pin on the level shifter
+	#endif
+	#endif
+		ResetSerialTarget();
+	} else
+	{
+		mSyncState = eSyncLocked;
+	}
+#endif
+	/*
+	*	Setup the contextual stream even if the stream is serial.
+	*/
+	mContextualStream.begin();
+	{
+		mContextualStream.ReadFrom1(true);
+		GetSync(false);	// Load the 1st command for either stream
+		mContextualStream.ReadFrom1(false);
+	}
+	mStage = eVerifySignature;
+#ifdef SUPPORT_DIFF_PROGRAMMING
+	mDiffState = eDiffOff;
+#endif
+#ifdef SUPPORT_RESUME
+	mCheckpoint.valid = false;
+	mResumeCount = 0;
+#endif
+#ifdef SUPPORT_VERIFY_RETRY
+	mUnitAddress = 0xFFFFFFFF;
+	mRewritingUnit = false;
+	mErasedForRetry = false;
+	mRetryCount = 0;
+#endif
+#ifdef SUPPORT_CRC_VERIFY
+	mCRCVerify = !mSerialISP;
+	mCRCRegionCount = 0;
+#endif
+	// Page variables:
+	SetBytesPerPage(inLoadingFlash ? FlashBatchSize() : mConfig.eepromPageSize);
+	mBytesProcessed = 0;
+	mPercentageProcessed = 0;
+	// When loading flash, if the target device capacity is greaterthan 128KB
+	// then initializing mCurrentAddressH to 0xFF will generate a Load Extended
+	// Address command for extended address 0.
+	mCurrentAddressH = (!inLoadingFlash || (mConfig.devcode < 0xB0)) ? 0 : 0xFF;
+	mDataIndex = 0;
+	// Initializing mCurrentPageAddress to 0xFFFF will generate the initial Load
+	// Address command for the first address.
+	mCurrentPageAddress = 0xFFFF;
+#ifdef SUPPORT_REPLACEMENT_DATA
+	// See ReplaceData() for an explanation of what replacement data is.
+	mReplacementAddress = mConfig.timestamp;
+	mReplacementDataIndex = 0;
+	mReplacementData[3] = inTimestamp >> 24;
+	mReplacementData[2] = inTimestamp >> 16;
+	mReplacementData[1] = inTimestamp >> 8;
+	mReplacementData[0] = inTimestamp;
+#endif
+}
+
+/************************************ Halt ************************************/
+bool SDHexSession::Halt(void)
+{
+	bool haltedSession = mStream != nullptr;
+	if (haltedSession)
+	{
+		mStage = eSessionCompleted;
+	#if defined(__MACH__) && defined(SESSION_TIMING)
+		if (mSerialISP)
+		{
+			mStream->SetReset(false);	// Release DTR, the target boots normally
+		}
+	#endif
+		mStream = nullptr;
+	#ifndef __MACH__
+		if (mSerialISP)
+		{
+			/*
+			*	Restore DTR/reset to floating for 3v3 serial, and INPUT_PULLUP
+			*	for 5v. Both will allow the capacitor attached to DTR/reset on
+			*	the target board to rise to a HIGH state so the target MCU will
+			*	boot normally.
+			*/
+			digitalWrite(Config::kResetPin, HIGH);
+			/*
+			*	Something funky is happening and I don't understand why. If I
+			*	remove the delay before setting the pin mode, any SPI activity
+			*	following the call to pinMode will hang the MCU.  The reset pin
+			*	is on the same port as the SPI pins. I found this using code
+			*	elimination and have no idea why it happens or what the delay
+			*	does to keep it from hanging. I noticed that it stopped hanging
+			*	when I placed a few debugging print statements to isolate where
+			*	it was hanging.  I replaced the print statements with a delay.
+			*/
+			delay(1);
+			pinMode(Config::kResetPin, INPUT_PULLUP);
+		#if (HEX_LOADER_VER >= 12)
+			digitalWrite(Config::kReset3v3OEPin, HIGH);
+		#endif
+		}
+	#endif
+		mImage->end();	// Release/close SD file
+	#ifdef SUPPORT_RECORD_INDEX
+		mRunIndex.end();
+	#endif
+	#ifdef SUPPORT_TARGET_BACKUP
+		mHexWriter.Close();	// Does nothing if the backup completed
+	#endif
+	#ifdef SESSION_TIMING
+		mTimeout.Set(0);
+	#endif
+	}
+	return(haltedSession);
+}
+
+/****************************** WaitForAvailable ******************************/
+bool SDHexSession::WaitForAvailable(
+	uint8_t	inBytesToWaitFor)
+{
+#ifdef SESSION_TIMING
+	if (mSerialISP)
+	{
+		MSPeriod	timeout((uint32_t)inBytesToWaitFor * 10);
+		timeout.Start();
+		while (mStream->available() < inBytesToWaitFor)
+		{
+			if (!timeout.Passed())
+			{
+				continue;
+			}
+			return(false);
+		}
+	}
+#endif
+	return(true);
+}
+
+/************************** WaitForAvailableForWrite **************************/
+void SDHexSession::WaitForAvailableForWrite(
+	uint8_t	inBytesToWaitFor)
+{
+#ifndef __MACH__
+	if (mSerialISP)
+	{
+		while (((HardwareSerial*)mStream)->availableForWrite() < inBytesToWaitFor){}
+	}
+#endif
+}
+
+/*
+*	The bulk transfer routines below are what the page data goes through.  The
+*	transport is decided once per call rather than once per byte.  When the
+*	stream is mContextualStream (the internal ISP, or buffer 2 used as scratch)
+*	the data is copied directly rather than a byte at a time via the virtual
+*	Stream functions.
+*/
+/********************************** PutBytes **********************************/
+void SDHexSession::PutBytes(
+	Stream*			inStream,
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+	if (inStream == &mContextualStream)
+	{
+		mContextualStream.ContextualStream::write(inData, inLength);
+	} else
+	{
+		// HardwareSerial::write blocks while its transmit buffer is full.
+		inStream->write(inData, inLength);
+	}
+}
+
+/********************************** PutFill ***********************************/
+/*
+*	Writes inCount 0xFF bytes, the value of erased memory.
+*/
+void SDHexSession::PutFill(
+	Stream*		inStream,
+	uint16_t	inCount)
+{
+	if (inStream == &mContextualStream)
+	{
+		mContextualStream.Fill(0xFF, inCount);
+	} else
+	{
+		for (; inCount; inCount--)
+		{
+			inStream->write(0xFF);
+		}
+	}
+}
+
+/******************************** GetResponse *********************************/
+/*
+*	Returns a pointer to the next inLength bytes of the response, or nullptr on
+*	a timeout.  The internal ISP has already written the entire response to
+*	buffer 1, so it's used in place.  Serial responses are read into buffer 1,
+*	which isn't otherwise used when the stream is serial.
+*/
+const uint8_t* SDHexSession::GetResponse(
+	uint16_t	inLength)
+{
+	if (!mSerialISP)
+	{
+		return(mContextualStream.Take(inLength));
+	}
+	uint8_t*	response = mContextualStream.Buffer1();
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		if (!WaitForAvailable(1))
+		{
+			return(nullptr);
+		}
+		response[i] = mStream->read();
+	}
+	return(response);
+}
+
+/****************************** ResponseStatusOK ******************************/
+bool SDHexSession::ResponseStatusOK(void)
+{
+	
+	bool	statusOK = WaitForAvailable(1) &&
+						mStream->read() == STK_OK;
+	if (!statusOK)
+	{
+		GetSync(false);
+	}
+	return(statusOK);
+}
+
+/********************************** GetSync ***********************************/
+/*
+*	Prior to calling GetSync(false), the mCmdHandler should point to the handler
+*	to be called after attaining sync.
+*/
+void SDHexSession::GetSync(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(2);
+		mStream->write(STK_GET_SYNC);
+		mStream->write(CRC_EOP);
+		/*
+		*	If not resync...
+		*/
+		if (mCmdHandler != &SDHexSession::GetSync)
+		{
+			mOnSyncCmdHandler = mCmdHandler;
+			mCmdHandler = &SDHexSession::GetSync;
+		}
+	} else if (ResponseStatusOK())
+	{
+		mSyncRetries = 0;
+		mCmdHandler = mOnSyncCmdHandler;
+		(this->*(mCmdHandler))(false);
+	}
+}
+
+#ifdef SESSION_TIMING
+/***************************** ResetSerialTarget ******************************/
+/*
+*	Resets the target so that its bootloader runs.  The reset line is held low
+*	for the duration of the session.
+*/
+void SDHexSession::ResetSerialTarget(void)
+{
+#ifdef __MACH__
+	mStream->SetReset(false);
+	delay(1);
+	mStream->SetReset(true);	// DTR asserted is reset low
+#else
+	digitalWrite(Config::kResetPin, HIGH);
+	delay(1);	// Allow the DTR/reset cap on the target board time to charge.
+				// If this isn't done the board may not notice reset going low.
+	digitalWrite(Config::kResetPin, LOW);
+#endif
+	/*
+	*	avrdude delays 300ms before sending the first bit of data.  Rather
+	*	than waiting, STK_GET_SYNC is sent repeatedly starting right after
+	*	reset.  See UpdateEarlySync().
+	*/
+	mSyncState = eSyncSearching;
+	mSyncPeriod.Set(mConfig.syncInterval ? mConfig.syncInterval : kSyncInterval);
+	mSyncPeriod.Start();
+	mSyncWindow.Set(mConfig.syncWindow ? mConfig.syncWindow : kSyncWindow);
+	mSyncWindow.Start();
+}
+
+/****************************** UpdateEarlySync *******************************/
+/*
+*	Serial (bootloader) sessions only.  The bootloader is ready at some point
+*	after reset, typically within a few tens of milliseconds.  Until it
+*	responds, STK_GET_SYNC is sent every sync.interval ms.  Anything other than
+*	STK_INSYNC STK_OK is ignored while searching.
+*
+*	Because more than one STK_GET_SYNC may have been received by the
+*	bootloader, responses are drained until the line has been quiet for an
+*	interval.  A normal sync then confirms the connection and the session
+*	continues with the command saved by GetSync().
+*/
+void SDHexSession::UpdateEarlySync(void)
+{
+	if (mStream->available())
+	{
+		uint8_t	response = mStream->read();
+		if (mSyncState == eSyncSearching &&
+			response == STK_INSYNC &&
+			WaitForAvailable(1) &&
+			mStream->read() == STK_OK)
+		{
+			mSyncState = eSyncSettling;
+		}
+		if (mSyncState == eSyncSettling)
+		{
+			mSyncPeriod.Start();
+		}
+	} else if (mSyncPeriod.Passed())
+	{
+		if (mSyncState == eSyncSettling)
+		{
+			mSyncState = eSyncLocked;
+			GetSync(false);
+		} else if (mSyncWindow.Passed())
+		{
+			FailOrResume(eSyncErr);
+		} else
+		{
+			GetSync(false);
+			mSyncPeriod.Start();
+		}
+	}
+}
+#endif
+
+/********************************* SetDevice **********************************/
+/*
+*	Most of the parameters of the STK_SET_DEVICE command aren't used by the
+*	internal AVRStreamISP.  AVRStreamISP only uses the pagesize and eepromsize.
+*	Bootloaders ignore all of these params.
+*
+*	
+*	See "Set Device Programming Parameters" in the AVR061 doc.
+*
+*	[0] devicecode - Device code as defined in “devices.h”
+*	[1] revision - Device revision. Currently not used. Should be 0.
+*	[2] progtype - Defines which Program modes is supported:
+*			“0” – Both Parallel/High-voltage and Serial mode
+*			“1” – Only Parallel/High-voltage mode
+*	[3] parmode - Defines if the device has a full parallel interface or a
+*			pseudo parallel programming interface:
+*			“0” – Pseudo parallel interface
+*			“1” – Full parallel interface
+*	[4] polling - Defines if polling may be used during SPI access:
+*			“0” – No polling may be used
+*			“1” – Polling may be used
+*	[5] selftimed - Defines if programming instructions are self timed:
+*			“0” – Not self timed
+*			“1” – Self timed
+*	[6] lockbytes - Number of Lock bytes. Currently not used. Should be set to
+*			actual number of Lock bytes for future compability.
+*	[7] fusebytes - Number of Fuse bytes. Currently not used. Should be set to
+*			actual number of Fuse bytes for future caompability.
+*
+*	Multi byte parameters values are big endian...
+*
+*	[8:9] flashpollval - FLASH polling value. See Data Sheet for the device.
+*	[10:11] eeprompollval - EEPROM polling value, See data sheet for the device.
+*	[12:13] pagesize - Page size in bytes for pagemode parts
+*	[14:15] eepromsize - EEPROM size in bytes
+*	[16:19] flashsize - FLASH size in bytes.
+*/
+/********************************* SetDevice **********************************/
+void SDHexSession::SetDevice(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(21);
+		mStream->write(STK_SET_DEVICE);	// 0x42
+		uint8_t	zeroParams[11] = {0};
+		mStream->write(mConfig.devcode);			// 0
+		mStream->write(zeroParams, 11);				// 1:11
+		// These are written out big endian.
+		mStream->write(mConfig.flashPageSize >> 8);	// 12
+		mStream->write(mConfig.flashPageSize);		// 13
+		mStream->write(mConfig.eepromSize >> 8);	// 14
+		mStream->write(mConfig.eepromSize);			// 15
+		mStream->write(zeroParams, 4);				// 16:19
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::SetDevice;
+	} else if (ResponseStatusOK())
+	{
+		SetDeviceExt(false);
+	}
+}
+
+/******************************** SetDeviceExt ********************************/
+/*
+*	Most of the parameters of the STK_SET_DEVICE_EXT command aren't used by the
+*	internal AVRStreamISP.  AVRStreamISP only uses the eeprompagesize.
+*	Bootloaders ignore all of these params.
+*
+*	[0] commandsize - >> Differs from doc specification.  The doc says it's the
+*			number of bytes to follow.  Avrdude sends the total size including
+*			commandsize, so 5 instead of 4 as noted in the spec.
+*	[1]	eeprompagesize - EEPROM page size in bytes.
+*	[2] signalpagel - Defines to which port pin the PAGEL signal should be
+*			mapped. Example: signalpagel = 0xD7. In this case PAGEL should be
+*			mapped to PORTD7.
+*	[3] signalbs2 - Defines to which port pin the BS2 signal should be mapped.
+*			See signalpagel.
+*	[4] ResetDisable - Defines whether a part has RSTDSBL Fuse (value = 1) or
+*			not (value = 0).
+*/
+void SDHexSession::SetDeviceExt(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(7);
+		mStream->write(STK_SET_DEVICE_EXT);	// 0x45
+		uint8_t	zeroParams[3] = {0};
+		mStream->write(5);						// 0
+		mStream->write(mConfig.eepromPageSize);	// 1
+		mStream->write(zeroParams, 3);			// 2:4
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::SetDeviceExt;
+	} else if (ResponseStatusOK())
+	{
+		EnterProgramMode(false);
+	}
+}
+
+/****************************** EnterProgramMode ******************************/
+void SDHexSession::EnterProgramMode(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(2);
 		mStream->write(STK_ENTER_PROGMODE);	// 0x50
 		mStream->write(CRC_EOP);
-		mCmdHandler = &SDHexSession::EnterProgramMode;
+		mCmdHandler = &SDHexSession::EnterProgramMode;
+	} else if (ResponseStatusOK())
+	{
+		if (mStage == eVerifySignature)
+		{
+			ReadSignature(false);
+		} else if (mStage == eVerifyUnlocked)
+		{
+			// This is only done when setting fuses (with or without bootloader.)
+			mStageModifier = 0;
+			VerifyUnlocked(false);
+		} else if (mOperation == eSetFusesAndBootloader)
+		{
+			// This is only done when loading a bootloader. (called via VerifyFuse)
+			// Now that the fuses have been verified, adjust the SPI speed to
+			// the max for fCPU.
+			mAVRStreamISP->SetAVRConfig(mConfig);
+			ProcessPage(false);
+	#ifdef SUPPORT_RECIPES
+		} else if (mOperation == eRecipe)
+		{
+			// Re-entered to latch the fuses just written (called via VerifyFuse)
+			BeginRecipeMemory();
+	#endif
+		} else // assumed to be mOperation == eSetFuses
+		{
+			// This is done when just the fuses are being set (no bootloader)
+			mStage = eVerifyLockBits;
+			mStageModifier = 0;
+			VerifyLockBits(false);
+		}
+	}
+}
+
+/****************************** LeaveProgramMode ******************************/
+void SDHexSession::LeaveProgramMode(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(2);
+		mStream->write(STK_LEAVE_PROGMODE);	// 0x51
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::LeaveProgramMode;
+	} else if (ResponseStatusOK())
+	{
+		Halt();
+	}
+}
+
+/******************************* ReadSignature ********************************/
+void SDHexSession::ReadSignature(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(2);
+		mStream->write(STK_READ_SIGN);	// 0x75
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::ReadSignature;
+	} else if (WaitForAvailable(4) && mStream->available() > 3)
+	{
+		for (uint8_t i = 0; i < 3; i++)
+		{
+			if (mConfig.signature[i] == mStream->read())
+			{
+				continue;
+			}
+			mError = eSignatureErr;
+			break;
+		}
+		if (!mError &&
+			ResponseStatusOK())
+		{
+		#ifdef SUPPORT_TARGET_BACKUP
+			if (mOperation == eBackupMemory)
+			{
+				mStage = eDumpingFlash;
+				mDumpAddress = 0;
+				mDumpSize = mConfig.flashSize;
+				SetBytesPerPage(mSerialISP ? SerialReadSize() : 256);
+				ProcessPage(false);
+			} else
+		#endif
+		#ifdef SUPPORT_DIFF_PROGRAMMING
+			/*
+			*	If differential programming is enabled for this flash image THEN
+			*	read the target before erasing anything to determine which
+			*	pages actually need to be written.  See EndComparison().
+			*/
+			if (mConfig.diffProgram &&
+				mOperation == eProgramFlash)
+			{
+				mDiffState = eDiffCompare;
+				mNeedsErase = false;
+				mDirtyPageCount = 0;
+				memset(mDirtyPages, 0, DIFF_PAGE_MAP_SIZE);
+				mBlankAddress = 0;
+				/*
+				*	Only the application section is checked for old code
+				*	beyond the image.  A chip erase would also erase any
+				*	bootloader above it.
+				*/
+				mBlankEnd = (mConfig.uploadMaximumSize ?
+					mConfig.uploadMaximumSize : mConfig.flashSize) >> 1;
+				mStage = eComparingFlash;
+				/*
+				*	The comparison isn't batched.  The padding of a partial
+				*	batch would be compared with whatever is on the target
+				*	beyond the end of the hex data.
+				*/
+				SetBytesPerPage(mSerialISP ? SerialReadSize() : mConfig.flashPageSize);
+				ProcessPage(false);
+			} else
+		#endif
+			ChipErase(false);
+		}
+	}
+}
+
+/******************************* SetupUniversal *******************************/
+void SDHexSession::SetupUniversal(
+	uint8_t	inByte1,
+	uint8_t	inByte2,
+	uint8_t	inByte3,
+	uint8_t	inByte4)
+{
+	WaitForAvailableForWrite(6);
+	mStream->write(STK_UNIVERSAL);	// 0x56
+	mStream->write(inByte1);
+	mStream->write(inByte2);
+	mStream->write(inByte3);
+	mStream->write(inByte4);
+	mStream->write(CRC_EOP);
+}
+
+/********************************* ChipErase **********************************/
+/*
+*	This will only erase the chip when done through the ISP, not through a
+*	bootloader.  Most bootloaders ignore this command and self-erase as needed
+*	when writing pages.
+*/
+void SDHexSession::ChipErase(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		// Chip Erase as per AVR Serial Programming Instruction Set
+		SetupUniversal(0xAC, 0x80, 0, 0);
+		mCmdHandler = &SDHexSession::ChipErase;
+	#ifdef SESSION_TIMING
+		mCmdDelay.Set(mConfig.chipEraseDelay);
+		mCmdDelay.Start();
+	#endif
+	} else
+	{
+		if (WaitForAvailable(1))
+		{
+			mStream->read();	// Skip response
+			if (ResponseStatusOK())
+			{
+			#ifdef SUPPORT_RECIPES
+				/*
+				*	A recipe doesn't re-enter program mode here.  The lock bits
+				*	are verified directly, see VerifyUnlocked().
+				*/
+				if (mOperation == eRecipe)
+				{
+					if (mConfig.recipe & SAVRConfig::eRecipeFuses)
+					{
+						mStage = eVerifyUnlocked;
+						mStageModifier = 0;
+						VerifyUnlocked(false);
+					} else
+					{
+						BeginRecipeMemory();
+					}
+				} else
+			#endif
+				if (mOperation & eIsProgramming)	// Either flash or EEPROM
+				{
+					mStage = mOperation == eProgramFlash ? eLoadingFlash : eLoadingEEPROM;
+					ProcessPage(false);
+				} else	// Else, setting fuses, with or without a bootloader
+				{
+					// Re-enter program mode to latch new lock bits which should
+					// have been cleared (i.e. set to 0xFF) after chip erase.
+					mStage = eVerifyUnlocked;
+					EnterProgramMode(false);
+				}
+			}
+		}
+	}
+}
+
+/******************************* VerifyUnlocked *******************************/
+void SDHexSession::VerifyUnlocked(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		// Read the lock bits as per AVR Serial Programming Instruction Set
+		SetupUniversal(0x58, 0, 0, 0);
+		mCmdHandler = &SDHexSession::VerifyUnlocked;
+	} else
+	{
+		if (WaitForAvailable(1))
+		{
+			uint8_t	lockBits = mStream->read() & mConfig.lockBits[SAVRConfig::eMask];
+			if (ResponseStatusOK())
+			{
+				if (lockBits == mConfig.lockBits[SAVRConfig::eUnlock])
+				{
+					/*
+					*	If the 2nd verification passed THEN
+					*	move to the next stage.
+					*/
+					if (mStageModifier & eFuseVerified)
+					{
+						mStage = eVerifyExtendedFuse;
+						mStageModifier = 0;
+						mFuseInst = kFuseInst[0];
+						VerifyFuse(false);
+					} else
+					{
+						mStageModifier |= eFuseVerified;
+						VerifyUnlocked(false);
+					}
+			#ifdef SUPPORT_RECIPES
+				/*
+				*	If the chip still appears locked after a recipe's chip
+				*	erase THEN re-enter program mode (only once) to latch the
+				*	erased lock bits.
+				*/
+				} else if (mOperation == eRecipe &&
+					!mProgModeReentered)
+				{
+					mProgModeReentered = true;
+					EnterProgramMode(false);
+			#endif
+				} else
+				{
+					mError = eUnlockErr;
+				}
+			}
+		}
+	}
+}
+
+/********************************* VerifyFuse *********************************/
+/*
+*	Handler used to verify the extended, high and low fuses, in that order.
+*	If first verification fails an attempt is made to set the fuse (only once.)
+*	If subsequent verifications fail the session fails with a fuse error.
+*	This mimics the avrdude behavior.
+*/
+void SDHexSession::VerifyFuse(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		// Read the fuse as per AVR Serial Programming Instruction Set
+		SetupUniversal(mFuseInst.readInstByte1, mFuseInst.readInstByte2, 0, 0);
+		mCmdHandler = &SDHexSession::VerifyFuse;
+	#ifdef SESSION_TIMING
+		// Avrdude delays after each universal command sent.
+		// When this delay is removed, the set transaction below fails.
+		mCmdDelay.Set(mConfig.lockMinWriteDelay);
+		mCmdDelay.Start();
+	#endif
+	} else
+	{
+		if (WaitForAvailable(1))
+		{
+			uint8_t	fuseVal = mStream->read();
+			if (ResponseStatusOK())
+			{
+				if (mStageModifier & eFuseWriteResponse)
+				{
+					mStageModifier &= ~eFuseWriteResponse;
+					VerifyFuse(false);
+				// mStage is assumed to be one of eVerifyXXXFuse, so subtracting
+				// eVerifyFuse results in an index 0 to 2
+				} else if (fuseVal == mConfig.fuses[mStage - eVerifyFuse])
+				{
+					/*
+					*	If the 2nd verification passed THEN
+					*	move to the next stage.
+					*/
+					if (mStageModifier & eFuseVerified)
+					{
+						if (mStage < eVerifyLowFuse)
+						{
+							mStage++;
+							mStageModifier = 0;
+							mFuseInst = kFuseInst[mStage - eVerifyFuse];
+							VerifyFuse(false);
+					#ifdef SUPPORT_RECIPES
+						/*
+						*	Program mode is only re-entered by a recipe when a
+						*	fuse was actually written.
+						*/
+						} else if (mOperation == eRecipe &&
+							!mFusesWritten)
+						{
+							BeginRecipeMemory();
+					#endif
+						} else
+						{
+							mStage = eLoadingFlash;
+							EnterProgramMode(false);
+						}
+					} else
+					{
+						mStageModifier = eFuseVerified;
+						VerifyFuse(false);
+					}
+				/*
+				*	Else, if there was already a write attempt OR
+				*	the 2nd verification just failed THEN
+				*	fail.
+				*/
+				} else if (mStageModifier)
+				{
+					mError = eFuseErr + (mStage - eVerifyFuse);
+				/*
+				*	Else, attempt to write the fuse value.
+				*/
+				} else
+				{
+					mStageModifier = eFuseWriteResponse + eFuseWritten;
+				#ifdef SUPPORT_RECIPES
+					mFusesWritten = true;
+				#endif
+					SetupUniversal(0xAC, mFuseInst.writeInstByte2, 0, mConfig.fuses[mStage - eVerifyFuse]);
+				#ifdef SESSION_TIMING
+					mCmdDelay.Set(mConfig.lockMinWriteDelay);
+					mCmdDelay.Start();
+				#endif
+				}
+			}
+		}
+	}
+}
+
+/******************************* VerifyLockBits *******************************/
+/*
+*	Handler used to verify the lock bits.
+*	If first verification fails an attempt is made to set the lock bits (only once.)
+*	If subsequent verifications fail the session fails with a lock error.
+*	This mimics the avrdude behavior.
+*/
+void SDHexSession::VerifyLockBits(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		// Read the lock bits as per AVR Serial Programming Instruction Set
+		SetupUniversal(0x58, 0, 0, 0);
+		mCmdHandler = &SDHexSession::VerifyLockBits;
+	#ifdef SESSION_TIMING
+		// Avrdude delays after each universal command sent.
+		// When this delay is removed, the set transaction below may fail.
+		mCmdDelay.Set(mConfig.lockMinWriteDelay);
+		mCmdDelay.Start();
+	#endif
+	} else
+	{
+		if (WaitForAvailable(1))
+		{
+			uint8_t	lockBits = mStream->read() & mConfig.lockBits[SAVRConfig::eMask];
+			if (ResponseStatusOK())
+			{
+				if (mStageModifier & eFuseWriteResponse)
+				{
+					mStageModifier &= ~eFuseWriteResponse;
+					VerifyLockBits(false);
+				} else if (lockBits == mConfig.lockBits[SAVRConfig::eLock])
+				{
+					/*
+					*	If the 2nd verification passed THEN
+					*	we're done.
+					*/
+					if (mStageModifier & eFuseVerified)
+					{
+						LeaveProgramMode(false);
+					} else
+					{
+						mStageModifier = eFuseVerified;
+						VerifyLockBits(false);
+					}
+				/*
+				*	Else, if there was already a write attempt OR
+				*	the 2nd verification just failed THEN
+				*	fail.
+				*/
+				} else if (mStageModifier)
+				{
+					mError = eLockErr;
+				/*
+				*	Else, attempt to write the lockBits.
+				*/
+				} else
+				{
+					mStageModifier = eFuseWriteResponse + eFuseWritten;
+					// As per AVR docs, unused lock bits should be set. ORing
+					// the lock value with the ~mask satisfies this requirement.
+					SetupUniversal(0xAC, 0xE0, 0,
+										(~mConfig.lockBits[SAVRConfig::eMask]) |
+											mConfig.lockBits[SAVRConfig::eLock]);
+				#ifdef SESSION_TIMING
+					mCmdDelay.Set(mConfig.lockMinWriteDelay);
+					mCmdDelay.Start();
+				#endif
+				}
+			}
+		}
+	}
+}
+
+/******************************** LoadAddress *********************************/
+void SDHexSession::LoadAddress(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		WaitForAvailableForWrite(4);
+		mStream->write(STK_LOAD_ADDRESS);	// 0x55
+		mStream->write((uint8_t)mCurrentPageAddress);
+		mStream->write((uint8_t)(mCurrentPageAddress >> 8));
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::LoadAddress;
 	} else if (ResponseStatusOK())
 	{
-		if (mStage == eVerifySignature)
+		ProcessPage(false);
+	}
+}
+
+/******************************* LoadExtAddress *******************************/
+void SDHexSession::LoadExtAddress(
+	bool	inIsResponse)
+{
+	if (!inIsResponse)
+	{
+		// Load Extended Address byte as per AVR Serial Programming Instruction Set
+		SetupUniversal(0x4D, 0, mCurrentAddressH, 0);
+		mCmdHandler = &SDHexSession::LoadExtAddress;
+	} else
+	{
+		if (WaitForAvailable(1))
+		{
+			mStream->read();	// Skip response
+			if (ResponseStatusOK())
+			{
+				ProcessPage(false);
+			}
+		}
+	}
+}
+
+#ifdef SUPPORT_REPLACEMENT_DATA
+/******************************** ReplaceData *********************************/
+/*
+*	My DCSensor.ino bases the unique ID used on the CAN bus on the timestamp of
+*	when it was compiled.  There are several DCSensor boards on the bus, and
+*	when updating the software, each ID needs to be unique.  This requirement is
+*	satisified when using the Arduino IDE to upload the sketch.  The code below
+*	is a solution when SDHexSession is used to load the sketch on several boards
+*	with the same SD hex file. The SDHexSession::begin() function is passed the
+*	unix uint32_t timestamp as read from the loader's RTC.  This 32 bit value is
+*	divided up into 4 bytes placed in mReplacementData.  A new timestamp is
+*	passed each time a DCSensor board is loaded.
+*
+*	This proof of concept only targets sketches named DCSensor.ino that have a
+*	global variable named kTimestamp.  The address of kTimestamp within the
+*	DCSensor.ino binary is determined by the HexLoaderUtility application by
+*	reading the DCSensor.ino.elf file that's generated whenever a sketch is
+*	compiled by the Arduino IDE.  This address is written to the configuration
+*	file DCSensor.ino.txt with the key "timestamp".
+*/
+void SDHexSession::ReplaceData(void)
+{
+	if (mReplacementAddress &&
+		mImage->Address() <= mReplacementAddress &&
+		(mImage->Address() + mImage->ByteCount()) > mReplacementAddress)
+	{
+		// The code below allows for replacing the 4 bytes across an Intel
+		// Hex record boundary (as needed.)
+		uint16_t	dataIndex = mReplacementAddress - mImage->Address();
+		uint16_t	rIndex = mReplacementDataIndex;
+		while (rIndex < 4 && dataIndex < mImage->ByteCount())
+		{
+			mImage->Data()[dataIndex++] = mReplacementData[rIndex++];
+		}
+		if (rIndex < 4)
+		{
+			mReplacementAddress += (rIndex - mReplacementDataIndex);
+			mReplacementDataIndex = rIndex;
+		} else
+		{
+			mReplacementAddress = 0;
+		}
+	}
+}
+#endif
+
+/******************************** OpenHexFile *********************************/
+/*
+*	Opens a hex, eep, elf, S-record, bin, lzs or bootloader file along with
+*	its run index.  The image source is chosen by the file's extension.  When
+*	the file's records overlap, the file is left open and the error is set so
+*	that the session reports it.
+*/
+bool SDHexSession::OpenHexFile(
+	const char*	inPath)
+{
+	const char*	extension = &inPath[strlen(inPath)-3];
+	mImage->end();
+#ifdef SUPPORT_ELF_FILES
+	if (memcmp(extension, "elf", 3) == 0)
+	{
+		mImage = new (&mImageSource.elfFile) ElfFile;
+	} else
+#endif
+#ifdef SUPPORT_SRECORD_FILES
+	if (extension[0] == 's' &&
+		extension[1] >= '1' && extension[1] <= '3')
+	{
+		mImage = new (&mImageSource.sRecordFile) SRecordFile;
+	} else
+#endif
+#ifdef SUPPORT_BINARY_FILES
+	if (memcmp(extension, "bin", 3) == 0)
+	{
+		BinaryFile*	binaryFile = new (&mImageSource.binaryFile) BinaryFile;
+		binaryFile->SetBaseAddress(mConfig.binAddress);
+		mImage = binaryFile;
+	} else
+#endif
+#ifdef SUPPORT_LZSS_FILES
+	if (memcmp(extension, "lzs", 3) == 0)
+	{
+		mImage = new (&mImageSource.lzssFile) LZSSFile;
+	} else
+#endif
+	{
+		mImage = new (&mImageSource.hexFile) IntelHexFile;
+	}
+	bool	success = mImage->begin(inPath);
+#ifdef SUPPORT_RECORD_INDEX
+	/*
+	*	Sources that are always read in address order are also indexed, the
+	*	index holds their preflight result and exact byte count.
+	*/
+	mRunIndex.end();
+	if (success)
+	{
+		mRunIndex.begin(inPath, *mImage);
+		if (mRunIndex.Overlaps())
+		{
+			mError = eOverlapErr;
+		}
+		RewindHexFile();
+	}
+#endif
+	return(success);
+}
+
+#ifdef SUPPORT_PREFLIGHT
+/******************************* PreflightImage *******************************/
+/*
+*	Checks the open image, see ImagePreflight.h.  The result is taken from
+*	the image's run index when it has one, otherwise the image is read.  An
+*	image that can't be loaded sets mPreflightError, which begin() reports on
+*	the first update, before anything is done to the target.  Only the first
+*	error is kept.  inImage is an ImagePreflight::EImage.
+*/
+void SDHexSession::PreflightImage(
+	uint8_t			inImage,
+	ImagePreflight&	outPreflight)
+{
+	uint8_t	error = eNoErr;
+#ifdef SUPPORT_RECORD_INDEX
+	bool	valid = mRunIndex.IsValid() ?
+				outPreflight.begin(mRunIndex) : outPreflight.begin(*mImage);
+#else
+	bool	valid = outPreflight.begin(*mImage);
+#endif
+	if (!valid)
+	{
+		error = eLoadHexDataErr;
+	} else if (!outPreflight.FitsIn(mConfig, inImage))
+	{
+		error = eImageSizeErr;
+	}
+	if (!mPreflightError)
+	{
+		mPreflightError = error;
+	}
+	RewindHexFile();
+}
+#endif
+
+/******************************* RewindHexFile ********************************/
+/*
+*	Returns to the first record, or to the first run when following runs.
+*/
+bool SDHexSession::RewindHexFile(void)
+{
+#ifdef SUPPORT_RECORD_INDEX
+	if (mRunIndex.Reordered())
+	{
+		return(SeekRun(0));
+	}
+#endif
+	return(mImage->Rewind());
+}
+
+/******************************* HexDataLength ********************************/
+/*
+*	The exact data length from the run index when there is one, otherwise an
+*	estimate.  Either way the file is left at its first record.
+*/
+uint32_t SDHexSession::HexDataLength(void)
+{
+#ifdef SUPPORT_RECORD_INDEX
+	if (mRunIndex.IsValid())
+	{
+		RewindHexFile();
+		return(mRunIndex.ByteCount());
+	}
+#endif
+	return(mImage->EstimateLength());
+}
+
+#ifdef SUPPORT_RECORD_INDEX
+/*********************************** SeekRun **********************************/
+/*
+*	Positions the file at the first record of inRun.  The record is read by
+*	the next NextRecord().
+*/
+bool SDHexSession::SeekRun(
+	uint16_t	inRun)
+{
+	SHexRun	run;
+	bool	success = mRunIndex.ReadRun(inRun, run) &&
+				mImage->SeekLine(run.position, run.address >> 16);
+	if (success)
+	{
+		mRun = inRun;
+		mRunEndPosition = run.endPosition;
+	}
+	return(success);
+}
+
+/********************************* ContinueRun ********************************/
+/*
+*	Called after a data or end of file record is read when following runs.
+*	A record past the end of the current run is replaced by the first record
+*	of the next run in address order.  After the last run, an end of file
+*	record is substituted.
+*/
+bool SDHexSession::ContinueRun(void)
+{
+	bool	success = true;
+	while (success &&
+		(mImage->RecordType() == ImageSource::eEndOfFileRecord ||
+			mImage->RecordPosition() >= mRunEndPosition))
+	{
+		if ((mRun + 1) < mRunIndex.RunCount())
+		{
+			// A run starts with a data record
+			success = SeekRun(mRun + 1) && mImage->NextRecord();
+		} else
+		{
+			mImage->SetEndOfFileRecord();
+			break;
+		}
+	}
+	return(success);
+}
+#endif
+
+/***************************** LoadNextDataRecord *****************************/
+/*
+*	Bottleneck for loading data records.
+*/
+bool SDHexSession::LoadNextDataRecord(void)
+{
+	bool success;
+	while ((success = mImage->NextRecord()) && mImage->RecordType() > ImageSource::eEndOfFileRecord){}
+#ifdef SUPPORT_RECORD_INDEX
+	if (success &&
+		mRunIndex.Reordered())
+	{
+		success = ContinueRun();
+	}
+#endif
+	if (success)
+	{
+		mDataIndex = 0;
+#ifdef SUPPORT_REPLACEMENT_DATA
+	#ifdef SUPPORT_RESUME
+		mRecordReplacementAddress = mReplacementAddress;
+		mRecordReplacementDataIndex = mReplacementDataIndex;
+	#endif
+		ReplaceData();
+#endif
+	} else
+	{
+		mError = eLoadHexDataErr;
+	}
+	return(success);
+}
+
+/******************************** ProcessPage *********************************/
+/*
+*	This routine handles the page access data stream, both for verifying and
+*	loading.
+*
+*	EEPROM: Note that even for eeprom this is PAGE access, so full page
+*	blocks will be used when read from the eep file.  Attempting to write a
+*	non-aligned odd length eep will overwrite existing eeprom data.  The
+*	AVRStreamISP does support non-aligned odd length eeprom data because it
+*	checks alignment and length to determine the most efficient method of
+*	writing the eeprom data for the specific target MCU based on the eeprom page
+*	size.
+*/
+void SDHexSession::ProcessPage(
+	bool	inIsResponse)
+{
+#ifdef SUPPORT_TARGET_BACKUP
+	if (mStage & eDumpingMemory)
+	{
+		DumpPage(inIsResponse);
+		return;
+	}
+#endif
+#ifdef SUPPORT_DIFF_PROGRAMMING
+	if (mStage == eBlankCheckingFlash)
+	{
+		BlankCheckPage(inIsResponse);
+		return;
+	}
+#endif
+#ifdef SUPPORT_VERIFY_RETRY
+	/*
+	*	The rewrite of a unit may have reached the end of the hex data, so this
+	*	is checked before the next record is loaded.
+	*/
+	if (inIsResponse &&
+		mRewritingUnit)
+	{
+		if (ResponseStatusOK())
+		{
+			ReverifyUnit();
+		}
+		return;
+	}
+#endif
+	if (mDataIndex == mImage->ByteCount() &&
+		mImage->RecordType() != ImageSource::eEndOfFileRecord &&
+		!LoadNextDataRecord())
+	{
+		return;	// Fail
+	}
+
+#ifdef SUPPORT_DIFF_PROGRAMMING
+	if (!inIsResponse &&
+		mDiffState == eDiffActive &&
+		!SkipCleanPages())
+	{
+		return;	// Fail
+	}
+#endif
+	if (mImage->ByteCount())
+	{
+		uint32_t	wordAddress = (mImage->Address32() + mDataIndex) >> 1;
+		uint32_t	pageAddress = wordAddress & mPageAddressMask;
+		uint32_t	nextPageAddress = pageAddress + mWordsPerPage;
+		/*
+		*	The code below assumes 2^1 alignment even though the data section is
+		*	2^0 aligned.  I checked several hex files and tried to force an odd
+		*	alignment. I always ended up with an even number of bytes.  If the
+		*	assumption that there will always be an even number of bytes is
+		*	wrong, the code below needs to be modified to allow for this.
+		*/
+		if (!inIsResponse)
+		{
+			/*
+			*	Extended address support
+			*/
+			{
+				bool	highAddressChanged = mCurrentAddressH != (mImage->AddressH() >> 1);
+				/*
+				*	When the high address changes then the current page needs to be
+				*	completed before issuing the STK_UNIVERSAL command to change the
+				*	upper address.
+				*/
+				if (highAddressChanged)
+				{
+					mCurrentAddressH = mImage->AddressH() >> 1;
+					LoadExtAddress(false);
+					return;	// Send command
+				}
+			}
+	
+			/*
+			*	Send load address command if needed
+			*/
+			{// Testing for inIsResponse == false would probably also work here
+				if (pageAddress != mCurrentPageAddress)
+				{
+					mCurrentPageAddress = pageAddress;
+					LoadAddress(false);
+					return;	// Send command
+				}
+			}
+			/*
+			*	When writing via SPI in page mode, only full pages should be
+			*	sent otherwise the result is undefined.  When loading flash,
+			*	mBytesPerPage may span several target pages, see
+			*	FlashBatchSize().
+			*
+			*	Future optimization - It would be faster to verify immediately
+			*	after loading each page.  That way the SD would only need to be
+			*	read once.  There's no reason to load everything, then verify
+			*	everything.
+			*/
+		#ifdef SUPPORT_RESUME
+			SaveCheckpoint();
+		#endif
+		#ifdef SUPPORT_VERIFY_RETRY
+			TrackRewriteUnit(pageAddress);
+		#endif
+			WaitForAvailableForWrite(4);
+			mStream->write(mStage & eLoadingMemory ? STK_PROG_PAGE : STK_READ_PAGE);	// 0x64 : 0x74
+			mStream->write((uint8_t)(mBytesPerPage>>8));
+			mStream->write((uint8_t)(mBytesPerPage));
+			UpdateProgress(mBytesPerPage);
+			mStream->write((mStage & eIsFlash) ? 'F' : 'E');
+			mCmdHandler = &SDHexSession::ProcessPage;
+			/*
+			*	If loading Flash or EEPROM THEN
+			*	load the stream with the page data.
+			*/
+			if (mStage & eLoadingMemory)
+			{
+				if (!LoadPageFromSD(wordAddress, pageAddress, nextPageAddress, mStream))
+				{
+					return;	// Fail
+				}
+			#ifdef SUPPORT_CRC_VERIFY
+				/*
+				*	For the internal ISP the stream is mContextualStream, so the
+				*	STK_PROG_PAGE command is in buffer 2.  The page data follows
+				*	the 4 byte command header.
+				*/
+				if (mCRCVerify &&
+					mStage == eLoadingFlash)
+				{
+					AddPageToCRC(pageAddress, &mContextualStream.Buffer2()[4]);
+				}
+			#endif
+			#ifdef SESSION_TIMING
+				mCmdDelay.Set(mStage == eLoadingFlash ? mConfig.flashMinWriteDelay : mConfig.eepromMinWriteDelay);
+				mCmdDelay.Start();
+			#endif
+			}
+			WaitForAvailableForWrite(1);
+			mStream->write(CRC_EOP);
+		} else
+		{
+			/*
+			*	If verifying Flash or EEPROM THEN
+			*	compare the stream with the page data returned.
+			*/
+			if (mStage & eVerifyingMemory)
+			{
+				/*
+				*	The contextual stream should be read-from-1 / write-to-2
+				*	at this point, regardless of the ISP used.
+				*	The call to LoadPageFromSD will therefore write to buffer 2.
+				*	Buffer 2 should be empty at this point so it's available as
+				*	a general use stream so long as a context switch isn't made.
+				*/ 
+				if (!LoadPageFromSD(wordAddress, pageAddress, nextPageAddress, &mContextualStream))
+				{
+					return;	// Fail
+				}
+			#ifdef SUPPORT_DIFF_PROGRAMMING
+				if (mStage == eComparingFlash)
+				{
+					if (!ComparePage(pageAddress))
+					{
+						return;	// Fail
+					}
+					if (nextPageAddress > mBlankAddress)
+					{
+						mBlankAddress = nextPageAddress;
+					}
+				} else
+			#endif
+				{
+					uint8_t*	sdData = mContextualStream.Buffer2();
+					uint16_t	bytes2cmp = mBytesPerPage;
+					const uint8_t*	targetData = GetResponse(bytes2cmp);
+				#ifdef SUPPORT_VERIFY_RETRY
+					bool	matched = true;
+					bool	rewritable = true;
+				#endif
+					if (!targetData)
+					{
+						mError = eVerificationErr;
+						return;
+					}
+					for (uint16_t i = 0; i < bytes2cmp; i++)
+					{
+						uint8_t	targetByte = targetData[i];
+						if (targetByte == sdData[i])
+						{
+							continue;
+						}
+					#ifdef SUPPORT_VERIFY_RETRY
+						/*
+						*	The entire response has been read so the stream
+						*	stays in sync for the rewrite.  Programming
+						*	without an erase can only clear bits.
+						*/
+						matched = false;
+						rewritable = rewritable && (sdData[i] & ~targetByte) == 0;
+					#else
+						mError = eVerificationErr;
+						return;
+					#endif
+					}
+				#ifdef SUPPORT_VERIFY_RETRY
+					if (!matched)
+					{
+						mContextualStream.FlushBuffer2();
+						if (ResponseStatusOK())
+						{
+							RewriteUnit(rewritable);
+						}
+						return;
+					}
+				#endif
+				}
+				mContextualStream.FlushBuffer2();
+			}
+			/*
+			*	If response was terminated with the expected OK status THEN
+			*	recursively call this routine again.  This won't turn into a
+			*	runaway loop because the ProcessPage(false) case always returns
+			*	to the main loop.
+			*/
+			if (ResponseStatusOK())
+			{
+			#ifdef SUPPORT_DIFF_PROGRAMMING
+				/*
+				*	Once a full erase is known to be needed there's no point in
+				*	reading the rest of the target.
+				*/
+				if (mStage == eComparingFlash &&
+					mNeedsErase)
+				{
+					EndComparison();
+				} else
+			#endif
+				ProcessPage(false);
+			}
+		}
+	} else if (mImage->RecordType() == ImageSource::eEndOfFileRecord)
+	{
+		/*
+		*	When differential programming skips the trailing pages, the end of
+		*	file is reached without a pending response.
+		*/
+		if (mStage & eLoadingMemory)
 		{
-			ReadSignature(false);
-		} else if (mStage == eVerifyUnlocked)
+			if (!inIsResponse ||
+				ResponseStatusOK())
+			{
+			#ifdef SUPPORT_RECIPES
+				/*
+				*	If a recipe has another flash file (i.e. the bootloader) THEN
+				*	continue loading from it.
+				*/
+				if (mOperation == eRecipe &&
+					mStage == eLoadingFlash &&
+					NextRecipeFlashFile())
+				{
+					ProcessPage(false);
+					return;
+				}
+			#endif
+				RewindSession();
+				mStage += eLoadingMemory;	// Change from "Loading" to "Verifying"
+			#ifdef SUPPORT_CRC_VERIFY
+				/*
+				*	If the CRC of everything written is known THEN
+				*	verify by reading the flash directly, see VerifyCRC().
+				*/
+				if (mCRCVerify &&
+					mCRCRegionCount &&
+					mStage == eVerifyingFlash)
+				{
+					mStage = eCRCVerifyingFlash;
+					mCRCRegionIndex = 0;
+					mCRCOffset = 0;
+					mCRC = CRC32::kInitial;
+					return;	// Update() takes it from here
+				}
+			#endif
+				if (mSerialISP)
+				{
+					SetBytesPerPage(SerialReadSize());
+				}
+				ProcessPage(false);
+			}
+	#ifdef SUPPORT_DIFF_PROGRAMMING
+		} else if (mStage == eComparingFlash)
 		{
-			// This is only done when setting fuses (with or without bootloader.)
-			mStageModifier = 0;
-			VerifyUnlocked(false);
-		} else if (mOperation == eSetFusesAndBootloader)
+			EndComparison();
+	#endif
+		} else
 		{
-			// This is only done when loading a bootloader. (called via VerifyFuse)
-			// Now that the fuses have been verified, adjust the SPI speed to
-			// the max for fCPU.
-			mAVRStreamISP->SetAVRConfig(mConfig);
-			ProcessPage(false);
-		} else // assumed to be mOperation == eSetFuses
+			VerificationCompleted();
+		}
+	}
+}
+
+/*************************** VerificationCompleted ****************************/
+void SDHexSession::VerificationCompleted(void)
+{
+#ifdef SUPPORT_RESUME
+	/*
+	*	The checkpoint is of a page of the memory just verified.  The fuse,
+	*	lock bit and recipe stages that follow don't resume from it.
+	*/
+	mCheckpoint.valid = false;
+#endif
+#ifdef SUPPORT_RECIPES
+	if (mOperation == eRecipe)
+	{
+		ContinueRecipe();
+	} else
+#endif
+	if (mOperation & eIsProgramming)
+	{
+		LeaveProgramMode(false);
+	} else
+	{
+		mStage = eVerifyLockBits;
+		mStageModifier = 0;
+		VerifyLockBits(false);
+	}
+}
+
+/****************************** SetBytesPerPage *******************************/
+void SDHexSession::SetBytesPerPage(
+	uint16_t	inBytesPerPage)
+{
+	mBytesPerPage = inBytesPerPage;
+	mWordsPerPage = inBytesPerPage >> 1;
+	mPageAddressMask = (uint32_t)~(mWordsPerPage -1);
+}
+
+/******************************* FlashBatchSize *******************************/
+/*
+*	Returns the number of flash bytes sent per STK_PROG_PAGE/STK_READ_PAGE
+*	command.  Parts with small pages (32 or 64 bytes) would otherwise pay a
+*	full command round trip per page.  With the ISP, several pages are sent
+*	per command, up to the size of the AVRStreamISP buffer.  The ISP commits
+*	each page boundary within a command (see AVRStreamISP::WriteProgramPages.)
+*
+*	A bootloader such as Optiboot writes a single SPM page per STK_PROG_PAGE
+*	whatever the length, so with the serial ISP one device page is sent per
+*	command.
+*
+*	Page sizes are powers of 2.  The batch size is kept a power of 2 so that
+*	mPageAddressMask works for batches as well.
+*/
+uint16_t SDHexSession::FlashBatchSize(void) const
+{
+	uint16_t	batchSize = mConfig.flashPageSize;
+	if (!mSerialISP)
+	{
+		while (batchSize && (batchSize << 1) <= kMaxBatchSize)
 		{
-			// This is done when just the fuses are being set (no bootloader)
-			mStage = eVerifyLockBits;
-			mStageModifier = 0;
-			VerifyLockBits(false);
+			batchSize <<= 1;
 		}
 	}
+	return(batchSize);
 }
 
-/****************************** LeaveProgramMode ******************************/
-void SDHexSession::LeaveProgramMode(
-	bool	inIsResponse)
+/******************************* SerialReadSize *******************************/
+/*
+*	Returns the number of flash bytes requested per STK_READ_PAGE from a
+*	bootloader.  Because the Serial1 Rx buffer is only 64 bytes, and there's
+*	no clean way of increasing the size without editing the core sources
+*	(which affects all sketches/Serial instances, and would be a pain to
+*	maintain), the read size is reduced to a size that won't overrun Rx.
+*	flash.readsize, when set, limits it further for bootloaders that read
+*	less per command.  The size is kept a power of 2 for mPageAddressMask.
+*/
+uint16_t SDHexSession::SerialReadSize(void) const
 {
-	if (!inIsResponse)
+	uint16_t	readSize = kSerialReadSize;
+	while (readSize > 2 &&
+		mConfig.flashReadSize &&
+		readSize > mConfig.flashReadSize)
 	{
-		WaitForAvailableForWrite(2);
-		mStream->write(STK_LEAVE_PROGMODE);	// 0x51
-		mStream->write(CRC_EOP);
-		mCmdHandler = &SDHexSession::LeaveProgramMode;
-	} else if (ResponseStatusOK())
+		readSize >>= 1;
+	}
+	return(readSize);
+}
+
+/******************************* UpdateProgress *******************************/
+void SDHexSession::UpdateProgress(
+	uint16_t	inBytesProcessed)
+{
+	mBytesProcessed += inBytesProcessed;
+	mPercentageProcessed = (mBytesProcessed*100)/mConfig.byteCount;
+	if (mPercentageProcessed > 100)
 	{
-		Halt();
+		mPercentageProcessed = 100;
 	}
 }
 
-/******************************* ReadSignature ********************************/
-void SDHexSession::ReadSignature(
-	bool	inIsResponse)
+/******************************* RewindSession ********************************/
+/*
+*	Returns to the start of the hex file so that another pass can be made
+*	(e.g. verifying after loading.)
+*/
+void SDHexSession::RewindSession(void)
 {
-	if (!inIsResponse)
+#ifdef SUPPORT_RECIPES
+	/*
+	*	A recipe returns to the first file of the memory being processed.
+	*/
+	if (mOperation == eRecipe)
 	{
-		WaitForAvailableForWrite(2);
-		mStream->write(STK_READ_SIGN);	// 0x75
-		mStream->write(CRC_EOP);
-		mCmdHandler = &SDHexSession::ReadSignature;
-	} else if (WaitForAvailable(4) && mStream->available() > 3)
+		OpenRecipeFile((mStage & eIsFlash) == 0 ? eRecipeEEPROMFile :
+			(RecipeHasFile(eRecipeAppFile) ? eRecipeAppFile : eRecipeBootloaderFile));
+	} else
+#endif
+	RewindHexFile();
+	mDataIndex = 0;
+	mCurrentPageAddress = 0xFFFF;
+	mBytesProcessed = 0;
+	mPercentageProcessed = 0;
+	mCurrentAddressH = ((mStage & eIsFlash) == 0 || mConfig.devcode < 0xB0) ? 0 : 0xFF;
+#ifdef SUPPORT_REPLACEMENT_DATA
+	mReplacementAddress = mConfig.timestamp;
+	mReplacementDataIndex = 0;
+#endif
+#ifdef SUPPORT_RESUME
+	mCheckpoint.valid = false;
+#endif
+#ifdef SUPPORT_VERIFY_RETRY
+	mUnitAddress = 0xFFFFFFFF;
+	mRewritingUnit = false;
+#endif
+}
+
+/******************************** FailOrResume ********************************/
+/*
+*	Called when the target stops responding or loses sync.
+*/
+void SDHexSession::FailOrResume(
+	uint8_t	inError)
+{
+#ifdef SUPPORT_RESUME
+	if (!ResumeFromCheckpoint())
+#endif
 	{
-		for (uint8_t i = 0; i < 3; i++)
+		mError = inError;
+	}
+}
+
+#ifdef SUPPORT_RESUME
+/******************************* SaveCheckpoint *******************************/
+/*
+*	Called just before a page is sent to be loaded or read for verification.
+*	Comparing (differential programming) and dumping (backup) aren't resumed.
+*/
+void SDHexSession::SaveCheckpoint(void)
+{
+	uint8_t	memStage = mStage & ~eIsFlash;
+	mCheckpoint.valid = memStage == eLoadingMemory || memStage == eVerifyingMemory;
+	if (mCheckpoint.valid)
+	{
+		mCheckpoint.recordPosition = mImage->RecordPosition();
+		mCheckpoint.bytesProcessed = mBytesProcessed;
+	#ifdef SUPPORT_RECORD_INDEX
+		mCheckpoint.run = mRun;
+	#endif
+	#ifdef SUPPORT_REPLACEMENT_DATA
+		mCheckpoint.replacementAddress = mRecordReplacementAddress;
+		mCheckpoint.replacementDataIndex = mRecordReplacementDataIndex;
+	#endif
+		mCheckpoint.addressH = mImage->AddressH();
+		mCheckpoint.dataIndex = mDataIndex;
+	#ifdef SUPPORT_RECIPES
+		mCheckpoint.recipeFile = mRecipeFile;
+	#endif
+	}
+}
+
+/**************************** ResumeFromCheckpoint ****************************/
+/*
+*	Returns the hex file to the checkpoint saved by SaveCheckpoint() and
+*	resyncs.  Once in sync, the page that failed is sent again, preceded by
+*	the address commands.  For Serial1 the target is reset first because the
+*	bootloader may have timed out (or its watchdog may have fired) when the
+*	sync was lost.
+*
+*	Returns false if there's no checkpoint or the session has been resumed
+*	kMaxResumes times.
+*/
+bool SDHexSession::ResumeFromCheckpoint(void)
+{
+	bool	resumed = mCheckpoint.valid && mResumeCount < kMaxResumes;
+	if (resumed)
+	{
+		mResumeCount++;
+		resumed = RestoreCheckpoint(mCheckpoint);
+		if (resumed)
 		{
-			if (mConfig.signature[i] == mStream->read())
+		#ifdef SUPPORT_CRC_VERIFY
+			/*
+			*	The CRC of the failed page has already been added.  Rather than
+			*	saving the CRC regions, fall back to a byte-for-byte verify.
+			*/
+			if (mStage == eLoadingFlash)
 			{
-				continue;
+				mCRCVerify = false;
 			}
-			mError = eSignatureErr;
-			break;
+		#endif
+			// Discard whatever remains of the failed response.
+			while (mStream->available())
+			{
+				mStream->read();
+			}
+			mSyncRetries = 0;
+			mCmdHandler = &SDHexSession::ProcessPage;
+		#ifdef SESSION_TIMING
+			mTimeout.Set(0);
+			if (mSerialISP)
+			{
+				ResetSerialTarget();
+			}
+		#endif
+			GetSync(false);
 		}
-		if (!mError &&
-			ResponseStatusOK())
+	}
+	return(resumed);
+}
+
+/***************************** RestoreCheckpoint ******************************/
+/*
+*	Returns the hex file and page variables to inCheckpoint.  The next
+*	ProcessPage(false) sends the address commands followed by the page.
+*/
+bool SDHexSession::RestoreCheckpoint(
+	const SCheckpoint&	inCheckpoint)
+{
+#ifdef SUPPORT_RECIPES
+	if (mOperation == eRecipe &&
+		mRecipeFile != inCheckpoint.recipeFile)
+	{
+		OpenRecipeFile(inCheckpoint.recipeFile);
+	}
+#endif
+#ifdef SUPPORT_REPLACEMENT_DATA
+	mReplacementAddress = mRecordReplacementAddress = inCheckpoint.replacementAddress;
+	mReplacementDataIndex = mRecordReplacementDataIndex = inCheckpoint.replacementDataIndex;
+#endif
+#ifdef SUPPORT_RECORD_INDEX
+	/*
+	*	The checkpoint's record is within the checkpoint's run.
+	*/
+	bool	success = (!mRunIndex.Reordered() || SeekRun(inCheckpoint.run)) &&
+				mImage->SeekRecord(inCheckpoint.recordPosition, inCheckpoint.addressH);
+#else
+	bool	success = mImage->SeekRecord(inCheckpoint.recordPosition, inCheckpoint.addressH);
+#endif
+	if (success)
+	{
+	#ifdef SUPPORT_REPLACEMENT_DATA
+		ReplaceData();
+	#endif
+		mDataIndex = inCheckpoint.dataIndex;
+		mBytesProcessed = inCheckpoint.bytesProcessed;
+		// Force the address commands to be sent
+		mCurrentPageAddress = 0xFFFF;
+		mCurrentAddressH = ((mStage & eIsFlash) == 0 || mConfig.devcode < 0xB0) ? 0 : 0xFF;
+	} else
+	{
+		mError = eLoadHexDataErr;
+	}
+	return(success);
+}
+#endif
+
+#ifdef SUPPORT_VERIFY_RETRY
+/****************************** TrackRewriteUnit ******************************/
+/*
+*	Called as each page is sent.  When verification moves on to a new rewrite
+*	unit, the checkpoint of the unit's first page is saved for RewriteUnit().
+*/
+void SDHexSession::TrackRewriteUnit(
+	uint32_t	inPageAddress)
+{
+	if ((mStage == eVerifyingFlash || mStage == eVerifyingEEPROM) &&
+		!mRewritingUnit)
+	{
+		uint16_t	unitBytes = (mStage & eIsFlash) ? mConfig.flashPageSize : mConfig.eepromPageSize;
+		if (unitBytes < mBytesPerPage)
+		{
+			unitBytes = mBytesPerPage;
+		}
+		uint32_t	unitAddress = inPageAddress & ~(uint32_t)((unitBytes >> 1) -1);
+		if (unitAddress != mUnitAddress)
+		{
+			mUnitAddress = unitAddress;
+			mUnitBytes = unitBytes;
+			mUnitCheckpoint = mCheckpoint;
+			mUnitRetries = 0;
+		}
+	}
+}
+
+/******************************** RewriteUnit *********************************/
+/*
+*	Called when verification of a page within the current unit fails.  If the
+*	config's verify_retries allows, the unit is loaded again, then verified
+*	again starting from its first page, see ReverifyUnit().
+*
+*	A bootloader erases the page before writing it, and EEPROM bytes are
+*	erased as they're written.  Writing flash via the ISP can only clear bits.
+*	When a bit that should be set is clear, only a chip erase will fix it, so
+*	the erase and full reload used by differential programming is performed
+*	(once per session.)
+*/
+void SDHexSession::RewriteUnit(
+	bool	inRewritable)
+{
+	bool	canRewrite = inRewritable || mSerialISP || (mStage & eIsFlash) == 0;
+	if (mUnitRetries < mConfig.verifyRetries &&
+		mUnitAddress != 0xFFFFFFFF &&
+		(canRewrite || (mOperation == eProgramFlash && !mErasedForRetry)))
+	{
+		if (mUnitRetries == 0)
+		{
+			if (mRetryCount < RETRIED_PAGES_SIZE)
+			{
+				mRetriedPages[mRetryCount] = mUnitAddress << 1;
+			}
+			if (mRetryCount < 0xFF)
+			{
+				mRetryCount++;
+			}
+		}
+		mUnitRetries++;
+	#ifdef SUPPORT_CRC_VERIFY
+		mCRCVerify = false;
+	#endif
+		if (canRewrite)
 		{
+			mVerifyBytesPerPage = mBytesPerPage;
+			mRewritingUnit = true;
+			mStage -= eLoadingMemory;	// Change from "Verifying" to "Loading"
+			SetBytesPerPage(mUnitBytes);
+			if (RestoreCheckpoint(mUnitCheckpoint))
+			{
+				ProcessPage(false);
+			}
+		} else
+		{
+			mErasedForRetry = true;
+			mStage = eLoadingFlash;
+			SetBytesPerPage(FlashBatchSize());
+			RewindSession();
+		#ifdef SUPPORT_DIFF_PROGRAMMING
+			mDiffState = eDiffOff;
+		#endif
+		#ifdef SUPPORT_CRC_VERIFY
+			mCRCVerify = !mSerialISP;
+			mCRCRegionCount = 0;
+		#endif
 			ChipErase(false);
 		}
+	} else
+	{
+		mError = eVerificationErr;
 	}
 }
 
-/******************************* SetupUniversal *******************************/
-void SDHexSession::SetupUniversal(
-	uint8_t	inByte1,
-	uint8_t	inByte2,
-	uint8_t	inByte3,
-	uint8_t	inByte4)
+/******************************** ReverifyUnit ********************************/
+/*
+*	Called when the rewrite of the unit has been acknowledged.
+*/
+void SDHexSession::ReverifyUnit(void)
 {
-	WaitForAvailableForWrite(6);
-	mStream->write(STK_UNIVERSAL);	// 0x56
-	mStream->write(inByte1);
-	mStream->write(inByte2);
-	mStream->write(inByte3);
-	mStream->write(inByte4);
-	mStream->write(CRC_EOP);
+	mRewritingUnit = false;
+	mStage += eLoadingMemory;	// Change from "Loading" to "Verifying"
+	SetBytesPerPage(mVerifyBytesPerPage);
+	if (RestoreCheckpoint(mUnitCheckpoint))
+	{
+		ProcessPage(false);
+	}
 }
+#endif
 
-/********************************* ChipErase **********************************/
+#ifdef SUPPORT_DIFF_PROGRAMMING
+/******************************** PageIsDirty *********************************/
 /*
-*	This will only erase the chip when done through the ISP, not through a
-*	bootloader.  Most bootloaders ignore this command and self-erase as needed
-*	when writing pages.
+*	inPageAddress is a word address.  The dirty map is indexed by target flash
+*	page, which may be larger than the current read size (see Serial1 note in
+*	ProcessPage) or smaller (see FlashBatchSize.)  A batch is dirty if any of
+*	its pages are dirty.  Pages beyond the map are always considered dirty.
 */
-void SDHexSession::ChipErase(
-	bool	inIsResponse)
+bool SDHexSession::PageIsDirty(
+	uint32_t	inPageAddress) const
 {
-	if (!inIsResponse)
+	uint16_t	wordsPerTargetPage = mConfig.flashPageSize >> 1;
+	uint32_t	pageIndex = inPageAddress / wordsPerTargetPage;
+	uint32_t	endPageIndex = pageIndex + 1;
+	if (mWordsPerPage > wordsPerTargetPage)
 	{
-		// Chip Erase as per AVR Serial Programming Instruction Set
-		SetupUniversal(0xAC, 0x80, 0, 0);
-		mCmdHandler = &SDHexSession::ChipErase;
-	#ifndef __MACH__
-		mCmdDelay.Set(mConfig.chipEraseDelay);
-		mCmdDelay.Start();
-	#endif
-	} else
+		endPageIndex = pageIndex + (mWordsPerPage / wordsPerTargetPage);
+	}
+	for (; pageIndex < endPageIndex; pageIndex++)
 	{
-		if (WaitForAvailable(1))
+		if (pageIndex >= (DIFF_PAGE_MAP_SIZE * 8) ||
+			(mDirtyPages[pageIndex >> 3] & (1 << (pageIndex & 7))) != 0)
 		{
-			mStream->read();	// Skip response
-			if (ResponseStatusOK())
-			{
-				if (mOperation & eIsProgramming)	// Either flash or EEPROM
-				{
-					mStage = mOperation == eProgramFlash ? eLoadingFlash : eLoadingEEPROM;
-					ProcessPage(false);
-				} else	// Else, setting fuses, with or without a bootloader
-				{
-					// Re-enter program mode to latch new lock bits which should
-					// have been cleared (i.e. set to 0xFF) after chip erase.
-					mStage = eVerifyUnlocked;
-					EnterProgramMode(false);
-				}
-			}
+			return(true);
 		}
 	}
+	return(false);
 }
 
-/******************************* VerifyUnlocked *******************************/
-void SDHexSession::VerifyUnlocked(
-	bool	inIsResponse)
+/******************************** ComparePage *********************************/
+/*
+*	Compares the page read from the target with the hex data in buffer 2.  If
+*	they differ the target page is marked as dirty.
+*
+*	Bootloaders erase each page before writing it.  The ISP doesn't, the only
+*	erase available via the ISP is a chip erase.  An unerased flash page can
+*	only have bits cleared, so if any bit in the hex data is set where it's
+*	cleared on the target, a chip erase and full write is needed.
+*/
+bool SDHexSession::ComparePage(
+	uint32_t	inPageAddress)
 {
-	if (!inIsResponse)
+	uint8_t*		sdData = mContextualStream.Buffer2();
+	const uint8_t*	targetData = GetResponse(mBytesPerPage);
+	bool			pageDiffers = false;
+	if (!targetData)
 	{
-		// Read the lock bits as per AVR Serial Programming Instruction Set
-		SetupUniversal(0x58, 0, 0, 0);
-		mCmdHandler = &SDHexSession::VerifyUnlocked;
-	} else
+		mError = eTimeoutErr;
+		return(false);
+	}
+	for (uint16_t i = 0; i < mBytesPerPage; i++)
 	{
-		if (WaitForAvailable(1))
+		if (targetData[i] != sdData[i])
 		{
-			uint8_t	lockBits = mStream->read() & mConfig.lockBits[SAVRConfig::eMask];
-			if (ResponseStatusOK())
+			pageDiffers = true;
+			if (!mSerialISP &&
+				(sdData[i] & ~targetData[i]))
 			{
-				if (lockBits == mConfig.lockBits[SAVRConfig::eUnlock])
-				{
-					/*
-					*	If the 2nd verification passed THEN
-					*	move to the next stage.
-					*/
-					if (mStageModifier & eFuseVerified)
-					{
-						mStage = eVerifyExtendedFuse;
-						mStageModifier = 0;
-						mFuseInst = kFuseInst[0];
-						VerifyFuse(false);
-					} else
-					{
-						mStageModifier |= eFuseVerified;
-						VerifyUnlocked(false);
-					}
-				} else
-				{
-					mError = eUnlockErr;
-				}
+				mNeedsErase = true;
 			}
 		}
 	}
+	if (pageDiffers &&
+		!MarkPageDirty(inPageAddress / (mConfig.flashPageSize >> 1)))
+	{
+		mNeedsErase = true;	// Too many pages to track
+	}
+	return(true);
 }
 
-/********************************* VerifyFuse *********************************/
+/******************************* MarkPageDirty ********************************/
 /*
-*	Handler used to verify the extended, high and low fuses, in that order.
-*	If first verification fails an attempt is made to set the fuse (only once.)
-*	If subsequent verifications fail the session fails with a fuse error.
-*	This mimics the avrdude behavior.
+*	Returns false if inPageIndex is beyond the dirty page map.
 */
-void SDHexSession::VerifyFuse(
-	bool	inIsResponse)
+bool SDHexSession::MarkPageDirty(
+	uint32_t	inPageIndex)
 {
-	if (!inIsResponse)
-	{
-		// Read the fuse as per AVR Serial Programming Instruction Set
-		SetupUniversal(mFuseInst.readInstByte1, mFuseInst.readInstByte2, 0, 0);
-		mCmdHandler = &SDHexSession::VerifyFuse;
-	#ifndef __MACH__
-		// Avrdude delays after each universal command sent.
-		// When this delay is removed, the set transaction below fails.
-		mCmdDelay.Set(mConfig.lockMinWriteDelay);
-		mCmdDelay.Start();
-	#endif
-	} else
+	bool	inMap = inPageIndex < (DIFF_PAGE_MAP_SIZE * 8);
+	if (inMap)
 	{
-		if (WaitForAvailable(1))
+		uint8_t	pageMask = 1 << (inPageIndex & 7);
+		if ((mDirtyPages[inPageIndex >> 3] & pageMask) == 0)
 		{
-			uint8_t	fuseVal = mStream->read();
-			if (ResponseStatusOK())
-			{
-				if (mStageModifier & eFuseWriteResponse)
-				{
-					mStageModifier &= ~eFuseWriteResponse;
-					VerifyFuse(false);
-				// mStage is assumed to be one of eVerifyXXXFuse, so subtracting
-				// eVerifyFuse results in an index 0 to 2
-				} else if (fuseVal == mConfig.fuses[mStage - eVerifyFuse])
-				{
-					/*
-					*	If the 2nd verification passed THEN
-					*	move to the next stage.
-					*/
-					if (mStageModifier & eFuseVerified)
-					{
-						if (mStage < eVerifyLowFuse)
-						{
-							mStage++;
-							mStageModifier = 0;
-							mFuseInst = kFuseInst[mStage - eVerifyFuse];
-							VerifyFuse(false);
-						} else
-						{
-							mStage = eLoadingFlash;
-							EnterProgramMode(false);
-						}
-					} else
-					{
-						mStageModifier = eFuseVerified;
-						VerifyFuse(false);
-					}
-				/*
-				*	Else, if there was already a write attempt OR
-				*	the 2nd verification just failed THEN
-				*	fail.
-				*/
-				} else if (mStageModifier)
-				{
-					mError = eFuseErr + (mStage - eVerifyFuse);
-				/*
-				*	Else, attempt to write the fuse value.
-				*/
-				} else
-				{
-					mStageModifier = eFuseWriteResponse + eFuseWritten;
-					SetupUniversal(0xAC, mFuseInst.writeInstByte2, 0, mConfig.fuses[mStage - eVerifyFuse]);
-				#ifndef __MACH__
-					mCmdDelay.Set(mConfig.lockMinWriteDelay);
-					mCmdDelay.Start();
-				#endif
-				}
-			}
+			mDirtyPages[inPageIndex >> 3] |= pageMask;
+			mDirtyPageCount++;
 		}
 	}
+	return(inMap);
 }
 
-/******************************* VerifyLockBits *******************************/
+/******************************* SkipCleanPages *******************************/
 /*
-*	Handler used to verify the lock bits.
-*	If first verification fails an attempt is made to set the lock bits (only once.)
-*	If subsequent verifications fail the session fails with a lock error.
-*	This mimics the avrdude behavior.
+*	Consumes the hex data of pages that don't need to be written or verified.
+*	The data is written to buffer 2 then discarded.  See the buffer 2 comment
+*	in ProcessPage.
 */
-void SDHexSession::VerifyLockBits(
-	bool	inIsResponse)
+bool SDHexSession::SkipCleanPages(void)
 {
-	if (!inIsResponse)
-	{
-		// Read the lock bits as per AVR Serial Programming Instruction Set
-		SetupUniversal(0x58, 0, 0, 0);
-		mCmdHandler = &SDHexSession::VerifyLockBits;
-	#ifndef __MACH__
-		// Avrdude delays after each universal command sent.
-		// When this delay is removed, the set transaction below may fail.
-		mCmdDelay.Set(mConfig.lockMinWriteDelay);
-		mCmdDelay.Start();
-	#endif
-	} else
+	while (mImage->ByteCount() &&
+		mCurrentAddressH == (mImage->AddressH() >> 1))
 	{
-		if (WaitForAvailable(1))
+		uint32_t	wordAddress = (mImage->Address32() + mDataIndex) >> 1;
+		uint32_t	pageAddress = wordAddress & mPageAddressMask;
+		if (PageIsDirty(pageAddress))
 		{
-			uint8_t	lockBits = mStream->read() & mConfig.lockBits[SAVRConfig::eMask];
-			if (ResponseStatusOK())
-			{
-				if (mStageModifier & eFuseWriteResponse)
-				{
-					mStageModifier &= ~eFuseWriteResponse;
-					VerifyLockBits(false);
-				} else if (lockBits == mConfig.lockBits[SAVRConfig::eLock])
-				{
-					/*
-					*	If the 2nd verification passed THEN
-					*	we're done.
-					*/
-					if (mStageModifier & eFuseVerified)
-					{
-						LeaveProgramMode(false);
-					} else
-					{
-						mStageModifier = eFuseVerified;
-						VerifyLockBits(false);
-					}
-				/*
-				*	Else, if there was already a write attempt OR
-				*	the 2nd verification just failed THEN
-				*	fail.
-				*/
-				} else if (mStageModifier)
-				{
-					mError = eLockErr;
-				/*
-				*	Else, attempt to write the lockBits.
-				*/
-				} else
-				{
-					mStageModifier = eFuseWriteResponse + eFuseWritten;
-					// As per AVR docs, unused lock bits should be set. ORing
-					// the lock value with the ~mask satisfies this requirement.
-					SetupUniversal(0xAC, 0xE0, 0,
-										(~mConfig.lockBits[SAVRConfig::eMask]) |
-											mConfig.lockBits[SAVRConfig::eLock]);
-				#ifndef __MACH__
-					mCmdDelay.Set(mConfig.lockMinWriteDelay);
-					mCmdDelay.Start();
-				#endif
-				}
-			}
+			break;
+		}
+		if (!LoadPageFromSD(wordAddress, pageAddress, pageAddress + mWordsPerPage, &mContextualStream))
+		{
+			return(false);	// Fail
+		}
+		mContextualStream.FlushBuffer2();
+		UpdateProgress(mBytesPerPage);
+		if (mDataIndex == mImage->ByteCount() &&
+			mImage->RecordType() != ImageSource::eEndOfFileRecord &&
+			!LoadNextDataRecord())
+		{
+			return(false);	// Fail
 		}
 	}
+	return(true);
 }
 
-/******************************** LoadAddress *********************************/
-void SDHexSession::LoadAddress(
-	bool	inIsResponse)
+/******************************* EndComparison ********************************/
+/*
+*	Called after the target has been compared with the hex file.  Depending on
+*	the result, the session either continues as a normal full chip session,
+*	writes only the dirty pages, or ends because the target is already current.
+*
+*	Without a chip erase, code of a previous, larger image would be left
+*	beyond the end of this image.  With the ISP, the flash from the end of the
+*	image to the end of the application section is first checked to be erased,
+*	see BlankCheckPage().  Bootloaders don't chip erase, so with the serial
+*	ISP whatever is beyond the image is left as it is, with or without
+*	differential programming.
+*/
+void SDHexSession::EndComparison(void)
 {
-	if (!inIsResponse)
+	if (!mNeedsErase &&
+		!mSerialISP &&
+		mBlankAddress < mBlankEnd)
 	{
-		WaitForAvailableForWrite(4);
-		mStream->write(STK_LOAD_ADDRESS);	// 0x55
-		mStream->write((uint8_t)mCurrentPageAddress);
-		mStream->write((uint8_t)(mCurrentPageAddress >> 8));
-		mStream->write(CRC_EOP);
-		mCmdHandler = &SDHexSession::LoadAddress;
-	} else if (ResponseStatusOK())
+		mStage = eBlankCheckingFlash;
+		SetBytesPerPage(256);
+		mCurrentPageAddress = 0xFFFF;
+		ProcessPage(false);
+		return;
+	}
+	SetBytesPerPage(mConfig.flashPageSize);
+	RewindSession();
+	if (mNeedsErase)
+	{
+		mDiffState = eDiffOff;
+		ChipErase(false);
+	} else if (mDirtyPageCount == 0)
+	{
+		mDiffState = eDiffOff;
+		mPercentageProcessed = 100;
+		LeaveProgramMode(false);
+	} else
 	{
+		mDiffState = eDiffActive;
+		mStage = eLoadingFlash;
 		ProcessPage(false);
 	}
 }
 
-/******************************* LoadExtAddress *******************************/
-void SDHexSession::LoadExtAddress(
+/******************************* BlankCheckPage *******************************/
+/*
+*	Reads the target flash from mBlankAddress to mBlankEnd.  If anything isn't
+*	erased, a chip erase is needed.  Either way the comparison then ends.
+*/
+void SDHexSession::BlankCheckPage(
 	bool	inIsResponse)
 {
+	uint32_t	wordsRemaining = mBlankEnd - mBlankAddress;
+	uint16_t	bytesToRead = wordsRemaining < mWordsPerPage ?
+									(wordsRemaining << 1) : mBytesPerPage;
 	if (!inIsResponse)
 	{
-		// Load Extended Address byte as per AVR Serial Programming Instruction Set
-		SetupUniversal(0x4D, 0, mCurrentAddressH, 0);
-		mCmdHandler = &SDHexSession::LoadExtAddress;
+		uint8_t	addressH = mBlankAddress >> 16;
+		if (mCurrentAddressH != addressH)
+		{
+			mCurrentAddressH = addressH;
+			LoadExtAddress(false);
+			return;	// Send command
+		}
+		if (mCurrentPageAddress != mBlankAddress)
+		{
+			mCurrentPageAddress = mBlankAddress;
+			LoadAddress(false);
+			return;	// Send command
+		}
+		WaitForAvailableForWrite(5);
+		mStream->write(STK_READ_PAGE);	// 0x74
+		mStream->write((uint8_t)(bytesToRead>>8));
+		mStream->write((uint8_t)bytesToRead);
+		mStream->write('F');
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::ProcessPage;
 	} else
 	{
-		if (WaitForAvailable(1))
+		const uint8_t*	targetData = GetResponse(bytesToRead);
+		if (!targetData)
+		{
+			mError = eTimeoutErr;
+			return;
+		}
+		for (uint16_t i = 0; i < bytesToRead; i++)
 		{
-			mStream->read();	// Skip response
-			if (ResponseStatusOK())
+			if (targetData[i] != 0xFF)
+			{
+				mNeedsErase = true;
+				break;
+			}
+		}
+		if (ResponseStatusOK())
+		{
+			mBlankAddress += (bytesToRead >> 1);
+			if (mNeedsErase ||
+				mBlankAddress >= mBlankEnd)
+			{
+				mBlankAddress = mBlankEnd;
+				EndComparison();
+			} else
 			{
 				ProcessPage(false);
 			}
 		}
 	}
 }
+#endif
 
-#ifdef SUPPORT_REPLACEMENT_DATA
-/******************************** ReplaceData *********************************/
+#ifdef SUPPORT_CRC_VERIFY
+/******************************** AddPageToCRC ********************************/
 /*
-*	My DCSensor.ino bases the unique ID used on the CAN bus on the timestamp of
-*	when it was compiled.  There are several DCSensor boards on the bus, and
-*	when updating the software, each ID needs to be unique.  This requirement is
-*	satisified when using the Arduino IDE to upload the sketch.  The code below
-*	is a solution when SDHexSession is used to load the sketch on several boards
-*	with the same SD hex file. The SDHexSession::begin() function is passed the
-*	unix uint32_t timestamp as read from the loader's RTC.  This 32 bit value is
-*	divided up into 4 bytes placed in mReplacementData.  A new timestamp is
-*	passed each time a DCSensor board is loaded.
-*
-*	This proof of concept only targets sketches named DCSensor.ino that have a
-*	global variable named kTimestamp.  The address of kTimestamp within the
-*	DCSensor.ino binary is determined by the HexLoaderUtility application by
-*	reading the DCSensor.ino.elf file that's generated whenever a sketch is
-*	compiled by the Arduino IDE.  This address is written to the configuration
-*	file DCSensor.ino.txt with the key "timestamp".
+*	Adds a page just written to the CRC regions.  A new region is started when
+*	the page isn't contiguous with the current region, or when the current
+*	region has reached kCRCRegionSize and there's a free region.  Smaller
+*	regions narrow the area that needs to be verified byte-for-byte when there
+*	is a mismatch.  If a non-contiguous page is written after all the regions
+*	are used, CRC verification is abandoned for this session.
 */
-void SDHexSession::ReplaceData(void)
+void SDHexSession::AddPageToCRC(
+	uint32_t		inPageAddress,
+	const uint8_t*	inData)
 {
-	if (mReplacementAddress &&
-		mAddress <= mReplacementAddress &&
-		(mAddress + mByteCount) > mReplacementAddress)
+	uint32_t	address = inPageAddress << 1;
+	SCRCRegion*	region = mCRCRegionCount ? &mCRCRegion[mCRCRegionCount-1] : nullptr;
+	if (!region ||
+		(region->address + region->length) != address ||
+		region->length >= kCRCRegionSize)
 	{
-		// The code below allows for replacing the 4 bytes across an Intel
-		// Hex record boundary (as needed.)
-		uint16_t	dataIndex = mReplacementAddress - mAddress;
-		uint16_t	rIndex = mReplacementDataIndex;
-		while (rIndex < 4 && dataIndex < mByteCount)
-		{
-			mData[dataIndex++] = mReplacementData[rIndex++];
-		}
-		if (rIndex < 4)
+		if (mCRCRegionCount < CRC_REGION_COUNT)
 		{
-			mReplacementAddress += (rIndex - mReplacementDataIndex);
-			mReplacementDataIndex = rIndex;
-		} else
+			region = &mCRCRegion[mCRCRegionCount++];
+			region->address = address;
+			region->length = 0;
+			region->crc = CRC32::kInitial;
+		} else if ((region->address + region->length) != address)
 		{
-			mReplacementAddress = 0;
+			mCRCVerify = false;
+			return;
 		}
 	}
+	region->crc = CRC32::Update(region->crc, inData, mBytesPerPage);
+	region->length += mBytesPerPage;
 }
-#endif
 
-/***************************** LoadNextDataRecord *****************************/
+/********************************* VerifyCRC **********************************/
 /*
-*	Bottleneck for loading data records.
+*	Called from Update() while in the eCRCVerifyingFlash stage.  Each call reads
+*	at most kCRCChunkSize bytes of flash so the UI remains responsive.
+*
+*	If the CRC of a region doesn't match, the pages of that region and of the
+*	regions not yet checked are marked as dirty, and a byte-for-byte verify of
+*	just those pages is performed.  The regions before it have already passed.
 */
-bool SDHexSession::LoadNextDataRecord(void)
+void SDHexSession::VerifyCRC(void)
 {
-	bool success;
-	while ((success = NextRecord()) && mRecordType > eEndOfFileRecord){}
-	if (success)
+	SCRCRegion*	region = &mCRCRegion[mCRCRegionIndex];
+	uint16_t	bytesToRead = kCRCChunkSize;
+	if ((region->length - mCRCOffset) < bytesToRead)
 	{
-		mDataIndex = 0;
-#ifdef SUPPORT_REPLACEMENT_DATA
-		ReplaceData();
-#endif
+		bytesToRead = region->length - mCRCOffset;
+	}
+	mCRC = mAVRStreamISP->CRCFlash(region->address + mCRCOffset, bytesToRead,
+										mCRC, mConfig.devcode >= 0xB0);
+	mCRCOffset += bytesToRead;
+	UpdateProgress(bytesToRead);
+	if (mCRCOffset < region->length)
+	{
+		return;
+	}
+	if (mCRC == region->crc)
+	{
+		mCRCRegionIndex++;
+		mCRCOffset = 0;
+		mCRC = CRC32::kInitial;
+		if (mCRCRegionIndex >= mCRCRegionCount)
+		{
+			mStage = eVerifyingFlash;
+			VerificationCompleted();
+		}
+	/*
+	*	Else fall back to a byte-for-byte verify of this region and the
+	*	regions that follow it.
+	*/
 	} else
 	{
-		mError = eLoadHexDataErr;
+		uint16_t	bytesPerPage = mConfig.flashPageSize;
+		memset(mDirtyPages, 0, DIFF_PAGE_MAP_SIZE);
+		mDirtyPageCount = 0;
+		for (; mCRCRegionIndex < mCRCRegionCount; mCRCRegionIndex++)
+		{
+			region = &mCRCRegion[mCRCRegionIndex];
+			uint32_t	pageIndex = region->address / bytesPerPage;
+			uint32_t	endPageIndex = (region->address + region->length) / bytesPerPage;
+			for (; pageIndex < endPageIndex; pageIndex++)
+			{
+				MarkPageDirty(pageIndex);
+			}
+		}
+		mCRCVerify = false;
+		mDiffState = eDiffActive;
+		mStage = eVerifyingFlash;
+		RewindSession();
+		ProcessPage(false);
 	}
-	return(success);
 }
+#endif
 
-/******************************** ProcessPage *********************************/
+#ifdef SUPPORT_TARGET_BACKUP
+/********************************** DumpPage **********************************/
 /*
-*	This routine handles the page access data stream, both for verifying and
-*	loading.
-*
-*	EEPROM: Note that even for eeprom this is PAGE access, so full page
-*	blocks will be used when read from the eep file.  Attempting to write a
-*	non-aligned odd length eep will overwrite existing eeprom data.  The
-*	AVRStreamISP does support non-aligned odd length eeprom data because it
-*	checks alignment and length to determine the most efficient method of
-*	writing the eeprom data for the specific target MCU based on the eeprom page
-*	size.
+*	Reads the target memory sequentially and passes it to the backup hex
+*	writer.  Called via ProcessPage so that the LoadAddress and LoadExtAddress
+*	handlers can be shared with loading/verifying.
 */
-void SDHexSession::ProcessPage(
+void SDHexSession::DumpPage(
 	bool	inIsResponse)
 {
-	if (mDataIndex == mByteCount &&
-		mRecordType != eEndOfFileRecord &&
-		!LoadNextDataRecord())
-	{
-		return;	// Fail
-	}
-
-	if (mByteCount)
+	uint32_t	bytesRemaining = mDumpSize - (mDumpAddress << 1);
+	uint16_t	bytesToRead = bytesRemaining < mBytesPerPage ?
+									bytesRemaining : mBytesPerPage;
+	if (!inIsResponse)
 	{
-		uint32_t	wordAddress = (Address32() + mDataIndex) >> 1;
-		uint32_t	pageAddress = wordAddress & mPageAddressMask;
-		uint32_t	nextPageAddress = pageAddress + mWordsPerPage;
-		/*
-		*	The code below assumes 2^1 alignment even though the data section is
-		*	2^0 aligned.  I checked several hex files and tried to force an odd
-		*	alignment. I always ended up with an even number of bytes.  If the
-		*	assumption that there will always be an even number of bytes is
-		*	wrong, the code below needs to be modified to allow for this.
-		*/
-		if (!inIsResponse)
+		if (bytesToRead == 0)
 		{
-			/*
-			*	Extended address support
-			*/
-			{
-				bool	highAddressChanged = mCurrentAddressH != (mAddressH >> 1);
-				/*
-				*	When the high address changes then the current page needs to be
-				*	completed before issuing the STK_UNIVERSAL command to change the
-				*	upper address.
-				*/
-				if (highAddressChanged)
-				{
-					mCurrentAddressH = mAddressH >> 1;
-					LoadExtAddress(false);
-					return;	// Send command
-				}
-			}
-	
-			/*
-			*	Send load address command if needed
-			*/
-			{// Testing for inIsResponse == false would probably also work here
-				if (pageAddress != mCurrentPageAddress)
-				{
-					mCurrentPageAddress = pageAddress;
-					LoadAddress(false);
-					return;	// Send command
-				}
-			}
-			/*
-			*	When writing via SPI in page mode, only full pages should be
-			*	sent otherwise the result is undefined.
-			*
-			*	Future optimization - It would be faster to verify immediately
-			*	after loading each page.  That way the SD would only need to be
-			*	read once.  There's no reason to load everything, then verify
-			*	everything.
-			*/
-			WaitForAvailableForWrite(4);
-			mStream->write(mStage & eLoadingMemory ? STK_PROG_PAGE : STK_READ_PAGE);	// 0x64 : 0x74
-			mStream->write((uint8_t)(mBytesPerPage>>8));
-			mStream->write((uint8_t)(mBytesPerPage));
-			mBytesProcessed+=mBytesPerPage;
-			mPercentageProcessed = (mBytesProcessed*100)/mConfig.byteCount;
-			if (mPercentageProcessed > 100)
-			{
-				mPercentageProcessed = 100;
-			}
-			mStream->write((mStage & eIsFlash) ? 'F' : 'E');
-			mCmdHandler = &SDHexSession::ProcessPage;
-			/*
-			*	If loading Flash or EEPROM THEN
-			*	load the stream with the page data.
-			*/
-			if (mStage & eLoadingMemory)
-			{
-				if (!LoadPageFromSD(wordAddress, pageAddress, nextPageAddress, mStream))
-				{
-					return;	// Fail
-				}
-			#ifndef __MACH__
-				mCmdDelay.Set(mStage == eLoadingFlash ? mConfig.flashMinWriteDelay : mConfig.eepromMinWriteDelay);
-				mCmdDelay.Start();
-			#endif
-			}
-			WaitForAvailableForWrite(1);
-			mStream->write(CRC_EOP);
-		} else
+			EndDump();
+			return;
+		}
+		if (mStage == eDumpingFlash)
 		{
-			/*
-			*	If verifying Flash or EEPROM THEN
-			*	compare the stream with the page data returned.
-			*/
-			if (mStage & eVerifyingMemory)
+			uint8_t	addressH = mDumpAddress >> 16;
+			if (mCurrentAddressH != addressH)
 			{
-				/*
-				*	The contextual stream should be read-from-1 / write-to-2
-				*	at this point, regardless of the ISP used.
-				*	The call to LoadPageFromSD will therefore write to buffer 2.
-				*	Buffer 2 should be empty at this point so it's available as
-				*	a general use stream so long as a context switch isn't made.
-				*/ 
-				if (!LoadPageFromSD(wordAddress, pageAddress, nextPageAddress, &mContextualStream))
-				{
-					return;	// Fail
-				}
-					uint8_t*	sdData = mContextualStream.Buffer2();
-					
-					uint16_t bytes2cmp = mBytesPerPage;
-					for (uint16_t i = 0; i < bytes2cmp; i++)
-					{
-						if (WaitForAvailable(1) &&
-							mStream->read() == sdData[i])
-						{
-							continue;
-						}
-						mError = eVerificationErr;
-						return;
-					}
-					mContextualStream.FlushBuffer2();
+				mCurrentAddressH = addressH;
+				LoadExtAddress(false);
+				return;	// Send command
 			}
-			/*
-			*	If response was terminated with the expected OK status THEN
-			*	recursively call this routine again.  This won't turn into a
-			*	runaway loop because the ProcessPage(false) case always returns
-			*	to the main loop.
-			*/
-			if (ResponseStatusOK())
+		}
+		if (mCurrentPageAddress != mDumpAddress)
+		{
+			mCurrentPageAddress = mDumpAddress;
+			LoadAddress(false);
+			return;	// Send command
+		}
+		WaitForAvailableForWrite(5);
+		mStream->write(STK_READ_PAGE);	// 0x74
+		mStream->write((uint8_t)(bytesToRead>>8));
+		mStream->write((uint8_t)bytesToRead);
+		mStream->write((mStage & eIsFlash) ? 'F' : 'E');
+		mStream->write(CRC_EOP);
+		mCmdHandler = &SDHexSession::ProcessPage;
+	} else
+	{
+		const uint8_t*	targetData = GetResponse(bytesToRead);
+		if (!targetData)
+		{
+			mError = eTimeoutErr;
+			return;
+		}
+		for (uint16_t i = 0; i < bytesToRead; i++)
+		{
+			mHexWriter.Put(targetData[i]);
+		}
+		if (ResponseStatusOK())
+		{
+			if (!mHexWriter.Error())
 			{
+				mDumpAddress += (bytesToRead >> 1);
+				UpdateProgress(bytesToRead);
 				ProcessPage(false);
+			} else
+			{
+				mError = eSDWriteErr;
 			}
 		}
-	} else if (mRecordType == eEndOfFileRecord)
+	}
+}
+
+/********************************** EndDump ***********************************/
+/*
+*	Called when all of the current memory type has been read.  After the flash
+*	has been written, the backup config is completed and the EEPROM, if any,
+*	is read to the backup eep file.
+*/
+void SDHexSession::EndDump(void)
+{
+	char	path[52];
+	mHexWriter.GetName(path, sizeof(path));
+	if (!mHexWriter.end())
 	{
-		if (mStage & eLoadingMemory)
+		mError = eSDWriteErr;
+	} else if (mStage == eDumpingFlash)
+	{
+		size_t	pathLen = strlen(path);
+		if (!AddBackupToCatalog(path) ||
+			!AppendBackupByteCount(path))
 		{
-			if (ResponseStatusOK())
+			mError = eSDWriteErr;
+		} else if (mConfig.eepromSize)
+		{
+			strcpy(&path[pathLen-3], "eep");
+			if (mHexWriter.begin(path))
 			{
-				Rewind();
-				mStage += eLoadingMemory;	// Change from "Loading" to "Verifying"
+				mStage = eDumpingEEPROM;
+				mDumpAddress = 0;
+				mDumpSize = mConfig.eepromSize;
 				mCurrentPageAddress = 0xFFFF;
-				mBytesProcessed = 0;
-				mPercentageProcessed = 0;
-				/*
-				*	Because the Serial1 Rx buffer is only 64 bytes, and there's
-				*	no clean way of increasing the size without editing the core
-				*	sources (which affects all sketches/Serial instances, and
-				*	would be a pain to maintain), the requested read size for
-				*	verification is reduced to a size that won't overrun Rx.
-				*/
-				if (mSerialISP)
-				{
-					mWordsPerPage = 16;
-					mBytesPerPage = 32;
-					mPageAddressMask = (uint32_t)~(16 -1);
-				}
-				mCurrentAddressH = mConfig.devcode < 0xB0 ? 0 : 0xFF;
-			#ifdef SUPPORT_REPLACEMENT_DATA
-				mReplacementAddress = mConfig.timestamp;
-				mReplacementDataIndex = 0;
-			#endif
 				ProcessPage(false);
+			} else
+			{
+				mError = eSDWriteErr;
 			}
-		} else if (mOperation & eIsProgramming)
-		{
-			LeaveProgramMode(false);
 		} else
 		{
-			mStage = eVerifyLockBits;
-			mStageModifier = 0;
-			VerifyLockBits(false);
+			LeaveProgramMode(false);
 		}
+	} else if (AddBackupToCatalog(path))
+	{
+		LeaveProgramMode(false);
+	} else
+	{
+		mError = eSDWriteErr;
 	}
 }
+#endif
 
 /******************************* LoadPageFromSD *******************************/
 bool SDHexSession::LoadPageFromSD(
@@ -1123,29 +3275,17 @@ bool SDHexSession::LoadPageFromSD(
 	*/
 	if (inPageAddress < inWordAddress)
 	{
-		for (uint16_t i = (inWordAddress-inPageAddress) << 1; i; i--)
-		{
-			WaitForAvailableForWrite(1);
-			inStream->write(0xFF);
-		}
+		PutFill(inStream, (inWordAddress-inPageAddress) << 1);
 	}
 	while (inWordAddress < inNextPageAddress)
 	{
-		uint16_t	wordsInData = (mByteCount - mDataIndex) >> 1;
+		uint16_t	wordsInData = (mImage->ByteCount() - mDataIndex) >> 1;
 		if ((inWordAddress + wordsInData) > inNextPageAddress)
 		{
 			wordsInData = inNextPageAddress - inWordAddress;
 		}
-		{
-			uint16_t i = mDataIndex;
-			uint16_t endIndex = i + (wordsInData << 1);
-			while (i < endIndex)
-			{
-				WaitForAvailableForWrite(1);
-				inStream->write(mData[i++]);
-			}
-			mDataIndex = i;
-		}
+		PutBytes(inStream, &mImage->Data()[mDataIndex], wordsInData << 1);
+		mDataIndex += (wordsInData << 1);
 		inWordAddress += wordsInData;
 
 		if (inWordAddress < inNextPageAddress)
@@ -1156,20 +3296,27 @@ bool SDHexSession::LoadPageFromSD(
 			}
 			/*
 			*	If the page changed after reading the next line ||
-			*	the high address changed THEN
+			*	the high address changed ||
+			*	this is the end of the file THEN
 			*	pad the rest of the current page.
 			*/
-			if (((Address32() >> 1) & mPageAddressMask) != inPageAddress ||
-					mCurrentAddressH != (mAddressH >> 1))
+			uint32_t	recordWordAddress = mImage->Address32() >> 1;
+			if ((recordWordAddress & mPageAddressMask) != inPageAddress ||
+					mCurrentAddressH != (mImage->AddressH() >> 1) ||
+					mImage->RecordType() == ImageSource::eEndOfFileRecord)
 			{
-				for (uint16_t i = (inNextPageAddress - inWordAddress) << 1; i; i--)
-				{
-					WaitForAvailableForWrite(1);
-					inStream->write(0xFF);
-				}
+				PutFill(inStream, (inNextPageAddress - inWordAddress) << 1);
 				inWordAddress = inNextPageAddress;
 				break;
 			}
+			/*
+			*	Records within a page needn't be contiguous, pad any gap.
+			*/
+			if (recordWordAddress > inWordAddress)
+			{
+				PutFill(inStream, (recordWordAddress - inWordAddress) << 1);
+				inWordAddress = recordWordAddress;
+			}
 		}
 	}
 	return(true);
@@ -1187,20 +3334,35 @@ bool SDHexSession::Update(void)
 	{
 		// StReadFrom1 is defined in ContextualStream.h
 		StReadFrom1	readFrom1(mContextualStream, true);
-	#ifndef __MACH__
+	#ifdef SESSION_TIMING
 		if (mCmdDelay.Get())
 		{
 			// Most bootloaders self delay, so the call to Delay does nothing.
 			mCmdDelay.Delay();
 			mCmdDelay.Set(0);
 		}
+	#endif
+	#ifdef SESSION_TIMING
+		if (mSyncState != eSyncLocked)
+		{
+			UpdateEarlySync();
+		} else
+	#endif
+	#ifdef SUPPORT_CRC_VERIFY
+		/*
+		*	No stream traffic is involved when verifying by CRC.
+		*/
+		if (mStage == eCRCVerifyingFlash)
+		{
+			VerifyCRC();
+		} else
 	#endif
 		/*
 		*	If there is a response available...
 		*/
 		if (mStream->available())
 		{
-		#ifndef __MACH__
+		#ifdef SESSION_TIMING
 			mTimeout.Set(0);	// Cancel timeout timer.
 		#endif
 			uint8_t	response = mStream->read();
@@ -1216,7 +3378,7 @@ bool SDHexSession::Update(void)
 					GetSync(false);
 				} else
 				{
-					mError = eSyncErr;
+					FailOrResume(eSyncErr);
 				}
 			
 			} else if (response != 0)	// If not a frame error
@@ -1238,10 +3400,10 @@ bool SDHexSession::Update(void)
 		*	Else if there hasn't been a response for kSessionTimeout ms THEN
 		*	quit the session and flag the timeout error.
 		*/
-	#ifndef __MACH__
+	#ifdef SESSION_TIMING
 		} else if (mTimeout.Passed())
 		{
-			mError = eTimeoutErr;
+			FailOrResume(eTimeoutErr);
 		/*
 		*	Else start the timeout timer if not yet started
 		*/
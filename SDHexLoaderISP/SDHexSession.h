@@ -28,21 +28,139 @@
 #include "IntelHexFile.h"
 #include "AVRConfig.h"
 #include "ContextualStream.h"
-#ifndef __MACH__
+#include "IntelHexWriter.h"
+/*
+*	Hex files whose records aren't in ascending address order are loaded by
+*	following an index of their runs, see HexRunIndex.h.
+*/
+#define SUPPORT_RECORD_INDEX	1
+#ifdef SUPPORT_RECORD_INDEX
+#include "HexRunIndex.h"
+#endif
+/*
+*	Every image of a session is checked before anything is done to the
+*	target, see ImagePreflight.h.
+*/
+#define SUPPORT_PREFLIGHT	1
+#ifdef SUPPORT_PREFLIGHT
+#include "ImagePreflight.h"
+#endif
+/*
+*	A .elf file can be loaded in place of a .hex file.  For a recipe, a .elf
+*	file replaces the .hex and .eep files and supplies the fuses and lock
+*	bits.  See ElfFile.h.
+*/
+#define SUPPORT_ELF_FILES	1
+#ifdef SUPPORT_ELF_FILES
+#include "ElfFile.h"
+#endif
+/*
+*	Motorola S-record (.s19, .s28, .s37) and raw binary (.bin) files can also
+*	be loaded in place of a .hex file.  See SRecordFile.h and BinaryFile.h.
+*/
+#define SUPPORT_SRECORD_FILES	1
+#ifdef SUPPORT_SRECORD_FILES
+#include "SRecordFile.h"
+#endif
+#define SUPPORT_BINARY_FILES	1
+#ifdef SUPPORT_BINARY_FILES
+#include "BinaryFile.h"
+#endif
+/*
+*	LZSS compressed images (.lzs), see LZSSFile.h.  The decoder's window makes
+*	the image source storage, and therefore every session, LZSS_WINDOW_SIZE
+*	bytes larger, so it's off by default.  The host tools always have it.
+*/
+#ifdef __MACH__
+#define SUPPORT_LZSS_FILES	1
+#else
+//#define SUPPORT_LZSS_FILES	1
+#endif
+#ifdef SUPPORT_LZSS_FILES
+#include "LZSSFile.h"
+#endif
+/*
+*	Session timing (timeouts, command delays and the serial early sync) is
+*	left out of the host build unless the host is driving a real serial port.
+*	SUPPORT_HOST_SERIAL is defined by HostTools/SDHexMultiLoad, which supplies
+*	millis(), micros() and delay() via HostTools/Arduino.h.
+*/
+#if !defined(__MACH__) || defined(SUPPORT_HOST_SERIAL)
+#define SESSION_TIMING	1
 #include "MSPeriod.h"
 #include "USPeriod.h"
-#else
+#endif
+#ifdef __MACH__
 #define Stream	ContextualStream
 #endif
 
 class AVRStreamISP;
 class Stream;
 class SDHexSession;
+class ImagePreflight;
 #define SUPPORT_REPLACEMENT_DATA	1
+#define SUPPORT_DIFF_PROGRAMMING	1
+/*
+*	The dirty page map has one bit per target flash page.  128 bytes covers
+*	1024 pages, enough for a 256KB part with 256 byte pages.  Parts with more
+*	pages fall back to a full chip erase.
+*/
+#define DIFF_PAGE_MAP_SIZE	128
+/*
+*	CRC verification is only used with the internal ISP.  The regions are used
+*	to locate a mismatch.  The byte verify fallback relies on the dirty page
+*	map, so SUPPORT_DIFF_PROGRAMMING is required.
+*/
+#ifdef SUPPORT_DIFF_PROGRAMMING
+#define SUPPORT_CRC_VERIFY	1
+#define CRC_REGION_COUNT	8
+#endif
+#define SUPPORT_TARGET_BACKUP	1
+/*
+*	A recipe (.rcp) performs fuses, bootloader, application, EEPROM and lock
+*	bits as a single ISP session.  See SDHexSession::begin().
+*/
+#define SUPPORT_RECIPES	1
+/*
+*	When a page load or read times out or loses sync, the session resyncs and
+*	continues from the page that failed rather than failing the session.
+*/
+#define SUPPORT_RESUME	1
+/*
+*	On a verify mismatch the page is rewritten and verified again, up to the
+*	config's verify_retries times.  The checkpoints of SUPPORT_RESUME are used
+*	to return to the start of the page.
+*/
+#ifdef SUPPORT_RESUME
+#define SUPPORT_VERIFY_RETRY	1
+#define RETRIED_PAGES_SIZE		4
+#endif
 
 typedef  void (SDHexSession::*CmdHandler)(bool);
 
-class SDHexSession : public IntelHexFile
+/*
+*	Only one image source is open at a time.  The source for each file is
+*	constructed in this storage by SDHexSession::OpenHexFile().
+*/
+union UImageSource
+{
+							UImageSource(void){}
+	IntelHexFile	hexFile;
+#ifdef SUPPORT_ELF_FILES
+	ElfFile			elfFile;
+#endif
+#ifdef SUPPORT_SRECORD_FILES
+	SRecordFile		sRecordFile;
+#endif
+#ifdef SUPPORT_BINARY_FILES
+	BinaryFile		binaryFile;
+#endif
+#ifdef SUPPORT_LZSS_FILES
+	LZSSFile		lzssFile;
+#endif
+};
+
+class SDHexSession
 {
 public:
 							SDHexSession(void);
@@ -52,6 +170,12 @@ public:
 								AVRStreamISP*			inAVRStreamISP = nullptr,
 								bool					inSetFusesAndBootloader = false,
 								uint32_t				inTimestamp = 0);
+#ifdef SUPPORT_TARGET_BACKUP
+	bool					beginBackup(
+								const char*				inPath,
+								Stream*					inStream,
+								AVRStreamISP*			inAVRStreamISP);
+#endif
 	bool					Update(void);
 	uint8_t					Error(void) const
 								{return(mError);}
@@ -64,6 +188,13 @@ public:
 								{return(mConfig.byteCount);}
 	uint32_t				BytesProcessed(void) const
 								{return(mBytesProcessed);}
+#ifdef SUPPORT_VERIFY_RETRY
+	uint8_t					RetryCount(void) const	// Pages rewritten
+								{return(mRetryCount);}
+	uint32_t				RetriedPage(	// byte address, index < RETRIED_PAGES_SIZE
+								uint8_t					inIndex) const
+								{return(mRetriedPages[inIndex]);}
+#endif
 	uint8_t					PercentageProcessed(void) const	// 0 to 100
 								{return(mPercentageProcessed);}
 	enum EErrors
@@ -81,7 +212,10 @@ public:
 		eFuseErr,
 		eEFuseErr = eFuseErr,
 		eHFuseErr,
-		eLFuseErr
+		eLFuseErr,
+		eSDWriteErr,
+		eOverlapErr,
+		eImageSizeErr	// Exceeds the memory or overlaps the bootloader
 	};
 	enum EStage
 	{
@@ -102,6 +236,21 @@ public:
 		eVerifyingMemory		= 0x10,
 		eVerifyingEEPROM		= eVerifyingMemory,
 		eVerifyingFlash,
+		// Differential programming reads the target before anything is
+		// written.  It's a form of verifying so eVerifyingMemory is set.
+		eComparingMemory		= 0x30,
+		eComparingFlash,
+		// After the comparison, the ISP checks that the flash beyond the
+		// image is erased, see BlankCheckPage().
+		eBlankCheckingMemory	= 0x70,
+		eBlankCheckingFlash,
+		// CRC verification reads the flash directly through AVRStreamISP.
+		eCRCVerifyingMemory		= 0x50,
+		eCRCVerifyingFlash,
+		// Backup, reading the target memory to SD
+		eDumpingMemory			= 0x80,
+		eDumpingEEPROM			= eDumpingMemory,
+		eDumpingFlash,
 
 		eFuseWritten			= 0x20,	// Stage modifier
 		eFuseWriteResponse		= 0x40,	// Stage modifier
@@ -113,8 +262,18 @@ public:
 		eProgramFlash			= eIsProgramming,
 		eProgramEEPROM			= 3,
 		eSetFuses				= 0x04,
-		eSetFusesAndBootloader	= 0x08
+		eSetFusesAndBootloader	= 0x08,
+		eBackupMemory			= 0x10,
+		eRecipe					= 0x20
 	};
+#ifdef SUPPORT_DIFF_PROGRAMMING
+	enum EDiffState
+	{
+		eDiffOff,
+		eDiffCompare,	// Reading the target to build the dirty page map
+		eDiffActive		// Only dirty pages are loaded and verified
+	};
+#endif
 protected:
 	struct SFuseInst
 	{
@@ -122,6 +281,14 @@ protected:
 		uint8_t	readInstByte2;
 		uint8_t	writeInstByte2;
 	};
+#ifdef SUPPORT_CRC_VERIFY
+	struct SCRCRegion
+	{
+		uint32_t	address;	// byte address
+		uint32_t	length;
+		uint32_t	crc;
+	};
+#endif
 	SFuseInst		mFuseInst;
 	Stream*			mStream;
 	AVRStreamISP*	mAVRStreamISP;
@@ -129,9 +296,21 @@ protected:
 	ContextualStream mContextualStream;
 	CmdHandler		mCmdHandler;
 	CmdHandler		mOnSyncCmdHandler;	// Used by GetSync()
-#ifndef __MACH__
+#ifdef SESSION_TIMING
+	enum ESyncState
+	{
+		eSyncLocked,
+		eSyncSearching,	// Sending STK_GET_SYNC every sync interval
+		eSyncSettling	// Draining extra responses, see UpdateEarlySync()
+	};
 	MSPeriod		mTimeout;
 	USPeriod		mCmdDelay;
+	MSPeriod		mSyncPeriod;
+	MSPeriod		mSyncWindow;
+	uint8_t			mSyncState;
+
+	void					UpdateEarlySync(void);
+	void					ResetSerialTarget(void);
 #endif
 	uint16_t		mBytesPerPage;
 	uint32_t		mCurrentPageAddress;
@@ -156,12 +335,193 @@ protected:
 	
 	void					ReplaceData(void);
 #endif
+#ifdef SUPPORT_DIFF_PROGRAMMING
+	uint16_t		mDirtyPageCount;
+	uint8_t			mDiffState;
+	bool			mNeedsErase;
+	uint8_t			mDirtyPages[DIFF_PAGE_MAP_SIZE];
+	uint32_t		mBlankAddress;	// word address, following the last page compared
+	uint32_t		mBlankEnd;		// word address
+
+	bool					ComparePage(
+								uint32_t				inPageAddress);
+	void					BlankCheckPage(
+								bool					inIsResponse);
+	bool					MarkPageDirty(
+								uint32_t				inPageIndex);
+	bool					PageIsDirty(
+								uint32_t				inPageAddress) const;
+	bool					SkipCleanPages(void);
+	void					EndComparison(void);
+#endif
+#ifdef SUPPORT_CRC_VERIFY
+	uint32_t		mCRC;
+	uint32_t		mCRCOffset;
+	uint8_t			mCRCRegionCount;
+	uint8_t			mCRCRegionIndex;
+	bool			mCRCVerify;
+	SCRCRegion		mCRCRegion[CRC_REGION_COUNT];
+
+	void					AddPageToCRC(
+								uint32_t				inPageAddress,
+								const uint8_t*			inData);
+	void					VerifyCRC(void);
+#endif
+	void					VerificationCompleted(void);
+#ifdef SUPPORT_TARGET_BACKUP
+	IntelHexWriter	mHexWriter;
+	uint32_t		mDumpAddress;	// word address
+	uint32_t		mDumpSize;		// bytes
+
+	bool					CopyConfigForBackup(
+								char*					ioPath,
+								size_t					inPathLen);
+	bool					AppendBackupByteCount(
+								char*					ioPath);
+	bool					AddBackupToCatalog(
+								const char*				inPath);
+	void					DumpPage(
+								bool					inIsResponse);
+	void					EndDump(void);
+#endif
+#ifdef SUPPORT_RECIPES
+	enum ERecipeFile
+	{
+		eRecipeAppFile,			// <base>.hex
+		eRecipeBootloaderFile,	// bootloaders/Bn.hex
+		eRecipeEEPROMFile,		// <base>.eep
+		eNoRecipeFile
+	};
+	char			mRecipePath[52];
+	uint8_t			mRecipeFile;
+	bool			mProgModeReentered;
+	bool			mFusesWritten;
+#ifdef SUPPORT_ELF_FILES
+	bool			mRecipeElf;	// <base>.elf replaces the .hex and .eep
+
+	bool					ReadRecipeElf(void);
+#endif
+
+	bool					BeginRecipe(
+								const char*				inPath,
+								AVRStreamISP*			inAVRStreamISP);
+	bool					RecipeHasFile(
+								uint8_t					inRecipeFile) const;
+	bool					OpenRecipeFile(
+								uint8_t					inRecipeFile,
+								ImagePreflight*			outPreflight = nullptr);
+	bool					NextRecipeFlashFile(void);
+	void					BeginRecipeMemory(void);
+	void					BeginRecipeEEPROM(void);
+	void					ContinueRecipe(void);
+	void					EndRecipe(void);
+#endif
+#ifdef SUPPORT_RESUME
+	/*
+	*	The state of the hex file and session just before the page currently
+	*	being loaded or verified was sent.
+	*/
+	struct SCheckpoint
+	{
+		uint32_t	recordPosition;	// Of the record containing the page start
+		uint32_t	bytesProcessed;
+	#ifdef SUPPORT_RECORD_INDEX
+		uint16_t	run;
+	#endif
+	#ifdef SUPPORT_REPLACEMENT_DATA
+		uint16_t	replacementAddress;	// Before the record was loaded
+		uint8_t		replacementDataIndex;
+	#endif
+		uint8_t		addressH;
+		uint8_t		dataIndex;
+		uint8_t		recipeFile;
+		bool		valid;
+	};
+	SCheckpoint		mCheckpoint;
+#ifdef SUPPORT_REPLACEMENT_DATA
+	uint16_t		mRecordReplacementAddress;	// Before the record was loaded
+	uint8_t			mRecordReplacementDataIndex;
+#endif
+	uint8_t			mResumeCount;
+
+	void					SaveCheckpoint(void);
+	bool					RestoreCheckpoint(
+								const SCheckpoint&		inCheckpoint);
+	bool					ResumeFromCheckpoint(void);
+#endif
+#ifdef SUPPORT_VERIFY_RETRY
+	/*
+	*	A rewrite unit is the larger of the target page and the verify read
+	*	size.  Bootloaders erase the entire target page before writing it.
+	*/
+	SCheckpoint		mUnitCheckpoint;	// Start of the unit being verified
+	uint32_t		mUnitAddress;		// word address, 0xFFFFFFFF if none
+	uint32_t		mRetriedPages[RETRIED_PAGES_SIZE];
+	uint16_t		mUnitBytes;
+	uint16_t		mVerifyBytesPerPage;
+	uint8_t			mUnitRetries;
+	uint8_t			mRetryCount;
+	bool			mRewritingUnit;
+	bool			mErasedForRetry;
+
+	void					TrackRewriteUnit(
+								uint32_t				inPageAddress);
+	void					RewriteUnit(
+								bool					inRewritable);
+	void					ReverifyUnit(void);
+#endif
+#ifdef SUPPORT_RECORD_INDEX
+	HexRunIndex		mRunIndex;
+	uint32_t		mRunEndPosition;	// Of the current run
+	uint16_t		mRun;				// Current run, in address order
+
+	bool					SeekRun(
+								uint16_t				inRun);
+	bool					ContinueRun(void);
+#endif
+	UImageSource	mImageSource;
+	ImageSource*	mImage;				// Of the open file, in mImageSource
+#ifdef SUPPORT_PREFLIGHT
+	uint8_t			mPreflightError;	// Reported on the first update
+
+	void					PreflightImage(
+								uint8_t					inImage,
+								ImagePreflight&			outPreflight);
+#endif
+
+	bool					OpenHexFile(
+								const char*				inPath);
+	bool					RewindHexFile(void);
+	uint32_t				HexDataLength(void);
+	void					FailOrResume(
+								uint8_t					inError);
+	void					BootloaderPath(
+								char*					outPath);
+	void					StartSession(
+								bool					inLoadingFlash,
+								uint32_t				inTimestamp);
+	void					SetBytesPerPage(
+								uint16_t				inBytesPerPage);
+	uint16_t				FlashBatchSize(void) const;
+	uint16_t				SerialReadSize(void) const;
+	void					UpdateProgress(
+								uint16_t				inBytesProcessed);
+	void					RewindSession(void);
 	bool					CanContinue(void) const
 								{return(mStage != eSessionCompleted && !mError);}
 	bool					WaitForAvailable(
 								uint8_t					inBytesToWaitFor);
 	void					WaitForAvailableForWrite(
 								uint8_t					inBytesToWaitFor);
+	void					PutBytes(
+								Stream*					inStream,
+								const uint8_t*			inData,
+								uint16_t				inLength);
+	void					PutFill(
+								Stream*					inStream,
+								uint16_t				inCount);
+	const uint8_t*			GetResponse(
+								uint16_t				inLength);
 	bool					LoadNextDataRecord(void);
 	bool					ResponseStatusOK(void);
 	void					GetSync(
@@ -0,0 +1,106 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	SRAMMonitor.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include <Arduino.h>
+#include "SRAMMonitor.h"
+#ifdef SUPPORT_SRAM_MONITOR
+
+// Defined by the linker script and avr-libc's malloc
+extern uint8_t	__data_start;
+extern uint8_t	__heap_start;
+extern void*	__brkval;
+
+/********************************* PaintSRAM **********************************/
+/*
+*	Placed in .init1, so it runs straight after reset, before the stack
+*	pointer is set and before r1 is cleared.  Naked and written in assembly
+*	for that reason.  Nothing has used the stack yet, so all of the SRAM
+*	from the start of the heap to RAMEND is painted.
+*/
+void PaintSRAM(void) __attribute__((naked, used, section(".init1")));
+void PaintSRAM(void)
+{
+	asm volatile(
+		"ldi r30, lo8(__heap_start)"	"\n\t"
+		"ldi r31, hi8(__heap_start)"	"\n\t"
+		"ldi r24, %0"				"\n\t"
+		"ldi r25, hi8(%1)"			"\n\t"
+		"rjmp 2f"					"\n"
+	"1:"							"\n\t"
+		"st Z+, r24"				"\n"
+	"2:"							"\n\t"
+		"cpi r30, lo8(%1)"			"\n\t"
+		"cpc r31, r25"				"\n\t"
+		"brlo 1b"					"\n\t"
+		"breq 1b"					"\n\t"
+		:: "i" (SRAM_PAINT_BYTE), "i" (RAMEND));
+}
+
+/********************************* StaticSize *********************************/
+uint16_t SRAMMonitor::StaticSize(void)
+{
+	return(&__heap_start - &__data_start);
+}
+
+/********************************** HeapEnd ***********************************/
+const uint8_t* SRAMMonitor::HeapEnd(void)
+{
+	return(__brkval ? (const uint8_t*)__brkval : &__heap_start);
+}
+
+/********************************** HeapSize **********************************/
+uint16_t SRAMMonitor::HeapSize(void)
+{
+	return(HeapEnd() - &__heap_start);
+}
+
+/******************************** FirstTouched ********************************/
+/*
+*	Returns the lowest address above the heap that no longer holds the paint
+*	byte.
+*/
+const uint8_t* SRAMMonitor::FirstTouched(void)
+{
+	const uint8_t*	ramPtr = HeapEnd();
+	while (ramPtr <= (const uint8_t*)RAMEND &&
+		*ramPtr == SRAM_PAINT_BYTE)
+	{
+		ramPtr++;
+	}
+	return(ramPtr);
+}
+
+/******************************* StackHighWater *******************************/
+uint16_t SRAMMonitor::StackHighWater(void)
+{
+	return((const uint8_t*)(RAMEND + 1) - FirstTouched());
+}
+
+/*********************************** Unused ***********************************/
+uint16_t SRAMMonitor::Unused(void)
+{
+	return(FirstTouched() - HeapEnd());
+}
+#endif // SUPPORT_SRAM_MONITOR
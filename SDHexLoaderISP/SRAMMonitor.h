@@ -0,0 +1,65 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	SRAMMonitor.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Measures how the 4KB of SRAM is used.  Static is the .data, .bss and
+*	.noinit sections, i.e. every global and static object.  Heap is what
+*	malloc has taken above them.  The stack grows down from the end of SRAM
+*	towards the heap.
+*
+*	Before the C runtime initializes anything, the SRAM between the start of
+*	the heap and the end of SRAM is painted with SRAM_PAINT_BYTE.  Any painted
+*	byte that has since changed was used by the stack (or heap.)  The lowest
+*	changed byte is the stack's high-water mark.  Unused is the number of
+*	bytes between the heap and the high-water mark that were never touched,
+*	the margin left for enlarging a buffer.  A stack byte that happens to be
+*	written with the paint byte value can make the high-water mark a few
+*	bytes low.
+*
+*	Only compiled when SUPPORT_SRAM_MONITOR is defined, see
+*	SDHexLoaderConfig.h.
+*/
+#ifndef SRAMMonitor_h
+#define SRAMMonitor_h
+
+#include "SDHexLoaderConfig.h"
+#ifdef SUPPORT_SRAM_MONITOR
+#include <inttypes.h>
+
+#define SRAM_PAINT_BYTE	0xC5
+
+class SRAMMonitor
+{
+public:
+	static uint16_t			StaticSize(void);	// .data + .bss + .noinit
+	static uint16_t			HeapSize(void);
+	static uint16_t			StackHighWater(void);	// Deepest stack since reset
+	static uint16_t			Unused(void);	// Never touched since reset
+protected:
+	static const uint8_t*	HeapEnd(void);
+	static const uint8_t*	FirstTouched(void);
+};
+
+#endif // SUPPORT_SRAM_MONITOR
+#endif // SRAMMonitor_h
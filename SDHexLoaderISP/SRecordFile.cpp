@@ -0,0 +1,162 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	SRecordFile.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "SRecordFile.h"
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#endif
+
+/*
+*	The address length in bytes of each record type S0 to S9.  S4 is
+*	reserved.
+*/
+const uint8_t kAddressLength[] PROGMEM = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+
+/********************************** NextByte **********************************/
+bool SRecordFile::NextByte(
+	uint8_t&	outByte)
+{
+	uint8_t	thisByte = 0;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		uint8_t	nibble = NextChar() - '0';
+		if (nibble > 9)
+		{
+			nibble -= 7;	// Only support uppercase hex ascii
+			if (nibble < 10 || nibble > 15)
+			{
+				return(false);
+			}
+		}
+		thisByte = (thisByte << 4) + nibble;
+	}
+	outByte = thisByte;
+	return(true);
+}
+
+/********************************* NextRecord *********************************/
+/*
+*	The checksum is the ones' complement of the sum of the byte count, address
+*	and data bytes, so the sum of every byte of a valid record is 0xFF.
+*/
+bool SRecordFile::NextRecord(void)
+{
+	mRecordType = eInvalidRecordType;
+	mRecordPosition = Position();
+	uint8_t	type = 0xFF;
+	uint8_t	byteCount;
+	bool	success = NextChar() == 'S' &&
+		(type = NextChar() - '0') <= 9 &&
+		NextByte(byteCount);
+	uint8_t	addressLength = success ? pgm_read_byte(&kAddressLength[type]) : 0;
+	success = success &&
+		addressLength != 0 &&
+		byteCount > addressLength;
+	if (success)
+	{
+		uint8_t		checksum = byteCount;
+		uint8_t		thisByte;
+		uint32_t	address = 0;
+		for (uint8_t i = 0; success && i < addressLength; i++)
+		{
+			success = NextByte(thisByte);
+			checksum += thisByte;
+			address = (address << 8) | thisByte;
+		}
+		/*
+		*	Data bytes are only kept for data records.  The data of other
+		*	records (e.g. the S0 header's module name) is only checksummed.
+		*/
+		uint8_t	dataLength = byteCount - addressLength - 1;
+		bool	isDataRecord = type >= 1 && type <= 3;
+		success = success &&
+			(!isDataRecord || (dataLength != 0 && dataLength <= sizeof(mData))) &&
+			address <= 0xFFFFFF;
+		for (uint8_t i = 0; success && i < dataLength; i++)
+		{
+			success = NextByte(thisByte);
+			checksum += thisByte;
+			if (isDataRecord)
+			{
+				mData[i] = thisByte;
+			}
+		}
+		success = success &&
+			NextByte(thisByte) &&
+			(uint8_t)(checksum + thisByte) == 0xFF;
+		if (success)
+		{
+			// Skip the line ending (CRLF or LF)
+			if (NextChar() == '\r')
+			{
+				NextChar();
+			}
+			mByteCount = 0;
+			if (isDataRecord)
+			{
+				mRecordType = eDataRecord;
+				mByteCount = dataLength;
+				mAddressH = address >> 16;
+				mAddress = address;
+			} else if (type >= 7)
+			{
+				mRecordType = eEndOfFileRecord;
+				mAddress = 0;
+				mEndOfFile = true;
+			} else
+			{
+				mRecordType = eInformationRecord;
+			}
+		}
+	}
+	return(success);
+}
+
+/******************************* EstimateLength *******************************/
+/*
+*	Assumes the lines are all the length of the first data record's line,
+*	which is the case for files written by avr-objcopy.  The estimated length
+*	is used for the progress indicator.
+*/
+uint32_t SRecordFile::EstimateLength(void)
+{
+	uint32_t	estimatedLength = 0;
+	if (mFile)
+	{
+		while (NextRecord() &&
+			mRecordType != eDataRecord &&
+			mRecordType != eEndOfFileRecord){}
+		if (mRecordType == eDataRecord)
+		{
+			uint32_t	lineLength = Position() - mRecordPosition;
+			estimatedLength = FileSize() / lineLength * mByteCount;
+		}
+		Rewind();
+	}
+	return(estimatedLength);
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	SRecordFile.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Interprets a Motorola S-record file per line.  S1, S2 and S3 data records
+*	(16, 24 and 32 bit addresses) are returned as data records.  S7, S8 and S9
+*	records end the file.  S0 header and S5/S6 count records are returned as
+*	information records.  Addresses are limited to 24 bits.
+*
+*	As with IntelHexFile, only uppercase hex digits are accepted and data
+*	records are limited to 16 data bytes (the avr-objcopy -O srec default.)
+*/
+
+#ifndef SRecordFile_h
+#define SRecordFile_h
+
+#include "ImageSource.h"
+
+class SRecordFile : public ImageSource
+{
+public:
+	virtual bool			NextRecord(void);
+	virtual uint32_t		EstimateLength(void);
+protected:
+	bool					NextByte(
+								uint8_t&				outByte);
+};
+
+#endif /* SRecordFile_h */
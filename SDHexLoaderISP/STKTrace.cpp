@@ -0,0 +1,197 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	STKTrace.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include "STKTrace.h"
+#include "BufferArena.h"
+#ifndef __MACH__
+#include <Arduino.h>
+#else
+#include <string.h>
+#include <time.h>
+#endif
+
+/********************************** STKTrace **********************************/
+STKTrace::STKTrace(void)
+	: mFile(nullptr), mBuffer(nullptr), mBufferLength(0), mFrameType(0), mChunkOpen(false),
+	  mOverflow(false), mError(false)
+{
+}
+
+/*********************************** begin ************************************/
+/*
+*	Creates the trace file, replacing any existing file of the same name.  If
+*	the trace is already open, the trace continues in the same file.  There
+*	is no trace when the BufferArena phase doesn't include the trace region.
+*/
+bool STKTrace::begin(
+	const char*	inPath)
+{
+	if (!mFile &&
+		(mBuffer = BufferArena::Region(BufferArena::eTraceRegion)) != nullptr)
+	{
+	#ifdef __MACH__
+		mFile = fopen(inPath, "wb");
+	#else
+		if (mSdFile.open(inPath, O_WRONLY | O_CREAT | O_TRUNC))
+		{
+			mFile = &mSdFile;
+		}
+	#endif
+		mBufferLength = 0;
+		mFrameType = 0;
+		mChunkOpen = false;
+		mOverflow = false;
+		mError = false;
+	}
+	return(mFile != nullptr);
+}
+
+/************************************ end *************************************/
+void STKTrace::end(void)
+{
+	if (mFile)
+	{
+		Flush();
+	#ifndef __MACH__
+		mFile->close();
+	#else
+		fclose(mFile);
+	#endif
+		mFile = nullptr;
+	}
+}
+
+/*********************************** Micros ***********************************/
+uint32_t STKTrace::Micros(void)
+{
+#ifdef __MACH__
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint32_t)(now.tv_sec * 1000000 + now.tv_nsec / 1000));
+#else
+	return(micros());
+#endif
+}
+
+/********************************* StartChunk *********************************/
+/*
+*	Starts a new chunk of inType.  Returns false if there isn't room for the
+*	header plus at least one byte.
+*/
+bool STKTrace::StartChunk(
+	uint8_t	inType)
+{
+	mChunkOpen = (mBufferLength + STK_TRACE_HEADER_SIZE) < STK_TRACE_BUFFER_SIZE;
+	if (mChunkOpen)
+	{
+		uint32_t	timestamp = Micros();
+		mChunkStart = mBufferLength;
+		mBuffer[mBufferLength++] = inType;
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			mBuffer[mBufferLength++] = (uint8_t)timestamp;
+			timestamp >>= 8;
+		}
+		mBuffer[mBufferLength++] = 0;	// Length
+	} else
+	{
+		mOverflow = true;
+	}
+	return(mChunkOpen);
+}
+
+/*********************************** Append ***********************************/
+void STKTrace::Append(
+	uint8_t	inType,
+	uint8_t	inByte)
+{
+	if (mFile)
+	{
+		/*
+		*	If the direction changed THEN
+		*	start a new frame.
+		*/
+		if (mFrameType != inType)
+		{
+			mFrameType = inType;
+			StartChunk(inType);
+		/*
+		*	Else if the open chunk is full or was closed by Flush THEN
+		*	continue the frame in a new chunk.
+		*/
+		} else if (!mChunkOpen ||
+			mBuffer[mChunkStart + 5] == 0xFF ||
+			mBufferLength >= STK_TRACE_BUFFER_SIZE)
+		{
+			StartChunk(inType | eContinued);
+		}
+		if (mChunkOpen)
+		{
+			mBuffer[mBufferLength++] = inByte;
+			mBuffer[mChunkStart + 5]++;
+		}
+	}
+}
+
+/*********************************** Append ***********************************/
+void STKTrace::Append(
+	uint8_t			inType,
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+	for (uint16_t i = 0; i < inLength; i++)
+	{
+		Append(inType, inData[i]);
+	}
+}
+
+/*********************************** Flush ************************************/
+/*
+*	Writes the buffered chunks to the file.  The open chunk is closed so that
+*	any traffic that follows continues the frame in a new chunk.  If any chunks
+*	were dropped since the last flush, an eOverflow chunk is written after the
+*	chunks that fit.
+*/
+void STKTrace::Flush(void)
+{
+	if (mFile)
+	{
+		for (uint8_t pass = 0; pass < 2 && mBufferLength; pass++)
+		{
+		#ifdef __MACH__
+			mError |= fwrite(mBuffer, 1, mBufferLength, mFile) != mBufferLength;
+		#else
+			mError |= mFile->write(mBuffer, mBufferLength) != mBufferLength;
+		#endif
+			mBufferLength = 0;
+			if (mOverflow)
+			{
+				mOverflow = false;
+				StartChunk(eOverflow);
+			}
+		}
+		mChunkOpen = false;
+	}
+}
@@ -0,0 +1,107 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	STKTrace.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	Records the STK500 traffic seen by AVRStreamISP to a binary trace file.
+*	The trace is a sequence of chunks:
+*
+*		[type 1][micros 4, little endian][length 1][data length bytes]
+*
+*	The type is eCommandFrame or eResponseFrame.  eContinued is or'd into the
+*	type when the chunk continues the frame of the previous chunk.  A new
+*	frame starts whenever the direction of the traffic changes.  A frame is
+*	split into several chunks when it exceeds 255 bytes or when the buffer is
+*	flushed mid frame.
+*
+*	Chunks are accumulated in RAM and only written to the file when Flush is
+*	called.  The caller is responsible for calling Flush when the SPI bus isn't
+*	in use by the target (i.e. outside of an ISP transaction.)  If the buffer
+*	fills before Flush is called, the chunks that don't fit are dropped and
+*	an eOverflow chunk is recorded in their place.
+*
+*	HostTools/STKReplay reads this format.
+*/
+#ifndef STKTrace_h
+#define STKTrace_h
+
+#include <inttypes.h>
+#ifdef __MACH__
+#include <stdio.h>
+#define SdFile	FILE
+#else
+#include "SdFat.h"
+#endif
+
+/*
+*	Large enough to hold the largest command plus its response between calls
+*	to Flush.
+*/
+#define STK_TRACE_BUFFER_SIZE	320
+#define STK_TRACE_HEADER_SIZE	6
+
+class STKTrace
+{
+public:
+	enum EChunkType
+	{
+		eCommandFrame	= 1,	// Host/SDHexSession to AVRStreamISP
+		eResponseFrame	= 2,	// AVRStreamISP to Host/SDHexSession
+		eOverflow		= 3,	// Chunks were dropped, length is 0
+		eContinued		= 0x80
+	};
+							STKTrace(void);
+	bool					begin(
+								const char*				inPath);
+	void					end(void);
+	bool					IsOpen(void) const
+								{return(mFile != nullptr);}
+	void					Append(
+								uint8_t					inType,
+								uint8_t					inByte);
+	void					Append(
+								uint8_t					inType,
+								const uint8_t*			inData,
+								uint16_t				inLength);
+	void					Flush(void);
+	bool					Error(void) const
+								{return(mError);}
+protected:
+#ifndef __MACH__
+	SdFile		mSdFile;
+#endif
+	SdFile*		mFile;
+	uint8_t*	mBuffer;	// STK_TRACE_BUFFER_SIZE bytes from BufferArena
+	uint16_t	mBufferLength;
+	uint16_t	mChunkStart;	// Index in mBuffer of the open chunk's header
+	uint8_t		mFrameType;		// Of the current frame, 0 if none
+	bool		mChunkOpen;
+	bool		mOverflow;
+	bool		mError;
+
+	bool					StartChunk(
+								uint8_t					inType);
+	static uint32_t			Micros(void);
+};
+
+#endif /* STKTrace_h */
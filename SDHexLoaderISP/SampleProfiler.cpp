@@ -0,0 +1,160 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	SampleProfiler.cpp
+*	Copyright (c) 2020 Jonathan Mackey
+*/
+#include <Arduino.h>
+#include "SampleProfiler.h"
+#ifdef SUPPORT_SAMPLE_PROFILER
+
+uint16_t	SampleProfiler::sHistogram[SAMPLE_PROFILER_BUCKETS];
+uint32_t	SampleProfiler::sSamples;
+uint32_t	SampleProfiler::sOutside;
+bool		SampleProfiler::sRunning;
+
+/*********************************** Start ************************************/
+void SampleProfiler::Start(void)
+{
+	cli();
+	memset(sHistogram, 0, sizeof(sHistogram));
+	sSamples = 0;
+	sOutside = 0;
+	sRunning = true;
+	TIFR1 = _BV(TOV1);		// Clear any pending overflow
+	TIMSK1 |= _BV(TOIE1);
+	sei();
+}
+
+/************************************ Stop ************************************/
+void SampleProfiler::Stop(void)
+{
+	cli();
+	TIMSK1 &= ~_BV(TOIE1);
+	sRunning = false;
+	sei();
+}
+
+/*********************************** Sample ***********************************/
+/*
+*	inPC is the interrupted word address.  A bucket stops counting at 0xFFFF,
+*	the sample is still included in sSamples.
+*/
+void SampleProfiler::Sample(
+	uint16_t	inPC)
+{
+	uint16_t	address = inPC << 1;
+	sSamples++;
+	if (address >= SAMPLE_PROFILER_BASE)
+	{
+		uint16_t	bucket = (address - SAMPLE_PROFILER_BASE) >> SAMPLE_PROFILER_SHIFT;
+		if (bucket < SAMPLE_PROFILER_BUCKETS)
+		{
+			if (sHistogram[bucket] != 0xFFFF)
+			{
+				sHistogram[bucket]++;
+			}
+			return;
+		}
+	}
+	sOutside++;
+}
+
+/************************************ Dump ************************************/
+/*
+*	See SampleProfiler.h for the format.  The profiler should be stopped.
+*/
+void SampleProfiler::Dump(
+	Stream&	inStream)
+{
+	inStream.print(F("profile base="));
+	inStream.print((uint16_t)SAMPLE_PROFILER_BASE, HEX);
+	inStream.print(F(" shift="));
+	inStream.print(SAMPLE_PROFILER_SHIFT);
+	inStream.print(F(" samples="));
+	inStream.print(sSamples);
+	inStream.print(F(" outside="));
+	inStream.println(sOutside);
+	for (uint16_t i = 0; i < SAMPLE_PROFILER_BUCKETS; i++)
+	{
+		if (sHistogram[i])
+		{
+			inStream.print((uint16_t)(SAMPLE_PROFILER_BASE + (i << SAMPLE_PROFILER_SHIFT)), HEX);
+			inStream.print(' ');
+			inStream.println(sHistogram[i]);
+		}
+	}
+	inStream.println(F("end"));
+}
+
+/************************** Timer/Counter1 Overflow ***************************/
+/*
+*	Naked so that the position of the return address on the stack is known.
+*	The registers a call may change are saved, then the return address pushed
+*	by the interrupt is passed to Sample.  The ATmega644's PC is 2 bytes,
+*	stored high byte first, above the 15 bytes pushed here.
+*/
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+	asm volatile(
+		"push r0"				"\n\t"
+		"in r0, __SREG__"		"\n\t"
+		"push r0"				"\n\t"
+		"push r1"				"\n\t"
+		"clr r1"				"\n\t"
+		"push r18"				"\n\t"
+		"push r19"				"\n\t"
+		"push r20"				"\n\t"
+		"push r21"				"\n\t"
+		"push r22"				"\n\t"
+		"push r23"				"\n\t"
+		"push r24"				"\n\t"
+		"push r25"				"\n\t"
+		"push r26"				"\n\t"
+		"push r27"				"\n\t"
+		"push r30"				"\n\t"
+		"push r31"				"\n\t"
+		"in r30, __SP_L__"		"\n\t"
+		"in r31, __SP_H__"		"\n\t"
+		"ldd r25, Z+16"			"\n\t"	// PC high
+		"ldd r24, Z+17"			"\n\t"	// PC low
+		"call %x0"				"\n\t"
+		"pop r31"				"\n\t"
+		"pop r30"				"\n\t"
+		"pop r27"				"\n\t"
+		"pop r26"				"\n\t"
+		"pop r25"				"\n\t"
+		"pop r24"				"\n\t"
+		"pop r23"				"\n\t"
+		"pop r22"				"\n\t"
+		"pop r21"				"\n\t"
+		"pop r20"				"\n\t"
+		"pop r19"				"\n\t"
+		"pop r18"				"\n\t"
+		"pop r1"				"\n\t"
+		"pop r0"				"\n\t"
+		"out __SREG__, r0"		"\n\t"
+		"pop r0"				"\n\t"
+		"reti"					"\n\t"
+		:: "i" (SampleProfiler::Sample));
+}
+#endif // SUPPORT_SAMPLE_PROFILER
@@ -0,0 +1,92 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+/*
+*	SampleProfiler.h
+*	Copyright (c) 2020 Jonathan Mackey
+*
+*	A statistical profiler.  While running, the Timer/Counter1 overflow
+*	interrupt samples the address the CPU was interrupted at and counts it in
+*	a histogram of SAMPLE_PROFILER_BUCKETS buckets.  Each bucket covers
+*	2^SAMPLE_PROFILER_SHIFT bytes of flash starting at SAMPLE_PROFILER_BASE.
+*	The defaults cover all 64KB of the ATmega644 in 512 byte buckets.  To look
+*	closer at a hot region, set the base to the start of the region and
+*	reduce the shift.  Samples outside of the histogram are only counted.
+*
+*	Timer1 isn't reconfigured.  The Arduino core runs it in 8 bit phase
+*	correct PWM mode with a prescale of 64 (the v1.4 heartbeat LED uses it),
+*	so it overflows every 32640 clocks, about 490 times a second at 16MHz.
+*	The sample can't land in another interrupt handler, so time spent in
+*	handlers is attributed to the code they interrupted.
+*
+*	Dump writes the histogram as text, one line per non-empty bucket:
+*
+*		profile base=0 shift=9 samples=1234 outside=0
+*		1E00 17
+*		...
+*		end
+*
+*	The bucket addresses and counts are hex and decimal respectively.
+*	HostTools/ProfileReport maps the buckets to functions using the symbol
+*	table of the sketch's .elf file.
+*
+*	Only compiled when SUPPORT_SAMPLE_PROFILER is defined, see
+*	SDHexLoaderConfig.h.
+*/
+#ifndef SampleProfiler_h
+#define SampleProfiler_h
+
+#include "SDHexLoaderConfig.h"
+#ifdef SUPPORT_SAMPLE_PROFILER
+#include <inttypes.h>
+
+#ifndef SAMPLE_PROFILER_BUCKETS
+#define SAMPLE_PROFILER_BUCKETS	128	// 2 bytes of SRAM each
+#endif
+#ifndef SAMPLE_PROFILER_SHIFT
+#define SAMPLE_PROFILER_SHIFT	9
+#endif
+#ifndef SAMPLE_PROFILER_BASE
+#define SAMPLE_PROFILER_BASE	0
+#endif
+
+class Stream;
+
+class SampleProfiler
+{
+public:
+	static void				Start(void);	// Clears the histogram
+	static void				Stop(void);
+	static bool				IsRunning(void)
+								{return(sRunning);}
+	static void				Dump(
+								Stream&					inStream);
+	static void				Sample(	// Called by the Timer1 overflow ISR
+								uint16_t				inPC);
+protected:
+	static uint16_t			sHistogram[SAMPLE_PROFILER_BUCKETS];
+	static uint32_t			sSamples;
+	static uint32_t			sOutside;
+	static bool				sRunning;
+};
+
+#endif // SUPPORT_SAMPLE_PROFILER
+#endif // SampleProfiler_h
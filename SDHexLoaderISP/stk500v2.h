@@ -0,0 +1,76 @@
+/* STK500v2 constants list, from AVRDUDE
+ *
+ * Trivial set of constants derived from Atmel App Note AVR068
+ * Not copyrighted.  Released to the public domain.
+ */
+#ifndef stk500v2_h
+#define stk500v2_h
+
+// Message framing
+#define MESSAGE_START               0x1B  // ESC
+#define TOKEN                       0x0E
+#define STK500V2_MAX_BODY_SIZE      275
+
+// General commands
+#define CMD_SIGN_ON                 0x01
+#define CMD_SET_PARAMETER           0x02
+#define CMD_GET_PARAMETER           0x03
+#define CMD_SET_DEVICE_PARAMETERS   0x04  // Not used
+#define CMD_OSCCAL                  0x05
+#define CMD_LOAD_ADDRESS            0x06
+#define CMD_FIRMWARE_UPGRADE        0x07  // Not used
+
+// ISP commands
+#define CMD_ENTER_PROGMODE_ISP      0x10
+#define CMD_LEAVE_PROGMODE_ISP      0x11
+#define CMD_CHIP_ERASE_ISP          0x12
+#define CMD_PROGRAM_FLASH_ISP       0x13
+#define CMD_READ_FLASH_ISP          0x14
+#define CMD_PROGRAM_EEPROM_ISP      0x15
+#define CMD_READ_EEPROM_ISP         0x16
+#define CMD_PROGRAM_FUSE_ISP        0x17
+#define CMD_READ_FUSE_ISP           0x18
+#define CMD_PROGRAM_LOCK_ISP        0x19
+#define CMD_READ_LOCK_ISP           0x1A
+#define CMD_READ_SIGNATURE_ISP      0x1B
+#define CMD_READ_OSCCAL_ISP         0x1C
+#define CMD_SPI_MULTI               0x1D
+
+// Status constants
+#define STATUS_CMD_OK               0x00
+#define STATUS_CMD_TOUT             0x80
+#define STATUS_RDY_BSY_TOUT         0x81
+#define STATUS_SET_PARAM_MISSING    0x82
+#define STATUS_CMD_FAILED           0xC0
+#define STATUS_CKSUM_ERROR          0xC1
+#define STATUS_CMD_UNKNOWN          0xC9
+
+// Answer to a message with a bad checksum
+#define ANSWER_CKSUM_ERROR          0xB0
+
+// Parameters
+#define PARAM_BUILD_NUMBER_LOW      0x80
+#define PARAM_BUILD_NUMBER_HIGH     0x81
+#define PARAM_HW_VER                0x90
+#define PARAM_SW_MAJOR              0x91
+#define PARAM_SW_MINOR              0x92
+#define PARAM_VTARGET               0x94
+#define PARAM_VADJUST               0x95
+#define PARAM_OSC_PSCALE            0x96
+#define PARAM_OSC_CMATCH            0x97
+#define PARAM_SCK_DURATION          0x98
+#define PARAM_TOPCARD_DETECT        0x9A
+#define PARAM_STATUS                0x9C
+#define PARAM_DATA                  0x9D
+#define PARAM_RESET_POLARITY        0x9E
+#define PARAM_CONTROLLER_INIT       0x9F
+
+// CMD_PROGRAM_FLASH_ISP/CMD_PROGRAM_EEPROM_ISP mode bits
+#define MODE_PAGE                   0x01  // Else word/byte mode
+#define MODE_RDY_BSY_POLL           0x40  // Else timed delay or value polling
+#define MODE_WRITE_PAGE             0x80  // Write the page after loading it
+
+// CMD_LOAD_ADDRESS flag, load extended address (> 64K words)
+#define LOAD_EXT_ADDR_FLAG          0x80000000
+
+#endif // stk500v2_h
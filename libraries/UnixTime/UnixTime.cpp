@@ -28,6 +28,7 @@
 #include "DS3231SN.h"
 #else
 #include <iostream>
+#include <string.h>
 #define PROGMEM
 #define pgm_read_word(xx) *(xx)
 #define pgm_read_byte(xx) *(xx)